@@ -27,6 +27,9 @@
 #include <xfiredb/list.h>
 #include <xfiredb/string.h>
 #include <xfiredb/hashmap.h>
+#include <xfiredb/intern.h>
+#include <xfiredb/os.h>
+#include <xfiredb/snapshot.h>
 
 #include "se.h"
 
@@ -44,6 +47,16 @@ static VALUE rb_container_to_obj(struct db_entry_container *c)
 	return c->obj;
 }
 
+static void raw_rb_db_delete(struct db_entry_container *entry);
+
+static void rb_db_expire_hook(struct database *db, const char *key, db_data_t *data)
+{
+	struct db_entry_container *entry;
+
+	entry = container_of(data->ptr, struct db_entry_container, c);
+	raw_rb_db_delete(entry);
+}
+
 /* 
  * Document-method: new
  * @return [Database] A new database instance.
@@ -53,6 +66,7 @@ static VALUE rb_db_new(VALUE klass)
 	struct database *db = db_alloc("xfire-database");
 	VALUE obj = Data_Wrap_Struct(klass, NULL, rb_db_release, db);
 
+	db_set_expire_hook(db, &rb_db_expire_hook);
 	return obj;
 }
 
@@ -62,8 +76,6 @@ static VALUE rb_db_ref(VALUE self, VALUE key)
 	struct container *c;
 	struct db_entry_container *entry;
 	struct string *s;
-	char *tmp;
-	VALUE rv;
 	db_data_t dbdata;
 
 	Data_Get_Struct(self, struct database, db);
@@ -77,11 +89,7 @@ static VALUE rb_db_ref(VALUE self, VALUE key)
 		return rb_container_to_obj(entry);
 	} else {
 		s = container_get_data(&entry->c);
-		string_get(s, &tmp);
-		rv = rb_str_new2(tmp);
-		xfiredb_free(tmp);
-
-		return rv;
+		return rb_string_to_obj(s);
 	}
 }
 
@@ -92,7 +100,7 @@ static void raw_rb_db_delete(struct db_entry_container *entry)
 	entry->intree = false;
 	if(entry->type == rb_cString) {
 		/* string type, free it here */
-		xfiredb_notice_disk(entry->key, NULL, NULL, STRING_DEL);
+		xfiredb_notice_disk(entry->key, NULL, NULL, 0, STRING_DEL);
 		container_destroy(c);
 		xfiredb_free(entry->key);
 		xfiredb_free(entry);
@@ -127,6 +135,9 @@ static VALUE rb_db_store(VALUE self, VALUE key, VALUE data)
 	db_data_t dbdata;
 
 	Data_Get_Struct(self, struct database, db);
+	if(db_evict_if_needed(db))
+		return Qnil;
+
 	if(db_delete(db, tmp, &dbdata) == -XFIREDB_OK) {
 		c = dbdata.ptr;
 		rb_c = container_of(c, struct db_entry_container, c);
@@ -134,8 +145,9 @@ static VALUE rb_db_store(VALUE self, VALUE key, VALUE data)
 			if(rb_c->type == rb_cString && rb_obj_class(data) == rb_cString) {
 				c = dbdata.ptr;
 				s = container_get_data(c);
-				string_set(s, StringValueCStr(data));
-				xfiredb_notice_disk((char*)tmp, NULL, StringValueCStr(data), STRING_UPDATE);
+				rb_string_set(s, data);
+				xfiredb_notice_disk((char*)tmp, NULL, RSTRING_PTR(data),
+						RSTRING_LEN(data), STRING_UPDATE);
 				return db_store(db, tmp, c) == -XFIREDB_OK ? data : Qnil;
 			}
 
@@ -146,14 +158,14 @@ static VALUE rb_db_store(VALUE self, VALUE key, VALUE data)
 	if(rb_obj_class(data) != rb_cString) {
 		Data_Get_Struct(data, struct db_entry_container, rb_c);
 		rb_c->obj = data;
+		rb_c->db = db;
 		rb_c->intree = true;
 	} else {
-		rb_c = xfiredb_zalloc(sizeof(*rb_c));
+		rb_c = db_entry_container_alloc(CONTAINER_STRING);
 		rb_c->obj = Qnil;
 		rb_c->type = rb_cString;
-		container_init(&rb_c->c, CONTAINER_STRING);
 		s = container_get_data(&rb_c->c);
-		string_set(s, StringValueCStr(data));
+		rb_string_set(s, data);
 	}
 
 	xfiredb_sprintf(&rb_c->key, "%s", tmp);
@@ -167,6 +179,241 @@ static VALUE rb_db_store(VALUE self, VALUE key, VALUE data)
 	return data;
 }
 
+static struct string *rb_db_string(struct database *db, const char *key,
+				   const char *init, bool *new)
+{
+	struct db_entry_container *rb_c;
+	struct container *c;
+	struct string *s;
+	db_data_t dbdata;
+
+	*new = false;
+	if(db_evict_if_needed(db))
+		return NULL;
+
+	if(db_lookup(db, key, &dbdata) == -XFIREDB_OK) {
+		c = dbdata.ptr;
+		rb_c = container_of(c, struct db_entry_container, c);
+		if(rb_c->type != rb_cString)
+			return NULL;
+
+		return container_get_data(c);
+	}
+
+	rb_c = db_entry_container_alloc(CONTAINER_STRING);
+	rb_c->obj = Qnil;
+	rb_c->type = rb_cString;
+	s = container_get_data(&rb_c->c);
+	string_set(s, init);
+	xfiredb_sprintf(&rb_c->key, "%s", key);
+
+	if(db_store(db, key, &rb_c->c) != -XFIREDB_OK) {
+		container_destroy(&rb_c->c);
+		xfiredb_free(rb_c->key);
+		xfiredb_free(rb_c);
+		return NULL;
+	}
+
+	*new = true;
+	return s;
+}
+
+static void rb_db_string_notice(const char *key, struct string *s, bool new)
+{
+	const char *data;
+	size_t len;
+
+	data = string_borrow(s, &len);
+	xfiredb_notice_disk((char*)key, NULL, data, len,
+			new ? STRING_ADD : STRING_UPDATE);
+	string_unborrow(s);
+}
+
+/*
+ * Document-method: incr
+ *
+ * Atomically increment an integer string. Non existing keys are
+ * created with an initial value of 0.
+ *
+ * @return [Integer] The new value, or nil if the key doesn't hold an integer.
+ */
+static VALUE rb_db_incr(VALUE self, VALUE key, VALUE delta)
+{
+	struct database *db;
+	struct string *s;
+	const char *tmp = StringValueCStr(key);
+	s64 value;
+	bool new;
+
+	Data_Get_Struct(self, struct database, db);
+	s = rb_db_string(db, tmp, "0", &new);
+	if(!s || string_incr(s, NUM2LL(delta), &value) != -XFIREDB_OK)
+		return Qnil;
+
+	rb_db_string_notice(tmp, s, new);
+	return LL2NUM(value);
+}
+
+/*
+ * Document-method: incr_float
+ *
+ * Atomically increment a floating point string. Non existing keys are
+ * created with an initial value of 0.
+ *
+ * @return [Float] The new value, or nil if the key doesn't hold a number.
+ */
+static VALUE rb_db_incr_float(VALUE self, VALUE key, VALUE delta)
+{
+	struct database *db;
+	struct string *s;
+	const char *tmp = StringValueCStr(key);
+	double value;
+	bool new;
+
+	Data_Get_Struct(self, struct database, db);
+	s = rb_db_string(db, tmp, "0", &new);
+	if(!s || string_incr_float(s, NUM2DBL(delta), &value) != -XFIREDB_OK)
+		return Qnil;
+
+	rb_db_string_notice(tmp, s, new);
+	return DBL2NUM(value);
+}
+
+static struct string *rb_db_string_lookup(VALUE self, VALUE key)
+{
+	struct database *db;
+	struct container *c;
+	struct db_entry_container *entry;
+	db_data_t dbdata;
+
+	Data_Get_Struct(self, struct database, db);
+	if(db_lookup(db, StringValueCStr(key), &dbdata) != -XFIREDB_OK)
+		return NULL;
+
+	c = dbdata.ptr;
+	entry = container_of(c, struct db_entry_container, c);
+	if(entry->type != rb_cString)
+		return NULL;
+
+	return container_get_data(c);
+}
+
+/*
+ * Document-method: append
+ *
+ * Append data to a string. Non existing keys are created. Only the
+ * appended data is written to disk.
+ *
+ * @return [Integer] The length of the string after the append, or nil if
+ *   the key doesn't hold a string.
+ */
+static VALUE rb_db_append(VALUE self, VALUE key, VALUE data)
+{
+	struct database *db;
+	struct string *s;
+	const char *tmp = StringValueCStr(key);
+	size_t len;
+	bool new;
+
+	Data_Get_Struct(self, struct database, db);
+	s = rb_db_string(db, tmp, "", &new);
+	if(!s)
+		return Qnil;
+
+	StringValue(data);
+	len = string_append(s, RSTRING_PTR(data), RSTRING_LEN(data));
+	if(new)
+		rb_db_string_notice(tmp, s, new);
+	else
+		xfiredb_notice_disk((char*)tmp, NULL, RSTRING_PTR(data),
+				RSTRING_LEN(data), STRING_APPEND);
+
+	return ULL2NUM(len);
+}
+
+/*
+ * Document-method: setrange
+ *
+ * Overwrite part of a string, starting at a given offset. The string is
+ * padded with zero bytes if the offset lies beyond its end. Non existing
+ * keys are created.
+ *
+ * @return [Integer] The length of the string after the write, false if
+ *   the string would grow beyond 512 MB, or nil if the key doesn't hold a
+ *   string.
+ */
+static VALUE rb_db_setrange(VALUE self, VALUE key, VALUE offset, VALUE data)
+{
+	struct database *db;
+	struct string *s;
+	const char *tmp = StringValueCStr(key);
+	size_t len, off;
+	bool new;
+
+	Data_Get_Struct(self, struct database, db);
+	if(NUM2LL(offset) < 0)
+		return Qnil;
+
+	StringValue(data);
+	off = NUM2SIZET(offset);
+	len = RSTRING_LEN(data);
+	if(len > STRING_MAX_SIZE || off > STRING_MAX_SIZE - len)
+		return Qfalse;
+
+	s = rb_db_string(db, tmp, "", &new);
+	if(!s)
+		return Qnil;
+
+	len = string_set_range(s, off, RSTRING_PTR(data), len);
+	rb_db_string_notice(tmp, s, new);
+
+	return ULL2NUM(len);
+}
+
+/*
+ * Document-method: getrange
+ *
+ * Get part of a string. Negative offsets count from the end of the
+ * string. Only the requested range is copied.
+ *
+ * @return [String] The requested range, or nil if the key doesn't hold a
+ *   string.
+ */
+static VALUE rb_db_getrange(VALUE self, VALUE key, VALUE start, VALUE end)
+{
+	struct string *s;
+	const char *data;
+	size_t len;
+	VALUE rv;
+
+	s = rb_db_string_lookup(self, key);
+	if(!s)
+		return Qnil;
+
+	data = string_borrow_range(s, NUM2LL(start), NUM2LL(end), &len);
+	rv = rb_str_new(data, len);
+	string_unborrow(s);
+
+	return rv;
+}
+
+/*
+ * Document-method: strlen
+ *
+ * @return [Integer] The length of a string, or nil if the key doesn't hold
+ *   a string.
+ */
+static VALUE rb_db_strlen(VALUE self, VALUE key)
+{
+	struct string *s;
+
+	s = rb_db_string_lookup(self, key);
+	if(!s)
+		return Qnil;
+
+	return ULL2NUM(string_length(s));
+}
+
 /*
  * Document-mehtod: delete
  *
@@ -190,6 +437,358 @@ static VALUE rb_db_delete(VALUE self, VALUE key)
 	return key;
 }
 
+/*
+ * Document-method: expire
+ *
+ * Set a time out on a key. A key whose time out has passed is deleted.
+ *
+ * @param [String] key Key to set the time out on.
+ * @param [Integer] ms Time to live in milliseconds.
+ * @return [Boolean] true if the time out was set, false if the key doesn't
+ *   exist.
+ */
+static VALUE rb_db_expire(VALUE self, VALUE key, VALUE ms)
+{
+	struct database *db;
+
+	Data_Get_Struct(self, struct database, db);
+	if(db_set_expiry(db, StringValueCStr(key), xfiredb_time_stamp() + NUM2LL(ms)))
+		return Qfalse;
+
+	return Qtrue;
+}
+
+/*
+ * Document-method: persist
+ *
+ * Remove the time out of a key.
+ *
+ * @return [Boolean] true if a time out was removed, false otherwise.
+ */
+static VALUE rb_db_persist(VALUE self, VALUE key)
+{
+	struct database *db;
+
+	Data_Get_Struct(self, struct database, db);
+	if(db_persist(db, StringValueCStr(key)))
+		return Qfalse;
+
+	return Qtrue;
+}
+
+/*
+ * Document-method: ttl
+ *
+ * @return [Integer] The time to live of a key in milliseconds, -1 if the
+ *   key doesn't expire or -2 if the key doesn't exist.
+ */
+static VALUE rb_db_ttl(VALUE self, VALUE key)
+{
+	struct database *db;
+
+	Data_Get_Struct(self, struct database, db);
+	return LL2NUM(db_ttl(db, StringValueCStr(key)));
+}
+
+/*
+ * Document-method: expire_cycle
+ *
+ * Delete keys whose time out has passed.
+ *
+ * @param [Integer] max Maximum number of expiry entries to handle.
+ * @return [Integer] The number of deleted keys.
+ */
+static VALUE rb_db_expire_cycle(VALUE self, VALUE max)
+{
+	struct database *db;
+
+	Data_Get_Struct(self, struct database, db);
+	return INT2NUM(db_expire_cycle(db, NUM2INT(max)));
+}
+
+/*
+ * Document-method: set_maxmemory
+ *
+ * Set the memory budget of the database. Keys are evicted according to
+ * the eviction policy when a write exceeds the budget.
+ *
+ * @param [Integer] bytes Memory budget in bytes, 0 to disable it.
+ * @param [String] policy Eviction policy: noeviction, allkeys-lru,
+ *   allkeys-lfu or volatile-ttl.
+ * @return [Boolean] false if the policy is unknown, true otherwise.
+ */
+static VALUE rb_db_set_maxmemory(VALUE self, VALUE bytes, VALUE policy)
+{
+	struct database *db;
+
+	Data_Get_Struct(self, struct database, db);
+	if(db_set_maxmemory(db, NUM2SIZET(bytes), StringValueCStr(policy)))
+		return Qfalse;
+
+	return Qtrue;
+}
+
+/*
+ * Document-method: set_share_limit
+ *
+ * Set the maximum length of string values which are shared between keys.
+ * Equal values up to this length are stored only once.
+ *
+ * @param [Integer] bytes Maximum value length in bytes, 0 to disable
+ *   sharing.
+ */
+static VALUE rb_db_set_share_limit(VALUE self, VALUE bytes)
+{
+	string_set_share_limit(NUM2SIZET(bytes));
+	return Qnil;
+}
+
+/*
+ * Document-method: memory_usage
+ *
+ * Estimate the memory footprint of a key.
+ *
+ * @param [String] key Key to estimate the footprint of.
+ * @param [Integer] samples Number of elements to sample for lists,
+ *   hashmaps and sets. Set to 0 to inspect every element.
+ * @return [Integer] The estimated number of bytes used by key, or nil
+ *   if the key doesn't exist.
+ */
+static VALUE rb_db_memory_usage(VALUE self, VALUE key, VALUE samples)
+{
+	struct database *db;
+	struct db_entry_container *entry;
+	db_data_t dbdata;
+	char *_key = StringValueCStr(key);
+	size_t usage;
+
+	Data_Get_Struct(self, struct database, db);
+	if(db_lookup(db, _key, &dbdata) != -XFIREDB_OK)
+		return Qnil;
+
+	entry = container_of(dbdata.ptr, struct db_entry_container, c);
+	usage = xfiredb_mem_size(entry) + xfiredb_mem_size(entry->key);
+	usage += container_mem_usage(&entry->c, NUM2SIZET(samples));
+	usage += db_key_mem_usage(db, _key);
+
+	return SIZET2NUM(usage);
+}
+
+#define MEMORY_STATS_SAMPLES 16
+#define MEMORY_STATS_KEYS 16
+#define MEMORY_STATS_ROUNDS 8
+
+static void rb_hash_set_size(VALUE hash, const char *field, size_t value)
+{
+	rb_hash_aset(hash, rb_str_new2(field), SIZET2NUM(value));
+}
+
+/*
+ * Document-method: memory_stats
+ *
+ * Get the memory statistics of the storage engine. The per-type totals
+ * are estimated from a bounded random sample of keys, scaled up to the
+ * size of the key space, so the call costs the same for any database size.
+ *
+ * @return [Hash] Memory statistics, indexed by field name.
+ */
+static VALUE rb_db_memory_stats(VALUE self)
+{
+	struct database *db;
+	struct db_entry_container *entry;
+	char *keys[MEMORY_STATS_KEYS];
+	db_data_t data[MEMORY_STATS_KEYS];
+	size_t used, rss, usage, size, sampled = 0;
+	size_t types[CONTAINER_SET + 1] = {0, 0, 0, 0};
+	int round, num, idx;
+	VALUE stats;
+
+	Data_Get_Struct(self, struct database, db);
+	size = db_get_size(db);
+	for(round = 0; round < MEMORY_STATS_ROUNDS && sampled < size; round++) {
+		num = dict_sample(db->container, keys, data, MEMORY_STATS_KEYS);
+		for(idx = 0; idx < num; idx++) {
+			entry = container_of(data[idx].ptr, struct db_entry_container, c);
+			usage = xfiredb_mem_size(entry) + xfiredb_mem_size(entry->key);
+			usage += container_mem_usage(&entry->c, MEMORY_STATS_SAMPLES);
+			types[container_type(&entry->c)] += usage;
+			xfiredb_free(keys[idx]);
+		}
+
+		sampled += num;
+		if(!num)
+			break;
+	}
+
+	for(idx = 0; sampled && idx <= CONTAINER_SET; idx++)
+		types[idx] = (size_t)((double)types[idx] * size / sampled);
+
+	used = xfiredb_mem_used();
+	rss = xfiredb_mem_rss();
+	stats = rb_hash_new();
+
+	rb_hash_set_size(stats, "used_memory", used);
+	rb_hash_set_size(stats, "used_memory_rss", rss);
+	rb_hash_aset(stats, rb_str_new2("mem_fragmentation_ratio"),
+			rb_float_new(used ? (double)rss / used : 0.0));
+	rb_hash_set_size(stats, "mem_dict", xfiredb_mem_used_stat(MEM_STAT_DICT));
+	rb_hash_set_size(stats, "mem_skiplist",
+			xfiredb_mem_used_stat(MEM_STAT_SKIPLIST));
+	rb_hash_set_size(stats, "mem_bio", xfiredb_mem_used_stat(MEM_STAT_BIO));
+	rb_hash_set_size(stats, "mem_intern", xfiredb_mem_used_stat(MEM_STAT_INTERN));
+	rb_hash_set_size(stats, "interned_strings", intern_count());
+	rb_hash_set_size(stats, "mem_cache_reserved", xfiredb_mem_reserved());
+	rb_hash_set_size(stats, "heap_profile_rate", xfiredb_heapprof_rate());
+	rb_hash_set_size(stats, "mem_strings", types[CONTAINER_STRING]);
+	rb_hash_set_size(stats, "mem_lists", types[CONTAINER_LIST]);
+	rb_hash_set_size(stats, "mem_hashmaps", types[CONTAINER_HASHMAP]);
+	rb_hash_set_size(stats, "mem_sets", types[CONTAINER_SET]);
+	rb_hash_set_size(stats, "maxmemory", db->maxmemory);
+
+	return stats;
+}
+
+/*
+ * Document-method: snapshot
+ *
+ * Rewrite the disk from the database. Used after the background I/O queue
+ * dropped writes.
+ *
+ * @return [nil]
+ */
+static VALUE rb_db_snapshot(VALUE self)
+{
+	struct database *db;
+
+	Data_Get_Struct(self, struct database, db);
+	xfiredb_se_snapshot(db);
+	return Qnil;
+}
+
+/*
+ * Document-method: save
+ *
+ * Write a snapshot of the database to a file. Blocks until the snapshot
+ * has been synced to disk.
+ *
+ * @param [String] path File to write the snapshot to.
+ * @return [Boolean] true if the snapshot was written, false otherwise.
+ */
+static VALUE rb_db_save(VALUE self, VALUE path)
+{
+	struct database *db;
+
+	Data_Get_Struct(self, struct database, db);
+	if(snapshot_save(db, StringValueCStr(path)) != -XFIREDB_OK)
+		return Qfalse;
+
+	return Qtrue;
+}
+
+/*
+ * Document-method: bgsave
+ *
+ * Write a snapshot of the database to a file in the background.
+ *
+ * @param [String] path File to write the snapshot to.
+ * @return [Boolean] false if a background save is already running or
+ *   couldn't be started, true otherwise.
+ */
+static VALUE rb_db_bgsave(VALUE self, VALUE path)
+{
+	struct database *db;
+
+	Data_Get_Struct(self, struct database, db);
+	if(snapshot_bgsave(db, StringValueCStr(path)) != -XFIREDB_OK)
+		return Qfalse;
+
+	return Qtrue;
+}
+
+/*
+ * Document-method: snapshot_stats
+ *
+ * Get the state of the background save.
+ *
+ * @return [Hash] Snapshot statistics, indexed by field name.
+ */
+static VALUE rb_db_snapshot_stats(VALUE self)
+{
+	struct snapshot_info info;
+	VALUE stats;
+
+	snapshot_get_info(&info);
+	stats = rb_hash_new();
+
+	rb_hash_aset(stats, rb_str_new2("snapshot_in_progress"),
+			INT2NUM(info.in_progress ? 1 : 0));
+	rb_hash_aset(stats, rb_str_new2("snapshot_saves"), ULL2NUM(info.saves));
+	rb_hash_aset(stats, rb_str_new2("snapshot_last_status"),
+			rb_str_new2(info.last_ok ? "ok" : "err"));
+	rb_hash_aset(stats, rb_str_new2("snapshot_last_save_time"),
+			LONG2NUM((long)(info.last_save / 1000)));
+	rb_hash_aset(stats, rb_str_new2("snapshot_last_duration_ms"),
+			LONG2NUM((long)info.last_duration));
+	rb_hash_aset(stats, rb_str_new2("snapshot_last_size"), ULL2NUM(info.last_size));
+	rb_hash_aset(stats, rb_str_new2("snapshot_fork_usec"),
+			LONG2NUM((long)info.fork_usec));
+
+	return stats;
+}
+
+/*
+ * Document-method: heap_profile_start
+ *
+ * Start the sampling heap profiler, or change its sampling rate.
+ *
+ * @param [Integer] rate Average number of allocated bytes between samples.
+ * @return [Boolean] true if the profiler is running, false otherwise.
+ */
+static VALUE rb_db_heap_profile_start(VALUE self, VALUE rate)
+{
+	if(xfiredb_heapprof_start(NUM2SIZET(rate)) != -XFIREDB_OK)
+		return Qfalse;
+
+	return Qtrue;
+}
+
+/*
+ * Document-method: heap_profile_stop
+ *
+ * Stop the sampling heap profiler. Samples taken so far are discarded.
+ */
+static VALUE rb_db_heap_profile_stop(VALUE self)
+{
+	xfiredb_heapprof_stop();
+	return Qnil;
+}
+
+/*
+ * Document-method: heap_profile_dump
+ *
+ * Write a pprof compatible profile of the live heap to a file. The path
+ * isn't checked here; callers serving clients must confine it themselves.
+ *
+ * @param [String] path File to write the profile to.
+ * @return [Boolean] false if the profiler isn't running or the file
+ *   couldn't be written, true otherwise.
+ */
+static VALUE rb_db_heap_profile_dump(VALUE self, VALUE path)
+{
+	FILE *fp;
+	int rc;
+
+	fp = fopen(StringValueCStr(path), "w");
+	if(!fp)
+		return Qfalse;
+
+	rc = xfiredb_heapprof_dump(fp);
+	if(fclose(fp) || rc != -XFIREDB_OK)
+		return Qfalse;
+
+	return Qtrue;
+}
+
 void rb_db_free(VALUE self)
 {
 	struct database *db;
@@ -216,7 +815,6 @@ static VALUE rb_db_each_pair(VALUE db)
 	struct database *dbase;
 	struct container *c;
 	struct db_entry_container *db_c;
-	char *value;
 	VALUE k, v;
 	struct string *s_val;
 
@@ -233,9 +831,7 @@ static VALUE rb_db_each_pair(VALUE db)
 			v = rb_container_to_obj(db_c);
 		} else {
 			s_val = container_get_data(c);
-			string_get(s_val, &value);
-			v = rb_str_new2(value);
-			xfiredb_free(value);
+			v = rb_string_to_obj(s_val);
 		}
 
 		rb_yield(rb_assoc_new(k, v));
@@ -260,9 +856,31 @@ void init_database(void)
 	rb_include_module(c_database, rb_mEnumerable);
 	rb_define_singleton_method(c_database, "new", rb_db_new, 0);
 	rb_define_method(c_database, "[]=", rb_db_store, 2);
+	rb_define_method(c_database, "store", rb_db_store, 2);
 	rb_define_method(c_database, "[]", rb_db_ref, 1);
 	rb_define_method(c_database, "delete", rb_db_delete, 1);
 	rb_define_method(c_database, "size", rb_db_size, 0);
+	rb_define_method(c_database, "incr", rb_db_incr, 2);
+	rb_define_method(c_database, "incr_float", rb_db_incr_float, 2);
+	rb_define_method(c_database, "append", rb_db_append, 2);
+	rb_define_method(c_database, "setrange", rb_db_setrange, 3);
+	rb_define_method(c_database, "getrange", rb_db_getrange, 3);
+	rb_define_method(c_database, "strlen", rb_db_strlen, 1);
+	rb_define_method(c_database, "expire", rb_db_expire, 2);
+	rb_define_method(c_database, "persist", rb_db_persist, 1);
+	rb_define_method(c_database, "ttl", rb_db_ttl, 1);
+	rb_define_method(c_database, "expire_cycle", rb_db_expire_cycle, 1);
+	rb_define_method(c_database, "set_maxmemory", rb_db_set_maxmemory, 2);
+	rb_define_method(c_database, "set_share_limit", rb_db_set_share_limit, 1);
+	rb_define_method(c_database, "memory_usage", rb_db_memory_usage, 2);
+	rb_define_method(c_database, "memory_stats", rb_db_memory_stats, 0);
+	rb_define_method(c_database, "heap_profile_start", rb_db_heap_profile_start, 1);
+	rb_define_method(c_database, "heap_profile_stop", rb_db_heap_profile_stop, 0);
+	rb_define_method(c_database, "heap_profile_dump", rb_db_heap_profile_dump, 1);
 	rb_define_method(c_database, "each", rb_db_each_pair, 0);
+	rb_define_method(c_database, "snapshot", rb_db_snapshot, 0);
+	rb_define_method(c_database, "save", rb_db_save, 1);
+	rb_define_method(c_database, "bgsave", rb_db_bgsave, 1);
+	rb_define_method(c_database, "snapshot_stats", rb_db_snapshot_stats, 0);
 }
 
@@ -61,9 +61,8 @@ void rb_hashmap_free(struct db_entry_container *c)
 
 VALUE rb_hashmap_alloc(VALUE klass)
 {
-	struct db_entry_container *container = xfiredb_zalloc(sizeof(*container));
+	struct db_entry_container *container = db_entry_container_alloc(CONTAINER_HASHMAP);
 
-	container_init(&container->c, CONTAINER_HASHMAP);
 	container->obj = Data_Wrap_Struct(klass, NULL, rb_hashmap_release, container);
 	container->intree = false;
 	container->type = klass;
@@ -126,12 +125,12 @@ void rb_hashmap_remove(struct db_entry_container *c)
 	it = hashmap_new_iterator(map);
 	while((node = hashmap_iterator_next(it)) != NULL) {
 		if(c->key)
-			xfiredb_notice_disk(c->key, node->key, NULL, HM_DEL);
+			xfiredb_notice_disk(c->key, node->key, NULL, 0, HM_DEL);
 
 		s = container_of(node, struct string, node);
 		hashmap_iterator_delete(it);
-		string_destroy(s);
-		xfiredb_free(s);
+		hashmap_node_destroy(node);
+		string_free(s);
 	}
 	hashmap_free_iterator(it);
 }
@@ -139,7 +138,6 @@ void rb_hashmap_remove(struct db_entry_container *c)
 VALUE rb_hashmap_delete(VALUE self, VALUE key)
 {
 	struct string *s;
-	char *data;
 	char *keyval = StringValueCStr(key);
 	struct hashmap_node *node;
 	VALUE rv = Qnil;
@@ -153,16 +151,12 @@ VALUE rb_hashmap_delete(VALUE self, VALUE key)
 		return Qnil;
 
 	s = container_of(node, struct string, node);
-	string_get(s, &data);
-
 	if(c->key)
-		xfiredb_notice_disk(c->key, node->key, NULL, HM_DEL);
+		xfiredb_notice_disk(c->key, node->key, NULL, 0, HM_DEL);
 
-	rv = rb_str_new2(data);
-	xfiredb_free(data);
+	rv = rb_string_to_obj(s);
 	hashmap_node_destroy(node);
-	string_destroy(s);
-	xfiredb_free(s);
+	string_free(s);
 
 	return rv;
 }
@@ -170,51 +164,92 @@ VALUE rb_hashmap_delete(VALUE self, VALUE key)
 VALUE rb_hashmap_ref(VALUE self, VALUE key)
 {
 	struct string *s;
-	char *tmp;
 	char *keyval = StringValueCStr(key);
 	struct hashmap_node *node;
-	VALUE rv = Qnil;
 
 	node = __rb_hashmap_ref(self, keyval);
 	if(!node)
 		return Qnil;
 
 	s = container_of(node, struct string, node);
-	string_get(s, &tmp);
-	rv = rb_str_new2(tmp);
-	xfiredb_free(tmp);
-
-	return rv;
+	return rb_string_to_obj(s);
 }
 
 VALUE rb_hashmap_store(VALUE self, VALUE key, VALUE data)
 {
 	struct string *s;
 	char *tmp_key = StringValueCStr(key);
-	char *tmp_data = StringValueCStr(data);
 	struct hashmap_node *node;
 	struct hashmap *map;
 	struct db_entry_container *c;
 
+	StringValue(data);
+	Data_Get_Struct(self, struct db_entry_container, c);
+	if(rb_container_make_room(c))
+		return Qfalse;
+
 	map = obj_to_map(self);
 	node = hashmap_find(map, tmp_key);
-	Data_Get_Struct(self, struct db_entry_container, c);
 
 	if(!node) {
-		s = string_alloc(tmp_data);
+		s = rb_string_alloc(data);
 		hashmap_add(map, tmp_key, &s->node);
-		if(c->key)
-			xfiredb_notice_disk(c->key, tmp_key, tmp_data, HM_ADD);
+		if(c->intree)
+			xfiredb_notice_disk(c->key, tmp_key, RSTRING_PTR(data),
+					RSTRING_LEN(data), HM_ADD);
 	} else {
 		s = container_of(node, struct string, node);
-		string_set(s, tmp_data);
-		if(c->key)
-			xfiredb_notice_disk(c->key, tmp_key, tmp_data, HM_UPDATE);
+		rb_string_set(s, data);
+		if(c->intree)
+			xfiredb_notice_disk(c->key, tmp_key, RSTRING_PTR(data),
+					RSTRING_LEN(data), HM_UPDATE);
 	}
 
 	return data;
 }
 
+VALUE rb_hashmap_incr(VALUE self, VALUE key, VALUE delta)
+{
+	struct string *s;
+	char *tmp_key = StringValueCStr(key);
+	const char *data;
+	size_t len;
+	struct hashmap_node *node;
+	struct hashmap *map;
+	struct db_entry_container *c;
+	s64 value;
+
+	Data_Get_Struct(self, struct db_entry_container, c);
+	if(rb_container_make_room(c))
+		return Qfalse;
+
+	map = obj_to_map(self);
+	node = hashmap_find(map, tmp_key);
+
+	if(node) {
+		s = container_of(node, struct string, node);
+		if(string_incr(s, NUM2LL(delta), &value) != -XFIREDB_OK)
+			return Qnil;
+	} else {
+		s = string_alloc("0");
+		if(string_incr(s, NUM2LL(delta), &value) != -XFIREDB_OK) {
+			string_free(s);
+			return Qnil;
+		}
+
+		hashmap_add(map, tmp_key, &s->node);
+	}
+
+	if(c->intree) {
+		data = string_borrow(s, &len);
+		xfiredb_notice_disk(c->key, tmp_key, data, len,
+				node ? HM_UPDATE : HM_ADD);
+		string_unborrow(s);
+	}
+
+	return LL2NUM(value);
+}
+
 VALUE rb_hashmap_new(void)
 {
 	return rb_hashmap_alloc(c_hashmap);
@@ -231,7 +266,6 @@ VALUE rb_hashmap_each(VALUE hash)
 	struct hashmap *map;
 	struct hashmap_node *node;
 	VALUE key, value;
-	char *tmp;
 	struct string *s;
 
 	RETURN_SIZED_ENUMERATOR(hash, 0, 0, hash_enum_size);
@@ -241,11 +275,8 @@ VALUE rb_hashmap_each(VALUE hash)
 	for(node = hashmap_iterator_next(it); node;
 			node = hashmap_iterator_next(it)) {
 		s = container_of(node, struct string, node);
-		string_get(s, &tmp);
-
-		value = rb_str_new2(tmp);
+		value = rb_string_to_obj(s);
 		key = rb_str_new2(node->key);
-		xfiredb_free(tmp);
 
 		rb_yield(rb_assoc_new(key, value));
 	}
@@ -267,5 +298,6 @@ void init_hashmap(void)
 	rb_define_method(c_hashmap, "clear", rb_hashmap_clear, 0);
 	rb_define_method(c_hashmap, "size", rb_hashmap_size, 0);
 	rb_define_method(c_hashmap, "each", rb_hashmap_each, 0);
+	rb_define_method(c_hashmap, "incr", rb_hashmap_incr, 2);
 }
 
@@ -17,6 +17,7 @@
  */
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <ruby.h>
 
 #include <xfiredb/xfiredb.h>
@@ -34,6 +35,18 @@ VALUE c_list;
 
 static void raw_rb_list_clear(struct db_entry_container *c);
 
+static void list_notice_disk(struct db_entry_container *c, struct list *entry,
+			     const char *data, size_t len, int op)
+{
+	char id[BIO_ID_SIZE];
+
+	if(!c->key)
+		return;
+
+	snprintf(id, sizeof(id), "%lld", (long long)list_entry_id(entry));
+	xfiredb_notice_disk(c->key, id, data, len, op);
+}
+
 static void rb_list_release(void *p)
 {
 	struct db_entry_container *container = p;
@@ -60,9 +73,8 @@ void rb_list_free(struct db_entry_container *container)
 
 VALUE rb_list_alloc(VALUE klass)
 {
-	struct db_entry_container *container = xfiredb_zalloc(sizeof(*container));
+	struct db_entry_container *container = db_entry_container_alloc(CONTAINER_LIST);
 
-	container_init(&container->c, CONTAINER_LIST);
 	container->obj = Data_Wrap_Struct(klass, NULL, rb_list_release, container);
 	container->type = klass;
 	container->intree = false;
@@ -79,17 +91,34 @@ VALUE rb_list_new(void)
 VALUE rb_list_push(VALUE self, VALUE data)
 {
 	struct string *s;
-	char *tmp = StringValueCStr(data);
 	struct db_entry_container *c;
 	struct list_head *lh;
 
-	s = string_alloc(tmp);
+	StringValue(data);
 	Data_Get_Struct(self, struct db_entry_container, c);
-	if(c->key)
-		xfiredb_notice_disk(c->key, NULL, tmp, LIST_ADD);
+	if(rb_container_make_room(c))
+		return Qfalse;
+
+	s = rb_string_alloc(data);
 	lh = container_get_data(&c->c);
 	list_rpush(lh, &s->entry);
+	if(c->intree)
+		list_notice_disk(c, &s->entry, RSTRING_PTR(data),
+				RSTRING_LEN(data), LIST_ADD);
+
+	return self;
+}
+
+VALUE rb_list_restore(VALUE self, VALUE data, VALUE id)
+{
+	struct string *s;
+	struct db_entry_container *c;
+	struct list_head *lh;
 
+	s = rb_string_alloc(data);
+	Data_Get_Struct(self, struct db_entry_container, c);
+	lh = container_get_data(&c->c);
+	list_rpush_id(lh, &s->entry, NUM2LL(rb_Integer(id)));
 
 	return self;
 }
@@ -99,19 +128,14 @@ static void raw_rb_list_clear(struct db_entry_container *container)
 	struct list_head *lh;
 	struct list *carriage, *tmp;
 	struct string *s;
-	char *data;
 
 	lh = container_get_data(&container->c);
 
 	list_for_each_safe(lh, carriage, tmp) {
 		list_del(lh, carriage);
 		s = container_of(carriage, struct string, entry);
-		string_get(s, &data);
-		if(container->key)
-			xfiredb_notice_disk(container->key, data, NULL, LIST_DEL);
-		xfiredb_free(data);
-		string_destroy(s);
-		xfiredb_free(s);
+		list_notice_disk(container, carriage, NULL, 0, LIST_DEL);
+		string_free(s);
 	}
 }
 
@@ -162,9 +186,12 @@ VALUE rb_list_set(VALUE self, VALUE i, VALUE data)
 	struct list_head *lh;
 	struct list *carriage;
 	struct string *s;
-	char *tmp;
 
+	StringValue(data);
 	Data_Get_Struct(self, struct db_entry_container, c);
+	if(rb_container_make_room(c))
+		return Qfalse;
+
 	lh = container_get_data(&c->c);
 	carriage = list_ref(lh, idx);
 
@@ -172,11 +199,10 @@ VALUE rb_list_set(VALUE self, VALUE i, VALUE data)
 		return Qnil;
 
 	s = container_of(carriage, struct string, entry);
-	string_get(s, &tmp);
-	if(c->key)
-		xfiredb_notice_disk(c->key, tmp, StringValueCStr(data), LIST_UPDATE);
-	xfiredb_free(tmp);
-	string_set(s, StringValueCStr(data));
+	if(c->intree)
+		list_notice_disk(c, carriage, RSTRING_PTR(data),
+				RSTRING_LEN(data), LIST_UPDATE);
+	rb_string_set(s, data);
 	return data;
 }
 
@@ -188,7 +214,6 @@ VALUE rb_list_pop(VALUE self, VALUE i)
 	struct list *carriage;
 	struct string *s;
 	VALUE rv;
-	char *data;
 
 	Data_Get_Struct(self, struct db_entry_container, c);
 	lh = container_get_data(&c->c);
@@ -199,15 +224,10 @@ VALUE rb_list_pop(VALUE self, VALUE i)
 
 	list_del(lh, carriage);
 	s = container_of(carriage, struct string, entry);
-	string_get(s, &data);
-	rv = rb_str_new2(data);
-
-	if(c->key)
-		xfiredb_notice_disk(c->key, data, NULL, LIST_DEL);
+	rv = rb_string_to_obj(s);
+	list_notice_disk(c, carriage, NULL, 0, LIST_DEL);
 
-	xfiredb_free(data);
-	string_destroy(s);
-	xfiredb_free(s);
+	string_free(s);
 
 	return rv;
 }
@@ -219,8 +239,6 @@ VALUE rb_list_ref(VALUE self, VALUE i)
 	struct list_head *lh;
 	struct list *carriage;
 	struct string *s;
-	VALUE rv;
-	char *data;
 
 	Data_Get_Struct(self, struct db_entry_container, c);
 	lh = container_get_data(&c->c);
@@ -230,10 +248,7 @@ VALUE rb_list_ref(VALUE self, VALUE i)
 		return Qnil;
 
 	s = container_of(carriage, struct string, entry);
-	string_get(s, &data);
-	rv = rb_str_new2(data);
-	xfiredb_free(data);
-	return rv;
+	return rb_string_to_obj(s);
 }
 
 VALUE rb_list_each(VALUE self)
@@ -261,6 +276,7 @@ void init_list(void)
 	rb_include_module(c_list, rb_mEnumerable);
 	rb_define_singleton_method(c_list, "new", rb_list_alloc, 0);
 	rb_define_method(c_list, "push", rb_list_push, 1);
+	rb_define_method(c_list, "restore", rb_list_restore, 2);
 	rb_define_method(c_list, "pop", rb_list_pop, 1);
 	rb_define_method(c_list, "[]", rb_list_ref, 1);
 	rb_define_method(c_list, "[]=", rb_list_set, 2);
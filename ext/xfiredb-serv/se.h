@@ -20,29 +20,63 @@
 #define __DEFINED_SE_H__
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <ruby.h>
 
 #include <xfiredb/xfiredb.h>
+#include <xfiredb/mem.h>
+#include <xfiredb/error.h>
 #include <xfiredb/container.h>
+#include <xfiredb/database.h>
 
 struct db_entry_container {
 	char *key;
+	struct database *db; /* Database the container was stored in */
 
-	struct container c;
 	bool intree;
 	bool obj_released;
 	VALUE obj;
 	VALUE type;
 	void (*release)(void *p);
+
+	/* Right-sized to the container type, must be the last member */
+	struct container c;
 };
 
+static inline struct db_entry_container *db_entry_container_alloc(container_type_t type)
+{
+	struct db_entry_container *entry;
+
+	entry = xfiredb_zalloc(offsetof(struct db_entry_container, c) +
+			container_size(type));
+	container_init(&entry->c, type);
+	return entry;
+}
+
+/*
+ * Make room for a write to a stored container. Fails if the memory budget
+ * of its database can't be met. The container itself may be evicted, after
+ * which it is no longer in the tree and writes to it don't reach the disk.
+ */
+static inline int rb_container_make_room(struct db_entry_container *c)
+{
+	if(!c->intree || !c->db)
+		return -XFIREDB_OK;
+
+	return db_evict_if_needed(c->db);
+}
+
 extern VALUE c_xfiredb_mod;
 extern VALUE c_hashmap;
 extern VALUE c_list;
 extern VALUE c_set;
 
 /* string funcs */
+struct string;
 extern void init_string(void);
+extern VALUE rb_string_to_obj(struct string *s);
+extern struct string *rb_string_alloc(VALUE str);
+extern void rb_string_set(struct string *s, VALUE str);
 
 /* set funcs */
 extern void init_set(void);
@@ -39,7 +39,7 @@ void rb_set_remove(struct db_entry_container *e)
 	if(e->key) {
 		it = set_iterator_new(set);
 		for_each_set(set, k, it)
-			xfiredb_notice_disk(e->key, k->key, NULL, SET_DEL);
+			xfiredb_notice_disk(e->key, k->key, NULL, 0, SET_DEL);
 
 		set_iterator_free(it);
 	}
@@ -74,10 +74,9 @@ static void rb_set_release(void *p)
 
 static VALUE rb_set_alloc(VALUE klass)
 {
-	struct db_entry_container *container = xfiredb_zalloc(sizeof(*container));
+	struct db_entry_container *container = db_entry_container_alloc(CONTAINER_SET);
 	VALUE obj;
 
-	container_init(&container->c, CONTAINER_SET);
 	obj = Data_Wrap_Struct(klass, NULL, rb_set_release, container);
 	container->intree = false;
 	container->type = klass;
@@ -100,13 +99,17 @@ static VALUE rb_set_add(VALUE self, VALUE _key)
 	struct set *set;
 	struct db_entry_container *e;
 	char *key = StringValueCStr(_key);
-	struct set_key *k = xfiredb_zalloc(sizeof(*k));
+	struct set_key *k;
 
 	Data_Get_Struct(self, struct db_entry_container, e);
+	if(rb_container_make_room(e))
+		return Qfalse;
+
+	k = xfiredb_zalloc(sizeof(*k));
 	set = obj_to_set(self);
 	if(set_add(set, key, k) == -XFIREDB_OK) {
-		if(e->key)
-			xfiredb_notice_disk(e->key, k->key, NULL, SET_ADD);
+		if(e->intree)
+			xfiredb_notice_disk(e->key, k->key, NULL, 0, SET_ADD);
 
 		return _key;
 	}
@@ -130,7 +133,7 @@ static VALUE rb_set_remove_key(VALUE self, VALUE _key)
 		return Qnil;
 
 	if(e->key)
-		xfiredb_notice_disk(e->key, k->key, NULL, SET_DEL);
+		xfiredb_notice_disk(e->key, k->key, NULL, 0, SET_DEL);
 	set_key_destroy(k);
 	xfiredb_free(k);
 	return _key;
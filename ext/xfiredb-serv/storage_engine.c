@@ -18,6 +18,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <ruby.h>
 
 #include "se.h"
@@ -27,6 +28,10 @@
 #include <xfiredb/mem.h>
 #include <xfiredb/database.h>
 #include <xfiredb/disk.h>
+#include <xfiredb/bio.h>
+#include <xfiredb/aof.h>
+#include <xfiredb/snapshot.h>
+#include <xfiredb/time.h>
 
 extern void init_list(void);
 extern void init_database(void);
@@ -37,6 +42,7 @@ VALUE rb_se_init(VALUE self,
 		VALUE err_log,
 		VALUE db_file,
 		VALUE pers_lvl,
+		VALUE engine,
 		VALUE silent)
 {
 	struct config conf;
@@ -45,6 +51,8 @@ VALUE rb_se_init(VALUE self,
 	xfiredb_sprintf(&conf.err_log_file, "%s", StringValueCStr(err_log));
 	xfiredb_sprintf(&conf.db_file, "%s", StringValueCStr(db_file));
 	conf.persist_level = NUM2INT(pers_lvl);
+	conf.persist_engine = strcmp(StringValueCStr(engine), "aof") ?
+		BIO_ENGINE_DISK : BIO_ENGINE_AOF;
 
 	if(silent == Qtrue)
 		xfiredb_se_init_silent(&conf);
@@ -72,26 +80,35 @@ VALUE rb_se_get_loadstate(VALUE self)
 		return Qfalse;
 }
 
+/*
+ * Push the rows passed to a load hook onto ary, as [key, secondary key,
+ * type, value] arrays.
+ */
+static void rb_se_push_rows(VALUE ary, int argc, char **rows, size_t *lens)
+{
+	VALUE key, hash, type, data;
+	int i;
+
+	for(i = 0; i < argc; i += 4) {
+		key = rb_str_new(rows[i + TABLE_KEY_IDX], lens[i + TABLE_KEY_IDX]);
+		hash = rb_str_new(rows[i + TABLE_SCND_KEY_IDX],
+				lens[i + TABLE_SCND_KEY_IDX]);
+		type = rb_str_new(rows[i + TABLE_TYPE_IDX], lens[i + TABLE_TYPE_IDX]);
+		data = rb_str_new(rows[i + TABLE_DATA_IDX], lens[i + TABLE_DATA_IDX]);
+
+		rb_ary_push(ary, rb_ary_new_from_args(4, key, hash, type, data));
+	}
+}
+
 VALUE rb_se_load_key(VALUE self, VALUE _key)
 {
 	VALUE ary;
-	auto void load_hook(int argc, char **rows, char **cols);
+	auto void load_hook(int argc, char **rows, size_t *lens, char **cols);
 	char *k = StringValueCStr(_key);
 
-	void load_hook(int argc, char **rows, char **cols)
+	void load_hook(int argc, char **rows, size_t *lens, char **cols)
 	{
-		VALUE key, hash, type, data, tmp;
-		int i;
-
-		for(i = 0; i < argc; i += 4) {
-			key = rb_str_new2(rows[i + TABLE_KEY_IDX]);
-			hash = rb_str_new2(rows[i + TABLE_SCND_KEY_IDX]);
-			type = rb_str_new2(rows[i + TABLE_TYPE_IDX]);
-			data = rb_str_new2(rows[i + TABLE_DATA_IDX]);
-
-			tmp = rb_ary_new_from_args(4, key, hash, type, data);
-			rb_ary_push(ary, tmp);
-		}
+		rb_se_push_rows(ary, argc, rows, lens);
 	}
 
 	ary = rb_ary_new();
@@ -101,23 +118,12 @@ VALUE rb_se_load_key(VALUE self, VALUE _key)
 
 VALUE rb_se_load(VALUE self)
 {
-	auto void load_hook(int argc, char **rows, char **cols);
+	auto void load_hook(int argc, char **rows, size_t *lens, char **cols);
 	VALUE ary;
 
-	void load_hook(int argc, char **rows, char **cols)
+	void load_hook(int argc, char **rows, size_t *lens, char **cols)
 	{
-		VALUE key, hash, type, data, tmp;
-		int i;
-
-		for(i = 0; i < argc; i += 4) {
-			key = rb_str_new2(rows[i + TABLE_KEY_IDX]);
-			hash = rb_str_new2(rows[i + TABLE_SCND_KEY_IDX]);
-			type = rb_str_new2(rows[i + TABLE_TYPE_IDX]);
-			data = rb_str_new2(rows[i + TABLE_DATA_IDX]);
-
-			tmp = rb_ary_new_from_args(4, key, hash, type, data);
-			rb_ary_push(ary, tmp);
-		}
+		rb_se_push_rows(ary, argc, rows, lens);
 	}
 
 	ary = rb_ary_new();
@@ -125,6 +131,36 @@ VALUE rb_se_load(VALUE self)
 	return ary;
 }
 
+/*
+ * Load a snapshot file. Returns the rows, in the same format as load, and
+ * the time to live in milliseconds of every key that expires, as
+ * [key, ttl] pairs. nil if the snapshot couldn't be read.
+ */
+VALUE rb_se_snapshot_load(VALUE self, VALUE path)
+{
+	auto void load_hook(int argc, char **rows, size_t *lens, char **cols);
+	auto void expire_hook(const char *key, s64 when);
+	VALUE ary, expires;
+
+	void load_hook(int argc, char **rows, size_t *lens, char **cols)
+	{
+		rb_se_push_rows(ary, argc, rows, lens);
+	}
+
+	void expire_hook(const char *key, s64 when)
+	{
+		rb_ary_push(expires, rb_ary_new_from_args(2, rb_str_new2(key),
+					LL2NUM(when - xfiredb_time_stamp())));
+	}
+
+	ary = rb_ary_new();
+	expires = rb_ary_new();
+	if(snapshot_load(StringValueCStr(path), &load_hook, &expire_hook))
+		return Qnil;
+
+	return rb_ary_new_from_args(2, ary, expires);
+}
+
 VALUE rb_se_exit(VALUE self, VALUE db)
 {
 	xfiredb_se_exit();
@@ -137,6 +173,159 @@ VALUE rb_se_save(VALUE self)
 	return Qnil;
 }
 
+/*
+ * Set the group commit limits of a persistency level. A size or latency of
+ * zero keeps the current value.
+ */
+VALUE rb_se_set_batch(VALUE self, VALUE level, VALUE size, VALUE latency)
+{
+	struct bio_batch batch;
+	int lvl = NUM2INT(level);
+	unsigned int sz = NUM2UINT(size);
+	unsigned int ms = NUM2UINT(latency);
+
+	bio_get_batch(lvl, &batch);
+	if(sz)
+		batch.size = sz;
+	if(ms)
+		batch.latency = ms;
+
+	if(bio_set_batch(lvl, batch.size, batch.latency))
+		return Qfalse;
+
+	return Qtrue;
+}
+
+/*
+ * Set the flush policy of a persistency level. A count or interval of zero
+ * keeps the current value.
+ */
+VALUE rb_se_set_flush(VALUE self, VALUE level, VALUE ops, VALUE interval)
+{
+	struct bio_flush flush;
+	int lvl = NUM2INT(level);
+	unsigned int num = NUM2UINT(ops);
+	unsigned int ms = NUM2UINT(interval);
+
+	bio_get_flush(lvl, &flush);
+	if(num)
+		flush.ops = num;
+	if(ms)
+		flush.interval = ms;
+
+	if(bio_set_flush(lvl, flush.ops, flush.interval))
+		return Qfalse;
+
+	return Qtrue;
+}
+
+/*
+ * Limit the background I/O queue. The policy is one of "block", "shed" or
+ * "degrade".
+ */
+VALUE rb_se_set_bio_limits(VALUE self, VALUE depth, VALUE bytes, VALUE policy)
+{
+	const char *name = StringValueCStr(policy);
+	bio_policy_t p;
+
+	if(!strcmp(name, "block"))
+		p = BIO_POLICY_BLOCK;
+	else if(!strcmp(name, "shed"))
+		p = BIO_POLICY_SHED;
+	else if(!strcmp(name, "degrade"))
+		p = BIO_POLICY_DEGRADE;
+	else
+		return Qfalse;
+
+	bio_set_limits(NUM2ULONG(depth), NUM2SIZET(bytes), p);
+	return Qtrue;
+}
+
+VALUE rb_se_bio_degraded(VALUE self)
+{
+	return bio_degraded() ? Qtrue : Qfalse;
+}
+
+/*
+ * Set the sync policy of the append-only log: "always", "everysec" or
+ * "no". Returns false if the policy is unknown, or if the append-only log
+ * isn't used.
+ */
+VALUE rb_se_set_aof_fsync(VALUE self, VALUE policy)
+{
+	const char *name = StringValueCStr(policy);
+	aof_fsync_t p;
+
+	if(!strcmp(name, "always"))
+		p = AOF_FSYNC_ALWAYS;
+	else if(!strcmp(name, "everysec"))
+		p = AOF_FSYNC_EVERYSEC;
+	else if(!strcmp(name, "no"))
+		p = AOF_FSYNC_NO;
+	else
+		return Qfalse;
+
+	return bio_set_aof_fsync(p) ? Qfalse : Qtrue;
+}
+
+VALUE rb_se_bio_rewrite_needed(VALUE self)
+{
+	return bio_rewrite_needed() ? Qtrue : Qfalse;
+}
+
+static const char *bio_policy_names[] = {"block", "shed", "degrade"};
+
+static void bio_hash_set(VALUE hash, const char *field, VALUE value)
+{
+	rb_hash_aset(hash, rb_str_new2(field), value);
+}
+
+/*
+ * Get the background I/O queue statistics as a hash.
+ */
+VALUE rb_se_bio_stats(VALUE self)
+{
+	struct bio_stats stats;
+	struct bio_op_stats *op;
+	char field[64];
+	VALUE hash;
+	int idx;
+
+	bio_get_stats(&stats);
+	hash = rb_hash_new();
+
+	bio_hash_set(hash, "bio_queue_depth", ULONG2NUM(stats.depth));
+	bio_hash_set(hash, "bio_queue_bytes", SIZET2NUM(stats.bytes));
+	bio_hash_set(hash, "bio_queue_max_depth", ULONG2NUM(stats.max_depth));
+	bio_hash_set(hash, "bio_queue_max_bytes", SIZET2NUM(stats.max_bytes));
+	bio_hash_set(hash, "bio_queue_policy",
+			rb_str_new2(bio_policy_names[stats.policy]));
+	bio_hash_set(hash, "bio_degraded", INT2NUM(stats.degraded ? 1 : 0));
+	bio_hash_set(hash, "bio_enqueued", ULL2NUM(stats.enqueued));
+	bio_hash_set(hash, "bio_dequeued", ULL2NUM(stats.dequeued));
+	bio_hash_set(hash, "bio_written", ULL2NUM(stats.written));
+	bio_hash_set(hash, "bio_shed", ULL2NUM(stats.shed));
+	bio_hash_set(hash, "bio_blocked", ULL2NUM(stats.blocked));
+	bio_hash_set(hash, "bio_enqueue_rate", rb_float_new(stats.enqueue_rate));
+	bio_hash_set(hash, "bio_dequeue_rate", rb_float_new(stats.dequeue_rate));
+	bio_hash_set(hash, "bio_oldest_pending_ms", LONG2NUM((long)stats.oldest));
+
+	for(idx = 0; idx < BIO_OPERATIONS; idx++) {
+		op = &stats.ops[idx];
+		if(!op->calls)
+			continue;
+
+		snprintf(field, sizeof(field), "bio_op_%s", bio_op_name(idx));
+		bio_hash_set(hash, field,
+				rb_sprintf("calls=%llu,usec_per_call=%.2f,max_usec=%llu",
+					(unsigned long long)op->calls,
+					(double)op->usec / op->calls,
+					(unsigned long long)op->max_usec));
+	}
+
+	return hash;
+}
+
 VALUE c_xfiredb_mod;
 VALUE rb_cStorageEngine;
 void Init_storage_engine(void)
@@ -145,13 +334,21 @@ void Init_storage_engine(void)
 	rb_cStorageEngine = rb_define_class_under(c_xfiredb_mod,
 			"Engine", rb_cObject);
 
-	rb_define_method(rb_cStorageEngine, "init", rb_se_init, 5);
+	rb_define_method(rb_cStorageEngine, "init", rb_se_init, 6);
 	rb_define_method(rb_cStorageEngine, "stop", rb_se_exit, 1);
 	rb_define_method(rb_cStorageEngine, "save", rb_se_save, 0);
 	rb_define_method(rb_cStorageEngine, "load", rb_se_load, 0);
 	rb_define_method(rb_cStorageEngine, "load_key", rb_se_load_key, 1);
+	rb_define_method(rb_cStorageEngine, "snapshot_load", rb_se_snapshot_load, 1);
 	rb_define_method(rb_cStorageEngine, "set_loadstate", rb_se_set_loadstate, 1);
 	rb_define_method(rb_cStorageEngine, "get_loadstate", rb_se_get_loadstate, 0);
+	rb_define_method(rb_cStorageEngine, "set_batch", rb_se_set_batch, 3);
+	rb_define_method(rb_cStorageEngine, "set_flush", rb_se_set_flush, 3);
+	rb_define_method(rb_cStorageEngine, "set_bio_limits", rb_se_set_bio_limits, 3);
+	rb_define_method(rb_cStorageEngine, "bio_degraded?", rb_se_bio_degraded, 0);
+	rb_define_method(rb_cStorageEngine, "set_aof_fsync", rb_se_set_aof_fsync, 1);
+	rb_define_method(rb_cStorageEngine, "bio_rewrite_needed?", rb_se_bio_rewrite_needed, 0);
+	rb_define_method(rb_cStorageEngine, "bio_stats", rb_se_bio_stats, 0);
 
 	init_database();
 	init_list();
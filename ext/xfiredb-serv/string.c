@@ -17,14 +17,58 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <ruby.h>
 
 #include <xfiredb/xfiredb.h>
 #include <xfiredb/error.h>
 #include <xfiredb/quotearg.h>
+#include <xfiredb/string.h>
 
 #include "se.h"
 
+/*
+ * Copy a string container into a Ruby string. Ruby may raise or run the
+ * GC when it allocates, so the Ruby string is allocated before the string
+ * is borrowed, and the borrow only covers the copy. If the string grew in
+ * between, try again with the new length.
+ */
+VALUE rb_string_to_obj(struct string *s)
+{
+	const char *data;
+	size_t len, size;
+	VALUE rv;
+
+	size = string_length(s);
+	while(true) {
+		rv = rb_str_buf_new(size);
+		data = string_borrow(s, &len);
+		if(len <= size) {
+			memcpy(RSTRING_PTR(rv), data, len);
+			string_unborrow(s);
+			break;
+		}
+
+		string_unborrow(s);
+		size = len;
+	}
+
+	rb_str_set_len(rv, len);
+	return rv;
+}
+
+struct string *rb_string_alloc(VALUE str)
+{
+	StringValue(str);
+	return string_alloc_len(RSTRING_PTR(str), RSTRING_LEN(str));
+}
+
+void rb_string_set(struct string *s, VALUE str)
+{
+	StringValue(str);
+	string_set_len(s, RSTRING_PTR(str), RSTRING_LEN(str));
+}
+
 static VALUE rb_string_escape(VALUE str)
 {
 	char *x, *new;
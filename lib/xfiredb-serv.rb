@@ -39,6 +39,7 @@ require 'xfiredb-serv/clusternode'
 require 'xfiredb-serv/localnode'
 require 'xfiredb-serv/command'
 require 'xfiredb-serv/storage_commands'
+require 'xfiredb-serv/server_commands'
 require 'xfiredb-serv/cluster_commands'
 require 'xfiredb-serv/engine'
 require 'xfiredb-serv/config'
@@ -68,6 +69,23 @@ module XFireDB
     "GET" => XFireDB::CommandGet,
     "SET" => XFireDB::CommandSet,
     "DELETE" => XFireDB::CommandDelete,
+    "INCR" => XFireDB::CommandIncr,
+    "DECR" => XFireDB::CommandDecr,
+    "INCRBY" => XFireDB::CommandIncrBy,
+    "INCRBYFLOAT" => XFireDB::CommandIncrByFloat,
+    "HINCRBY" => XFireDB::CommandHIncrBy,
+    "APPEND" => XFireDB::CommandAppend,
+    "SETRANGE" => XFireDB::CommandSetRange,
+    "GETRANGE" => XFireDB::CommandGetRange,
+    "STRLEN" => XFireDB::CommandStrlen,
+    "EXPIRE" => XFireDB::CommandExpire,
+    "PEXPIRE" => XFireDB::CommandPExpire,
+    "TTL" => XFireDB::CommandTTL,
+    "PERSIST" => XFireDB::CommandPersist,
+    "MEMORY" => XFireDB::CommandMemory,
+    "INFO" => XFireDB::CommandInfo,
+    "SAVE" => XFireDB::CommandSave,
+    "BGSAVE" => XFireDB::CommandBgsave,
 
     "MADD" => XFireDB::CommandMAdd,
     "MREF" => XFireDB::CommandMRef,
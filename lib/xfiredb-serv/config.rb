@@ -24,7 +24,11 @@ module XFireDB
   class Config
     attr_reader :port, :config_port, :addr, :cluster, :data_dir,
       :debug, :log_file, :err_log_file, :db_file, :persist_level, :auth, :problems,
-      :ssl, :ssl_cert, :ssl_key, :cluster_user, :cluster_auth, :pid_file
+      :ssl, :ssl_cert, :ssl_key, :cluster_user, :cluster_auth, :pid_file,
+      :maxmemory, :maxmemory_policy, :heap_profile_rate, :shared_value_max,
+      :bio_batch_size, :bio_batch_latency, :bio_queue_max_ops,
+      :bio_queue_max_bytes, :bio_queue_policy, :bio_flush_ops, :bio_flush_interval,
+      :persist_engine, :aof_file, :aof_fsync, :snapshot_file
     attr_accessor :daemon, :secret
 
     CONFIG_PORT = "port"
@@ -39,6 +43,25 @@ module XFireDB
     CONFIG_SSL_CERT = 'ssl-certificate'
     CONFIG_SSL_KEY = 'ssl-key'
     CONFIG_DATA_DIR = 'data-dir'
+    CONFIG_MAXMEMORY = 'maxmemory'
+    CONFIG_MAXMEMORY_POLICY = 'maxmemory-policy'
+    CONFIG_HEAP_PROFILE_RATE = 'heap-profile-rate'
+    CONFIG_SHARED_VALUE_MAX = 'shared-value-max'
+    CONFIG_BIO_BATCH_SIZE = 'bio-batch-size'
+    CONFIG_BIO_BATCH_LATENCY = 'bio-batch-latency'
+    CONFIG_BIO_FLUSH_OPS = 'bio-flush-ops'
+    CONFIG_BIO_FLUSH_INTERVAL = 'bio-flush-interval'
+    CONFIG_BIO_QUEUE_MAX_OPS = 'bio-queue-max-ops'
+    CONFIG_BIO_QUEUE_MAX_BYTES = 'bio-queue-max-bytes'
+    CONFIG_BIO_QUEUE_POLICY = 'bio-queue-policy'
+    CONFIG_PERSIST_ENGINE = 'persist-engine'
+    CONFIG_AOF_FILE = 'aof-file'
+    CONFIG_AOF_FSYNC = 'aof-fsync'
+    CONFIG_SNAPSHOT_FILE = 'snapshot-file'
+    MAXMEMORY_POLICIES = ['noeviction', 'allkeys-lru', 'allkeys-lfu', 'volatile-ttl']
+    BIO_QUEUE_POLICIES = ['block', 'shed', 'degrade']
+    PERSIST_ENGINES = ['disk', 'aof']
+    AOF_FSYNC_POLICIES = ['always', 'everysec', 'no']
 
     @port = nil
     @addr = nil
@@ -58,6 +81,21 @@ module XFireDB
     @cluser_auth = false
     @pid_file = nil
     @data_dir = nil
+    @maxmemory = 0
+    @maxmemory_policy = 'noeviction'
+    @heap_profile_rate = 0
+    @shared_value_max = 0
+    @bio_batch_size = 0
+    @bio_batch_latency = 0
+    @bio_flush_ops = 0
+    @bio_flush_interval = 0
+    @bio_queue_max_ops = 0
+    @bio_queue_max_bytes = 0
+    @bio_queue_policy = 'block'
+    @persist_engine = 'disk'
+    @aof_file = nil
+    @aof_fsync = 'everysec'
+    @snapshot_file = nil
 
     # Create a new config.
     #
@@ -67,6 +105,19 @@ module XFireDB
 
       @filename = file
       @problems = 0
+      @maxmemory = 0
+      @maxmemory_policy = 'noeviction'
+      @heap_profile_rate = 0
+      @shared_value_max = 0
+      @bio_batch_size = 0
+      @bio_batch_latency = 0
+      @bio_flush_ops = 0
+      @bio_flush_interval = 0
+      @bio_queue_max_ops = 0
+      @bio_queue_max_bytes = 0
+      @bio_queue_policy = 'block'
+      @persist_engine = 'disk'
+      @aof_fsync = 'everysec'
       @cluster_user = 'cluster'
       fh = File.open(@filename, "r")
       puts "[config]: config file (#{file}) not found!" unless check_config(fh)
@@ -126,6 +177,11 @@ module XFireDB
         fail_count += 1
       end
 
+      if @persist_engine == 'aof' and @aof_file.nil?
+        puts "[config]: aof-file is required when persist-engine is aof"
+        fail_count += 1
+      end
+
       exit unless fail_count == 0
     end
 
@@ -141,6 +197,7 @@ module XFireDB
         @pid_file = arg
         @log_file = File.expand_path("#{arg}/xfiredb.stdout")
         @err_log_file = File.expand_path("#{arg}/xfiredb.stderr")
+        @snapshot_file ||= File.expand_path("#{arg}/xfiredb.snap")
       when CONFIG_SSL_CERT
         @ssl_cert = File.expand_path(arg)
       when CONFIG_SSL_KEY
@@ -163,6 +220,60 @@ module XFireDB
         end
       when CONFIG_BIND_ADDR
         @addr = arg
+      when CONFIG_MAXMEMORY
+        @maxmemory = parse_size(arg) || 0
+        puts "[config]: #{opt} should be a size (e.g. 512mb)" unless parse_size(arg)
+      when CONFIG_MAXMEMORY_POLICY
+        if MAXMEMORY_POLICIES.include? arg
+          @maxmemory_policy = arg
+        else
+          puts "[config]: #{opt} should be one of: #{MAXMEMORY_POLICIES.join(', ')}"
+        end
+      when CONFIG_HEAP_PROFILE_RATE
+        @heap_profile_rate = parse_size(arg) || 0
+      when CONFIG_SHARED_VALUE_MAX
+        @shared_value_max = parse_size(arg) || 0
+        puts "[config]: #{opt} should be a size (e.g. 512kb)" unless parse_size(arg)
+      when CONFIG_BIO_BATCH_SIZE
+        @bio_batch_size = arg.to_i if arg.is_i?
+        puts "[config]: #{opt} should be numeric" unless arg.is_i?
+      when CONFIG_BIO_BATCH_LATENCY
+        @bio_batch_latency = arg.to_i if arg.is_i?
+        puts "[config]: #{opt} should be numeric" unless arg.is_i?
+      when CONFIG_BIO_FLUSH_OPS
+        @bio_flush_ops = arg.to_i if arg.is_i?
+        puts "[config]: #{opt} should be numeric" unless arg.is_i?
+      when CONFIG_BIO_FLUSH_INTERVAL
+        @bio_flush_interval = arg.to_i if arg.is_i?
+        puts "[config]: #{opt} should be numeric" unless arg.is_i?
+      when CONFIG_BIO_QUEUE_MAX_OPS
+        @bio_queue_max_ops = arg.to_i if arg.is_i?
+        puts "[config]: #{opt} should be numeric" unless arg.is_i?
+      when CONFIG_BIO_QUEUE_MAX_BYTES
+        @bio_queue_max_bytes = parse_size(arg) || 0
+        puts "[config]: #{opt} should be a size (e.g. 64mb)" unless parse_size(arg)
+      when CONFIG_BIO_QUEUE_POLICY
+        if BIO_QUEUE_POLICIES.include? arg
+          @bio_queue_policy = arg
+        else
+          puts "[config]: #{opt} should be one of: #{BIO_QUEUE_POLICIES.join(', ')}"
+        end
+      when CONFIG_PERSIST_ENGINE
+        if PERSIST_ENGINES.include? arg
+          @persist_engine = arg
+        else
+          puts "[config]: #{opt} should be one of: #{PERSIST_ENGINES.join(', ')}"
+        end
+      when CONFIG_AOF_FILE
+        @aof_file = File.expand_path(arg)
+      when CONFIG_SNAPSHOT_FILE
+        @snapshot_file = File.expand_path(arg)
+      when CONFIG_AOF_FSYNC
+        if AOF_FSYNC_POLICIES.include? arg
+          @aof_fsync = arg
+        else
+          puts "[config]: #{opt} should be one of: #{AOF_FSYNC_POLICIES.join(', ')}"
+        end
       when CONFIG_CLUSTER
         @cluster = true if arg.eql? "true"
       when CONFIG_DEBUG
@@ -174,6 +285,17 @@ module XFireDB
       end
     end
 
+    # Parse a memory size.
+    #
+    # @param [String] arg Size with an optional kb, mb or gb unit.
+    # @return [Fixnum] The size in bytes or nil if arg isn't a valid size.
+    def parse_size(arg)
+      units = {'' => 1, 'KB' => 1024, 'MB' => 1024 ** 2, 'GB' => 1024 ** 3}
+      match = /\A(\d+)\s*(kb|mb|gb)?\z/i.match(arg)
+      return nil unless match
+      match[1].to_i * units[match[2].to_s.upcase]
+    end
+
     # Check the configuration file.
     #
     # @param [File] file Config file to check.
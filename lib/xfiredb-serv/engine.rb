@@ -21,6 +21,11 @@ module XFireDB
   class Engine
     attr_reader :db
 
+    # Time between two active expiry runs in seconds.
+    EXPIRE_INTERVAL = 0.1
+    # Maximum number of keys handled by a single expiry run.
+    EXPIRE_BATCH = 64
+
     # Create a new storage engine.
     def initialize
       @db = XFireDB::Database.new
@@ -31,7 +36,8 @@ module XFireDB
     # breaking anything.
     def pre_init
       config = XFireDB.config
-      self.init(config.log_file, config.err_log_file, config.db_file, config.persist_level, false)
+      self.init(config.log_file, config.err_log_file, persist_file(config),
+                config.persist_level, config.persist_engine, false)
 
       XFireDB.preinit_keys.each do |key|
         self.load_key(key).each do |key,hash,type,data|
@@ -46,17 +52,31 @@ module XFireDB
     def start
       set_loadstate(false)
       config = XFireDB.config
-      self.init(config.log_file, config.err_log_file, config.db_file, config.persist_level, true)
+      self.init(config.log_file, config.err_log_file, persist_file(config),
+                config.persist_level, config.persist_engine, true)
 
       self.load.each.each do |key, hash, type, data|
         load_entry(key, hash, type, data)
       end
+      restored = @db.size == 0 && load_snapshot(config.snapshot_file)
 
       self.set_loadstate(true)
+      @db.snapshot if restored
+      if config.persist_level < 3
+        self.set_batch(config.persist_level, config.bio_batch_size, config.bio_batch_latency)
+        self.set_flush(config.persist_level, config.bio_flush_ops, config.bio_flush_interval)
+      end
+      self.set_bio_limits(config.bio_queue_max_ops, config.bio_queue_max_bytes, config.bio_queue_policy)
+      self.set_aof_fsync(config.aof_fsync) if config.persist_engine == 'aof'
+      @db.set_maxmemory(config.maxmemory, config.maxmemory_policy)
+      @db.set_share_limit(config.shared_value_max)
+      @db.heap_profile_start(config.heap_profile_rate) if config.heap_profile_rate > 0
+      start_expirer
     end
 
     # Stop the XFireDB engine. All data will be stored to disk.
     def exit
+      @expirer.kill unless @expirer.nil?
       self.set_loadstate(false)
       @db.each do |key, value|
         @db.delete(key)
@@ -75,13 +95,68 @@ module XFireDB
     end
 
     private
+    # Start the active expirer. Keys whose time out has passed are
+    # deleted in bounded batches. The expirer runs as a Ruby thread,
+    # because the database may only be touched while holding the GVL.
+    # It also rewrites the disk once the background I/O queue has
+    # dropped writes, or once the append-only log has grown enough to be
+    # compacted.
+    def start_expirer
+      @expirer = Thread.new do
+        loop do
+          sleep EXPIRE_INTERVAL
+          @db.expire_cycle(EXPIRE_BATCH)
+          @db.snapshot if bio_degraded? or bio_rewrite_needed?
+        end
+      end
+    end
+
+    # Load the snapshot file into an empty database. The disk is at least
+    # as recent as any snapshot, so the snapshot is only used when the disk
+    # holds no data. The caller has to write the loaded entries to disk.
+    #
+    # @param [String] path Snapshot file.
+    # @return [Boolean] true if the snapshot was loaded.
+    def load_snapshot(path)
+      return false if path.nil? or not File.exist?(path)
+
+      snapshot = self.snapshot_load(path)
+      if snapshot.nil?
+        puts "[engine]: snapshot #{path} is damaged, not loaded"
+        return false
+      end
+
+      rows, expiries = snapshot
+      rows.each do |key, hash, type, data|
+        load_entry(key, hash, type, data)
+      end
+
+      expiries.each do |key, ttl|
+        if ttl > 0
+          @db.expire(key, ttl)
+        else
+          @db.delete(key)
+        end
+      end
+
+      return true
+    end
+
+    # Get the file used by the configured persistence engine.
+    #
+    # @param [Config] config Server configuration.
+    # @return [String] Path to the SQLite database or the append-only log.
+    def persist_file(config)
+      config.persist_engine == 'aof' ? config.aof_file : config.db_file
+    end
+
     # Load a database entry from file.
     def load_entry(key, hash, type, data)
         case type
         when "string"
           load_string(key, data)
         when "list"
-          load_list_entry(key, data)
+          load_list_entry(key, hash, data)
         when "hashmap"
           load_map_entry(key, hash, data)
         when "set"
@@ -100,12 +175,13 @@ module XFireDB
     # Load a list entry into the DB.
     #
     # @param [String] key Key to load.
+    # @param [String] id Position ID of the entry.
     # @param [String] data Data to load.
-    def load_list_entry(key, data)
+    def load_list_entry(key, id, data)
       @db[key] ||= XFireDB::List.new
       list = @db[key]
       return unless list.class == XFireDB::List
-      list.push(data)
+      list.restore(data, id)
     end
 
     # Load a hashmap entry from disk.
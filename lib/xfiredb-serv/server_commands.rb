@@ -0,0 +1,246 @@
+#
+#   XFireDB server commands
+#   Copyright (C) 2015  Michel Megens <dev@michelmegens.net>
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+module XFireDB
+  # MEMORY handler
+  class CommandMemory < XFireDB::Command
+    # Default number of elements sampled by MEMORY USAGE.
+    USAGE_SAMPLES = 5
+    # Default sampling rate of MEMORY PROFILE START.
+    PROFILE_RATE = 512 * 1024
+    # Valid MEMORY PROFILE DUMP names: a plain file name, no path components.
+    PROFILE_NAME = /\A[A-Za-z0-9_-]+\z/
+    # Extension of heap profiles written to the data directory.
+    PROFILE_SUFFIX = ".heap"
+
+    # Create a new MEMORY handler.
+    #
+    # @param [Cluster] cluster Cluster object.
+    # @param [Client] client Client object.
+    def initialize(cluster, client)
+      super(cluster, "MEMORY", client, client.request.args[1])
+    end
+
+    # Excute the command. MEMORY USAGE replies with the estimated number
+    # of bytes used by a key and its value. MEMORY PROFILE controls the
+    # heap profiler of the local node.
+    #
+    # @return [String] Reply to client.
+    def exec
+      sub = @argv[0]
+      return "-Syntax error: #{usage}" if sub.nil?
+
+      case sub.upcase
+      when "USAGE"
+        memory_usage
+      when "PROFILE"
+        memory_profile
+      else
+        "-Syntax error: #{usage}"
+      end
+    end
+
+    private
+    # Estimate the memory usage of a key.
+    #
+    # @return [String] Reply to client.
+    def memory_usage
+      key = @argv[1]
+
+      return "-Syntax error: #{usage}" unless key
+      return forward(key, "MEMORY #{@argv.join(' ')}") unless @cluster.local_node.shard.include? key
+
+      samples = USAGE_SAMPLES
+      if @argv[2]
+        return "-Syntax error: #{usage}" unless @argv[2].upcase == "SAMPLES"
+        samples = Integer(@argv[3]) rescue nil
+        return "-Syntax error: #{usage}" if samples.nil? or samples < 0
+      end
+
+      bytes = XFireDB.db.memory_usage(key, samples)
+      return "-nil" if bytes.nil?
+      return "%" + bytes.to_s
+    end
+
+    # Start, stop or dump the heap profiler.
+    #
+    # @return [String] Reply to client.
+    def memory_profile
+      if @client.user and @client.user.level < XFireDB::User::ADMIN
+        return "-Not authorized to execute MEMORY PROFILE"
+      end
+
+      action = @argv[1]
+      return "-Syntax error: #{usage}" if action.nil?
+
+      case action.upcase
+      when "START"
+        rate = PROFILE_RATE
+        if @argv[2]
+          rate = Integer(@argv[2]) rescue nil
+          return "-Syntax error: #{usage}" if rate.nil? or rate <= 0
+        end
+
+        return "-Heap profiler not available" unless XFireDB.db.heap_profile_start(rate)
+      when "STOP"
+        XFireDB.db.heap_profile_stop
+      when "DUMP"
+        name = @argv[2]
+        return "-Syntax error: #{usage}" if name.nil?
+        return "-Invalid profile name" unless name =~ PROFILE_NAME
+
+        dir = XFireDB.config.data_dir
+        return "-No data directory configured" if dir.nil?
+
+        path = File.join(File.expand_path(dir), name + PROFILE_SUFFIX)
+        return "-Heap profile could not be written" unless XFireDB.db.heap_profile_dump(path)
+      else
+        return "-Syntax error: #{usage}"
+      end
+
+      return "-OK"
+    end
+
+    # Get the command syntax.
+    #
+    # @return [String] Command syntax.
+    def usage
+      "MEMORY USAGE <key> [SAMPLES <count>] | MEMORY PROFILE START [<rate>] | " \
+        "MEMORY PROFILE STOP | MEMORY PROFILE DUMP <name>"
+    end
+  end
+
+  # SAVE handler
+  class CommandSave < XFireDB::Command
+    # Create a new SAVE handler.
+    #
+    # @param [Cluster] cluster Cluster object.
+    # @param [Client] client Client object.
+    def initialize(cluster, client)
+      super(cluster, "SAVE", client, "")
+    end
+
+    # Excute the command. A snapshot of the local node is written to the
+    # snapshot file before the command returns, blocking every other
+    # client in the meantime.
+    #
+    # @return [String] Reply to client.
+    def exec
+      if @client.user and @client.user.level < XFireDB::User::ADMIN
+        return "-Not authorized to execute SAVE"
+      end
+
+      path = XFireDB.config.snapshot_file
+      return "-No snapshot file configured" if path.nil?
+      return "-Snapshot could not be written" unless XFireDB.db.save(path)
+      return "-OK"
+    end
+  end
+
+  # BGSAVE handler
+  class CommandBgsave < XFireDB::Command
+    # Create a new BGSAVE handler.
+    #
+    # @param [Cluster] cluster Cluster object.
+    # @param [Client] client Client object.
+    def initialize(cluster, client)
+      super(cluster, "BGSAVE", client, "")
+    end
+
+    # Excute the command. A snapshot of the local node is written to the
+    # snapshot file by a child process, so the command returns right away.
+    #
+    # @return [String] Reply to client.
+    def exec
+      if @client.user and @client.user.level < XFireDB::User::ADMIN
+        return "-Not authorized to execute BGSAVE"
+      end
+
+      path = XFireDB.config.snapshot_file
+      return "-No snapshot file configured" if path.nil?
+      return "-Background save already in progress" unless XFireDB.db.bgsave(path)
+      return "-OK"
+    end
+  end
+
+  # INFO handler
+  class CommandInfo < XFireDB::Command
+    # Available INFO sections.
+    SECTIONS = ["memory", "bio", "snapshot"]
+
+    # Create a new INFO handler.
+    #
+    # @param [Cluster] cluster Cluster object.
+    # @param [Client] client Client object.
+    def initialize(cluster, client)
+      super(cluster, "INFO", client, "")
+    end
+
+    # Excute the command. The statistics of the local node are
+    # returned as a list of 'field:value' pairs.
+    #
+    # @return [Array] Reply to client.
+    def exec
+      section = @argv[0]
+      section = section.downcase unless section.nil?
+      return "-Unknown section: #{section}" unless section.nil? or SECTIONS.include? section
+
+      reply = Array.new
+      SECTIONS.each do |name|
+        next unless section.nil? or section == name
+        reply.push "+# #{name.capitalize}"
+        send("info_#{name}").each do |field, value|
+          reply.push "+#{field}:#{value}"
+        end
+      end
+
+      return reply
+    end
+
+    private
+    # Get the memory statistics.
+    #
+    # @return [Hash] Memory statistics.
+    def info_memory
+      stats = XFireDB.db.memory_stats
+      stats['mem_fragmentation_ratio'] = stats['mem_fragmentation_ratio'].round(2)
+      stats['maxmemory_policy'] = XFireDB.config.maxmemory_policy
+      stats
+    end
+
+    # Get the background I/O statistics.
+    #
+    # @return [Hash] Background I/O statistics.
+    def info_bio
+      stats = XFireDB.engine.bio_stats
+      stats['bio_enqueue_rate'] = stats['bio_enqueue_rate'].round(2)
+      stats['bio_dequeue_rate'] = stats['bio_dequeue_rate'].round(2)
+      stats
+    end
+
+    # Get the snapshot statistics.
+    #
+    # @return [Hash] Snapshot statistics.
+    def info_snapshot
+      stats = XFireDB.db.snapshot_stats
+      stats['snapshot_file'] = XFireDB.config.snapshot_file
+      stats
+    end
+  end
+end
+
@@ -141,12 +141,16 @@ module XFireDB
       return "-Syntax error: SADD <key> <set-key1> <set-key2> ..." unless key and @argv.length > 0
       return forward(key, "SADD #{key} #{@argv.map(&:quote).join(' ')}") unless @cluster.local_node.shard.include? key
 
-      XFireDB.db[key] = XFireDB::Set.new unless XFireDB.db[key].is_a? XFireDB::Set
+      unless XFireDB.db[key].is_a? XFireDB::Set
+        return "-OOM command not allowed when used memory > maxmemory" if XFireDB.db.store(key, XFireDB::Set.new).nil?
+      end
       set = XFireDB.db[key]
 
       rv = 0
       @argv.each do |hkey|
-        rv += 1 unless set.add(hkey).nil?
+        added = set.add(hkey)
+        return "-OOM command not allowed when used memory > maxmemory" if added == false
+        rv += 1 unless added.nil?
       end
 
       super(true)
@@ -279,8 +283,10 @@ module XFireDB
       return forward(key, "MADD #{key} #{hkey} \"#{data}\"") unless @cluster.local_node.shard.include? key
 
       db = XFireDB.db
-      db[key] = XFireDB::Hashmap.new unless db[key].is_a? XFireDB::Hashmap
-      db[key][hkey] = data
+      unless db[key].is_a? XFireDB::Hashmap
+        return "-OOM command not allowed when used memory > maxmemory" if db.store(key, XFireDB::Hashmap.new).nil?
+      end
+      return "-OOM command not allowed when used memory > maxmemory" if db[key].store(hkey, data) == false
       super(true)
       return "-OK"
     end
@@ -334,8 +340,10 @@ module XFireDB
       return forward(key, "LPUSH #{key} \"#{data}\"") unless @cluster.local_node.shard.include? key
 
       db = XFireDB.db
-      db[key] = XFireDB::List.new unless db[key].is_a? XFireDB::List
-      db[key].push data
+      unless db[key].is_a? XFireDB::List
+        return "-OOM command not allowed when used memory > maxmemory" if db.store(key, XFireDB::List.new).nil?
+      end
+      return "-OOM command not allowed when used memory > maxmemory" if db[key].push(data) == false
       super(true)
       return "-OK"
     end
@@ -538,7 +546,7 @@ module XFireDB
       return "-nil" unless list.is_a? XFireDB::List
 
       idx = idx.to_i
-      list[idx] = data
+      return "-OOM command not allowed when used memory > maxmemory" if list.set(idx, data) == false
       super(true)
       "-OK"
     end
@@ -561,15 +569,414 @@ module XFireDB
       key = @argv[0]
       data = @argv[1]
       db = XFireDB.db
+      ttl = nil
+
+      if @argv[2]
+        ttl = Integer(@argv[3]) rescue nil if @argv[2].upcase == "EX"
+        return "-Syntax `SET <key> \"<data>\" [EX <seconds>]'" unless ttl and ttl > 0
+      end
+
+      return "-Syntax `SET <key> \"<data>\" [EX <seconds>]'" unless key and data
+      unless @cluster.local_node.shard.include? key
+        return forward(key, "SET #{key} \"#{data}\"") if ttl.nil?
+        return forward(key, "SET #{key} \"#{data}\" EX #{ttl}")
+      end
 
-      return "-Syntax `SET <key> \"<data>\"'" unless key and data
-      return forward(key, "SET #{key} \"#{data}\"") unless @cluster.local_node.shard.include? key
-      db[key] = data
+      return "-OOM command not allowed when used memory > maxmemory" if db.store(key, data).nil?
+      db.expire(key, ttl * 1000) unless ttl.nil?
       super(true)
       return "-OK"
     end
   end
 
+  # PEXPIRE handler
+  class CommandPExpire < XFireDB::Command
+    # Create a new PEXPIRE handler.
+    #
+    # @param [Cluster] cluster Cluster object.
+    # @param [Client] client Client object.
+    # @param [String] cmd Command name.
+    def initialize(cluster, client, cmd = "PEXPIRE")
+      super(cluster, cmd, client)
+    end
+
+    # Excute the command.
+    #
+    # @return [String] Reply to client.
+    def exec
+      key = @argv[0]
+      ms = timeout
+
+      return "-Syntax error: #{usage}" unless key and ms
+      return forward(key, "#{@cmd} #{key} #{@argv[1]}") unless @cluster.local_node.shard.include? key
+
+      db = XFireDB.db
+      return "-nil" unless db.expire(key, ms)
+      super(false) if db.ttl(key) < -1
+      return "-OK"
+    end
+
+    protected
+    # Get the time out of the command.
+    #
+    # @return [Integer] The time out in milliseconds or nil if it is not
+    #   an integer.
+    def timeout
+      Integer(@argv[1]) rescue nil
+    end
+
+    # Get the command syntax.
+    #
+    # @return [String] Command syntax.
+    def usage
+      "PEXPIRE <key> <milliseconds>"
+    end
+  end
+
+  # EXPIRE handler
+  class CommandExpire < XFireDB::CommandPExpire
+    # Create a new EXPIRE handler.
+    #
+    # @param [Cluster] cluster Cluster object.
+    # @param [Client] client Client object.
+    def initialize(cluster, client)
+      super(cluster, client, "EXPIRE")
+    end
+
+    protected
+    # Get the time out of the command.
+    #
+    # @return [Integer] The time out in milliseconds or nil if it is not
+    #   an integer.
+    def timeout
+      secs = Integer(@argv[1]) rescue nil
+      secs * 1000 unless secs.nil?
+    end
+
+    # Get the command syntax.
+    #
+    # @return [String] Command syntax.
+    def usage
+      "EXPIRE <key> <seconds>"
+    end
+  end
+
+  # TTL handler
+  class CommandTTL < XFireDB::Command
+    # Create a new TTL handler.
+    #
+    # @param [Cluster] cluster Cluster object.
+    # @param [Client] client Client object.
+    def initialize(cluster, client)
+      super(cluster, "TTL", client)
+    end
+
+    # Excute the command. The reply is -1 for keys without a time out
+    # and -2 for keys that do not exist.
+    #
+    # @return [String] Reply to client.
+    def exec
+      key = @argv[0]
+
+      return "-Syntax error: TTL <key>" unless key
+      return forward(key, "TTL #{key}") unless @cluster.local_node.shard.include? key
+
+      ttl = XFireDB.db.ttl(key)
+      ttl = (ttl + 999) / 1000 if ttl >= 0
+      return "%" + ttl.to_s
+    end
+  end
+
+  # PERSIST handler
+  class CommandPersist < XFireDB::Command
+    # Create a new PERSIST handler.
+    #
+    # @param [Cluster] cluster Cluster object.
+    # @param [Client] client Client object.
+    def initialize(cluster, client)
+      super(cluster, "PERSIST", client)
+    end
+
+    # Excute the command.
+    #
+    # @return [String] Reply to client.
+    def exec
+      key = @argv[0]
+
+      return "-Syntax error: PERSIST <key>" unless key
+      return forward(key, "PERSIST #{key}") unless @cluster.local_node.shard.include? key
+      return "-nil" unless XFireDB.db.persist(key)
+      return "-OK"
+    end
+  end
+
+  # INCRBY handler
+  class CommandIncrBy < XFireDB::Command
+    # Create a new INCRBY handler.
+    #
+    # @param [Cluster] cluster Cluster object.
+    # @param [Client] client Client object.
+    # @param [String] cmd Command name.
+    def initialize(cluster, client, cmd = "INCRBY")
+      super(cluster, cmd, client)
+    end
+
+    # Excute the command.
+    #
+    # @return [String] Reply to client.
+    def exec
+      key = @argv[0]
+      delta = increment
+
+      return "-Syntax error: #{usage}" unless key and delta
+      return forward(key, "INCRBY #{key} #{delta}") unless @cluster.local_node.shard.include? key
+
+      rv = XFireDB.db.incr(key, delta)
+      return "-Value is not an integer or out of range" if rv.nil?
+      super(true)
+      return "%" + rv.to_s
+    end
+
+    protected
+    # Get the increment of the command.
+    #
+    # @return [Integer] The increment or nil if it is not an integer.
+    def increment
+      Integer(@argv[1]) rescue nil
+    end
+
+    # Get the command syntax.
+    #
+    # @return [String] Command syntax.
+    def usage
+      "INCRBY <key> <increment>"
+    end
+  end
+
+  # INCR handler
+  class CommandIncr < XFireDB::CommandIncrBy
+    # Create a new INCR handler.
+    #
+    # @param [Cluster] cluster Cluster object.
+    # @param [Client] client Client object.
+    def initialize(cluster, client)
+      super(cluster, client, "INCR")
+    end
+
+    protected
+    # Get the increment of the command.
+    #
+    # @return [Integer] The increment.
+    def increment
+      1
+    end
+
+    # Get the command syntax.
+    #
+    # @return [String] Command syntax.
+    def usage
+      "INCR <key>"
+    end
+  end
+
+  # DECR handler
+  class CommandDecr < XFireDB::CommandIncrBy
+    # Create a new DECR handler.
+    #
+    # @param [Cluster] cluster Cluster object.
+    # @param [Client] client Client object.
+    def initialize(cluster, client)
+      super(cluster, client, "DECR")
+    end
+
+    protected
+    # Get the increment of the command.
+    #
+    # @return [Integer] The increment.
+    def increment
+      -1
+    end
+
+    # Get the command syntax.
+    #
+    # @return [String] Command syntax.
+    def usage
+      "DECR <key>"
+    end
+  end
+
+  # INCRBYFLOAT handler
+  class CommandIncrByFloat < XFireDB::Command
+    # Create a new INCRBYFLOAT handler.
+    #
+    # @param [Cluster] cluster Cluster object.
+    # @param [Client] client Client object.
+    def initialize(cluster, client)
+      super(cluster, "INCRBYFLOAT", client)
+    end
+
+    # Excute the command.
+    #
+    # @return [String] Reply to client.
+    def exec
+      key = @argv[0]
+      delta = Float(@argv[1]) rescue nil
+
+      return "-Syntax error: INCRBYFLOAT <key> <increment>" unless key and delta
+      return forward(key, "INCRBYFLOAT #{key} #{@argv[1]}") unless @cluster.local_node.shard.include? key
+
+      rv = XFireDB.db.incr_float(key, delta)
+      return "-Value is not a number or out of range" if rv.nil?
+      super(true)
+      return "+" + XFireDB.db[key]
+    end
+  end
+
+  # HINCRBY handler
+  class CommandHIncrBy < XFireDB::Command
+    # Create a new HINCRBY handler.
+    #
+    # @param [Cluster] cluster Cluster object.
+    # @param [Client] client Client object.
+    def initialize(cluster, client)
+      super(cluster, "HINCRBY", client)
+    end
+
+    # Excute the command.
+    #
+    # @return [String] Reply to client.
+    def exec
+      key = @argv[0]
+      hkey = @argv[1]
+      delta = Integer(@argv[2]) rescue nil
+
+      return "-Syntax error: HINCRBY <key> <map-key> <increment>" unless key and hkey and delta
+      return forward(key, "HINCRBY #{key} #{hkey.quote} #{delta}") unless @cluster.local_node.shard.include? key
+
+      db = XFireDB.db
+      if db[key].nil?
+        return "-OOM command not allowed when used memory > maxmemory" if db.store(key, XFireDB::Hashmap.new).nil?
+      end
+      map = db[key]
+      return "-nil" unless map.is_a? XFireDB::Hashmap
+
+      rv = map.incr(hkey, delta)
+      return "-OOM command not allowed when used memory > maxmemory" if rv == false
+      return "-Value is not an integer or out of range" if rv.nil?
+      super(true)
+      return "%" + rv.to_s
+    end
+  end
+
+  # APPEND handler
+  class CommandAppend < XFireDB::Command
+    # Create a new APPEND handler.
+    #
+    # @param [Cluster] cluster Cluster object.
+    # @param [Client] client Client object.
+    def initialize(cluster, client)
+      super(cluster, "APPEND", client)
+    end
+
+    # Excute the command.
+    #
+    # @return [String] Reply to client.
+    def exec
+      key = @argv[0]
+      data = @argv[1]
+
+      return "-Syntax error: APPEND <key> \"<data>\"" unless key and data
+      return forward(key, "APPEND #{key} \"#{data}\"") unless @cluster.local_node.shard.include? key
+
+      rv = XFireDB.db.append(key, data)
+      return "-nil" if rv.nil?
+      super(true)
+      return "%" + rv.to_s
+    end
+  end
+
+  # SETRANGE handler
+  class CommandSetRange < XFireDB::Command
+    # Create a new SETRANGE handler.
+    #
+    # @param [Cluster] cluster Cluster object.
+    # @param [Client] client Client object.
+    def initialize(cluster, client)
+      super(cluster, "SETRANGE", client)
+    end
+
+    # Excute the command.
+    #
+    # @return [String] Reply to client.
+    def exec
+      key = @argv[0]
+      offset = Integer(@argv[1]) rescue nil
+      data = @argv[2]
+
+      return "-Syntax error: SETRANGE <key> <offset> \"<data>\"" unless key and offset and data
+      return "-Offset is out of range" if offset < 0
+      return forward(key, "SETRANGE #{key} #{offset} \"#{data}\"") unless @cluster.local_node.shard.include? key
+
+      rv = XFireDB.db.setrange(key, offset, data)
+      return "-String exceeds maximum allowed size" if rv == false
+      return "-nil" if rv.nil?
+      super(true)
+      return "%" + rv.to_s
+    end
+  end
+
+  # GETRANGE handler
+  class CommandGetRange < XFireDB::Command
+    # Create a new GETRANGE handler.
+    #
+    # @param [Cluster] cluster Cluster object.
+    # @param [Client] client Client object.
+    def initialize(cluster, client)
+      super(cluster, "GETRANGE", client)
+    end
+
+    # Excute the command.
+    #
+    # @return [String] Reply to client.
+    def exec
+      key = @argv[0]
+      first = Integer(@argv[1]) rescue nil
+      last = Integer(@argv[2]) rescue nil
+
+      return "-Syntax error: GETRANGE <key> <start> <end>" unless key and first and last
+      return forward(key, "GETRANGE #{key} #{first} #{last}") unless @cluster.local_node.shard.include? key
+
+      rv = XFireDB.db.getrange(key, first, last)
+      return "-nil" if rv.nil?
+      return "+" + rv
+    end
+  end
+
+  # STRLEN handler
+  class CommandStrlen < XFireDB::Command
+    # Create a new STRLEN handler.
+    #
+    # @param [Cluster] cluster Cluster object.
+    # @param [Client] client Client object.
+    def initialize(cluster, client)
+      super(cluster, "STRLEN", client)
+    end
+
+    # Excute the command.
+    #
+    # @return [String] Reply to client.
+    def exec
+      key = @argv[0]
+
+      return "-Syntax error: STRLEN <key>" unless key
+      return forward(key, "STRLEN #{key}") unless @cluster.local_node.shard.include? key
+
+      rv = XFireDB.db.strlen(key)
+      return "%0" if rv.nil?
+      return "%" + rv.to_s
+    end
+  end
+
   # GET handler
   class CommandGet < XFireDB::Command
     # Create a new GET handler.
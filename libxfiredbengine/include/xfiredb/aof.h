@@ -0,0 +1,99 @@
+/*
+ *  Append-only operation log
+ *  Copyright (C) 2015   Michel Megens <dev@michelmegens.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @addtogroup aof
+ * @{
+ */
+
+#ifndef __XFIREDB_AOF_H__
+#define __XFIREDB_AOF_H__
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include <xfiredb/xfiredb.h>
+#include <xfiredb/types.h>
+#include <xfiredb/os.h>
+#include <xfiredb/database.h>
+#include <xfiredb/bio.h>
+
+/**
+ * @brief Policies for syncing the log to disk.
+ */
+typedef enum {
+	AOF_FSYNC_ALWAYS, //!< Sync on every commit.
+	AOF_FSYNC_EVERYSEC, //!< Sync once a second, from aof_sync.
+	AOF_FSYNC_NO, //!< Leave syncing to the operating system.
+} aof_fsync_t;
+
+/**
+ * @brief Append-only log.
+ */
+struct aof {
+	char *path; //!< Path of the log.
+	char *rewrite_path; //!< Path of the log written by a rewrite.
+	char *incr_path; //!< Path of the records appended during a rewrite.
+	FILE *file; //!< Active log.
+	/**
+	 * @brief Records appended during a rewrite.
+	 *
+	 * While a rewrite is in progress, records are appended to both the
+	 * active log and this file, which is added to the end of the new log
+	 * once the rewrite finished. \p NULL if there is no rewrite in progress.
+	 */
+	FILE *rewrite;
+	pid_t child; //!< Process writing the new log, 0 if none.
+	int rewrite_pipe; //!< Pipe the child reports its record count on.
+	time_t rewrite_retry; //!< Time stamp after which a failed rewrite is retried.
+
+	aof_fsync_t fsync; //!< Sync policy.
+	bool dirty; //!< Set when data was written since the last sync.
+	u64 records; //!< Number of records in the active log.
+	u64 size; //!< Size of the active log in bytes.
+	u64 rewrite_records; //!< Number of records appended during the rewrite.
+	u64 rewrite_size; //!< Size of the records appended during the rewrite.
+	u64 base_size; //!< Size of the active log after its last rewrite.
+
+	xfiredb_mutex_t lock; //!< Log lock.
+};
+
+CDECL
+extern struct aof *aof_create(const char *path);
+extern void aof_destroy(struct aof *aof);
+extern void aof_set_fsync(struct aof *aof, aof_fsync_t policy);
+extern int aof_append(struct aof *aof, bio_operation_t op, const char *key,
+		const char *arg, const char *data, size_t len);
+extern int aof_commit(struct aof *aof);
+extern int aof_sync(struct aof *aof);
+extern void aof_clear(struct aof *aof);
+extern bool aof_rewrite_needed(struct aof *aof);
+extern int aof_bgrewrite(struct aof *aof, struct database *db);
+extern void aof_rewrite_wait(struct aof *aof);
+extern long aof_size(struct aof *aof);
+extern int aof_load(struct aof *aof,
+		void (*hook)(int argc, char **rows, size_t *lens, char **cols));
+extern int aof_load_key(struct aof *aof, char *key,
+		void (*hook)(int argc, char **rows, size_t *lens, char **cols));
+CDECL_END
+
+#endif
+
+/** @} */
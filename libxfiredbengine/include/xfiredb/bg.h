@@ -38,6 +38,14 @@ struct job {
 	char *name; //!< Name of the job ('thread').
 	time_t stamp; //!< Creation time stamp.
 	bool done; //!< Indicator if the job is done or not.
+	/**
+	 * @brief Signal indicator.
+	 *
+	 * Set when the job is signalled, so a signal that arrives while the
+	 * handler is running isn't lost.
+	 */
+	bool pending;
+	time_t interval; //!< Run interval in milliseconds, 0 if signal driven.
 
 	void (*handle)(void *arg); //!< Job handler.
 	void *arg; //!< Argument passed to handle.
@@ -52,7 +60,11 @@ extern void bg_processes_exit(void);
 
 extern struct job *bg_process_create(const char *name, 
 			void (*handle)(void *arg), void *arg);
+extern struct job *bg_process_create_periodic(const char *name,
+			void (*handle)(void *arg), void *arg, time_t interval);
 extern int bg_process_signal(const char *name);
+extern void bg_job_signal(struct job *job);
+extern void bg_job_set_interval(struct job *job, time_t interval);
 extern int bg_process_stop(const char *name);
 CDECL_END
 
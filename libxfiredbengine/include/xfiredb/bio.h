@@ -29,17 +29,7 @@
 #include <xfiredb/dict.h>
 #include <xfiredb/os.h>
 #include <xfiredb/database.h>
-
-struct bio_q;
-
-struct bio_q_head {
-	struct bio_q *next,
-		     *tail;
-	struct job *job;
-
-	xfiredb_spinlock_t lock;
-	long size;
-};
+#include <xfiredb/disk.h>
 
 /**
  * @brief BIO operation type.
@@ -48,6 +38,7 @@ typedef enum {
 	STRING_ADD, //!< Add a string.
 	STRING_DEL, //!< Delete a string.
 	STRING_UPDATE, //!< Update a string.
+	STRING_APPEND, //!< Append to a string.
 
 	LIST_ADD, //!< Add a list (entry).
 	LIST_DEL, //!< Delete a list (entry).
@@ -59,14 +50,117 @@ typedef enum {
 
 	SET_ADD, //!<  Add a set key.
 	SET_DEL, //!< Delete a set key.
+
+	DB_CLEAR, //!< Remove every entry from the disk.
+	DB_SAVE, //!< Every entry has been queued after a DB_CLEAR.
 } bio_operation_t;
 
 /**
- * @brief Back ground I/O queue.
+ * @brief Number of BIO operation types.
+ */
+#define BIO_OPERATIONS (DB_SAVE + 1)
+
+/**
+ * @brief Persistence engines.
+ */
+typedef enum {
+	BIO_ENGINE_DISK, //!< SQLite database, see the disk group.
+	BIO_ENGINE_AOF, //!< Append-only log, see the aof group.
+} bio_engine_t;
+
+/**
+ * @brief Policy applied when the BIO queue is full.
+ */
+typedef enum {
+	BIO_POLICY_BLOCK, //!< Wait until the worker has made room.
+	/**
+	 * @brief Drop the change.
+	 *
+	 * The disk misses the change until the entry is written again.
+	 */
+	BIO_POLICY_SHED,
+	/**
+	 * @brief Drop changes until the next snapshot.
+	 *
+	 * Changes are dropped from the first full queue on, and the disk is
+	 * rewritten as a whole by bio_snapshot_begin and its caller.
+	 */
+	BIO_POLICY_DEGRADE,
+} bio_policy_t;
+/**
+ * @brief Number of records in the BIO ring. Has to be a power of two.
+ */
+#define BIO_RING_SIZE 4096
+
+/**
+ * @brief Size of the inline payload buffer of a BIO record.
+ *
+ * Chosen to keep a record at 128 bytes on 64-bit systems. Payloads that
+ * don't fit are allocated separately.
+ */
+#define BIO_INLINE_SIZE 72
+
+/**
+ * @brief Size of a buffer holding a formatted list entry ID.
+ */
+#define BIO_ID_SIZE 24
+
+/**
+ * @brief Sequence number returned for a record that was dropped.
+ *
+ * Returned by bio_queue_add when the queue is full and the policy set
+ * with bio_set_limits sheds the record. Zero is returned instead when
+ * persistency is disabled.
+ */
+#define BIO_SEQ_DROPPED (~0UL)
+
+/**
+ * @brief Number of persistency levels that write to disk.
+ *
+ * Level 3 disables persistency altogether.
+ */
+#define BIO_PERSIST_LEVELS 3
+
+/**
+ * @brief Group commit limits.
+ *
+ * The BIO worker writes queued records in transactions. A transaction is
+ * committed once it holds \p size records, or once it has been open for
+ * \p latency milliseconds, whichever comes first.
+ */
+struct bio_batch {
+	unsigned int size; //!< Maximum number of records per transaction.
+	unsigned int latency; //!< Maximum transaction duration in milliseconds.
+};
+
+/**
+ * @brief Flush policy.
+ *
+ * The BIO worker is woken up once \p ops records have been queued since
+ * it last ran, and at least every \p interval milliseconds.
+ */
+struct bio_flush {
+	unsigned int ops; //!< Number of queued records that trigger a flush.
+	unsigned int interval; //!< Maximum time between two flushes in milliseconds.
+};
+
+/**
+ * @brief Back ground I/O record.
+ *
+ * Records live in the slots of the BIO ring. The key, argument and data
+ * are copied into the inline buffer of the slot when they fit.
  */
 struct bio_q {
-	struct bio_q *next, //!< Next pointer.
-		     *prev; //!< Previous pointer.
+	/**
+	 * @brief Ring sequence number.
+	 *
+	 * Equals the ring position when the slot is free, and the position
+	 * plus one once a producer has published a record in it.
+	 */
+	volatile unsigned long seq;
+	bio_operation_t operation; //!< Type of operation.
+	unsigned int flags; //!< Record flags, used by the BIO worker.
+	time_t stamp; //!< Time the record was queued, in milliseconds.
 
 	char *key; //!< Entry key.
 	/**
@@ -74,23 +168,149 @@ struct bio_q {
 	 *
 	 * The contents of \p arg vary, depending on which
 	 * kind of entry is being altered or added. In case
-	 * of lists, the \p arg points to the data that is
-	 * currently in the database. In case of hashmaps, it
-	 * contains the key within the hashmap.
+	 * of lists, the \p arg contains the position ID of
+	 * the entry. In case of hashmaps, it contains the key
+	 * within the hashmap.
 	 */
 	char *arg;
 	char *newdata; //!< New data, in case we are adding or updating.
+	size_t len; //!< Length of \p newdata in bytes.
+	char buf[BIO_INLINE_SIZE]; //!< Inline storage for the strings above.
+};
 
-	bio_operation_t operation; //!< Type of operation.
+/**
+ * @brief Record is superseded by a later record for the same entry.
+ */
+#define BIO_SKIP_FLAG 1
+
+/**
+ * @brief Disk statistics of a single BIO operation type.
+ */
+struct bio_op_stats {
+	u64 calls; //!< Number of records written.
+	u64 usec; //!< Total time spent writing, in microseconds.
+	u64 max_usec; //!< Slowest write, in microseconds.
+};
+
+/**
+ * @brief BIO queue statistics.
+ * @see bio_get_stats
+ */
+struct bio_stats {
+	unsigned long depth; //!< Number of queued records.
+	size_t bytes; //!< Payload bytes queued.
+	unsigned long max_depth; //!< Queue depth limit.
+	size_t max_bytes; //!< Queued bytes limit, zero if unlimited.
+	bio_policy_t policy; //!< Policy applied when the queue is full.
+	bool degraded; //!< Changes are being dropped until the next snapshot.
+
+	u64 enqueued; //!< Total number of queued records.
+	u64 dequeued; //!< Total number of records taken off the queue.
+	u64 written; //!< Records written to disk, after coalescing.
+	u64 shed; //!< Records dropped because the queue was full.
+	u64 blocked; //!< Number of times a writer waited for room.
+	double enqueue_rate; //!< Records queued per second.
+	double dequeue_rate; //!< Records taken off the queue per second.
+	time_t oldest; //!< Age of the oldest queued record in milliseconds.
+
+	struct bio_op_stats ops[BIO_OPERATIONS]; //!< Disk statistics per operation.
+};
+
+/**
+ * @brief Coalescing table slot.
+ */
+struct bio_coalesce_slot {
+	unsigned long gen; //!< Worker pass the slot was last used in.
+	struct bio_q *entry; //!< Any record of the entry the slot belongs to.
+	struct bio_q *last; //!< Last record of the entry that is still written.
+};
+
+/**
+ * @brief Back ground I/O queue.
+ *
+ * Bounded multi-producer, single-consumer ring of BIO records. Producers
+ * claim a slot by advancing \p head, the BIO worker consumes records at
+ * \p tail. Both positions only ever increase.
+ */
+struct bio_q_head {
+	struct bio_q *ring; //!< Record slots.
+	unsigned long mask; //!< Number of slots minus one.
+	struct job *job; //!< BIO worker.
+	struct job *checkpoint; //!< WAL checkpoint job.
+	volatile time_t last_checkpoint; //!< Time stamp of the last WAL checkpoint.
+	struct bio_coalesce_slot *coalesce; //!< Coalescing table.
+	unsigned long gen; //!< Current worker pass.
+	/**
+	 * @brief Record each pending record depends on.
+	 *
+	 * A record that is superseded by a later one is only durable once
+	 * that later record has been committed.
+	 */
+	unsigned long *resolve;
+
+	xfiredb_mutex_t lock; //!< Protects \p durable and the rate samples.
+	xfiredb_cond_t durable_cond; //!< Signalled when \p durable advances.
+
+	unsigned long max_depth; //!< Queue depth limit.
+	size_t max_bytes; //!< Queued bytes limit, zero if unlimited.
+	bio_policy_t policy; //!< Policy applied when the queue is full.
+	volatile bool degraded; //!< Changes are dropped until the next snapshot.
+	volatile bool snapshot; //!< A snapshot is being queued.
+	bool rewriting; //!< The worker is writing a snapshot to the disk.
+
+	u64 written; //!< Records written to disk.
+	struct bio_op_stats ops[BIO_OPERATIONS]; //!< Per operation disk statistics.
+	volatile u64 shed; //!< Records dropped.
+	volatile u64 blocked; //!< Number of times a writer waited for room.
+
+	time_t sample_time; //!< Time of the last rate sample.
+	unsigned long sample_head; //!< \p head at the last rate sample.
+	unsigned long sample_tail; //!< \p tail at the last rate sample.
+	double enqueue_rate; //!< Enqueue rate at the last rate sample.
+	double dequeue_rate; //!< Dequeue rate at the last rate sample.
+
+	volatile unsigned long head __cacheline_aligned; //!< Enqueue position.
+	volatile size_t bytes; //!< Payload bytes queued.
+	volatile unsigned long unflushed; //!< Records queued since the last wake up.
+	volatile bool running; //!< The worker is writing records.
+	volatile unsigned long tail __cacheline_aligned; //!< Dequeue position.
+	/**
+	 * @brief Durable watermark.
+	 *
+	 * Every record with a sequence number up to and including this
+	 * value is on disk.
+	 */
+	volatile unsigned long durable;
 };
 
 CDECL
 extern void bio_init(void);
 extern void bio_exit(void);
-extern void bio_queue_add(char *key, char *arg,
-	       		char *newdata, bio_operation_t op);
+extern unsigned long bio_queue_add(const char *key, const char *arg,
+	       		const char *newdata, bio_operation_t op);
+extern unsigned long bio_queue_add_len(const char *key, const char *arg,
+		const void *newdata, size_t len, bio_operation_t op);
 extern void dbg_bio_queue(void);
 extern void bio_sync(void);
+extern unsigned long bio_durable(void);
+extern void bio_wait(unsigned long seq);
+extern void bio_set_limits(unsigned long depth, size_t bytes, bio_policy_t policy);
+extern void bio_get_stats(struct bio_stats *stats);
+extern const char *bio_op_name(bio_operation_t op);
+extern bool bio_degraded(void);
+extern void bio_snapshot_begin(void);
+extern void bio_snapshot_end(void);
+extern int bio_set_batch(int level, unsigned int size, unsigned int latency);
+extern void bio_get_batch(int level, struct bio_batch *batch);
+extern int bio_set_flush(int level, unsigned int ops, unsigned int interval);
+extern int bio_set_profile(int level, const struct disk_profile *profile);
+extern int bio_set_aof_fsync(int policy);
+extern bool bio_rewrite_needed(void);
+extern int bio_bgrewrite(struct database *db);
+extern void bio_apply(struct disk *d, bio_operation_t op, const char *key,
+		const char *arg, const char *data, size_t len);
+extern void bio_get_profile(int level, struct disk_profile *profile);
+extern void bio_get_flush(int level, struct bio_flush *flush);
 CDECL_END
 
 #endif
@@ -21,6 +21,8 @@
 
 #define __compiler_offsetof(a,b) __builtin_offsetof(a,b)
 #define barrier() __sync_synchronize()
+#define __noinline __attribute__((noinline))
+#define __cacheline_aligned __attribute__((aligned(XFIREDB_CACHE_LINE)))
 
 #define likely(x) __builtin_expect(!!(x), 1)
 #define unlikel(x) __builtin_expect(!!(x), 0)
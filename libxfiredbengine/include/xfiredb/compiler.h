@@ -44,6 +44,18 @@
 #define barrier() __asm__ __volatile("", ::: "memory")
 #endif
 
+#ifndef __noinline
+#define __noinline
+#endif
+
+#ifndef XFIREDB_CACHE_LINE
+#define XFIREDB_CACHE_LINE 64
+#endif
+
+#ifndef __cacheline_aligned
+#define __cacheline_aligned
+#endif
+
 #ifndef likely
 #define likely(x) x
 #endif
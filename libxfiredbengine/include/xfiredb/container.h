@@ -48,11 +48,15 @@ typedef enum {
 
 /**
  * @brief Container data structure.
+ *
+ * Every member of the data union starts with its base object, which also
+ * holds the container type. Containers are allocated at the size of their
+ * concrete type (see container_size), so only the member matching the
+ * container type may be accessed.
  */
 struct container {
-	container_type_t type; //!< Container type.
-
 	union {
+		struct object obj; //!< Base object.
 		struct list_head list; //!< List head.
 		struct string string; //!< String.
 		struct hashmap map; //!< Hashmap.
@@ -61,6 +65,16 @@ struct container {
 };
 
 CDECL
+/**
+ * @brief Get the type of a container.
+ * @param c Container to get the type of.
+ * @return The type of \p c.
+ */
+static inline container_type_t container_type(struct container *c)
+{
+	return (container_type_t)c->data.obj.type;
+}
+
 /**
  * @brief Check the type of a container.
  * @param c Container to check.
@@ -69,14 +83,16 @@ CDECL
  */
 static inline bool container_check_type(struct container *c, container_type_t type)
 {
-	return c->type == type ? true : false;
+	return container_type(c) == type ? true : false;
 }
 
+extern size_t container_size(container_type_t type);
 extern void container_init(struct container *c, container_type_t type);
 extern void *container_get_data(struct container *c);
 extern void container_destroy(struct container *c);
 extern struct container *container_alloc(container_type_t type);
 extern struct object *container_to_object(struct container *c);
+extern size_t container_mem_usage(struct container *c, size_t samples);
 CDECL_END
 
 #endif
@@ -26,6 +26,7 @@
 
 CDECL
 extern u16 xfiredb_crc16(const char *str);
+extern u32 xfiredb_crc32(u32 crc, const void *buf, size_t len);
 CDECL_END
 
 #endif
@@ -28,20 +28,48 @@
 #include <xfiredb/types.h>
 #include <xfiredb/dict.h>
 #include <xfiredb/container.h>
+#include <xfiredb/expire.h>
 
 /**
  * @brief Database data type.
  */
 typedef union entry_data db_data_t;
 
+/**
+ * @brief Eviction policy type definition.
+ */
+typedef enum {
+	DB_EVICT_NONE, //!< Refuse writes once the memory budget is exceeded.
+	DB_EVICT_ALLKEYS_LRU, //!< Evict the least recently used keys.
+	DB_EVICT_ALLKEYS_LFU, //!< Evict the least frequently used keys.
+	DB_EVICT_VOLATILE_TTL, //!< Evict the volatile keys closest to expiry.
+} db_evict_policy_t;
+
 /**
  * @brief Database type.
  */
 struct database {
 	char *name; //!< Database name.
 	struct dict *container; //!< Data container.
+	struct dict *expires; //!< Expiry time stamps of volatile keys.
+	struct expire_heap expire_queue; //!< Active expiry queue.
+	size_t maxmemory; //!< Memory budget in bytes, 0 if unlimited.
+	db_evict_policy_t policy; //!< Eviction policy.
+	/**
+	 * @brief Expired key handler.
+	 *
+	 * Called with the removed data after a key expired or was evicted.
+	 * The handler takes ownership of the data.
+	 */
+	void (*expire_hook)(struct database *db, const char *key, db_data_t *data);
 };
 
+#define DB_TTL_NONE    -1 //!< Key exists but doesn't expire.
+#define DB_TTL_MISSING -2 //!< Key doesn't exist.
+
+#define DB_EVICT_SAMPLES 5 //!< Number of keys sampled per eviction.
+#define DB_EVICT_BATCH  32 //!< Maximum number of evictions per write.
+
 #define db_iterator dict_iterator //!< Iterator typedef
 #define db_entry dict_entry //!< Data entry typedef
 
@@ -83,6 +111,17 @@ extern int db_update(struct database *db,
 extern int db_store(struct database *db, const char *key, struct container *c);
 extern int db_delete(struct database *db, const char *key, db_data_t *data);
 extern int db_lookup(struct database *db, const char *key, db_data_t *data);
+
+extern int db_set_expiry(struct database *db, const char *key, time_t when);
+extern int db_persist(struct database *db, const char *key);
+extern s64 db_ttl(struct database *db, const char *key);
+extern size_t db_key_mem_usage(struct database *db, const char *key);
+extern int db_expire_cycle(struct database *db, int max);
+extern int db_set_maxmemory(struct database *db, size_t maxmemory,
+		const char *policy);
+extern int db_evict_if_needed(struct database *db);
+extern void db_set_expire_hook(struct database *db,
+		void (*hook)(struct database *db, const char *key, db_data_t *data));
 CDECL_END
 
 #endif
@@ -96,7 +96,8 @@ struct dict {
 	bool rehashing; //!< Rehashing boolean.
 	int iterators; //!< Number of safe iterators.
 
-	xfiredb_mutex_t lock; //!< Dictionary lock.
+	xfiredb_rwlock_t lock; //!< Dictionary lock.
+	xfiredb_fast_mutex_t rehash_lock; //!< Rehash worker lock.
 	xfiredb_cond_t rehash_condi; //!< Rehashing condition.
 	struct thread *worker; //!< Rehashing worker.
 };
@@ -128,6 +129,7 @@ extern int raw_dict_add(struct dict *d, const char *key,
 			void *data, dict_type_t t, size_t size);
 extern int dict_delete(struct dict *d, const char *key, union entry_data *data, int free);
 extern int dict_lookup(struct dict *d, const char *key, union entry_data *data, size_t *size);
+extern int dict_sample(struct dict *d, char **keys, union entry_data *data, int num);
 extern int dict_update(struct dict *d, const char *key, void *data, dict_type_t type);
 extern int raw_dict_update(struct dict *d, const char *key,
 				void *data, dict_type_t type, size_t l);
@@ -41,6 +41,53 @@
 #define TABLE_TYPE_IDX 2
 #define TABLE_DATA_IDX 3
 
+/**
+ * @brief Cached disk statements.
+ */
+typedef enum {
+	DISK_STMT_BEGIN, //!< Start a transaction.
+	DISK_STMT_COMMIT, //!< Commit a transaction.
+	DISK_STMT_STORE, //!< Store a string, hashmap node or set key.
+	DISK_STMT_STORE_LIST, //!< Store a list entry.
+	DISK_STMT_UPDATE_HM, //!< Update a hashmap node.
+	DISK_STMT_UPDATE_LIST, //!< Update a list entry.
+	DISK_STMT_UPDATE_STRING, //!< Update a string.
+	DISK_STMT_APPEND_STRING, //!< Append to a string.
+	DISK_STMT_DELETE_STRING, //!< Delete a string.
+	DISK_STMT_DELETE_LIST, //!< Delete a list entry.
+	DISK_STMT_DELETE_HM, //!< Delete a hashmap node.
+	DISK_STMT_DELETE_SET, //!< Delete a set key.
+	DISK_STMT_LOAD_KEY, //!< Load all rows of a key.
+	DISK_STMT_LOAD_ALL, //!< Load all rows.
+	DISK_STMT_SIZE, //!< Get the number of rows.
+	DISK_STMT_NUM, //!< Number of cached statements.
+} disk_stmt_t;
+
+/**
+ * @brief Disk synchronisation modes.
+ */
+typedef enum {
+	DISK_SYNC_OFF, //!< Leave flushing to the operating system.
+	DISK_SYNC_NORMAL, //!< Sync the WAL at checkpoints only.
+	DISK_SYNC_FULL, //!< Sync the WAL on every commit.
+} disk_sync_t;
+
+/**
+ * @brief Disk tuning profile.
+ * @see disk_set_profile
+ */
+struct disk_profile {
+	disk_sync_t sync; //!< Synchronisation mode.
+	unsigned int cache_size; //!< Page cache size in KiB.
+	unsigned long mmap_size; //!< Memory mapped part of the database in bytes.
+	/**
+	 * @brief WAL checkpoint interval in milliseconds.
+	 *
+	 * Zero leaves checkpoints to SQLite.
+	 */
+	unsigned int checkpoint;
+};
+
 /**
  * @brief Persistent disk structure.
  */
@@ -53,6 +100,13 @@ struct disk {
 	bool initialised; //!< Initialisation status.
 
 	xfiredb_mutex_t lock; //!< Disk lock.
+	/**
+	 * @brief Prepared statements.
+	 *
+	 * Prepared on first use and kept until the disk is destroyed, so
+	 * writes don't have to be parsed and planned again.
+	 */
+	void *stmts[DISK_STMT_NUM];
 };
 
 CDECL
@@ -61,18 +115,30 @@ extern void disk_clear(struct disk *d);
 extern struct disk *disk_create(const char *path);
 extern void disk_destroy(struct disk *disk);
 extern void disk_dump(struct disk *d, FILE *out);
+extern int disk_set_profile(struct disk *d, const struct disk_profile *profile);
+extern int disk_checkpoint(struct disk *d);
+extern int disk_begin(struct disk *d);
+extern int disk_commit(struct disk *d);
 extern int disk_load_key(struct disk *d, char *key,
-		void (*hook)(int argc, char **rows, char **colnames));
+		void (*hook)(int argc, char **rows, size_t *lens, char **colnames));
 extern int disk_load(struct disk *disk,
-		void (*hook)(int argc, char **rows, char **colnames));
+		void (*hook)(int argc, char **rows, size_t *lens, char **colnames));
 
 extern int disk_store_list(struct disk *d, char *key, struct list_head *lh);
-extern int disk_store_list_entry(struct disk *d, char *key, char *data);
-extern int disk_delete_list(struct disk *d, char *key, char *data);
-extern int disk_update_list(struct disk *d, char *key, char *data, char *newdata);
+extern int disk_store_list_entry(struct disk *d, char *key, s64 id, char *data);
+extern int disk_store_list_entry_len(struct disk *d, char *key, s64 id,
+		const char *data, size_t len);
+extern int disk_delete_list(struct disk *d, char *key, s64 id);
+extern int disk_update_list(struct disk *d, char *key, s64 id, char *newdata);
+extern int disk_update_list_len(struct disk *d, char *key, s64 id,
+		const char *newdata, size_t len);
 
 extern int disk_store_string(struct disk *d, char *key, char *data);
+extern int disk_store_string_len(struct disk *d, char *key, const char *data, size_t len);
 extern int disk_update_string(struct disk *d, char *key, void *data);
+extern int disk_update_string_len(struct disk *d, char *key, const char *data, size_t len);
+extern int disk_append_string(struct disk *d, char *key, char *data);
+extern int disk_append_string_len(struct disk *d, char *key, const char *data, size_t len);
 extern int disk_delete_string(struct disk *d, char *key);
 
 extern int disk_store_set_key(struct disk *d, char *key, char *skey);
@@ -80,8 +146,12 @@ extern int disk_delete_set_key(struct disk *d, char *key, char *skey);
 
 extern int disk_store_hm(struct disk *d, char *key, struct hashmap *map);
 extern int disk_update_hm(struct disk *d, char *key, char *nodekey, char *data);
+extern int disk_update_hm_len(struct disk *d, char *key, char *nodekey,
+		const char *data, size_t len);
 extern int disk_delete_hashmapnode(struct disk *d, char *key, char *nodekey);
 extern int disk_store_hm_node(struct disk *d, char *key, char *nodekey, char *data);
+extern int disk_store_hm_node_len(struct disk *d, char *key, char *nodekey,
+		const char *data, size_t len);
 
 #endif
 
@@ -0,0 +1,69 @@
+/*
+ *  Key expiry queue
+ *  Copyright (C) 2015   Michel Megens <dev@michelmegens.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @addtogroup expire
+ * @{
+ */
+
+#ifndef __XFIREDB_EXPIRE_H__
+#define __XFIREDB_EXPIRE_H__
+
+#include <stdlib.h>
+#include <time.h>
+
+#include <xfiredb/xfiredb.h>
+#include <xfiredb/types.h>
+#include <xfiredb/os.h>
+
+/**
+ * @brief Expiry queue entry.
+ */
+struct expire_entry {
+	time_t when; //!< Expiry time stamp in milliseconds.
+	char *key; //!< Key which expires at \p when.
+};
+
+/**
+ * @brief Expiry queue.
+ *
+ * Binary min-heap of expiry time stamps. The queue isn't updated when a
+ * time out is changed or removed, so popped entries have to be validated
+ * against the expiry table of the owning database. Such stale entries are
+ * removed by expire_heap_compact.
+ */
+struct expire_heap {
+	struct expire_entry *heap; //!< Heap array.
+	size_t size; //!< Number of entries in \p heap.
+	size_t capacity; //!< Number of allocated entries.
+	xfiredb_spinlock_t lock; //!< Heap lock.
+};
+
+CDECL
+extern void expire_heap_init(struct expire_heap *h);
+extern void expire_heap_destroy(struct expire_heap *h);
+extern void expire_heap_push(struct expire_heap *h, const char *key, time_t when);
+extern char *expire_heap_pop(struct expire_heap *h, time_t now, time_t *when);
+extern size_t expire_heap_compact(struct expire_heap *h,
+		bool (*valid)(const char *key, time_t when, void *arg), void *arg);
+CDECL_END
+
+#endif
+
+/** @} */
+
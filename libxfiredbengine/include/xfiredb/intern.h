@@ -0,0 +1,56 @@
+/*
+ *  String interning
+ *  Copyright (C) 2015   Michel Megens <dev@michelmegens.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @addtogroup intern
+ * @{
+ */
+
+#ifndef __XFIREDB_INTERN_H__
+#define __XFIREDB_INTERN_H__
+
+#include <stdlib.h>
+
+#include <xfiredb/xfiredb.h>
+#include <xfiredb/types.h>
+
+/**
+ * @brief Interned string.
+ *
+ * The string data directly follows the header, so the pointer handed out
+ * to users can be converted back to its entry.
+ */
+struct intern_entry {
+	struct intern_entry *next; //!< Next entry in the same bucket.
+	u32 hash; //!< Hash of \p str.
+	u32 refs; //!< Number of references to \p str.
+	size_t len; //!< Length of \p str, excluding the terminator.
+	char str[]; //!< Terminated string data. May contain NUL bytes.
+};
+
+CDECL
+extern char *intern_get(const char *str);
+extern char *intern_get_len(const void *data, size_t len);
+extern void intern_put(const char *str);
+extern size_t intern_size(const char *str);
+extern size_t intern_count(void);
+CDECL_END
+
+#endif
+
+/** @} */
@@ -34,6 +34,7 @@
 typedef struct list {
 	struct list *next; //!< Next pointer.
 	struct list *prev; //!< Previous pointer.
+	s64 id; //!< Position ID.
 } LIST;
 
 /**
@@ -45,6 +46,8 @@ typedef struct list_head {
 
 	xfiredb_spinlock_t lock; //!< List lock.
 	atomic_t num; //!< Number of elements in the list.
+	s64 lid; //!< Next position ID on the left side.
+	s64 rid; //!< Last position ID on the right side.
 } LIST_HEAD;
 
 /**
@@ -76,6 +79,7 @@ typedef struct list_head {
 CDECL
 extern void list_lpush(struct list_head *head, struct list *node);
 extern void list_rpush(struct list_head *head, struct list *node);
+extern void list_rpush_id(struct list_head *head, struct list *node, s64 id);
 extern void list_del(struct list_head *lh, struct list *entry);
 
 /**
@@ -87,6 +91,7 @@ static inline void list_node_init(struct list *node)
 
 	node->next = node;
 	node->prev = node;
+	node->id = 0LL;
 }
 
 /**
@@ -97,6 +102,7 @@ static inline void list_head_init(struct list_head *head)
 {
 	xfiredb_spinlock_init(&head->lock);
 	list_node_init(&head->head);
+	head->lid = head->rid = 0LL;
 
 	atomic_init(&head->num);
 }
@@ -121,6 +127,20 @@ static inline int list_length(struct list_head *head)
 	return atomic_get(&head->num);
 }
 
+/**
+ * @brief Get the position ID of a list entry.
+ * @param node List entry.
+ * @return The position ID of \p node.
+ *
+ * Position ID's are assigned when an entry is pushed onto a list. They
+ * increase from left to right and never change while the entry is part
+ * of the list, which makes them suitable as a persistent identifier.
+ */
+static inline s64 list_entry_id(struct list *node)
+{
+	return node->id;
+}
+
 /**
  * @brief Lock the spinlock of a list.
  * @param lh List to lock.
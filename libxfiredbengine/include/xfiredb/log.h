@@ -26,6 +26,7 @@
 
 #define LOG_INIT "init"
 #define LOG_DISK "disk"
+#define LOG_BIO "bio"
 
 CDECL
 extern void xfiredb_log_init(const char *out, const char *err);
@@ -19,14 +19,47 @@
 #ifndef __MEM_H__
 #define __MEM_H__
 
+#include <stdio.h>
 #include <xfiredb/xfiredb.h>
 
+/**
+ * @brief Memory category type definition.
+ */
+typedef enum {
+	MEM_STAT_GENERAL, //!< Stored data and everything else.
+	MEM_STAT_DICT, //!< Dictionary tables and entries.
+	MEM_STAT_SKIPLIST, //!< Skiplist forward arrays.
+	MEM_STAT_BIO, //!< Background I/O queue records.
+	MEM_STAT_INTERN, //!< Interned strings and the intern table.
+	MEM_STAT_NUM, //!< Number of memory categories.
+} mem_stat_t;
+
 CDECL
 extern void *xfiredb_alloc(size_t len);
 extern void *xfiredb_zalloc(size_t len);
 extern void *xfiredb_calloc(size_t num, size_t size);
 extern void xfiredb_free(void *region);
 extern void *xfiredb_realloc(void *region, size_t size);
+extern size_t xfiredb_mem_used(void);
+extern size_t xfiredb_mem_used_stat(mem_stat_t stat);
+extern size_t xfiredb_mem_size(void *region);
+extern size_t xfiredb_mem_rss(void);
+extern void xfiredb_mem_charge(void *region, mem_stat_t from, mem_stat_t to);
+extern void *xfiredb_alloc_stat(size_t len, mem_stat_t stat);
+extern void *xfiredb_zalloc_stat(size_t len, mem_stat_t stat);
+extern void xfiredb_free_stat(void *region, mem_stat_t stat);
+extern void *xfiredb_cache_alloc(size_t size, mem_stat_t stat);
+extern void *xfiredb_cache_zalloc(size_t size, mem_stat_t stat);
+extern void xfiredb_cache_free(void *region, size_t size, mem_stat_t stat);
+extern size_t xfiredb_cache_size(void *region, size_t size);
+extern size_t xfiredb_mem_reserved(void);
+
+extern int xfiredb_heapprof_start(size_t rate);
+extern void xfiredb_heapprof_stop(void);
+extern size_t xfiredb_heapprof_rate(void);
+extern int xfiredb_heapprof_dump(FILE *stream);
+extern void xfiredb_heapprof_alloc(void *region, size_t size);
+extern void xfiredb_heapprof_free(void *region);
 CDECL_END
 
 #endif
@@ -34,60 +34,66 @@
 /**
  * @brief XFireDB base object.
  *
- * Every object needs an assigned key (from the end-user). Then
- * the system assigns it a time stamp (creation time). When the
- * object needs to remove itself after a certain time, the expiration
- * time is also set (end-user supplied). An expiration time of zero means
- * that the object does not expire.
+ * Header shared by every stored value. The header is kept as small as
+ * possible, since every key pays for it. Time outs are not stored in the
+ * header: the database keeps them out of line, in its expiry table, and
+ * only the \p OBJECT_VOLATILE_FLAG is set on objects which have one.
  */
 struct object {
-	time_t crea, //!< Creation time.
-	       exp; //!< Expire time.
-
-	unsigned long flags; //!< Object flags
-	xfiredb_spinlock_t lock; //!< Object lock.
+	u8 type; //!< Object (container) type.
+	u8 encoding; //!< Object encoding.
+	u16 flags; //!< Object flags.
+	u32 lru : 24, //!< Access clock (seconds) of the last access.
+	    freq : 8; //!< Logarithmic access frequency counter.
 };
 
+#define OBJECT_LRU_MAX  ((1 << 24) - 1) //!< Maximum value of the access clock.
+#define OBJECT_LFU_INIT 5 //!< Initial access frequency of new objects.
+
 /**
  * @name Object flags
  * @{
  */
 #define OBJECT_INTREE_FLAG          0 //!< Object in-tree flag.
-#define OBJECT_EXPIRED_FLAG         1 //!< Object expired flag.
+#define OBJECT_VOLATILE_FLAG        1 //!< Object has a time out.
+#define OBJECT_SHARED_FLAG          2 //!< Object data is shared and immutable.
 /** @} */
 
 CDECL
 extern struct object *object_alloc(void);
 extern void object_init(struct object *obj);
 
-extern bool object_has_expired(struct object *obj);
-extern int object_set_expiry(struct object *obj, time_t exp);
+extern u32 object_lru_clock(void);
+extern void object_touch(struct object *obj);
+extern u32 object_idle_time(struct object *obj);
+extern u32 object_frequency(struct object *obj);
 
 extern void object_destroy(struct object *obj);
 extern void object_free(struct object *obj);
 
 /**
- * @brief Lock a given object.
- * @param obj Object to lock.
+ * @brief Test an object flag.
+ * @param obj Object to test the flag on.
+ * @param flag Flag to test.
+ * @return True if \p flag is set on \p obj.
  */
-static inline void object_lock(struct object *obj)
+static inline bool object_test_flag(struct object *obj, int flag)
 {
-	if(!obj)
-		return;
-
-	xfiredb_spin_lock(&obj->lock);
+	return (obj->flags & (1U << flag)) != 0;
 }
 
 /**
- * @brief Unlock an object.
- * @param obj Object to unlock.
+ * @brief Set or clear an object flag.
+ * @param obj Object to update.
+ * @param flag Flag to update.
+ * @param value True to set \p flag, false to clear it.
  */
-static inline void object_unlock(struct object *obj)
+static inline void object_assign_flag(struct object *obj, int flag, bool value)
 {
-	if(!obj)
-		return;
-
-	xfiredb_spin_unlock(&obj->lock);
+	if(value)
+		obj->flags |= 1U << flag;
+	else
+		obj->flags &= ~(1U << flag);
 }
 
 CDECL_END
@@ -27,6 +27,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <sched.h>
 
 #include <xfiredb/xfiredb.h>
 #include <xfiredb/types.h>
@@ -93,6 +94,50 @@ static inline void xfiredb_set_stack_size(xfiredb_attr_t *attr, size_t *stack)
  */
 #define xfiredb_spin_unlock(__s) pthread_spin_unlock(__s)
 
+#define xfiredb_rwlock_t pthread_rwlock_t //!< XFire reader-writer lock.
+/**
+ * @brief Destroy a reader-writer lock.
+ * @param __l Lock to destroy.
+ */
+#define xfiredb_rwlock_destroy(__l) pthread_rwlock_destroy(__l)
+/**
+ * @brief Lock a reader-writer lock for reading.
+ * @param __l Lock to read lock.
+ */
+#define xfiredb_read_lock(__l) pthread_rwlock_rdlock(__l)
+/**
+ * @brief Release a read lock.
+ * @param __l Lock to unlock.
+ */
+#define xfiredb_read_unlock(__l) pthread_rwlock_unlock(__l)
+/**
+ * @brief Lock a reader-writer lock for writing.
+ * @param __l Lock to write lock.
+ */
+#define xfiredb_write_lock(__l) pthread_rwlock_wrlock(__l)
+/**
+ * @brief Release a write lock.
+ * @param __l Lock to unlock.
+ */
+#define xfiredb_write_unlock(__l) pthread_rwlock_unlock(__l)
+
+#define xfiredb_fast_mutex_t fast_mutex_t //!< XFire non-recursive mutex.
+/**
+ * @brief Destroy a fast mutex.
+ * @param __m Mutex to destroy.
+ */
+#define xfiredb_fast_mutex_destroy(__m) pthread_mutex_destroy(&(__m)->mtx)
+/**
+ * @brief Lock a fast mutex.
+ * @param __m Mutex to lock.
+ */
+#define xfiredb_fast_mutex_lock(__m) pthread_mutex_lock(&(__m)->mtx)
+/**
+ * @brief Unlock a fast mutex.
+ * @param __m Mutex to unlock.
+ */
+#define xfiredb_fast_mutex_unlock(__m) pthread_mutex_unlock(&(__m)->mtx)
+
 /**
  * @brief Initialise a condition variable.
  * @param __c Condition variable to init.
@@ -114,6 +159,11 @@ static inline void xfiredb_set_stack_size(xfiredb_attr_t *attr, size_t *stack)
  * @param __c Condition to signal.
  */
 #define xfiredb_cond_signal(__c) pthread_cond_signal(__c)
+/**
+ * @brief Wake up every thread waiting for a condition.
+ * @param __c Condition to signal.
+ */
+#define xfiredb_cond_broadcast(__c) pthread_cond_broadcast(__c)
 /**
  * @brief Exit a thread.
  * @param __a Thread to exit.
@@ -149,12 +199,48 @@ typedef struct mutex {
 #endif
 } mutex_t;
 
+/**
+ * @brief Fast (non-recursive) mutex data structure.
+ *
+ * Where the platform supports it, a fast mutex spins for a short while
+ * before it puts the caller to sleep. A fast mutex may not be locked
+ * recursively.
+ */
+typedef struct fast_mutex {
+#if defined(HAVE_PTHREAD) || defined(__DOXYGEN__)
+	pthread_mutex_t mtx; //!< pthread mutex
+#endif
+} fast_mutex_t;
+
+/**
+ * @brief Sequence lock data structure.
+ *
+ * A sequence lock suits small, read-mostly objects. Writers exclude each
+ * other, readers don't take the lock at all. Instead they retry when a
+ * writer was active while they were reading. Readers that have to keep a
+ * pointer into the data can take the lock shared, which keeps writers out
+ * but not other readers.
+ */
+typedef struct seqlock {
+	volatile u32 seq; //!< Sequence count, odd while a writer holds the lock.
+	volatile u32 readers; //!< Number of readers holding the lock shared.
+} seqlock_t;
+
+#define xfiredb_seqlock_t seqlock_t //!< XFire sequence lock.
+
+/**
+ * @brief Number of spins before a seqlock writer yields the processor.
+ */
+#define XFIREDB_SEQLOCK_SPINS 100
+
 /**
  * @brief 32-bit atomic type.
  */
 typedef struct atomic {
 	s32 val; //!< Atomic value.
+#if !defined(HAVE_ATOMIC_BUILTINS) || defined(__DOXYGEN__)
 	xfiredb_spinlock_t lock; //!< Protection lock.
+#endif
 } atomic_t;
 
 /**
@@ -162,7 +248,9 @@ typedef struct atomic {
  */
 typedef struct atomic64 {
 	s64 val; //!< 64-bit atomic type.
+#if !defined(HAVE_ATOMIC_BUILTINS) || defined(__DOXYGEN__)
 	xfiredb_spinlock_t lock; //!< Protection lock.
+#endif
 } atomic64_t;
 
 /**
@@ -205,6 +293,14 @@ extern void xfiredb_mutex_lock(xfiredb_mutex_t *m);
  * @param m Mutex to unlock.
  */
 extern void xfiredb_mutex_unlock(xfiredb_mutex_t *m);
+/**
+ * @brief Wait for a condition with a time out.
+ * @param c Condition to wait for.
+ * @param m Mutex to use for the waiting process.
+ * @param ms Maximum number of milliseconds to wait.
+ * @return -XFIREDB_OK if \p c was signalled, -XFIREDB_ERR if the wait timed out.
+ */
+extern int xfiredb_cond_timedwait(xfiredb_cond_t *c, xfiredb_mutex_t *m, time_t ms);
 
 /**
  * @brief Get the current time of the day in milliseconds.
@@ -212,6 +308,13 @@ extern void xfiredb_mutex_unlock(xfiredb_mutex_t *m);
  */
 extern time_t xfiredb_time_stamp(void);
 
+/**
+ * @brief Get a monotonic time stamp in microseconds.
+ * @return Microseconds since an unspecified starting point.
+ * @note Only useful to measure intervals.
+ */
+extern time_t xfiredb_clock_us(void);
+
 /**
  * @brief Create a new thread.
  * @param name Thread name.
@@ -251,83 +354,248 @@ extern int xfiredb_destroy_thread(struct thread *tp);
  */
 extern int xfiredb_thread_cancel(struct thread *tp);
 
+/**
+ * @brief Initialise a mutex variable.
+ * @param m Mutex variable.
+ */
+extern void xfiredb_mutex_init(xfiredb_mutex_t *m);
+/**
+ * @brief Initialise a fast mutex.
+ * @param m Mutex to initialise.
+ */
+extern void xfiredb_fast_mutex_init(xfiredb_fast_mutex_t *m);
+/**
+ * @brief Initialise a reader-writer lock.
+ * @param l Lock to initialise.
+ *
+ * Writers are preferred over readers, where the platform allows it.
+ */
+extern void xfiredb_rwlock_init(xfiredb_rwlock_t *l);
+
+/**
+ * @brief Initialise a sequence lock.
+ * @param s Lock to initialise.
+ */
+static inline void xfiredb_seqlock_init(xfiredb_seqlock_t *s)
+{
+	s->seq = 0;
+	s->readers = 0;
+}
+
+/**
+ * @brief Lock a sequence lock for writing.
+ * @param s Lock to lock.
+ *
+ * The caller spins while another writer holds the lock, and yields the
+ * processor every \p XFIREDB_SEQLOCK_SPINS attempts. Once the sequence
+ * count is odd no new shared readers get in, and the caller waits for the
+ * ones that are still holding the lock.
+ */
+static inline void xfiredb_write_seqlock(xfiredb_seqlock_t *s)
+{
+	u32 seq;
+	int spins = 0;
+
+	while(true) {
+		seq = s->seq;
+		if(!(seq & 1) && __sync_bool_compare_and_swap(&s->seq, seq, seq + 1))
+			break;
+
+		if(++spins == XFIREDB_SEQLOCK_SPINS) {
+			spins = 0;
+			sched_yield();
+		}
+	}
+
+	while(s->readers)
+		sched_yield();
+}
+
+/**
+ * @brief Release a sequence lock.
+ * @param s Lock to unlock.
+ */
+static inline void xfiredb_write_sequnlock(xfiredb_seqlock_t *s)
+{
+	__sync_fetch_and_add(&s->seq, 1);
+}
+
+/**
+ * @brief Start a lockless read.
+ * @param s Lock protecting the data that is about to be read.
+ * @return The sequence count to pass to xfiredb_read_seqretry.
+ */
+static inline u32 xfiredb_read_seqbegin(xfiredb_seqlock_t *s)
+{
+	u32 seq;
+
+	while((seq = s->seq) & 1)
+		sched_yield();
+
+	barrier();
+	return seq;
+}
+
+/**
+ * @brief Finish a lockless read.
+ * @param s Lock protecting the data that was read.
+ * @param seq Sequence count returned by xfiredb_read_seqbegin.
+ * @return True if a writer interfered and the read has to be retried.
+ */
+static inline bool xfiredb_read_seqretry(xfiredb_seqlock_t *s, u32 seq)
+{
+	barrier();
+	return s->seq != seq;
+}
+
+/**
+ * @brief Lock a sequence lock for reading.
+ * @param s Lock to lock.
+ *
+ * Keeps writers out until xfiredb_read_sequnlock is called, without
+ * bumping the sequence count, so lockless readers don't have to retry.
+ * Other readers may hold the lock at the same time.
+ */
+static inline void xfiredb_read_seqlock(xfiredb_seqlock_t *s)
+{
+	u32 seq;
+
+	while(true) {
+		seq = xfiredb_read_seqbegin(s);
+		__sync_fetch_and_add(&s->readers, 1);
+		if(s->seq == seq)
+			break;
+
+		/* A writer got in first */
+		__sync_fetch_and_sub(&s->readers, 1);
+	}
+}
+
+/**
+ * @brief Release a sequence lock held for reading.
+ * @param s Lock to unlock.
+ */
+static inline void xfiredb_read_sequnlock(xfiredb_seqlock_t *s)
+{
+	__sync_fetch_and_sub(&s->readers, 1);
+}
+
+#if defined(HAVE_ATOMIC_BUILTINS) || defined(__DOXYGEN__)
 /**
  * @brief Add a number atomically.
  * @param atom Atom to add to.
  * @param val Value to add.
  */
-extern void atomic_add(atomic_t *atom, s32 val);
+static inline void atomic_add(atomic_t *atom, s32 val)
+{
+	__atomic_fetch_add(&atom->val, val, __ATOMIC_ACQ_REL);
+}
 
 /**
  * @brief Substract a number atomically.
  * @param atom Atom to substract from.
  * @param val Value to substract.
  */
-extern void atomic_sub(atomic_t *atom, s32 val);
+static inline void atomic_sub(atomic_t *atom, s32 val)
+{
+	__atomic_fetch_sub(&atom->val, val, __ATOMIC_ACQ_REL);
+}
+
+/**
+ * @brief Get a value atomically
+ * @param atom Atom to retrieve the value from.
+ * @return The value stored in \p atom.
+ */
+static inline s32 atomic_get(atomic_t *atom)
+{
+	return __atomic_load_n(&atom->val, __ATOMIC_ACQUIRE);
+}
 
 /**
  * @brief Add a number atomically.
  * @param atom Atom to add to.
  * @param val Value to add.
  */
-extern void atomic64_add(atomic64_t *atom, s64 val);
+static inline void atomic64_add(atomic64_t *atom, s64 val)
+{
+	__atomic_fetch_add(&atom->val, val, __ATOMIC_ACQ_REL);
+}
 
 /**
  * @brief Substract a number atomically.
  * @param atom Atom to substract from.
  * @param val Value to substract.
  */
-extern void atomic64_sub(atomic64_t *atom, s64 val);
+static inline void atomic64_sub(atomic64_t *atom, s64 val)
+{
+	__atomic_fetch_sub(&atom->val, val, __ATOMIC_ACQ_REL);
+}
 
 /**
  * @brief Get a value atomically
  * @param atom Atom to retrieve the value from.
  * @return The value stored in \p atom.
  */
-extern s32 atomic_get(atomic_t *atom);
+static inline s64 atomic64_get(atomic64_t *atom)
+{
+	return __atomic_load_n(&atom->val, __ATOMIC_ACQUIRE);
+}
+
 /**
- * @brief Get a value atomically
- * @param atom Atom to retrieve the value from.
- * @return The value stored in \p atom.
+ * @brief Initialise an atomic variable.
+ * @param atom Atom to init.
  */
-extern s64 atomic64_get(atomic64_t *atom);
+static inline void atomic_init(atomic_t *atom)
+{
+	__atomic_store_n(&atom->val, 0, __ATOMIC_RELAXED);
+}
+
 /**
- * @brief Initialise a mutex variable.
- * @param m Mutex variable.
+ * @brief Initialise an atomic variable.
+ * @param atom Atom to init.
  */
-extern void xfiredb_mutex_init(xfiredb_mutex_t *m);
+static inline void atomic64_init(atomic64_t *atom)
+{
+	__atomic_store_n(&atom->val, 0LL, __ATOMIC_RELAXED);
+}
 
 /**
  * @brief Destroy a 32-bit atomic.
  * @param atom Atomic to kill.
  */
-extern void atomic_destroy(atomic_t *atom);
+static inline void atomic_destroy(atomic_t *atom)
+{
+}
 
 /**
  * @brief Destroy a 64-bit atomic.
  * @param atom Atomic to kill.
  */
+static inline void atomic64_destroy(atomic64_t *atom)
+{
+}
+#else
+extern void atomic_add(atomic_t *atom, s32 val);
+extern void atomic_sub(atomic_t *atom, s32 val);
+extern s32 atomic_get(atomic_t *atom);
+extern void atomic64_add(atomic64_t *atom, s64 val);
+extern void atomic64_sub(atomic64_t *atom, s64 val);
+extern s64 atomic64_get(atomic64_t *atom);
+extern void atomic_destroy(atomic_t *atom);
 extern void atomic64_destroy(atomic64_t *atom);
 
-/**
- * @brief Initialise an atomic variable.
- * @param atom Atom to init.
- */
 static inline void atomic_init(atomic_t *atom)
 {
 	atom->val = 0;
 	xfiredb_spinlock_init(&atom->lock);
 }
 
-/**
- * @brief Initialise an atomic variable.
- * @param atom Atom to init.
- */
 static inline void atomic64_init(atomic64_t *atom)
 {
 	atom->val = 0LL;
 	xfiredb_spinlock_init(&atom->lock);
 }
+#endif
 CDECL_END
 
 #endif
@@ -39,12 +39,13 @@
 struct skiplist_node {
 	char *key; //!< Node key;
 	u32 hash; //!< Node hash;
+	u32 level; //!< Number of levels in \p forward.
 	struct skiplist_node **forward; //!< List forward.
 };
 
 struct skiplist {
 	struct object obj; //!< Base object.
-	xfiredb_mutex_t lock;
+	xfiredb_rwlock_t lock; //!< Skiplist lock.
 
 	int level; //!< Current number of levels.
 	atomic_t size; //!< Atomic size.
@@ -91,12 +92,27 @@ extern void skiplist_free(struct skiplist *l);
 
 static inline void skiplist_lock(struct skiplist *list)
 {
-	xfiredb_mutex_lock(&list->lock);
+	xfiredb_write_lock(&list->lock);
 }
 
 static inline void skiplist_unlock(struct skiplist *list)
 {
-	xfiredb_mutex_unlock(&list->lock);
+	xfiredb_write_unlock(&list->lock);
+}
+
+static inline void skiplist_read_lock(struct skiplist *list)
+{
+	xfiredb_read_lock(&list->lock);
+}
+
+static inline void skiplist_read_unlock(struct skiplist *list)
+{
+	xfiredb_read_unlock(&list->lock);
+}
+
+static inline size_t skiplist_forward_size(struct skiplist_node *node)
+{
+	return sizeof(*node->forward) * (node->level + 1);
 }
 
 static inline s32 skiplist_size(struct skiplist *list)
@@ -0,0 +1,66 @@
+/*
+ *  Binary database snapshots
+ *  Copyright (C) 2015   Michel Megens <dev@michelmegens.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @addtogroup snapshot
+ * @{
+ */
+
+#ifndef __XFIREDB_SNAPSHOT_H__
+#define __XFIREDB_SNAPSHOT_H__
+
+#include <stdlib.h>
+#include <time.h>
+
+#include <xfiredb/xfiredb.h>
+#include <xfiredb/types.h>
+#include <xfiredb/database.h>
+
+/**
+ * @brief State of the background save.
+ */
+struct snapshot_info {
+	bool in_progress; //!< A background save is running.
+	bool last_ok; //!< The last save succeeded.
+	time_t last_save; //!< Time stamp (ms) at which the last save finished.
+	time_t last_duration; //!< Duration of the last save in milliseconds.
+	u64 last_size; //!< Size of the last snapshot written, in bytes.
+	time_t fork_usec; //!< Time the last fork() took, in microseconds.
+	u64 saves; //!< Number of background saves started.
+};
+
+/**
+ * @brief Snapshot expiry hook.
+ * @param key Key that expires.
+ * @param when Time stamp (ms) at which \p key expires.
+ */
+typedef void (*snapshot_expire_hook_t)(const char *key, s64 when);
+
+CDECL
+extern int snapshot_save(struct database *db, const char *path);
+extern int snapshot_bgsave(struct database *db, const char *path);
+extern void snapshot_wait(void);
+extern void snapshot_get_info(struct snapshot_info *info);
+extern int snapshot_load(const char *path,
+		void (*hook)(int argc, char **rows, size_t *lens, char **cols),
+		snapshot_expire_hook_t expire);
+CDECL_END
+
+#endif
+
+/** @} */
@@ -31,6 +31,29 @@
 #include <xfiredb/list.h>
 #include <xfiredb/hashmap.h>
 
+/**
+ * @brief Size of the inline string buffer.
+ *
+ * Strings shorter than this (i.e. strings that fit including their
+ * terminator) are stored inside the string container itself. Longer
+ * strings are stored in a separately allocated buffer.
+ */
+#define STRING_INLINE_SIZE 24
+
+/**
+ * @brief Maximum length of a string that is grown by string_set_range.
+ */
+#define STRING_MAX_SIZE (512UL * 1024UL * 1024UL)
+
+/**
+ * @brief String encoding type.
+ */
+typedef enum {
+	STRING_ENC_RAW, //!< Raw (binary) string.
+	STRING_ENC_INT, //!< Integer string.
+	STRING_ENC_FLOAT, //!< Floating point string.
+} string_encoding_t;
+
 /**
  * @brief String container.
  */
@@ -39,9 +62,24 @@ struct string {
 	struct list entry; //!< List entry.
 	struct hashmap_node node; //!< Map node.
 
-	char *str; //!< String pointer.
-	size_t len; //!< Length of \p str in bytes.
-	xfiredb_spinlock_t lock; //!< Lock.
+	char *str; //!< String pointer. Always terminated, may contain NUL bytes.
+	size_t len; //!< Length of \p str in bytes, excluding the terminator.
+	size_t capacity; //!< Number of bytes \p str can hold, excluding the terminator.
+	xfiredb_seqlock_t lock; //!< Sequence lock.
+	char buf[STRING_INLINE_SIZE]; //!< Inline storage for short strings.
+
+	/**
+	 * @brief Numerical value of the string.
+	 *
+	 * Only valid if the encoding of \p obj is STRING_ENC_INT or
+	 * STRING_ENC_FLOAT.
+	 * The textual representation in \p str is kept up to date, so the
+	 * string can be read without formatting the number again.
+	 */
+	union {
+		s64 i; //!< Integer value.
+		double f; //!< Floating point value.
+	} num;
 };
 
 /**
@@ -51,12 +89,25 @@ struct string {
 
 CDECL
 extern struct string *string_alloc(const char *data);
+extern struct string *string_alloc_len(const void *data, size_t len);
 extern void string_init(struct string *str);
 extern void string_free(struct string *string);
 extern void string_destroy(struct string *str);
 extern void string_set(struct string *string, const char *str);
+extern void string_set_len(struct string *string, const void *data, size_t len);
 extern int string_get(struct string *str, char **buf);
+extern int string_incr(struct string *str, s64 delta, s64 *result);
+extern int string_incr_float(struct string *str, double delta, double *result);
+extern size_t string_append(struct string *str, const void *data, size_t len);
+extern size_t string_set_range(struct string *str, size_t offset,
+		const void *data, size_t len);
+extern const char *string_borrow(struct string *str, size_t *len);
+extern const char *string_borrow_range(struct string *str, s64 start,
+		s64 end, size_t *len);
+extern void string_unborrow(struct string *str);
 extern size_t string_length(struct string *str);
+extern void string_set_share_limit(size_t max);
+extern size_t string_share_limit(void);
 
 /**
  * @brief Get the c string from a string container.
@@ -68,6 +119,27 @@ static inline void *string_data(struct string *str)
 	return str->str;
 }
 
+/**
+ * @brief Check if a string is stored inline.
+ * @param str String container.
+ * @return True if the data of \p str is stored within \p str itself.
+ */
+static inline bool string_is_inline(struct string *str)
+{
+	return str->str == str->buf;
+}
+
+/**
+ * @brief Check if a string refers to a shared buffer.
+ * @param str String container.
+ * @return True if the data of \p str is an interned, shared buffer.
+ * @see string_set_share_limit
+ */
+static inline bool string_is_shared(struct string *str)
+{
+	return object_test_flag(&str->obj, OBJECT_SHARED_FLAG);
+}
+
 CDECL_END
 
 /** @} */
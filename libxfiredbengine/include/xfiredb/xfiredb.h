@@ -19,6 +19,7 @@
 #ifndef __XFIREDB_CLIENT_H_
 #define __XFIREDB_CLIENT_H_
 
+#include <stdlib.h>
 #include <config.h>
 #include <xfiredb/compiler.h>
 #ifndef __cplusplus
@@ -51,6 +52,7 @@ struct database;
 struct container;
 
 extern struct disk *disk_db;
+extern struct aof *aof_db;
 CDECL
 extern struct config *xfiredb_get_config(void);
 extern void xfiredb_se_init_silent(struct config *conf);
@@ -58,11 +60,15 @@ extern void xfiredb_se_init(struct config *conf);
 extern void xfiredb_set_loadstate(bool v);
 extern bool xfiredb_loadstate(void);
 extern long xfiredb_disk_size(void);
-extern void xfiredb_raw_load(void (*hook)(int argc, char **rows, char **cols));
-extern void xfiredb_load_key(char *key, void (*hook)(int argc, char **rows, char **cols));
+extern void xfiredb_raw_load(
+		void (*hook)(int argc, char **rows, size_t *lens, char **cols));
+extern void xfiredb_load_key(char *key,
+		void (*hook)(int argc, char **rows, size_t *lens, char **cols));
 extern void xfiredb_se_exit(void);
 extern void xfiredb_se_save(void);
-extern void xfiredb_notice_disk(char *_key, char *_arg, char *_data, int op);
+extern void xfiredb_se_snapshot(struct database *db);
+extern void xfiredb_notice_disk(char *_key, char *_arg, const void *_data,
+		size_t _len, int op);
 extern void xfiredb_store_container(char *_key, struct container *c);
 
 extern int xfiredb_hashmap_clear(char *key, void (*hook)(char *key, char *data));
@@ -75,7 +81,15 @@ extern int xfiredb_string_set(char *key, char *str);
 extern int xfiredb_list_push(char *key, char *data, bool left);
 extern int xfiredb_hashmap_set(char *key, char *skey, char *data);
 extern int xfiredb_key_delete(char *key);
+extern int xfiredb_key_expire(char *key, s64 ms);
+extern int xfiredb_key_persist(char *key);
+extern s64 xfiredb_key_ttl(char *key);
+extern int xfiredb_set_maxmemory(size_t maxmemory, const char *policy);
 extern int xfiredb_string_get(char *key, char **data);
+extern int xfiredb_string_incr(char *key, s64 delta, s64 *result);
+extern int xfiredb_string_append(char *key, char *data);
+extern int xfiredb_string_incr_float(char *key, double delta, double *result);
+extern int xfiredb_hashmap_incr(char *key, char *skey, s64 delta, s64 *result);
 extern int xfiredb_list_get(char *key, char **data, int *idx, int num);
 extern int xfiredb_list_pop(char *key, int *idx, int num);
 extern int xfiredb_list_set(char *key, int idx, char *data);
@@ -25,6 +25,7 @@
 #include <xfiredb/os.h>
 #include <xfiredb/mem.h>
 
+#ifndef HAVE_ATOMIC_BUILTINS
 void atomic_destroy(atomic_t *atom)
 {
 	xfiredb_spinlock_destroy(&atom->lock);
@@ -84,4 +85,5 @@ s64 atomic64_get(atomic64_t *atom)
 
 	return tmp;
 }
+#endif
 
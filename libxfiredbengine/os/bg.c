@@ -62,8 +62,13 @@ static void *job_processor(void *arg)
 
 	while(true) {
 		xfiredb_mutex_lock(&j->lock);
-		if(!j->done)
-			xfiredb_cond_wait(&j->condi, &j->lock);
+		if(!j->done && !j->pending) {
+			if(j->interval)
+				xfiredb_cond_timedwait(&j->condi, &j->lock, j->interval);
+			else
+				xfiredb_cond_wait(&j->condi, &j->lock);
+		}
+		j->pending = false;
 		xfiredb_mutex_unlock(&j->lock);
 
 		j->handle(j->arg);
@@ -75,15 +80,8 @@ static void *job_processor(void *arg)
 	return NULL;
 }
 
-/**
- * @brief Create a new background job.
- * @param name Name of the job to create.
- * @param handle Job handler (function pointer).
- * @param arg Argument to \p handle.
- * @note The \p name argument has to be unique.
- */
-struct job *bg_process_create(const char *name,
-				void (*handle)(void*), void *arg)
+static struct job *__bg_process_create(const char *name,
+			void (*handle)(void*), void *arg, time_t interval)
 {
 	int l;
 	char *_name;
@@ -97,6 +95,7 @@ struct job *bg_process_create(const char *name,
 	job->name = _name;
 	job->handle = handle;
 	job->arg = arg;
+	job->interval = interval;
 	xfiredb_mutex_init(&job->lock);
 	xfiredb_cond_init(&job->condi);
 	dict_add(job_db, name, job, DICT_PTR);
@@ -109,6 +108,36 @@ struct job *bg_process_create(const char *name,
 	return job;
 }
 
+/**
+ * @brief Create a new background job.
+ * @param name Name of the job to create.
+ * @param handle Job handler (function pointer).
+ * @param arg Argument to \p handle.
+ * @note The \p name argument has to be unique.
+ */
+struct job *bg_process_create(const char *name,
+				void (*handle)(void*), void *arg)
+{
+	return __bg_process_create(name, handle, arg, 0);
+}
+
+/**
+ * @brief Create a new periodic background job.
+ * @param name Name of the job to create.
+ * @param handle Job handler (function pointer).
+ * @param arg Argument to \p handle.
+ * @param interval Time between two runs in milliseconds.
+ * @note The \p name argument has to be unique.
+ *
+ * The job runs every \p interval milliseconds, or earlier when it
+ * is signalled using bg_process_signal.
+ */
+struct job *bg_process_create_periodic(const char *name,
+			void (*handle)(void*), void *arg, time_t interval)
+{
+	return __bg_process_create(name, handle, arg, interval);
+}
+
 /**
  * @brief Signal a sleeping job.
  * @param name Name of the job to signal.
@@ -129,11 +158,38 @@ int bg_process_signal(const char *name)
 	if(!job)
 		return -XFIREDB_ERR;
 
+	bg_job_signal(job);
+	return -XFIREDB_OK;
+}
+
+/**
+ * @brief Signal a job.
+ * @param job Job to signal.
+ *
+ * The job runs once more after this call. If it is running already, it
+ * runs again as soon as it is done.
+ */
+void bg_job_signal(struct job *job)
+{
 	xfiredb_mutex_lock(&job->lock);
+	job->pending = true;
 	xfiredb_cond_signal(&job->condi);
 	xfiredb_mutex_unlock(&job->lock);
+}
 
-	return -XFIREDB_OK;
+/**
+ * @brief Change the run interval of a periodic job.
+ * @param job Job to change.
+ * @param interval Time between two runs in milliseconds, 0 to only run
+ *   the job when it is signalled.
+ *
+ * The new interval takes effect after the next run.
+ */
+void bg_job_set_interval(struct job *job, time_t interval)
+{
+	xfiredb_mutex_lock(&job->lock);
+	job->interval = interval;
+	xfiredb_mutex_unlock(&job->lock);
 }
 
 static int __bg_process_stop(struct job *job)
@@ -0,0 +1,448 @@
+/*
+ *  Sampling heap profiler
+ *  Copyright (C) 2015   Michel Megens <dev@michelmegens.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @addtogroup mem
+ * @{
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <xfiredb/xfiredb.h>
+#include <xfiredb/types.h>
+#include <xfiredb/error.h>
+#include <xfiredb/os.h>
+#include <xfiredb/mem.h>
+
+#if defined(HAVE_EXECINFO) && defined(HAVE_PTHREAD)
+#include <execinfo.h>
+
+#define HEAPPROF_MAX_DEPTH 32
+#define HEAPPROF_SKIP_FRAMES 2
+#define HEAPPROF_BUCKETS 4096
+#define HEAPPROF_SAMPLES 16384
+#define HEAPPROF_FILTER_SIZE 32768
+
+/*
+ * Call site of sampled allocations. Buckets live as long as the profiler
+ * is running.
+ */
+struct heapprof_bucket {
+	struct heapprof_bucket *next;
+	u32 hash;
+	int depth;
+	void *stack[HEAPPROF_MAX_DEPTH];
+
+	u64 allocs, alloc_size;
+	u64 frees, free_size;
+};
+
+/*
+ * Live sampled block.
+ */
+struct heapprof_sample {
+	struct heapprof_sample *next;
+	void *region;
+	size_t size;
+	struct heapprof_bucket *bucket;
+};
+
+static volatile int heapprof_enabled;
+static size_t heapprof_rate;
+static xfiredb_spinlock_t heapprof_lock;
+static pthread_once_t heapprof_once = PTHREAD_ONCE_INIT;
+
+static struct heapprof_bucket *heapprof_buckets[HEAPPROF_BUCKETS];
+static struct heapprof_sample *heapprof_samples[HEAPPROF_SAMPLES];
+
+/*
+ * Number of live samples per pointer hash. A free only has to take the
+ * profiler lock if the counter for its pointer is non-zero.
+ */
+static volatile u16 heapprof_filter[HEAPPROF_FILTER_SIZE];
+
+static __thread s64 heapprof_countdown;
+static __thread u64 heapprof_seed;
+
+static void heapprof_fork_prepare(void)
+{
+	xfiredb_spin_lock(&heapprof_lock);
+}
+
+static void heapprof_fork_release(void)
+{
+	xfiredb_spin_unlock(&heapprof_lock);
+}
+
+static void heapprof_init(void)
+{
+	xfiredb_spinlock_init(&heapprof_lock);
+	pthread_atfork(&heapprof_fork_prepare, &heapprof_fork_release,
+			&heapprof_fork_release);
+}
+
+static inline u32 heapprof_hash_ptr(void *region)
+{
+	u64 x = (unsigned long)region >> 4;
+
+	return (u32)((x * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+/*
+ * Fast approximation of log2(x) for x >= 1. The error is small enough to
+ * draw sampling intervals with, and avoids linking against libm.
+ */
+static inline double heapprof_log2(double x)
+{
+	union {
+		double d;
+		u64 i;
+	} u;
+	int exp;
+
+	u.d = x;
+	exp = (int)((u.i >> 52) & 0x7FF) - 1023;
+	u.i = (u.i & 0x000FFFFFFFFFFFFFULL) | 0x3FF0000000000000ULL;
+
+	/* approximates 1 + log2(m) for the mantissa m in [1, 2) */
+	return exp - 1 + (-0.34484843 * u.d + 2.02466578) * u.d - 0.67487759;
+}
+
+/*
+ * Draw the number of bytes until the next sample. Intervals are
+ * exponentially distributed with a mean of heapprof_rate bytes, which
+ * makes every allocated byte equally likely to be sampled.
+ */
+static s64 heapprof_next_interval(void)
+{
+	u64 x = heapprof_seed;
+	double q, interval;
+
+	if(unlikely(!x))
+		x = ((unsigned long)&heapprof_seed) ^ (u64)xfiredb_time_stamp() ^
+			0x2545F4914F6CDD1DULL;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	heapprof_seed = x;
+
+	/* q is uniformly distributed over [1, 2^26] */
+	q = (double)(x >> 38) + 1.0;
+	interval = (heapprof_log2(q) - 26.0) * -0.69314718 * heapprof_rate;
+
+	return interval < 1.0 ? 1 : (s64)interval;
+}
+
+static struct heapprof_bucket *heapprof_get_bucket(void **stack, int depth)
+{
+	struct heapprof_bucket *b;
+	u32 hash = 0;
+	int i;
+
+	for(i = 0; i < depth; i++)
+		hash = (hash ^ heapprof_hash_ptr(stack[i])) * 16777619U;
+
+	for(b = heapprof_buckets[hash % HEAPPROF_BUCKETS]; b; b = b->next) {
+		if(b->hash == hash && b->depth == depth &&
+				!memcmp(b->stack, stack, depth * sizeof(void*)))
+			return b;
+	}
+
+	b = calloc(1, sizeof(*b));
+	if(!b)
+		return NULL;
+
+	b->hash = hash;
+	b->depth = depth;
+	memcpy(b->stack, stack, depth * sizeof(void*));
+	b->next = heapprof_buckets[hash % HEAPPROF_BUCKETS];
+	heapprof_buckets[hash % HEAPPROF_BUCKETS] = b;
+
+	return b;
+}
+
+static __noinline void heapprof_record(void *region, size_t size)
+{
+	void *stack[HEAPPROF_MAX_DEPTH + HEAPPROF_SKIP_FRAMES];
+	struct heapprof_sample *s;
+	struct heapprof_bucket *b;
+	u32 hash;
+	int depth;
+
+	/* samples are kept outside of the accounted heap */
+	s = malloc(sizeof(*s));
+	if(!s)
+		return;
+
+	depth = backtrace(stack, HEAPPROF_MAX_DEPTH + HEAPPROF_SKIP_FRAMES);
+	depth = depth > HEAPPROF_SKIP_FRAMES ? depth - HEAPPROF_SKIP_FRAMES : 0;
+	hash = heapprof_hash_ptr(region);
+
+	xfiredb_spin_lock(&heapprof_lock);
+	if(!heapprof_enabled ||
+			!(b = heapprof_get_bucket(stack + HEAPPROF_SKIP_FRAMES, depth))) {
+		xfiredb_spin_unlock(&heapprof_lock);
+		free(s);
+		return;
+	}
+
+	b->allocs++;
+	b->alloc_size += size;
+
+	s->region = region;
+	s->size = size;
+	s->bucket = b;
+	s->next = heapprof_samples[hash % HEAPPROF_SAMPLES];
+	heapprof_samples[hash % HEAPPROF_SAMPLES] = s;
+	__sync_add_and_fetch(&heapprof_filter[hash % HEAPPROF_FILTER_SIZE], 1);
+	xfiredb_spin_unlock(&heapprof_lock);
+}
+
+/**
+ * @brief Notify the heap profiler of an allocation.
+ * @param region Allocated memory region.
+ * @param size Size of \p region.
+ */
+void xfiredb_heapprof_alloc(void *region, size_t size)
+{
+	if(likely(!heapprof_enabled) || !region)
+		return;
+
+	heapprof_countdown -= size;
+	if(likely(heapprof_countdown > 0))
+		return;
+
+	heapprof_countdown = heapprof_next_interval();
+	heapprof_record(region, size);
+}
+
+/**
+ * @brief Notify the heap profiler of a deallocation.
+ * @param region Memory region that is about to be free'd.
+ * @note This function has to be called before \p region is actually
+ *   returned to the system.
+ */
+void xfiredb_heapprof_free(void *region)
+{
+	struct heapprof_sample *s, **pp;
+	u32 hash;
+
+	if(!region)
+		return;
+
+	hash = heapprof_hash_ptr(region);
+	if(likely(!heapprof_filter[hash % HEAPPROF_FILTER_SIZE]))
+		return;
+
+	xfiredb_spin_lock(&heapprof_lock);
+	for(pp = &heapprof_samples[hash % HEAPPROF_SAMPLES]; (s = *pp) != NULL;
+			pp = &s->next) {
+		if(s->region != region)
+			continue;
+
+		*pp = s->next;
+		s->bucket->frees++;
+		s->bucket->free_size += s->size;
+		__sync_sub_and_fetch(&heapprof_filter[hash % HEAPPROF_FILTER_SIZE], 1);
+		break;
+	}
+	xfiredb_spin_unlock(&heapprof_lock);
+
+	free(s);
+}
+
+static void heapprof_reset(void)
+{
+	struct heapprof_sample *s;
+	struct heapprof_bucket *b;
+	int idx;
+
+	for(idx = 0; idx < HEAPPROF_SAMPLES; idx++) {
+		while((s = heapprof_samples[idx]) != NULL) {
+			heapprof_samples[idx] = s->next;
+			free(s);
+		}
+	}
+
+	for(idx = 0; idx < HEAPPROF_BUCKETS; idx++) {
+		while((b = heapprof_buckets[idx]) != NULL) {
+			heapprof_buckets[idx] = b->next;
+			free(b);
+		}
+	}
+
+	memset((void*)heapprof_filter, 0, sizeof(heapprof_filter));
+}
+
+/**
+ * @brief Start the heap profiler.
+ * @param rate Average number of allocated bytes between two samples.
+ * @return An error code.
+ * @retval -XFIREDB_OK on success.
+ * @retval -XFIREDB_ERR if \p rate is zero.
+ *
+ * Roughly one allocation per \p rate bytes is sampled. The call stack of
+ * sampled allocations is recorded, and the sample is kept until the
+ * allocation is free'd. If the profiler is already running, only the
+ * sampling rate is changed.
+ */
+int xfiredb_heapprof_start(size_t rate)
+{
+	if(!rate)
+		return -XFIREDB_ERR;
+
+	pthread_once(&heapprof_once, &heapprof_init);
+	xfiredb_spin_lock(&heapprof_lock);
+	heapprof_rate = rate;
+	heapprof_enabled = true;
+	xfiredb_spin_unlock(&heapprof_lock);
+
+	return -XFIREDB_OK;
+}
+
+/**
+ * @brief Stop the heap profiler.
+ *
+ * All samples that have been taken so far are discarded.
+ */
+void xfiredb_heapprof_stop(void)
+{
+	pthread_once(&heapprof_once, &heapprof_init);
+	xfiredb_spin_lock(&heapprof_lock);
+	heapprof_enabled = false;
+	heapprof_rate = 0;
+	heapprof_reset();
+	xfiredb_spin_unlock(&heapprof_lock);
+}
+
+/**
+ * @brief Get the sampling rate of the heap profiler.
+ * @return The average number of bytes between two samples, or 0 if the
+ *   heap profiler isn't running.
+ */
+size_t xfiredb_heapprof_rate(void)
+{
+	return heapprof_enabled ? heapprof_rate : 0;
+}
+
+static void heapprof_dump_maps(FILE *stream)
+{
+	char buf[4096];
+	size_t num;
+	FILE *maps;
+
+	fputs("\nMAPPED_LIBRARIES:\n", stream);
+	maps = fopen("/proc/self/maps", "r");
+	if(!maps)
+		return;
+
+	while((num = fread(buf, 1, sizeof(buf), maps)) > 0)
+		fwrite(buf, 1, num, stream);
+
+	fclose(maps);
+}
+
+/**
+ * @brief Write a heap profile.
+ * @param stream Stream to write the profile to.
+ * @return An error code.
+ * @retval -XFIREDB_OK on success.
+ * @retval -XFIREDB_ERR if the heap profiler isn't running.
+ *
+ * The profile is written in the legacy gperftools heap profile format,
+ * which can be read by pprof. Live (in use) samples are reported per
+ * call site, together with the totals since the profiler was started.
+ * The raw sample counts are written, pprof scales them up using the
+ * sampling rate in the profile header.
+ */
+int xfiredb_heapprof_dump(FILE *stream)
+{
+	struct heapprof_bucket *b;
+	u64 objs = 0, bytes = 0, allocs = 0, alloc_size = 0;
+	int idx, i;
+
+	if(!heapprof_enabled)
+		return -XFIREDB_ERR;
+
+	xfiredb_spin_lock(&heapprof_lock);
+	for(idx = 0; idx < HEAPPROF_BUCKETS; idx++) {
+		for(b = heapprof_buckets[idx]; b; b = b->next) {
+			objs += b->allocs - b->frees;
+			bytes += b->alloc_size - b->free_size;
+			allocs += b->allocs;
+			alloc_size += b->alloc_size;
+		}
+	}
+
+	fprintf(stream, "heap profile: %6llu: %8llu [%6llu: %8llu] @ heap_v2/%lu\n",
+			(unsigned long long)objs, (unsigned long long)bytes,
+			(unsigned long long)allocs, (unsigned long long)alloc_size,
+			(unsigned long)heapprof_rate);
+
+	for(idx = 0; idx < HEAPPROF_BUCKETS; idx++) {
+		for(b = heapprof_buckets[idx]; b; b = b->next) {
+			fprintf(stream, "%6llu: %8llu [%6llu: %8llu] @",
+					(unsigned long long)(b->allocs - b->frees),
+					(unsigned long long)(b->alloc_size - b->free_size),
+					(unsigned long long)b->allocs,
+					(unsigned long long)b->alloc_size);
+
+			for(i = 0; i < b->depth; i++)
+				fprintf(stream, " %p", b->stack[i]);
+			fputc('\n', stream);
+		}
+	}
+	xfiredb_spin_unlock(&heapprof_lock);
+
+	heapprof_dump_maps(stream);
+	return -XFIREDB_OK;
+}
+#else
+void xfiredb_heapprof_alloc(void *region, size_t size)
+{
+}
+
+void xfiredb_heapprof_free(void *region)
+{
+}
+
+int xfiredb_heapprof_start(size_t rate)
+{
+	return -XFIREDB_ERR;
+}
+
+void xfiredb_heapprof_stop(void)
+{
+}
+
+size_t xfiredb_heapprof_rate(void)
+{
+	return 0;
+}
+
+int xfiredb_heapprof_dump(FILE *stream)
+{
+	return -XFIREDB_ERR;
+}
+#endif
+
+/** @} */
+
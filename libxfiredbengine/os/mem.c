@@ -24,16 +24,103 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <malloc.h>
+#include <unistd.h>
 
 #include <xfiredb/xfiredb.h>
 #include <xfiredb/types.h>
+#include <xfiredb/os.h>
+#include <xfiredb/mem.h>
+
+static volatile size_t used_memory[MEM_STAT_NUM];
+
+static inline void mem_account_alloc(void *region, mem_stat_t stat)
+{
+	if(region)
+		__sync_add_and_fetch(&used_memory[stat], malloc_usable_size(region));
+}
+
+static inline void mem_account_free(void *region, mem_stat_t stat)
+{
+	if(region)
+		__sync_sub_and_fetch(&used_memory[stat], malloc_usable_size(region));
+}
 
 /**
- * @brief Allocate a memory region.
+ * @brief Get the amount of memory in use.
+ * @return The number of bytes currently allocated through the XFireDB
+ *   allocator.
+ */
+size_t xfiredb_mem_used(void)
+{
+	size_t total = 0;
+	int idx;
+
+	for(idx = 0; idx < MEM_STAT_NUM; idx++)
+		total += __sync_add_and_fetch(&used_memory[idx], 0);
+
+	return total;
+}
+
+/**
+ * @brief Get the amount of memory in use by a single category.
+ * @param stat Memory category.
+ * @return The number of bytes allocated for \p stat.
+ */
+size_t xfiredb_mem_used_stat(mem_stat_t stat)
+{
+	return __sync_add_and_fetch(&used_memory[stat], 0);
+}
+
+/**
+ * @brief Get the size of an allocated memory region.
+ * @param region Region to get the size of.
+ * @return The usable size of \p region in bytes.
+ */
+size_t xfiredb_mem_size(void *region)
+{
+	return region ? malloc_usable_size(region) : 0;
+}
+
+/**
+ * @brief Get the resident set size of the process.
+ * @return The resident set size in bytes, or 0 if it is unknown.
+ */
+size_t xfiredb_mem_rss(void)
+{
+	FILE *fp;
+	unsigned long pages, rss = 0;
+
+	fp = fopen("/proc/self/statm", "r");
+	if(!fp)
+		return 0;
+
+	if(fscanf(fp, "%lu %lu", &pages, &rss) != 2)
+		rss = 0;
+	fclose(fp);
+
+	return (size_t)rss * sysconf(_SC_PAGESIZE);
+}
+
+/**
+ * @brief Move an allocated region to another memory category.
+ * @param region Region to move.
+ * @param from Current category of \p region.
+ * @param to New category of \p region.
+ */
+void xfiredb_mem_charge(void *region, mem_stat_t from, mem_stat_t to)
+{
+	mem_account_free(region, from);
+	mem_account_alloc(region, to);
+}
+
+/**
+ * @brief Allocate a memory region for a memory category.
  * @param len Number of bytes to allocate.
+ * @param stat Memory category to account the region to.
  * @return Allocated memory.
  */
-void *xfiredb_alloc(size_t len)
+void *xfiredb_alloc_stat(size_t len, mem_stat_t stat)
 {
 	void *region;
 
@@ -47,25 +134,63 @@ void *xfiredb_alloc(size_t len)
 		abort();
 	}
 
+	mem_account_alloc(region, stat);
+	xfiredb_heapprof_alloc(region, len);
 	return region;
 }
 
 /**
- * @brief Allocate a memory region.
+ * @brief Allocate a zeroed memory region for a memory category.
  * @param len Number of bytes to allocate.
+ * @param stat Memory category to account the region to.
  * @return Allocated memory.
- * @note Allocated memory will be set to zero.
  */
-void *xfiredb_zalloc(size_t len)
+void *xfiredb_zalloc_stat(size_t len, mem_stat_t stat)
 {
 	void *region;
 
-	region = xfiredb_alloc(len);
+	region = xfiredb_alloc_stat(len, stat);
 	memset(region, 0x0, len);
 
 	return region;
 }
 
+/**
+ * @brief Return memory of a memory category.
+ * @param region Memory region to deallocate.
+ * @param stat Memory category \p region was allocated for.
+ */
+void xfiredb_free_stat(void *region, mem_stat_t stat)
+{
+	if(!region)
+		return;
+
+	xfiredb_heapprof_free(region);
+	mem_account_free(region, stat);
+	free(region);
+}
+
+/**
+ * @brief Allocate a memory region.
+ * @param len Number of bytes to allocate.
+ * @return Allocated memory.
+ */
+void *xfiredb_alloc(size_t len)
+{
+	return xfiredb_alloc_stat(len, MEM_STAT_GENERAL);
+}
+
+/**
+ * @brief Allocate a memory region.
+ * @param len Number of bytes to allocate.
+ * @return Allocated memory.
+ * @note Allocated memory will be set to zero.
+ */
+void *xfiredb_zalloc(size_t len)
+{
+	return xfiredb_zalloc_stat(len, MEM_STAT_GENERAL);
+}
+
 /**
  * @brief Allocate an array.
  * @param num Number of elements to allocate.
@@ -78,6 +203,8 @@ void *xfiredb_calloc(size_t num, size_t size)
 
 	region = calloc(num, size);
 	memset(region, 0x0, num*size);
+	mem_account_alloc(region, MEM_STAT_GENERAL);
+	xfiredb_heapprof_alloc(region, num * size);
 
 	return region;
 }
@@ -90,7 +217,19 @@ void *xfiredb_calloc(size_t num, size_t size)
  */
 void *xfiredb_realloc(void *region, size_t size)
 {
-	return realloc(region, size);
+	void *rv;
+
+	xfiredb_heapprof_free(region);
+	mem_account_free(region, MEM_STAT_GENERAL);
+	rv = realloc(region, size);
+	if(!rv && size) {
+		mem_account_alloc(region, MEM_STAT_GENERAL);
+		return NULL;
+	}
+
+	mem_account_alloc(rv, MEM_STAT_GENERAL);
+	xfiredb_heapprof_alloc(rv, size);
+	return rv;
 }
 
 /**
@@ -99,10 +238,309 @@ void *xfiredb_realloc(void *region, size_t size)
  */
 void xfiredb_free(void *region)
 {
+	xfiredb_free_stat(region, MEM_STAT_GENERAL);
+}
+
+#ifdef HAVE_SLAB
+#define SLAB_ALIGN 16
+#define SLAB_MAX_SIZE 256
+#define SLAB_CLASSES (SLAB_MAX_SIZE / SLAB_ALIGN)
+#define SLAB_CHUNK_SIZE (64 * 1024)
+#define MAGAZINE_SIZE 64
+
+/*
+ * Free objects are linked through their first word while they are in
+ * the depot of their size class.
+ */
+struct slab_object {
+	struct slab_object *next;
+};
+
+struct slab_class {
+	xfiredb_spinlock_t lock;
+	struct slab_object *depot;
+};
+
+struct magazine {
+	int rounds;
+	void *objects[MAGAZINE_SIZE];
+};
+
+struct slab_cache {
+	struct magazine magazines[SLAB_CLASSES];
+};
+
+static struct slab_class slab_classes[SLAB_CLASSES];
+static volatile size_t slab_reserved;
+static pthread_once_t slab_once = PTHREAD_ONCE_INIT;
+static pthread_key_t slab_key;
+static __thread struct slab_cache *slab_thread_cache;
+
+static inline int slab_class_index(size_t size)
+{
+	return (size - 1) / SLAB_ALIGN;
+}
+
+static inline size_t slab_class_size(int idx)
+{
+	return (idx + 1) * SLAB_ALIGN;
+}
+
+static void slab_flush(struct magazine *mag, int idx, int num)
+{
+	struct slab_class *sc = &slab_classes[idx];
+	struct slab_object *obj;
+
+	xfiredb_spin_lock(&sc->lock);
+	while(num-- && mag->rounds) {
+		obj = mag->objects[--mag->rounds];
+		obj->next = sc->depot;
+		sc->depot = obj;
+	}
+	xfiredb_spin_unlock(&sc->lock);
+}
+
+static void slab_cache_release(void *arg)
+{
+	struct slab_cache *cache = arg;
+	int idx;
+
+	for(idx = 0; idx < SLAB_CLASSES; idx++)
+		slab_flush(&cache->magazines[idx], idx, MAGAZINE_SIZE);
+
+	free(cache);
+}
+
+/*
+ * Hold every depot lock across fork(), so a child process never inherits a
+ * depot locked by a thread that doesn't exist in the child.
+ */
+static void slab_fork_prepare(void)
+{
+	int idx;
+
+	for(idx = 0; idx < SLAB_CLASSES; idx++)
+		xfiredb_spin_lock(&slab_classes[idx].lock);
+}
+
+static void slab_fork_release(void)
+{
+	int idx;
+
+	for(idx = SLAB_CLASSES - 1; idx >= 0; idx--)
+		xfiredb_spin_unlock(&slab_classes[idx].lock);
+}
+
+static void slab_init(void)
+{
+	int idx;
+
+	for(idx = 0; idx < SLAB_CLASSES; idx++) {
+		xfiredb_spinlock_init(&slab_classes[idx].lock);
+		slab_classes[idx].depot = NULL;
+	}
+
+	pthread_key_create(&slab_key, &slab_cache_release);
+	pthread_atfork(&slab_fork_prepare, &slab_fork_release, &slab_fork_release);
+}
+
+static struct slab_cache *slab_get_cache(void)
+{
+	struct slab_cache *cache = slab_thread_cache;
+
+	if(likely(cache))
+		return cache;
+
+	pthread_once(&slab_once, &slab_init);
+	cache = calloc(1, sizeof(*cache));
+	if(!cache) {
+		fputs("Memory allocation failed!\n", stderr);
+		abort();
+	}
+
+	pthread_setspecific(slab_key, cache);
+	slab_thread_cache = cache;
+	return cache;
+}
+
+/*
+ * Fill an empty magazine with half a magazine of objects. Objects are
+ * taken from the depot first. If the depot is empty, a new chunk is
+ * carved up into objects and the surplus is handed to the depot.
+ */
+static void slab_refill(struct magazine *mag, int idx)
+{
+	struct slab_class *sc = &slab_classes[idx];
+	struct slab_object *obj, *head = NULL, *tail = NULL;
+	size_t size, num, i;
+	char *chunk;
+
+	xfiredb_spin_lock(&sc->lock);
+	while(sc->depot && mag->rounds < MAGAZINE_SIZE / 2) {
+		obj = sc->depot;
+		sc->depot = obj->next;
+		mag->objects[mag->rounds++] = obj;
+	}
+	xfiredb_spin_unlock(&sc->lock);
+
+	if(mag->rounds)
+		return;
+
+	chunk = malloc(SLAB_CHUNK_SIZE);
+	if(!chunk) {
+		fputs("Memory allocation failed!\n", stderr);
+		abort();
+	}
+
+	__sync_add_and_fetch(&slab_reserved, SLAB_CHUNK_SIZE);
+	size = slab_class_size(idx);
+	num = SLAB_CHUNK_SIZE / size;
+
+	for(i = 0; i < num; i++) {
+		obj = (struct slab_object*)(chunk + i * size);
+		if(mag->rounds < MAGAZINE_SIZE / 2) {
+			mag->objects[mag->rounds++] = obj;
+			continue;
+		}
+
+		obj->next = head;
+		head = obj;
+		if(!tail)
+			tail = obj;
+	}
+
+	if(!head)
+		return;
+
+	xfiredb_spin_lock(&sc->lock);
+	tail->next = sc->depot;
+	sc->depot = head;
+	xfiredb_spin_unlock(&sc->lock);
+}
+#endif
+
+/**
+ * @brief Allocate a fixed size object.
+ * @param size Size of the object.
+ * @param stat Memory category to account the object to.
+ * @return The allocated object.
+ * @see xfiredb_cache_free
+ *
+ * Objects of up to 256 bytes are taken from a per-thread cache of
+ * same-sized objects when XFireDB is built with HAVE_SLAB. Larger objects,
+ * or all objects without HAVE_SLAB, are allocated from the general heap.
+ * The object has to be returned using xfiredb_cache_free with the same
+ * \p size and \p stat.
+ */
+void *xfiredb_cache_alloc(size_t size, mem_stat_t stat)
+{
+#ifdef HAVE_SLAB
+	struct magazine *mag;
+	void *region;
+	int idx;
+
+	if(!size || size > SLAB_MAX_SIZE)
+		return xfiredb_alloc_stat(size, stat);
+
+	idx = slab_class_index(size);
+	mag = &slab_get_cache()->magazines[idx];
+	if(unlikely(!mag->rounds))
+		slab_refill(mag, idx);
+
+	__sync_add_and_fetch(&used_memory[stat], slab_class_size(idx));
+	region = mag->objects[--mag->rounds];
+	xfiredb_heapprof_alloc(region, size);
+	return region;
+#else
+	return xfiredb_alloc_stat(size, stat);
+#endif
+}
+
+/**
+ * @brief Allocate a zeroed fixed size object.
+ * @param size Size of the object.
+ * @param stat Memory category to account the object to.
+ * @return The allocated object.
+ * @see xfiredb_cache_alloc
+ */
+void *xfiredb_cache_zalloc(size_t size, mem_stat_t stat)
+{
+	void *region;
+
+	region = xfiredb_cache_alloc(size, stat);
+	if(region)
+		memset(region, 0x0, size);
+
+	return region;
+}
+
+/**
+ * @brief Return a fixed size object.
+ * @param region Object to return.
+ * @param size Size \p region was allocated with.
+ * @param stat Memory category \p region was allocated for.
+ *
+ * Objects may be returned by another thread than the one that allocated
+ * them.
+ */
+void xfiredb_cache_free(void *region, size_t size, mem_stat_t stat)
+{
+#ifdef HAVE_SLAB
+	struct magazine *mag;
+	int idx;
+
 	if(!region)
 		return;
 
-	free(region);
+	if(!size || size > SLAB_MAX_SIZE) {
+		xfiredb_free_stat(region, stat);
+		return;
+	}
+
+	xfiredb_heapprof_free(region);
+	idx = slab_class_index(size);
+	mag = &slab_get_cache()->magazines[idx];
+	if(unlikely(mag->rounds == MAGAZINE_SIZE))
+		slab_flush(mag, idx, MAGAZINE_SIZE / 2);
+
+	mag->objects[mag->rounds++] = region;
+	__sync_sub_and_fetch(&used_memory[stat], slab_class_size(idx));
+#else
+	xfiredb_free_stat(region, stat);
+#endif
+}
+
+/**
+ * @brief Get the size of a fixed size object.
+ * @param region Object to get the size of.
+ * @param size Size \p region was allocated with.
+ * @return The number of bytes used by \p region.
+ */
+size_t xfiredb_cache_size(void *region, size_t size)
+{
+	if(!region)
+		return 0;
+
+#ifdef HAVE_SLAB
+	if(size && size <= SLAB_MAX_SIZE)
+		return slab_class_size(slab_class_index(size));
+#endif
+
+	return xfiredb_mem_size(region);
+}
+
+/**
+ * @brief Get the amount of memory reserved for object caches.
+ * @return The number of bytes claimed from the system for object caches,
+ *   including objects which are not in use.
+ */
+size_t xfiredb_mem_reserved(void)
+{
+#ifdef HAVE_SLAB
+	return __sync_add_and_fetch(&slab_reserved, 0);
+#else
+	return 0;
+#endif
 }
 
 /** @} */
@@ -19,6 +19,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <time.h>
+#include <errno.h>
 
 #include <xfiredb/xfiredb.h>
 #include <xfiredb/error.h>
@@ -33,6 +35,35 @@ void xfiredb_mutex_init(xfiredb_mutex_t *m)
 	pthread_mutex_init(&m->mtx, &m->attr);
 }
 
+void xfiredb_fast_mutex_init(xfiredb_fast_mutex_t *m)
+{
+#ifdef PTHREAD_ADAPTIVE_MUTEX_INITIALIZER_NP
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ADAPTIVE_NP);
+	pthread_mutex_init(&m->mtx, &attr);
+	pthread_mutexattr_destroy(&attr);
+#else
+	pthread_mutex_init(&m->mtx, NULL);
+#endif
+}
+
+void xfiredb_rwlock_init(xfiredb_rwlock_t *l)
+{
+#ifdef PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP
+	pthread_rwlockattr_t attr;
+
+	pthread_rwlockattr_init(&attr);
+	pthread_rwlockattr_setkind_np(&attr,
+			PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+	pthread_rwlock_init(l, &attr);
+	pthread_rwlockattr_destroy(&attr);
+#else
+	pthread_rwlock_init(l, NULL);
+#endif
+}
+
 void xfiredb_mutex_destroy(xfiredb_mutex_t *m)
 {
 	pthread_mutex_destroy(&m->mtx);
@@ -49,6 +80,24 @@ void xfiredb_mutex_unlock(xfiredb_mutex_t *m)
 	pthread_mutex_unlock(&m->mtx);
 }
 
+int xfiredb_cond_timedwait(xfiredb_cond_t *c, xfiredb_mutex_t *m, time_t ms)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += ms / 1000;
+	ts.tv_nsec += (ms % 1000) * 1000000L;
+	if(ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+
+	if(pthread_cond_timedwait(c, &m->mtx, &ts) == ETIMEDOUT)
+		return -XFIREDB_ERR;
+
+	return -XFIREDB_OK;
+}
+
 struct thread *__xfiredb_create_thread(const char *name,
 				size_t *stack,
 				void *(*fn)(void*),
@@ -65,7 +114,7 @@ struct thread *__xfiredb_create_thread(const char *name,
 	pthread_attr_setdetachstate(&tp->attr, PTHREAD_CREATE_JOINABLE);
 	
 	if(pthread_create(&tp->thread, &tp->attr, fn, arg)) {
-		free(tp);
+		xfiredb_free(tp);
 		return NULL;
 	}
 
@@ -92,8 +141,8 @@ int xfiredb_destroy_thread(struct thread *tp)
 	/*
 	 * free the allocated memory inside `tp'
 	 */
-	free(tp->name);
-	free(tp);
+	xfiredb_free(tp->name);
+	xfiredb_free(tp);
 
 	return -XFIREDB_OK;
 }
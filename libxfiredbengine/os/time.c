@@ -65,3 +65,11 @@ time_t xfiredb_time_stamp(void)
 	return rv;
 }
 
+
+time_t xfiredb_clock_us(void)
+{
+	struct timespec spec;
+
+	clock_gettime(CLOCK_MONOTONIC, &spec);
+	return (time_t)spec.tv_sec * 1000000L + spec.tv_nsec / 1000L;
+}
@@ -0,0 +1,901 @@
+/*
+ *  Append-only operation log
+ *  Copyright (C) 2015   Michel Megens <dev@michelmegens.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @addtogroup aof
+ * @{
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <xfiredb/xfiredb.h>
+#include <xfiredb/types.h>
+#include <xfiredb/aof.h>
+#include <xfiredb/bio.h>
+#include <xfiredb/database.h>
+#include <xfiredb/container.h>
+#include <xfiredb/string.h>
+#include <xfiredb/list.h>
+#include <xfiredb/hashmap.h>
+#include <xfiredb/set.h>
+#include <xfiredb/disk.h>
+#include <xfiredb/error.h>
+#include <xfiredb/log.h>
+#include <xfiredb/mem.h>
+#include <xfiredb/os.h>
+#include <xfiredb/time.h>
+
+#define AOF_MAGIC "XFDBAOF1"
+#define AOF_MAGIC_SIZE 8
+#define AOF_FIELDS 3
+/* Operation, followed by the length of every field */
+#define AOF_HEADER_SIZE (1 + AOF_FIELDS * 4)
+/* Length of a field that is NULL */
+#define AOF_NULL 0xFFFFFFFFU
+#define AOF_BUFFER_SIZE (64 * 1024)
+
+/*
+ * A log is rewritten once it has grown to twice its size after the last
+ * rewrite, and is at least AOF_REWRITE_MIN bytes.
+ */
+#define AOF_REWRITE_MIN (64ULL << 20)
+#define AOF_REWRITE_GROWTH 2
+/* Time before a failed rewrite is tried again, in ms */
+#define AOF_REWRITE_RETRY 10000
+#define AOF_COPY_SIZE 8192
+
+static inline void aof_put32(unsigned char *buf, u32 value)
+{
+	buf[0] = value & 0xFF;
+	buf[1] = (value >> 8) & 0xFF;
+	buf[2] = (value >> 16) & 0xFF;
+	buf[3] = (value >> 24) & 0xFF;
+}
+
+static inline u32 aof_get32(const unsigned char *buf)
+{
+	return (u32)buf[0] | (u32)buf[1] << 8 | (u32)buf[2] << 16 |
+		(u32)buf[3] << 24;
+}
+
+/*
+ * Open a log for appending, and write the magic if it is empty. The size
+ * of the log is stored in \p size.
+ */
+static FILE *aof_open(const char *path, const char *mode, u64 *size)
+{
+	FILE *file;
+	long pos;
+
+	file = fopen(path, mode);
+	if(!file)
+		return NULL;
+
+	setvbuf(file, NULL, _IOFBF, AOF_BUFFER_SIZE);
+	fseek(file, 0L, SEEK_END);
+	pos = ftell(file);
+
+	/* Empty, or cut off while it was created */
+	if(pos < AOF_MAGIC_SIZE) {
+		if(pos > 0 && ftruncate(fileno(file), 0)) {
+			fclose(file);
+			return NULL;
+		}
+
+		fwrite(AOF_MAGIC, 1, AOF_MAGIC_SIZE, file);
+		fflush(file);
+		pos = AOF_MAGIC_SIZE;
+	}
+
+	*size = pos;
+	return file;
+}
+
+static inline void aof_fields(const char **fields, size_t *lens,
+		const char *key, const char *arg, const char *data, size_t len)
+{
+	fields[0] = key;
+	fields[1] = arg;
+	fields[2] = data;
+	lens[0] = key ? strlen(key) : 0;
+	lens[1] = arg ? strlen(arg) : 0;
+	lens[2] = data ? len : 0;
+}
+
+/*
+ * Write a single record to \p file. The length of every field is given
+ * by \p len. Returns the number of bytes written, or 0 on failure.
+ */
+static size_t aof_write(FILE *file, bio_operation_t op, const char **fields,
+		const size_t *len)
+{
+	unsigned char hdr[AOF_HEADER_SIZE];
+	size_t total;
+	int idx;
+
+	hdr[0] = op;
+	total = AOF_HEADER_SIZE;
+	for(idx = 0; idx < AOF_FIELDS; idx++) {
+		aof_put32(&hdr[1 + idx * 4], fields[idx] ? len[idx] : AOF_NULL);
+		total += len[idx];
+	}
+
+	if(fwrite(hdr, 1, sizeof(hdr), file) != sizeof(hdr))
+		return 0;
+
+	for(idx = 0; idx < AOF_FIELDS; idx++) {
+		if(len[idx] && fwrite(fields[idx], 1, len[idx], file) != len[idx])
+			return 0;
+	}
+
+	return total;
+}
+
+static inline int aof_fsync(FILE *file)
+{
+	if(fflush(file) || fsync(fileno(file)))
+		return -XFIREDB_ERR;
+
+	return -XFIREDB_OK;
+}
+
+static bio_operation_t aof_del_op(bio_operation_t op)
+{
+	switch(op) {
+	case LIST_ADD:
+		return LIST_DEL;
+	case HM_ADD:
+		return HM_DEL;
+	case SET_ADD:
+		return SET_DEL;
+	case STRING_ADD:
+	default:
+		return STRING_DEL;
+	}
+}
+
+/*
+ * Replay a record onto \p d. Adds replace the entry they add, so records
+ * that were logged twice (during a rewrite) are harmless.
+ */
+static void aof_apply(struct disk *d, bio_operation_t op, char **fields,
+		size_t *len)
+{
+	switch(op) {
+	case STRING_ADD:
+	case LIST_ADD:
+	case HM_ADD:
+	case SET_ADD:
+		bio_apply(d, aof_del_op(op), fields[0], fields[1], NULL, 0);
+		break;
+
+	default:
+		break;
+	}
+
+	bio_apply(d, op, fields[0], fields[1], fields[2], len[2]);
+}
+
+/*
+ * Read the log at \p path sequentially, and replay every complete record
+ * onto \p d, if it isn't NULL. If \p key isn't NULL, records about other
+ * keys are skipped without being read. Returns the number of bytes holding
+ * complete records, or 0 if \p path isn't a log. The number of records is
+ * stored in \p records.
+ */
+static u64 aof_read(const char *path, struct disk *d, const char *key,
+		u64 *records)
+{
+	FILE *file;
+	unsigned char hdr[AOF_HEADER_SIZE];
+	char magic[AOF_MAGIC_SIZE];
+	char *buf = NULL, *fields[AOF_FIELDS];
+	size_t bufsize = 0, total, len[AOF_FIELDS];
+	size_t keylen = key ? strlen(key) : 0;
+	bool skip;
+	u64 good;
+	u32 raw;
+	int idx;
+
+	*records = 0ULL;
+	file = fopen(path, "rb");
+	if(!file)
+		return AOF_MAGIC_SIZE;
+
+	setvbuf(file, NULL, _IOFBF, AOF_BUFFER_SIZE);
+	if(fread(magic, 1, sizeof(magic), file) != sizeof(magic)) {
+		/* An empty file, or one cut off while it was created */
+		fclose(file);
+		return AOF_MAGIC_SIZE;
+	}
+
+	if(memcmp(magic, AOF_MAGIC, AOF_MAGIC_SIZE)) {
+		fclose(file);
+		return 0ULL;
+	}
+
+	good = AOF_MAGIC_SIZE;
+	while(fread(hdr, 1, sizeof(hdr), file) == sizeof(hdr)) {
+		if(hdr[0] >= BIO_OPERATIONS)
+			break;
+
+		for(total = idx = 0; idx < AOF_FIELDS; idx++) {
+			raw = aof_get32(&hdr[1 + idx * 4]);
+			len[idx] = raw == AOF_NULL ? 0 : raw;
+			total += len[idx] + 1;
+		}
+
+		if(total > bufsize) {
+			bufsize = total;
+			buf = xfiredb_realloc(buf, bufsize);
+		}
+
+		skip = false;
+		for(total = idx = 0; idx < AOF_FIELDS; idx++) {
+			fields[idx] = buf + total;
+			if(fread(fields[idx], 1, len[idx], file) != len[idx])
+				break;
+
+			fields[idx][len[idx]] = '\0';
+			total += len[idx] + 1;
+			if(aof_get32(&hdr[1 + idx * 4]) == AOF_NULL)
+				fields[idx] = NULL;
+
+			if(!idx && key && (!fields[0] || len[0] != keylen ||
+						memcmp(fields[0], key, keylen))) {
+				skip = true;
+				break;
+			}
+		}
+
+		if(skip) {
+			if(fseek(file, (long)(len[1] + len[2]), SEEK_CUR))
+				break;
+			continue;
+		}
+
+		/* Cut off by a crash */
+		if(idx != AOF_FIELDS)
+			break;
+
+		if(d)
+			aof_apply(d, hdr[0], fields, len);
+
+		good += AOF_HEADER_SIZE + total - AOF_FIELDS;
+		*records += 1;
+	}
+
+	xfiredb_free(buf);
+	fclose(file);
+	return good;
+}
+
+/**
+ * @brief Open an append-only log.
+ * @param path Path to the log. Created if it doesn't exist.
+ * @return The log.
+ *
+ * A record that was cut off by a crash is removed from the end of the
+ * log, and the files of a rewrite that didn't finish are removed.
+ */
+struct aof *aof_create(const char *path)
+{
+	struct aof *aof;
+	u64 good, records;
+
+	good = aof_read(path, NULL, NULL, &records);
+	if(!good) {
+		fprintf(stderr, "%s is not an append-only log\n", path);
+		exit(-EXIT_FAILURE);
+	}
+
+	aof = xfiredb_zalloc(sizeof(*aof));
+	xfiredb_sprintf(&aof->path, "%s", path);
+	xfiredb_sprintf(&aof->rewrite_path, "%s.rewrite", path);
+	xfiredb_sprintf(&aof->incr_path, "%s.rewrite.incr", path);
+	unlink(aof->rewrite_path);
+	unlink(aof->incr_path);
+
+	aof->file = aof_open(path, "ab", &aof->size);
+	if(!aof->file) {
+		fprintf(stderr, "Cannot create append-only log %s\n", path);
+		exit(-EXIT_FAILURE);
+	}
+
+	if(aof->size > good) {
+		xfiredb_log_console(LOG_DISK, "Removing %llu bytes of incomplete records from %s\n",
+				(unsigned long long)(aof->size - good), path);
+		if(ftruncate(fileno(aof->file), good))
+			xfiredb_log_err(LOG_DISK, "Could not truncate %s\n", path);
+		aof->size = good;
+	}
+
+	aof->records = records;
+	aof->base_size = aof->size;
+	aof->fsync = AOF_FSYNC_EVERYSEC;
+	xfiredb_mutex_init(&aof->lock);
+
+	return aof;
+}
+
+/*
+ * Stop a rewrite, killing its child if it is still running, and remove
+ * its files. Called with the log locked.
+ */
+static void aof_rewrite_abort(struct aof *aof)
+{
+	if(aof->child > 0) {
+		kill(aof->child, SIGKILL);
+		while(waitpid(aof->child, NULL, 0) < 0 && errno == EINTR);
+		close(aof->rewrite_pipe);
+		aof->child = 0;
+	}
+
+	if(aof->rewrite) {
+		fclose(aof->rewrite);
+		aof->rewrite = NULL;
+	}
+
+	unlink(aof->incr_path);
+	unlink(aof->rewrite_path);
+}
+
+/**
+ * @brief Close an append-only log.
+ * @param aof Log to close.
+ *
+ * Syncs the log before closing it. A rewrite that is still in progress
+ * is thrown away.
+ */
+void aof_destroy(struct aof *aof)
+{
+	if(!aof)
+		return;
+
+	aof_rewrite_abort(aof);
+	aof_fsync(aof->file);
+	fclose(aof->file);
+
+	xfiredb_mutex_destroy(&aof->lock);
+	xfiredb_free(aof->incr_path);
+	xfiredb_free(aof->rewrite_path);
+	xfiredb_free(aof->path);
+	xfiredb_free(aof);
+}
+
+/**
+ * @brief Set the sync policy of a log.
+ * @param aof Log to configure.
+ * @param policy Sync policy.
+ */
+void aof_set_fsync(struct aof *aof, aof_fsync_t policy)
+{
+	xfiredb_mutex_lock(&aof->lock);
+	aof->fsync = policy;
+	xfiredb_mutex_unlock(&aof->lock);
+}
+
+static void aof_rewrite_record(FILE *file, u64 *records, bio_operation_t op,
+		const char *key, const char *arg, const char *data, size_t len)
+{
+	const char *fields[AOF_FIELDS];
+	size_t lens[AOF_FIELDS];
+
+	aof_fields(fields, lens, key, arg, data, len);
+	if(aof_write(file, op, fields, lens))
+		*records += 1;
+}
+
+/*
+ * Write the records that recreate container \p c, stored under \p key.
+ */
+static void aof_rewrite_entry(FILE *file, u64 *records, const char *key,
+		struct container *c)
+{
+	char id[BIO_ID_SIZE];
+	const char *value;
+	size_t len;
+	struct string *s;
+	struct list *l;
+	struct list_head *lh;
+	struct hashmap *map;
+	struct hashmap_node *node;
+	struct hashmap_iterator *it;
+	struct set *set;
+	struct set_key *k;
+	struct set_iterator *set_it;
+
+	switch(container_type(c)) {
+	case CONTAINER_STRING:
+		s = container_get_data(c);
+		value = string_borrow(s, &len);
+		aof_rewrite_record(file, records, STRING_ADD, key, NULL, value, len);
+		string_unborrow(s);
+		break;
+
+	case CONTAINER_LIST:
+		lh = container_get_data(c);
+		list_for_each(lh, l) {
+			s = container_of(l, struct string, entry);
+			snprintf(id, sizeof(id), "%lld", (long long)list_entry_id(l));
+			value = string_borrow(s, &len);
+			aof_rewrite_record(file, records, LIST_ADD, key, id, value, len);
+			string_unborrow(s);
+		}
+		break;
+
+	case CONTAINER_HASHMAP:
+		map = container_get_data(c);
+		it = hashmap_new_iterator(map);
+		for(node = hashmap_iterator_next(it); node;
+				node = hashmap_iterator_next(it)) {
+			s = container_of(node, struct string, node);
+			value = string_borrow(s, &len);
+			aof_rewrite_record(file, records, HM_ADD, key, node->key,
+					value, len);
+			string_unborrow(s);
+		}
+		hashmap_free_iterator(it);
+		break;
+
+	case CONTAINER_SET:
+		set = container_get_data(c);
+		set_it = set_iterator_new(set);
+		for_each_set(set, k, set_it)
+			aof_rewrite_record(file, records, SET_ADD, key, k->key, NULL, 0);
+		set_iterator_free(set_it);
+		break;
+
+	default:
+		break;
+	}
+}
+
+/*
+ * Write a new log at \p path holding every entry of \p db, and report the
+ * number of records on \p fd. Runs in the child forked by aof_bgrewrite.
+ * Returns the exit status of the child.
+ */
+static int aof_rewrite_child(const char *path, struct database *db, int fd)
+{
+	struct db_iterator *it;
+	struct db_entry *e;
+	FILE *file;
+	u64 size, records = 0ULL;
+
+	file = aof_open(path, "wb", &size);
+	if(!file)
+		return 1;
+
+	it = db_get_iterator(db);
+	for(e = db_iterator_next(it); e; e = db_iterator_next(it))
+		aof_rewrite_entry(file, &records, e->key, e->value.ptr);
+	db_iterator_free(it);
+
+	if(ferror(file) || aof_fsync(file) || fclose(file))
+		return 1;
+
+	if(write(fd, &records, sizeof(records)) != sizeof(records))
+		return 1;
+
+	return 0;
+}
+
+/*
+ * Add the records appended during the rewrite to the new log, and let it
+ * replace the active log. \p records is the number of records the child
+ * wrote. Called with the log locked.
+ */
+static int aof_rewrite_end(struct aof *aof, u64 records)
+{
+	FILE *file, *incr;
+	char buf[AOF_COPY_SIZE];
+	size_t num;
+	u64 size;
+	int rc = -XFIREDB_OK;
+
+	if(fflush(aof->rewrite))
+		return -XFIREDB_ERR;
+
+	file = aof_open(aof->rewrite_path, "ab", &size);
+	if(!file)
+		return -XFIREDB_ERR;
+
+	incr = fopen(aof->incr_path, "rb");
+	if(!incr) {
+		fclose(file);
+		return -XFIREDB_ERR;
+	}
+
+	while((num = fread(buf, 1, sizeof(buf), incr)) > 0) {
+		if(fwrite(buf, 1, num, file) != num)
+			break;
+	}
+
+	if(ferror(incr) || ferror(file))
+		rc = -XFIREDB_ERR;
+	fclose(incr);
+
+	if(rc || aof_fsync(file) || rename(aof->rewrite_path, aof->path)) {
+		fclose(file);
+		return -XFIREDB_ERR;
+	}
+
+	fclose(aof->file);
+	fclose(aof->rewrite);
+	unlink(aof->incr_path);
+
+	aof->file = file;
+	aof->rewrite = NULL;
+	aof->size = aof->base_size = size + aof->rewrite_size;
+	aof->records = records + aof->rewrite_records;
+	aof->dirty = false;
+
+	return -XFIREDB_OK;
+}
+
+/*
+ * Reap the child of a rewrite, and finish the rewrite if it succeeded.
+ * Doesn't block unless \p wait is set. Called with the log locked.
+ */
+static void aof_rewrite_reap(struct aof *aof, bool wait)
+{
+	u64 records = 0ULL;
+	pid_t pid;
+	int status;
+	bool ok;
+
+	if(aof->child <= 0)
+		return;
+
+	do {
+		pid = waitpid(aof->child, &status, wait ? 0 : WNOHANG);
+	} while(pid < 0 && errno == EINTR);
+
+	if(!pid)
+		return;
+
+	ok = pid == aof->child && WIFEXITED(status) && !WEXITSTATUS(status) &&
+		read(aof->rewrite_pipe, &records, sizeof(records)) == sizeof(records);
+	close(aof->rewrite_pipe);
+	aof->child = 0;
+
+	if(!ok || aof_rewrite_end(aof, records)) {
+		xfiredb_log_err(LOG_DISK, "Background rewrite of %s failed\n", aof->path);
+		aof_rewrite_abort(aof);
+		aof->rewrite_retry = xfiredb_time_stamp() + AOF_REWRITE_RETRY;
+		return;
+	}
+
+	aof->rewrite_retry = 0;
+	xfiredb_log(LOG_DISK, "Background rewrite of %s finished\n", aof->path);
+}
+
+/**
+ * @brief Rewrite a log in the background.
+ * @param aof Log to rewrite.
+ * @param db Database to write the new log from.
+ * @return Error code. Fails if a rewrite is already running.
+ *
+ * The process is forked, and the child writes a new log from its copy on
+ * write view of \p db. Records appended while the child runs go to both
+ * the active log and a separate file, which is added to the new log once
+ * the child is done. The new log then replaces the active log. The child
+ * is reaped by aof_commit and aof_sync, or by aof_rewrite_wait.
+ *
+ * Every record that changes \p db before the fork has to be appended
+ * already, and \p db may not be modified by other threads while the
+ * process is forked.
+ */
+int aof_bgrewrite(struct aof *aof, struct database *db)
+{
+	int fds[2];
+	pid_t pid;
+
+	xfiredb_mutex_lock(&aof->lock);
+	if(aof->child > 0) {
+		xfiredb_mutex_unlock(&aof->lock);
+		return -XFIREDB_ERR;
+	}
+
+	aof_rewrite_abort(aof);
+	aof->rewrite = fopen(aof->incr_path, "wb");
+	if(!aof->rewrite || pipe(fds)) {
+		aof_rewrite_abort(aof);
+		xfiredb_mutex_unlock(&aof->lock);
+		xfiredb_log_err(LOG_DISK, "Could not start rewrite of %s\n", aof->path);
+		return -XFIREDB_ERR;
+	}
+
+	setvbuf(aof->rewrite, NULL, _IOFBF, AOF_BUFFER_SIZE);
+	aof->rewrite_records = 0ULL;
+	aof->rewrite_size = 0ULL;
+	fflush(aof->file);
+
+	/* Make sure the key space isn't half way a change in the child */
+	xfiredb_read_lock(&db->container->lock);
+	xfiredb_read_lock(&db->expires->lock);
+	pid = fork();
+	xfiredb_read_unlock(&db->expires->lock);
+	xfiredb_read_unlock(&db->container->lock);
+
+	if(!pid) {
+		close(fds[0]);
+		_exit(aof_rewrite_child(aof->rewrite_path, db, fds[1]));
+	}
+
+	close(fds[1]);
+	if(pid < 0) {
+		close(fds[0]);
+		aof_rewrite_abort(aof);
+		xfiredb_mutex_unlock(&aof->lock);
+		xfiredb_log_err(LOG_DISK, "Could not fork to rewrite %s\n", aof->path);
+		return -XFIREDB_ERR;
+	}
+
+	aof->child = pid;
+	aof->rewrite_pipe = fds[0];
+	xfiredb_mutex_unlock(&aof->lock);
+
+	return -XFIREDB_OK;
+}
+
+/**
+ * @brief Wait for a background rewrite to finish.
+ * @param aof Log that is being rewritten.
+ *
+ * Appends to \p aof wait until the rewrite is done.
+ */
+void aof_rewrite_wait(struct aof *aof)
+{
+	xfiredb_mutex_lock(&aof->lock);
+	aof_rewrite_reap(aof, true);
+	xfiredb_mutex_unlock(&aof->lock);
+}
+
+/**
+ * @brief Append a record to a log.
+ * @param aof Log to append to.
+ * @param op Operation to log.
+ * @param key Key of the entry.
+ * @param arg Extra info about the entry, see bio_queue_add.
+ * @param data New data of the entry.
+ * @param len Length of \p data in bytes.
+ * @return An error code.
+ *
+ * Records are buffered until aof_commit is called. DB_CLEAR and DB_SAVE
+ * are ignored; the log is compacted by aof_bgrewrite instead.
+ */
+int aof_append(struct aof *aof, bio_operation_t op, const char *key,
+		const char *arg, const char *data, size_t len)
+{
+	const char *fields[AOF_FIELDS];
+	size_t lens[AOF_FIELDS], written;
+	int rc = -XFIREDB_OK;
+
+	aof_fields(fields, lens, key, arg, data, len);
+
+	xfiredb_mutex_lock(&aof->lock);
+	switch(op) {
+	case DB_CLEAR:
+	case DB_SAVE:
+		break;
+
+	default:
+		written = aof_write(aof->file, op, fields, lens);
+		aof->size += written;
+		aof->records++;
+		if(!written)
+			rc = -XFIREDB_ERR;
+
+		if(aof->rewrite) {
+			aof->rewrite_size += aof_write(aof->rewrite, op, fields, lens);
+			aof->rewrite_records++;
+		}
+		break;
+	}
+	xfiredb_mutex_unlock(&aof->lock);
+
+	if(rc)
+		xfiredb_log_err(LOG_DISK, "Append to %s failed\n", aof->path);
+
+	return rc;
+}
+
+/**
+ * @brief Commit the records appended to a log.
+ * @param aof Log to commit.
+ * @return An error code.
+ *
+ * Hands the records to the operating system, and syncs them to disk if
+ * the sync policy is AOF_FSYNC_ALWAYS.
+ */
+int aof_commit(struct aof *aof)
+{
+	int rc = -XFIREDB_OK;
+
+	xfiredb_mutex_lock(&aof->lock);
+	if(aof->fsync == AOF_FSYNC_ALWAYS) {
+		rc = aof_fsync(aof->file);
+	} else {
+		if(fflush(aof->file))
+			rc = -XFIREDB_ERR;
+		aof->dirty = aof->fsync == AOF_FSYNC_EVERYSEC;
+	}
+
+	if(aof->rewrite)
+		fflush(aof->rewrite);
+	aof_rewrite_reap(aof, false);
+	xfiredb_mutex_unlock(&aof->lock);
+
+	if(rc)
+		xfiredb_log_err(LOG_DISK, "Commit to %s failed\n", aof->path);
+
+	return rc;
+}
+
+/**
+ * @brief Sync a log to disk.
+ * @param aof Log to sync.
+ * @return An error code.
+ *
+ * Called once a second. Doesn't sync if nothing was committed since the
+ * last sync, or if the sync policy is AOF_FSYNC_NO. Also finishes a
+ * background rewrite whose child is done.
+ */
+int aof_sync(struct aof *aof)
+{
+	int rc = -XFIREDB_OK;
+
+	xfiredb_mutex_lock(&aof->lock);
+	aof_rewrite_reap(aof, false);
+	if(aof->dirty && aof->fsync != AOF_FSYNC_NO) {
+		rc = aof_fsync(aof->file);
+		aof->dirty = false;
+	}
+	xfiredb_mutex_unlock(&aof->lock);
+
+	return rc;
+}
+
+/**
+ * @brief Remove every record from a log.
+ * @param aof Log to clear.
+ */
+void aof_clear(struct aof *aof)
+{
+	xfiredb_mutex_lock(&aof->lock);
+	aof_rewrite_abort(aof);
+	fclose(aof->file);
+
+	aof->file = aof_open(aof->path, "wb", &aof->size);
+	if(!aof->file) {
+		fprintf(stderr, "Cannot create append-only log %s\n", aof->path);
+		exit(-EXIT_FAILURE);
+	}
+
+	aof->base_size = aof->size;
+	aof->records = 0ULL;
+	aof->dirty = true;
+	xfiredb_mutex_unlock(&aof->lock);
+}
+
+/**
+ * @brief Check if a log should be rewritten.
+ * @param aof Log to check.
+ * @return True if the log has grown enough since its last rewrite, or if
+ *   the last rewrite failed and is due to be tried again.
+ * @see xfiredb_se_snapshot
+ */
+bool aof_rewrite_needed(struct aof *aof)
+{
+	bool rv;
+
+	xfiredb_mutex_lock(&aof->lock);
+	if(aof->child > 0)
+		rv = false;
+	else if(aof->rewrite_retry)
+		rv = xfiredb_time_stamp() >= aof->rewrite_retry;
+	else
+		rv = aof->size >= AOF_REWRITE_MIN &&
+			aof->size >= aof->base_size * AOF_REWRITE_GROWTH;
+	xfiredb_mutex_unlock(&aof->lock);
+
+	return rv;
+}
+
+/**
+ * @brief Get the number of records in a log.
+ * @param aof Log to get the size of.
+ * @return The number of records in the active log.
+ */
+long aof_size(struct aof *aof)
+{
+	return (long)aof->records;
+}
+
+/*
+ * Replay the log onto an in-memory disk, which can be loaded the same way
+ * as the SQLite engine. Only the records about \p key are replayed if it
+ * isn't NULL.
+ */
+static struct disk *aof_replay(struct aof *aof, const char *key)
+{
+	struct disk *d;
+	u64 records;
+
+	xfiredb_mutex_lock(&aof->lock);
+	fflush(aof->file);
+
+	d = disk_create(":memory:");
+	disk_begin(d);
+	aof_read(aof->path, d, key, &records);
+	disk_commit(d);
+	xfiredb_mutex_unlock(&aof->lock);
+
+	return d;
+}
+
+/**
+ * @brief Load a log into memory.
+ * @param aof Log to load.
+ * @param hook Load hook, called with the same rows as disk_load.
+ * @return Error code.
+ */
+int aof_load(struct aof *aof,
+		void (*hook)(int argc, char **rows, size_t *lens, char **cols))
+{
+	struct disk *d;
+
+	d = aof_replay(aof, NULL);
+	disk_load(d, hook);
+	disk_destroy(d);
+
+	return -XFIREDB_OK;
+}
+
+/**
+ * @brief Load a single key from a log.
+ * @param aof Log to load from.
+ * @param key Key to load.
+ * @param hook Load hook, called with the same rows as disk_load_key.
+ * @return Error code.
+ *
+ * The log is scanned once, and only the records about \p key are replayed.
+ */
+int aof_load_key(struct aof *aof, char *key,
+		void (*hook)(int argc, char **rows, size_t *lens, char **cols))
+{
+	struct disk *d;
+	int rc;
+
+	d = aof_replay(aof, key);
+	rc = disk_load_key(d, key, hook);
+	disk_destroy(d);
+
+	return rc;
+}
+
+/** @} */
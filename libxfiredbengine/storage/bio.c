@@ -23,6 +23,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 
 #include <xfiredb/xfiredb.h>
@@ -34,7 +35,9 @@
 #include <xfiredb/os.h>
 #include <xfiredb/error.h>
 #include <xfiredb/disk.h>
+#include <xfiredb/aof.h>
 #include <xfiredb/time.h>
+#include <xfiredb/log.h>
 
 extern struct disk *dbg_disk;
 #ifndef HAVE_DEBUG
@@ -43,96 +46,663 @@ extern struct disk *xfiredb_disk;
 static struct bio_q_head *bio_q;
 
 #define BIO_WORKER_NAME "bio-worker"
+#define BIO_CHECKPOINT_NAME "bio-checkpoint"
+/* Time between two syncs of the append-only log, in ms */
+#define BIO_AOF_SYNC_INTERVAL 1000
+#define BIO_FULL_SPINS 100
+#define BIO_COALESCE_SIZE (BIO_RING_SIZE * 2)
+/* Maximum time between two wake ups of the worker by a waiter, in ms */
+#define BIO_WAIT_INTERVAL 100
 
-static inline struct bio_q *bio_queue_pop(void)
+#define FNV_OFFSET 2166136261U
+#define FNV_PRIME 16777619U
+
+/*
+ * Group commit limits, indexed by persistency level. Higher levels trade
+ * durability of the most recent changes for write throughput.
+ */
+static struct bio_batch bio_batches[BIO_PERSIST_LEVELS] = {
+	{ 32, 5 },
+	{ 256, 50 },
+	{ 1024, 250 },
+};
+
+/*
+ * Flush policies, indexed by persistency level.
+ */
+static struct bio_flush bio_flushes[BIO_PERSIST_LEVELS] = {
+	{ 1, 10 },
+	{ 64, 100 },
+	{ 1024, 1000 },
+};
+
+/*
+ * SQLite profiles, indexed by persistency level. Every level runs in WAL
+ * mode. Level 0 syncs every commit, level 1 only syncs at checkpoints and
+ * level 2 never syncs. The lower levels get a larger cache and leave more
+ * time between checkpoints.
+ */
+static struct disk_profile bio_profiles[BIO_PERSIST_LEVELS] = {
+	{ DISK_SYNC_FULL, 8 * 1024, 64UL << 20, 1000 },
+	{ DISK_SYNC_NORMAL, 32 * 1024, 256UL << 20, 5000 },
+	{ DISK_SYNC_OFF, 64 * 1024, 256UL << 20, 30000 },
+};
+
+static inline int bio_level(int level)
 {
-	struct bio_q *tail;
+	if(level < 0)
+		return 0;
+	else if(level >= BIO_PERSIST_LEVELS)
+		return BIO_PERSIST_LEVELS - 1;
 
-	xfiredb_spin_lock(&bio_q->lock);
-	tail = bio_q->tail;
-	
-	if(tail) {
-		bio_q->tail = tail->prev;
-
-		if(tail->prev) {
-			tail->prev->next = NULL;
-		} else {
-			bio_q->next = NULL;
+	return level;
+}
+
+static inline void bio_wakeup(void)
+{
+	bg_job_signal(bio_q->job);
+}
+
+/*
+ * Claim the next free slot of the ring. The position of the slot is
+ * stored in \p pos, and has to be passed to bio_ring_publish. If the ring
+ * is full, the worker is woken up and the caller spins until it has made
+ * room.
+ */
+static struct bio_q *bio_ring_claim(unsigned long *pos)
+{
+	struct bio_q *q;
+	unsigned long head;
+	long diff;
+	int spins = 0;
+
+	while(true) {
+		head = bio_q->head;
+		q = &bio_q->ring[head & bio_q->mask];
+		diff = (long)(q->seq - head);
+
+		if(!diff) {
+			if(__sync_bool_compare_and_swap(&bio_q->head, head, head + 1))
+				break;
+		} else if(diff < 0 && ++spins == BIO_FULL_SPINS) {
+			spins = 0;
+			bio_wakeup();
+			sched_yield();
 		}
+	}
+
+	*pos = head;
+	return q;
+}
+
+static inline void bio_ring_publish(struct bio_q *q, unsigned long pos)
+{
+	barrier();
+	q->seq = pos + 1;
+}
+
+/*
+ * Get the published record \p offset positions past the oldest one. Only
+ * the BIO worker consumes records, so the record stays valid until it is
+ * released with bio_ring_release.
+ */
+static inline struct bio_q *bio_ring_peek(unsigned long offset)
+{
+	struct bio_q *q;
+	unsigned long pos;
+
+	pos = bio_q->tail + offset;
+	q = &bio_q->ring[pos & bio_q->mask];
+	if(q->seq != pos + 1)
+		return NULL;
+
+	barrier();
+	return q;
+}
+
+static inline size_t bio_len(const char *data)
+{
+	return data ? strlen(data) + 1 : 0;
+}
+
+static inline size_t bio_data_len(const void *data, size_t len)
+{
+	return data ? len + 1 : 0;
+}
+
+static inline bool bio_is_inline(struct bio_q *q, const char *data)
+{
+	return data >= q->buf && data < q->buf + BIO_INLINE_SIZE;
+}
+
+static inline void bio_release_data(struct bio_q *q, char *data)
+{
+	if(data && !bio_is_inline(q, data))
+		xfiredb_free_stat(data, MEM_STAT_BIO);
+}
 
-		tail->next = tail->prev = NULL;
+/*
+ * Hand the \p num oldest records back to the producers.
+ */
+static void bio_ring_release(unsigned long num)
+{
+	struct bio_q *q;
+	unsigned long tail, pos;
+
+	size_t bytes = 0;
+
+	tail = bio_q->tail;
+	for(pos = tail; pos != tail + num; pos++) {
+		q = &bio_q->ring[pos & bio_q->mask];
+		bytes += bio_len(q->key) + bio_len(q->arg) +
+			bio_data_len(q->newdata, q->len);
+		bio_release_data(q, q->key);
+		bio_release_data(q, q->arg);
+		bio_release_data(q, q->newdata);
 
-		bio_q->size--;
+		barrier();
+		q->seq = pos + bio_q->mask + 1;
 	}
-	xfiredb_spin_unlock(&bio_q->lock);
 
-	return tail;
+	__sync_fetch_and_sub(&bio_q->bytes, bytes);
+	bio_q->tail = tail + num;
+}
+
+/*
+ * Copy the \p len bytes at \p data into the inline buffer of \p q, if
+ * there is room left for them. Otherwise a separate copy is allocated. The
+ * copy is NUL terminated, but may hold NUL bytes itself.
+ */
+static char *bio_copy(struct bio_q *q, size_t *used, const void *data, size_t len)
+{
+	char *copy;
+
+	if(!data)
+		return NULL;
+
+	if(*used + len + 1 <= BIO_INLINE_SIZE) {
+		copy = q->buf + *used;
+		*used += len + 1;
+	} else {
+		copy = xfiredb_alloc_stat(len + 1, MEM_STAT_BIO);
+	}
+
+	memcpy(copy, data, len);
+	copy[len] = '\0';
+	return copy;
+}
+
+/*
+ * Count a queued record, and wake up the worker once enough records have
+ * been queued. Only the producer that resets the counter signals, and not
+ * while the worker is running, which bounds the signal rate to one per
+ * flush. Records queued while the worker runs are picked up by that run,
+ * or by the periodic flush.
+ */
+static void bio_try_wakeup_worker(void)
+{
+	struct bio_flush *flush;
+	unsigned long count;
+
+	flush = &bio_flushes[bio_level(xfiredb_get_config()->persist_level)];
+	count = __sync_add_and_fetch(&bio_q->unflushed, 1);
+	if(count < flush->ops || bio_q->running)
+		return;
+
+	if(__sync_bool_compare_and_swap(&bio_q->unflushed, count, 0))
+		bio_wakeup();
 }
 
-static int bio_try_wakeup_worker(void)
+static inline s64 bio_list_id(const char *arg)
+{
+	return arg ? strtoll(arg, NULL, 10) : 0LL;
+}
+
+/**
+ * @brief Apply a BIO operation to a disk.
+ * @param d Disk to write to.
+ * @param op Operation to apply.
+ * @param key Key of the entry.
+ * @param arg Extra info about the entry, see bio_queue_add.
+ * @param data New data of the entry.
+ * @param len Length of \p data in bytes.
+ */
+void bio_apply(struct disk *d, bio_operation_t op, const char *key,
+		const char *arg, const char *data, size_t len)
+{
+	char *k = (char*)key, *a = (char*)arg, *v = (char*)data;
+
+	switch(op) {
+	case STRING_ADD:
+		disk_store_string_len(d, k, v, len);
+		break;
+	case STRING_UPDATE:
+		disk_update_string_len(d, k, v, len);
+		break;
+	case STRING_DEL:
+		disk_delete_string(d, k);
+		break;
+	case STRING_APPEND:
+		disk_append_string_len(d, k, v, len);
+		break;
+	case LIST_ADD:
+		disk_store_list_entry_len(d, k, bio_list_id(a), v, len);
+		break;
+	case LIST_DEL:
+		disk_delete_list(d, k, bio_list_id(a));
+		break;
+	case LIST_UPDATE:
+		disk_update_list_len(d, k, bio_list_id(a), v, len);
+		break;
+	case HM_ADD:
+		disk_store_hm_node_len(d, k, a, v, len);
+		break;
+	case HM_DEL:
+		disk_delete_hashmapnode(d, k, a);
+		break;
+	case HM_UPDATE:
+		disk_update_hm_len(d, k, a, v, len);
+		break;
+	case SET_ADD:
+		disk_store_set_key(d, k, a);
+		break;
+	case SET_DEL:
+		disk_delete_set_key(d, k, a);
+		break;
+	case DB_CLEAR:
+		disk_clear(d);
+		break;
+	case DB_SAVE:
+		/* The worker commits the snapshot */
+		break;
+	default:
+		break;
+	}
+}
+
+static void bio_write_timed(struct bio_q *q)
+{
+	struct bio_op_stats *stats;
+	time_t start;
+	u64 usec;
+
+	start = xfiredb_clock_us();
+	if(aof_db)
+		aof_append(aof_db, q->operation, q->key, q->arg,
+				q->newdata, q->len);
+	else
+		bio_apply(disk_db, q->operation, q->key, q->arg,
+				q->newdata, q->len);
+	usec = xfiredb_clock_us() - start;
+
+	stats = &bio_q->ops[q->operation];
+	stats->calls++;
+	stats->usec += usec;
+	if(usec > stats->max_usec)
+		stats->max_usec = usec;
+	bio_q->written++;
+}
+
+/*
+ * A snapshot is written in a single transaction, from the clear of the
+ * disk up to and including the end of the snapshot, so the disk never
+ * holds a partial snapshot. Batches within it don't start or commit a
+ * transaction of their own.
+ */
+static inline void bio_begin(void)
+{
+	if(!aof_db && !bio_q->rewriting)
+		disk_begin(disk_db);
+}
+
+static void bio_disk_checkpoint(void)
+{
+	bio_q->last_checkpoint = xfiredb_time_stamp();
+	disk_checkpoint(disk_db);
+}
+
+static inline void bio_commit(void)
 {
-	static int wake_up_counter = 0;
 	struct config *conf = xfiredb_get_config();
+	unsigned int interval;
 
-	wake_up_counter += 1;
-	if((wake_up_counter % (conf->persist_level + 1)) == 0) {
-		wake_up_counter = 0;
-		bg_process_signal(BIO_WORKER_NAME);
-		return 0;
+	if(aof_db) {
+		aof_commit(aof_db);
+		return;
 	}
 
-	return 1;
+	if(bio_q->rewriting)
+		return;
+
+	disk_commit(disk_db);
+
+	/*
+	 * Under a steady write load the checkpoint job rarely finds the disk
+	 * outside a transaction, so checkpoint here once the interval passed.
+	 */
+	interval = bio_profiles[bio_level(conf->persist_level)].checkpoint;
+	if(interval && xfiredb_time_stamp() - bio_q->last_checkpoint >= interval)
+		bio_disk_checkpoint();
 }
 
-static void bio_worker(void *arg)
+static struct bio_batch *bio_current_batch(void)
 {
-	struct disk *d = arg;
-	struct bio_q *q;
+	struct config *conf = xfiredb_get_config();
 
-	while((q = bio_queue_pop()) != NULL) {
-		switch(q->operation) {
-		case STRING_ADD:
-			disk_store_string(d, q->key, q->newdata);
-			break;
-		case STRING_UPDATE:
-			disk_update_string(d, q->key, q->newdata);
-			break;
-		case STRING_DEL:
-			disk_delete_string(d, q->key);
-			break;
-		case LIST_ADD:
-			disk_store_list_entry(d, q->key, q->newdata);
-			break;
-		case LIST_DEL:
-			disk_delete_list(d, q->key, q->arg);
-			break;
-		case LIST_UPDATE:
-			disk_update_list(d, q->key, q->arg, q->newdata);
-			break;
-		case HM_ADD:
-			disk_store_hm_node(d, q->key, q->arg, q->newdata);
-			break;
-		case HM_DEL:
-			disk_delete_hashmapnode(d, q->key, q->arg);
-			break;
-		case HM_UPDATE:
-			disk_update_hm(d, q->key, q->arg, q->newdata);
+	return &bio_batches[bio_level(conf->persist_level)];
+}
+
+/*
+ * Get the number of published records, counted from the oldest one.
+ */
+static unsigned long bio_ring_pending(void)
+{
+	unsigned long num;
+
+	for(num = 0; num <= bio_q->mask; num++) {
+		if(!bio_ring_peek(num))
 			break;
-		case SET_ADD:
-			disk_store_set_key(d, q->key, q->arg);
+	}
+
+	return num;
+}
+
+typedef enum {
+	BIO_KIND_ADD,
+	BIO_KIND_UPDATE,
+	BIO_KIND_DEL,
+	BIO_KIND_APPEND,
+	BIO_KIND_OTHER,
+} bio_kind_t;
+
+static bio_kind_t bio_op_kind(bio_operation_t op)
+{
+	switch(op) {
+	case STRING_ADD:
+	case LIST_ADD:
+	case HM_ADD:
+	case SET_ADD:
+		return BIO_KIND_ADD;
+	case STRING_UPDATE:
+	case LIST_UPDATE:
+	case HM_UPDATE:
+		return BIO_KIND_UPDATE;
+	case STRING_DEL:
+	case LIST_DEL:
+	case HM_DEL:
+	case SET_DEL:
+		return BIO_KIND_DEL;
+	case STRING_APPEND:
+		return BIO_KIND_APPEND;
+	default:
+		return BIO_KIND_OTHER;
+	}
+}
+
+/*
+ * Get the add operation on the same kind of entry as \p op.
+ */
+static bio_operation_t bio_op_add(bio_operation_t op)
+{
+	switch(op) {
+	case LIST_UPDATE:
+		return LIST_ADD;
+	case HM_UPDATE:
+		return HM_ADD;
+	case STRING_UPDATE:
+	default:
+		return STRING_ADD;
+	}
+}
+
+static bio_operation_t bio_op_type(bio_operation_t op)
+{
+	switch(op) {
+	case STRING_ADD:
+	case STRING_DEL:
+	case STRING_UPDATE:
+	case STRING_APPEND:
+		return STRING_ADD;
+	case LIST_ADD:
+	case LIST_DEL:
+	case LIST_UPDATE:
+		return LIST_ADD;
+	case HM_ADD:
+	case HM_DEL:
+	case HM_UPDATE:
+		return HM_ADD;
+	default:
+		return SET_ADD;
+	}
+}
+
+static u32 bio_hash_str(u32 hash, const char *str)
+{
+	const unsigned char *ptr = (const unsigned char*)str;
+
+	if(!str)
+		return hash;
+
+	for(; *ptr; ptr++) {
+		hash ^= *ptr;
+		hash *= FNV_PRIME;
+	}
+
+	/* Keep key "ab" and argument "c" apart from "a" and "bc" */
+	hash ^= 0xff;
+	hash *= FNV_PRIME;
+	return hash;
+}
+
+static inline bool bio_str_equal(const char *a, const char *b)
+{
+	if(!a || !b)
+		return a == b;
+
+	return !strcmp(a, b);
+}
+
+/*
+ * Records write to the same entry when they have the same entry type,
+ * key and argument.
+ */
+static inline bool bio_same_entry(struct bio_q *a, struct bio_q *b)
+{
+	return bio_op_type(a->operation) == bio_op_type(b->operation) &&
+		bio_str_equal(a->key, b->key) && bio_str_equal(a->arg, b->arg);
+}
+
+static struct bio_coalesce_slot *bio_coalesce_lookup(struct bio_q *q)
+{
+	struct bio_coalesce_slot *slot;
+	unsigned long idx;
+	u32 hash;
+
+	hash = FNV_OFFSET ^ bio_op_type(q->operation);
+	hash = bio_hash_str(hash, q->key);
+	hash = bio_hash_str(hash, q->arg);
+
+	for(idx = hash;; idx++) {
+		slot = &bio_q->coalesce[idx & (BIO_COALESCE_SIZE - 1)];
+		if(slot->gen != bio_q->gen) {
+			slot->gen = bio_q->gen;
+			slot->entry = q;
+			slot->last = NULL;
+			return slot;
+		}
+
+		if(bio_same_entry(slot->entry, q))
+			return slot;
+	}
+}
+
+/*
+ * Mark \p q as superseded by the pending record at offset \p idx.
+ */
+static inline void bio_supersede(struct bio_q *q, unsigned long idx)
+{
+	unsigned long offset;
+
+	offset = ((unsigned long)(q - bio_q->ring) - bio_q->tail) & bio_q->mask;
+	q->flags |= BIO_SKIP_FLAG;
+	bio_q->resolve[offset] = idx;
+}
+
+/*
+ * Mark the records that don't have to be written, because a later record
+ * for the same entry supersedes them:
+ *
+ * - an update replaces an earlier add, update or append, and turns into
+ *   an add when it replaced an add;
+ * - a delete replaces an earlier update or append, and cancels out an
+ *   earlier add.
+ *
+ * Records are never reordered, so the changes to a single entry still
+ * reach the disk in the order they were made. A clear of the disk, and
+ * the end of a snapshot, end the coalescing of every entry.
+ */
+static void bio_coalesce(unsigned long num)
+{
+	struct bio_coalesce_slot *slot;
+	struct bio_q *q, *prev;
+	unsigned long idx, *resolve;
+	bio_kind_t kind;
+
+	/* A fresh generation empties the table */
+	bio_q->gen++;
+	resolve = bio_q->resolve;
+	for(idx = 0; idx < num; idx++) {
+		q = bio_ring_peek(idx);
+		q->flags = 0;
+		resolve[idx] = idx;
+
+		/*
+		 * Nothing before a clear can supersede anything after it, and
+		 * nothing may move over the end of a snapshot.
+		 */
+		if(q->operation == DB_CLEAR || q->operation == DB_SAVE) {
+			bio_q->gen++;
+			continue;
+		}
+
+		slot = bio_coalesce_lookup(q);
+		prev = slot->last;
+		slot->last = q;
+		if(!prev)
+			continue;
+
+		kind = bio_op_kind(prev->operation);
+		switch(bio_op_kind(q->operation)) {
+		case BIO_KIND_UPDATE:
+			if(kind == BIO_KIND_ADD) {
+				q->operation = bio_op_add(q->operation);
+				bio_supersede(prev, idx);
+			} else if(kind == BIO_KIND_UPDATE || kind == BIO_KIND_APPEND) {
+				bio_supersede(prev, idx);
+			}
 			break;
-		case SET_DEL:
-			disk_delete_set_key(d, q->key, q->arg);
+
+		case BIO_KIND_DEL:
+			if(kind == BIO_KIND_ADD) {
+				bio_supersede(prev, idx);
+				q->flags |= BIO_SKIP_FLAG;
+				slot->last = NULL;
+			} else if(kind == BIO_KIND_UPDATE || kind == BIO_KIND_APPEND) {
+				bio_supersede(prev, idx);
+			}
 			break;
+
 		default:
 			break;
 		}
+	}
+
+	/* Follow chains of superseded records to the record that is written */
+	for(idx = num; idx-- > 0; )
+		resolve[idx] = resolve[resolve[idx]];
+}
+
+static void bio_publish_durable(unsigned long durable)
+{
+	if(durable == bio_q->durable)
+		return;
+
+	xfiredb_mutex_lock(&bio_q->lock);
+	bio_q->durable = durable;
+	xfiredb_cond_broadcast(&bio_q->durable_cond);
+	xfiredb_mutex_unlock(&bio_q->lock);
+}
+
+/*
+ * Every pass coalesces the records that are pending at the start of the
+ * pass, and writes the remaining ones in transactions, which are committed
+ * once they are large or old enough. The records are only released after
+ * the commit, and are only durable once every record they depend on has
+ * been committed as well.
+ */
+static void bio_worker(void *arg)
+{
+	struct bio_batch *batch;
+	struct bio_q *q;
+	unsigned long pending, base, done, mark, num, idx, size;
+	time_t start, latency;
+
+	bio_q->running = true;
+	bio_q->unflushed = 0;
+	barrier();
+
+	batch = bio_current_batch();
+	while((pending = bio_ring_pending()) != 0) {
+		bio_coalesce(pending);
+		base = bio_q->tail;
 
-		xfiredb_free(q->key);
-		xfiredb_free(q->arg);
-		xfiredb_free(q->newdata);
-		xfiredb_free(q);
+		for(done = mark = 0; done < pending; done = idx) {
+			size = batch->size;
+			latency = batch->latency;
+			start = xfiredb_time_stamp();
+
+			bio_begin();
+			for(num = 0, idx = done; num < size && idx < pending; ) {
+				q = bio_ring_peek(idx++ - done);
+				if(q->flags & BIO_SKIP_FLAG)
+					continue;
+
+				bio_write_timed(q);
+				num++;
+
+				if(q->operation == DB_CLEAR)
+					bio_q->rewriting = true;
+				else if(q->operation == DB_SAVE)
+					bio_q->rewriting = false;
+
+				if(xfiredb_time_stamp() - start >= latency)
+					break;
+			}
+			bio_commit();
+			bio_ring_release(idx - done);
+
+			/* Nothing is durable before a snapshot is committed */
+			while(mark < idx && bio_q->resolve[mark] < idx)
+				mark++;
+			if(!bio_q->rewriting)
+				bio_publish_durable(base + mark);
+		}
 	}
+
+	bio_q->running = false;
+	barrier();
+
+	/* Don't leave records that were queued while we were stopping */
+	if(bio_ring_peek(0))
+		bio_wakeup();
+}
+
+static void bio_checkpoint(void *arg)
+{
+	if(aof_db)
+		aof_sync(aof_db);
+	else
+		bio_disk_checkpoint();
 }
 
 /**
@@ -141,13 +711,42 @@ static void bio_worker(void *arg)
 void bio_init(void)
 {
 	struct config *config;
+	struct disk_profile *profile;
+	unsigned long idx;
+	time_t checkpoint;
 
 	bio_q = xfiredb_zalloc(sizeof(*bio_q));
-	bio_q->size = 0L;
-	xfiredb_spinlock_init(&bio_q->lock);
+	bio_q->ring = xfiredb_zalloc_stat(BIO_RING_SIZE * sizeof(*bio_q->ring),
+			MEM_STAT_BIO);
+	bio_q->mask = BIO_RING_SIZE - 1;
+	bio_q->coalesce = xfiredb_zalloc_stat(BIO_COALESCE_SIZE *
+			sizeof(*bio_q->coalesce), MEM_STAT_BIO);
+	bio_q->resolve = xfiredb_zalloc_stat(BIO_RING_SIZE *
+			sizeof(*bio_q->resolve), MEM_STAT_BIO);
+	xfiredb_mutex_init(&bio_q->lock);
+	xfiredb_cond_init(&bio_q->durable_cond);
+	bio_q->max_depth = BIO_RING_SIZE;
+	bio_q->policy = BIO_POLICY_BLOCK;
+	bio_q->sample_time = xfiredb_time_stamp();
+	bio_q->last_checkpoint = bio_q->sample_time;
+	for(idx = 0; idx < BIO_RING_SIZE; idx++)
+		bio_q->ring[idx].seq = idx;
+
 	config = xfiredb_get_config();
-	disk_db = disk_create(config->db_file);
-	bio_q->job = bg_process_create(BIO_WORKER_NAME, &bio_worker, disk_db);
+	profile = &bio_profiles[bio_level(config->persist_level)];
+	checkpoint = profile->checkpoint;
+	if(config->persist_engine == BIO_ENGINE_AOF) {
+		aof_db = aof_create(config->db_file);
+		checkpoint = BIO_AOF_SYNC_INTERVAL;
+	} else {
+		disk_db = disk_create(config->db_file);
+		disk_set_profile(disk_db, profile);
+	}
+
+	bio_q->job = bg_process_create_periodic(BIO_WORKER_NAME, &bio_worker,
+			NULL, bio_flushes[bio_level(config->persist_level)].interval);
+	bio_q->checkpoint = bg_process_create_periodic(BIO_CHECKPOINT_NAME,
+			&bio_checkpoint, NULL, checkpoint);
 }
 
 /**
@@ -155,34 +754,414 @@ void bio_init(void)
  */
 void bio_exit(void)
 {
+	bg_process_stop(BIO_CHECKPOINT_NAME);
 	bg_process_stop(BIO_WORKER_NAME);
-	xfiredb_spinlock_destroy(&bio_q->lock);
+	xfiredb_free_stat(bio_q->ring, MEM_STAT_BIO);
+	xfiredb_free_stat(bio_q->coalesce, MEM_STAT_BIO);
+	xfiredb_free_stat(bio_q->resolve, MEM_STAT_BIO);
+	xfiredb_cond_destroy(&bio_q->durable_cond);
+	xfiredb_mutex_destroy(&bio_q->lock);
 	xfiredb_free(bio_q);
+	bio_q = NULL;
+
+	if(aof_db)
+		aof_destroy(aof_db);
+	else
+		disk_destroy(disk_db);
 
-	disk_destroy(disk_db);
+	aof_db = NULL;
+	disk_db = NULL;
 }
 
-static inline long bio_size(void)
+/**
+ * @brief Get the durable watermark.
+ * @return The sequence number up to which every queued record is on disk.
+ * @see bio_queue_add
+ */
+unsigned long bio_durable(void)
 {
-	long s;
+	return bio_q->durable;
+}
 
-	xfiredb_spin_lock(&bio_q->lock);
-	s = bio_q->size;
-	xfiredb_spin_unlock(&bio_q->lock);
+/**
+ * @brief Wait until a record is on disk.
+ * @param seq Sequence number of the record, as returned by bio_queue_add.
+ *
+ * Returns once the record with sequence number \p seq, and every record
+ * queued before it, has been committed to disk. Returns immediately for
+ * zero (persistency disabled) and for BIO_SEQ_DROPPED; a dropped record
+ * never reaches the disk, so the caller can't rely on it being durable.
+ */
+void bio_wait(unsigned long seq)
+{
+	if(seq == BIO_SEQ_DROPPED || (long)(bio_q->durable - seq) >= 0)
+		return;
 
-	return s;
+	xfiredb_mutex_lock(&bio_q->lock);
+	while((long)(bio_q->durable - seq) < 0) {
+		bio_wakeup();
+		xfiredb_cond_timedwait(&bio_q->durable_cond, &bio_q->lock,
+				BIO_WAIT_INTERVAL);
+	}
+	xfiredb_mutex_unlock(&bio_q->lock);
 }
 
 /**
  * @brief Immediatly wake up the BIO worker.
  * @see xfiredb_sync
+ *
+ * Returns once every record queued before the call has been written.
  */
 void bio_sync(void)
 {
-	bg_process_signal(BIO_WORKER_NAME);
+	bio_wait(bio_q->head);
+}
+
+static inline bool bio_full(size_t len)
+{
+	size_t bytes;
+
+	if(bio_q->head - bio_q->tail >= bio_q->max_depth)
+		return true;
+
+	/* A record larger than the limit still fits in an empty queue */
+	bytes = bio_q->bytes;
+	return bio_q->max_bytes && bytes && bytes + len > bio_q->max_bytes;
+}
+
+/*
+ * Decide whether a record of \p len payload bytes may be queued, and
+ * account for its bytes if so. Writers queueing a snapshot always wait.
+ */
+static bool bio_admit(size_t len)
+{
+	bool blocked = false;
+	int spins = 0;
+
+	if(bio_q->degraded && !bio_q->snapshot) {
+		__sync_fetch_and_add(&bio_q->shed, 1);
+		return false;
+	}
+
+	while(bio_full(len)) {
+		if(!bio_q->snapshot && bio_q->policy != BIO_POLICY_BLOCK) {
+			if(bio_q->policy == BIO_POLICY_DEGRADE && !bio_q->degraded) {
+				bio_q->degraded = true;
+				xfiredb_log_err(LOG_BIO, "Queue full, dropping writes " \
+						"until the next snapshot\n");
+			}
+
+			__sync_fetch_and_add(&bio_q->shed, 1);
+			return false;
+		}
+
+		if(!blocked) {
+			blocked = true;
+			__sync_fetch_and_add(&bio_q->blocked, 1);
+		}
+
+		if(++spins == BIO_FULL_SPINS) {
+			spins = 0;
+			bio_wakeup();
+			sched_yield();
+		}
+	}
+
+	__sync_fetch_and_add(&bio_q->bytes, len);
+	return true;
+}
+
+/**
+ * @brief Limit the size of the BIO queue.
+ * @param depth Maximum number of queued records. Zero, or anything over
+ *   BIO_RING_SIZE, selects BIO_RING_SIZE.
+ * @param bytes Maximum number of queued payload bytes. Zero disables the
+ *   limit.
+ * @param policy What to do with records that don't fit.
+ */
+void bio_set_limits(unsigned long depth, size_t bytes, bio_policy_t policy)
+{
+	if(!depth || depth > BIO_RING_SIZE)
+		depth = BIO_RING_SIZE;
+
+	bio_q->max_depth = depth;
+	bio_q->max_bytes = bytes;
+	bio_q->policy = policy;
 
-	while(bio_size())
-		xfiredb_sleep_ns(100000);
+	if(policy != BIO_POLICY_DEGRADE)
+		bio_q->degraded = false;
+}
+
+/**
+ * @brief Check whether writes are dropped until the next snapshot.
+ * @return True if a snapshot is required to bring the disk up to date.
+ * @see BIO_POLICY_DEGRADE
+ */
+bool bio_degraded(void)
+{
+	return bio_q->degraded;
+}
+
+/**
+ * @brief Start queueing a snapshot.
+ *
+ * Queues a clear of the disk. The caller should then queue every entry
+ * of the database, and finish with bio_snapshot_end. Until then, writers
+ * wait for room instead of dropping records. The worker writes everything
+ * from the clear up to the end of the snapshot in one transaction, so a
+ * crash in the mean time leaves the previous contents of the disk.
+ *
+ * The append-only log ignores queued snapshots; it is rewritten by
+ * bio_bgrewrite instead.
+ */
+void bio_snapshot_begin(void)
+{
+	bio_q->snapshot = true;
+	bio_q->degraded = false;
+	bio_queue_add(NULL, NULL, NULL, DB_CLEAR);
+}
+
+/**
+ * @brief Finish queueing a snapshot.
+ * @see bio_snapshot_begin
+ *
+ * Queues the end of the snapshot.
+ */
+void bio_snapshot_end(void)
+{
+	bio_queue_add(NULL, NULL, NULL, DB_SAVE);
+	bio_q->snapshot = false;
+}
+
+static const char *bio_op_names[BIO_OPERATIONS] = {
+	"string_add", "string_del", "string_update", "string_append",
+	"list_add", "list_del", "list_update",
+	"hashmap_add", "hashmap_del", "hashmap_update",
+	"set_add", "set_del",
+	"clear", "save",
+};
+
+/**
+ * @brief Get the name of a BIO operation.
+ * @param op Operation to get the name of.
+ * @return A static, lower case name.
+ */
+const char *bio_op_name(bio_operation_t op)
+{
+	if(op < 0 || op >= BIO_OPERATIONS)
+		return "unknown";
+
+	return bio_op_names[op];
+}
+
+static inline double bio_rate(unsigned long count, time_t ms)
+{
+	return ms ? count * 1000.0 / ms : 0.0;
+}
+
+/**
+ * @brief Get the BIO queue statistics.
+ * @param stats Output buffer.
+ *
+ * The rates are averaged over the time between two samples, which are
+ * taken at most once a second by this function.
+ */
+void bio_get_stats(struct bio_stats *stats)
+{
+	unsigned long head, tail;
+	struct bio_q *q;
+	time_t now;
+
+	head = bio_q->head;
+	tail = bio_q->tail;
+	now = xfiredb_time_stamp();
+
+	stats->depth = head - tail;
+	stats->bytes = bio_q->bytes;
+	stats->max_depth = bio_q->max_depth;
+	stats->max_bytes = bio_q->max_bytes;
+	stats->policy = bio_q->policy;
+	stats->degraded = bio_q->degraded;
+	stats->enqueued = head;
+	stats->dequeued = tail;
+	stats->written = bio_q->written;
+	stats->shed = bio_q->shed;
+	stats->blocked = bio_q->blocked;
+	memcpy(stats->ops, bio_q->ops, sizeof(stats->ops));
+
+	q = &bio_q->ring[tail & bio_q->mask];
+	stats->oldest = 0;
+	if(q->seq == tail + 1 && now > q->stamp)
+		stats->oldest = now - q->stamp;
+
+	xfiredb_mutex_lock(&bio_q->lock);
+	if(now - bio_q->sample_time >= 1000) {
+		bio_q->enqueue_rate = bio_rate(head - bio_q->sample_head,
+				now - bio_q->sample_time);
+		bio_q->dequeue_rate = bio_rate(tail - bio_q->sample_tail,
+				now - bio_q->sample_time);
+		bio_q->sample_head = head;
+		bio_q->sample_tail = tail;
+		bio_q->sample_time = now;
+	}
+
+	stats->enqueue_rate = bio_q->enqueue_rate;
+	stats->dequeue_rate = bio_q->dequeue_rate;
+	xfiredb_mutex_unlock(&bio_q->lock);
+}
+
+/**
+ * @brief Set the group commit limits of a persistency level.
+ * @param level Persistency level to configure.
+ * @param size Maximum number of records written in a single transaction.
+ * @param latency Maximum time a transaction is kept open, in milliseconds.
+ * @return An error code.
+ *
+ * A \p size of 1 writes every record in its own transaction. The size is
+ * limited to the number of records in the BIO ring.
+ */
+int bio_set_batch(int level, unsigned int size, unsigned int latency)
+{
+	struct bio_batch *batch;
+
+	if(level < 0 || level >= BIO_PERSIST_LEVELS || !size)
+		return -XFIREDB_ERR;
+
+	if(size > BIO_RING_SIZE)
+		size = BIO_RING_SIZE;
+
+	batch = &bio_batches[level];
+	batch->size = size;
+	batch->latency = latency;
+	return -XFIREDB_OK;
+}
+
+/**
+ * @brief Get the group commit limits of a persistency level.
+ * @param level Persistency level to look up.
+ * @param batch Output buffer for the limits.
+ */
+void bio_get_batch(int level, struct bio_batch *batch)
+{
+	*batch = bio_batches[bio_level(level)];
+}
+
+/**
+ * @brief Set the flush policy of a persistency level.
+ * @param level Persistency level to configure.
+ * @param ops Number of queued records that wake up the worker.
+ * @param interval Maximum time between two flushes in milliseconds.
+ * @return An error code.
+ */
+int bio_set_flush(int level, unsigned int ops, unsigned int interval)
+{
+	struct config *conf = xfiredb_get_config();
+	struct bio_flush *flush;
+
+	if(level < 0 || level >= BIO_PERSIST_LEVELS || !ops || !interval)
+		return -XFIREDB_ERR;
+
+	flush = &bio_flushes[level];
+	flush->ops = ops;
+	flush->interval = interval;
+
+	if(bio_q && bio_level(conf->persist_level) == level)
+		bg_job_set_interval(bio_q->job, interval);
+
+	return -XFIREDB_OK;
+}
+
+/**
+ * @brief Get the flush policy of a persistency level.
+ * @param level Persistency level to look up.
+ * @param flush Output buffer for the policy.
+ */
+void bio_get_flush(int level, struct bio_flush *flush)
+{
+	*flush = bio_flushes[bio_level(level)];
+}
+
+/**
+ * @brief Set the SQLite profile of a persistency level.
+ * @param level Persistency level to configure.
+ * @param profile Profile to use for \p level.
+ * @return An error code.
+ *
+ * If \p level is the active persistency level, the profile is applied to
+ * the disk right away.
+ */
+int bio_set_profile(int level, const struct disk_profile *profile)
+{
+	struct config *conf = xfiredb_get_config();
+
+	if(level < 0 || level >= BIO_PERSIST_LEVELS || profile->sync > DISK_SYNC_FULL)
+		return -XFIREDB_ERR;
+
+	bio_profiles[level] = *profile;
+	if(bio_q && disk_db && bio_level(conf->persist_level) == level) {
+		bg_job_set_interval(bio_q->checkpoint, profile->checkpoint);
+		return disk_set_profile(disk_db, profile);
+	}
+
+	return -XFIREDB_OK;
+}
+
+/**
+ * @brief Get the SQLite profile of a persistency level.
+ * @param level Persistency level to look up.
+ * @param profile Output buffer for the profile.
+ */
+void bio_get_profile(int level, struct disk_profile *profile)
+{
+	*profile = bio_profiles[bio_level(level)];
+}
+
+/**
+ * @brief Set the sync policy of the append-only log.
+ * @param policy Sync policy, see aof_fsync_t.
+ * @return An error code. Fails if the append-only log isn't used.
+ */
+int bio_set_aof_fsync(int policy)
+{
+	if(!aof_db || policy < AOF_FSYNC_ALWAYS || policy > AOF_FSYNC_NO)
+		return -XFIREDB_ERR;
+
+	aof_set_fsync(aof_db, policy);
+	return -XFIREDB_OK;
+}
+
+/**
+ * @brief Check if the persistent storage should be rewritten.
+ * @return True if the append-only log has grown enough to be compacted by
+ *   xfiredb_se_snapshot.
+ */
+bool bio_rewrite_needed(void)
+{
+	return aof_db && aof_rewrite_needed(aof_db);
+}
+
+/**
+ * @brief Rewrite the append-only log in the background.
+ * @param db Database to write the new log from.
+ * @return Error code. Fails if the append-only log isn't the active
+ *   engine, or if a rewrite is already running.
+ * @see aof_bgrewrite
+ *
+ * Waits for the queued records to be appended, then forks a child that
+ * writes the new log. Since the child writes every entry of \p db, writes
+ * dropped by BIO_POLICY_DEGRADE are no longer missing from the disk.
+ */
+int bio_bgrewrite(struct database *db)
+{
+	if(!aof_db)
+		return -XFIREDB_ERR;
+
+	bio_sync();
+	if(aof_bgrewrite(aof_db, db))
+		return -XFIREDB_ERR;
+
+	bio_q->degraded = false;
+	return -XFIREDB_OK;
 }
 
 /**
@@ -192,40 +1171,64 @@ void bio_sync(void)
  * @param newdata In case of an add or update, the new data to set.
  * @param op Type of operation.
  *
- * The \p arg argument can either point to the currently stored data, in case
- * of a list operation, or to the key within the hashmap in case of a
- * hashmap operation.
+ * The \p arg argument can either point to the position ID of the entry
+ * (formatted as a decimal string), in case of a list operation, or to the
+ * key within the hashmap in case of a hashmap operation.
+ *
+ * The strings are copied into the queue, so the caller keeps ownership of
+ * \p key, \p arg and \p newdata. Adding an entry doesn't take any locks.
+ * When the queue is full, the policy set with bio_set_limits decides
+ * whether the caller waits or the entry is dropped.
+ *
+ * @return The sequence number of the entry, which can be passed to
+ *   bio_wait. Zero if persistency is disabled, BIO_SEQ_DROPPED if the
+ *   queue was full and the entry was dropped.
+ * @see bio_queue_add_len
+ */
+unsigned long bio_queue_add(const char *key, const char *arg,
+		const char *newdata, bio_operation_t op)
+{
+	return bio_queue_add_len(key, arg, newdata,
+			newdata ? strlen(newdata) : 0, op);
+}
+
+/**
+ * @brief Add an entry with binary data to the BIO queue.
+ * @param key The key of the entry.
+ * @param arg Extra info about the added entry, see bio_queue_add.
+ * @param newdata In case of an add or update, the new data to set.
+ * @param len Length of \p newdata in bytes.
+ * @param op Type of operation.
+ *
+ * Same as bio_queue_add, but \p newdata may hold NUL bytes.
+ *
+ * @return The sequence number of the entry, see bio_queue_add.
  */
-void bio_queue_add(char *key, char *arg, char *newdata, bio_operation_t op)
+unsigned long bio_queue_add_len(const char *key, const char *arg,
+		const void *newdata, size_t len, bio_operation_t op)
 {
 	struct bio_q *q;
 	struct config *conf = xfiredb_get_config();
+	unsigned long pos;
+	size_t used = 0;
 
-	if(conf->persist_level >= 3) {
-		xfiredb_free(key);
-		xfiredb_free(arg);
-		xfiredb_free(newdata);
-		return;
-	}
+	if(conf->persist_level >= 3)
+		return 0UL;
+
+	if(!bio_admit(bio_len(key) + bio_len(arg) + bio_data_len(newdata, len)))
+		return BIO_SEQ_DROPPED;
 
-	q = xfiredb_zalloc(sizeof(*q));
-	q->key = key;
-	q->arg = arg;
-	q->newdata = newdata;
+	q = bio_ring_claim(&pos);
 	q->operation = op;
+	q->stamp = xfiredb_time_stamp();
+	q->key = bio_copy(q, &used, key, key ? strlen(key) : 0);
+	q->arg = bio_copy(q, &used, arg, arg ? strlen(arg) : 0);
+	q->newdata = bio_copy(q, &used, newdata, len);
+	q->len = len;
+	bio_ring_publish(q, pos);
 
-	xfiredb_spin_lock(&bio_q->lock);
-	bio_q->size++;
-	if(bio_q->next) {
-		q->next = bio_q->next;
-		bio_q->next->prev = q;
-		bio_q->next = q;
-	} else {
-		/* first entry */
-		bio_q->next = bio_q->tail = q;
-	}
-	xfiredb_spin_unlock(&bio_q->lock);
 	bio_try_wakeup_worker();
+	return pos + 1;
 }
 
 #if defined(HAVE_DEBUG) || defined(__DOXYGEN__)
@@ -235,151 +1238,63 @@ static char *dbg_data[] = {"first-data", "second-data", "second-data"};
 
 static void dbg_add_strings(void)
 {
-	char *key, *data;
-	int i, key_len, data_len;
+	int i;
 
-	for(i = 0; i < 3; i++) {
-		key_len = strlen(dbg_keys[i]);
-		data_len = strlen(dbg_data[i]);
-		key = xfiredb_zalloc(key_len + 1);
-		data = xfiredb_zalloc(data_len + 1);
-		memcpy(key, dbg_keys[i], key_len);
-		memcpy(data, dbg_data[i], data_len);
-		bio_queue_add(key, NULL, data, STRING_ADD);
-	}
+	for(i = 0; i < 3; i++)
+		bio_queue_add(dbg_keys[i], NULL, dbg_data[i], STRING_ADD);
 }
 
 static void dbg_del_strings(void)
 {
-	char *key;
-	int i, key_len;
+	int i;
 
-	for(i = 0; i < 2; i++) {
-		key_len = strlen(dbg_keys[i]);
-		key = xfiredb_zalloc(key_len + 1);
-		memcpy(key, dbg_keys[i], key_len);
-		bio_queue_add(key, NULL, NULL, STRING_DEL);
-	}
+	for(i = 0; i < 2; i++)
+		bio_queue_add(dbg_keys[i], NULL, NULL, STRING_DEL);
 }
 
 static void dbg_update_string(void)
 {
-	char *key, *data;
-	int key_len, data_len;
-
-
-	key_len = strlen("third-test");
-	data_len = strlen("third-data");
-	data = xfiredb_zalloc(data_len + 1);
-	key = xfiredb_zalloc(key_len + 1);
-	memcpy(data, "third-data", data_len);
-	memcpy(key, "third-test", key_len);
-
-	bio_queue_add(key, NULL, data, STRING_UPDATE);
+	bio_queue_add("third-test", NULL, "third-data", STRING_UPDATE);
 }
 
 static void dbg_add_list(void)
 {
-	char *key, *data;
-	int i, key_len, data_len;
-
-
-	key_len = strlen("list-key");
+	char id[16];
+	int i;
 
 	for(i = 0; i < 3; i++) {
-		data_len = strlen(dbg_data[i]);
-
-		data = xfiredb_zalloc(data_len + 1);
-		key = xfiredb_zalloc(key_len + 1);
-		memcpy(data, dbg_data[i], data_len);
-		memcpy(key, "list-key", key_len);
-
-		bio_queue_add(key, NULL, data, LIST_ADD);
+		snprintf(id, sizeof(id), "%d", i + 1);
+		bio_queue_add("list-key", id, dbg_data[i], LIST_ADD);
 	}
 }
 
 static void dbg_update_list(void)
 {
-	char *key, *data, *oldata;
-	int key_len, data_len;
-
-
-	key_len = strlen("list-key");
-	data_len = strlen("second-data");
-	data = xfiredb_zalloc(data_len + 1);
-	oldata = xfiredb_zalloc(data_len +1);
-	key = xfiredb_zalloc(key_len + 1);
-	memcpy(oldata, "second-data", data_len);
-	memcpy(data, "SECOND-DATA", data_len);
-	memcpy(key, "list-key", key_len);
-
-	bio_queue_add(key, oldata, data, LIST_UPDATE);
+	bio_queue_add("list-key", "3", "SECOND-DATA", LIST_UPDATE);
 }
 
 static void dbg_del_list(void)
 {
-	char *key, *data;
-	int key_len, data_len;
-
-	key_len = strlen("list-key");
-	data_len = strlen(dbg_data[1]);
-	key = xfiredb_zalloc(key_len + 1);
-	data = xfiredb_zalloc(data_len + 1);
-	memcpy(data, dbg_data[1], data_len);
-	memcpy(key, "list-key", key_len);
-	bio_queue_add(key, data, NULL, LIST_DEL);
+	bio_queue_add("list-key", "2", NULL, LIST_DEL);
 }
 
 static char *dbg_snd_keys[] = {"key1", "key2", "key3" };
 static void dbg_add_hashmap(void)
 {
-	char *key, *data, *subkey;
-	int i, key_len, data_len, skey_len;
-
-	key_len = strlen("hash-key");
+	int i;
 
-	for(i = 0; i < 3; i++) {
-		key = xfiredb_zalloc(key_len + 1);
-		memcpy(key, "hash-key", key_len);
-		data_len = strlen(dbg_data[i]);
-		skey_len = strlen(dbg_snd_keys[i]);
-		subkey = xfiredb_zalloc(skey_len + 1);
-		data = xfiredb_zalloc(data_len + 1);
-		memcpy(subkey, dbg_snd_keys[i], skey_len);
-		memcpy(data, dbg_data[i], data_len);
-		bio_queue_add(key, subkey, data, HM_ADD);
-	}
+	for(i = 0; i < 3; i++)
+		bio_queue_add("hash-key", dbg_snd_keys[i], dbg_data[i], HM_ADD);
 }
 
 static void dbg_update_hashmap(void)
 {
-	char *key, *skey, *ndata;
-	int key_len, skey_len, ndata_len;
-
-	key_len = strlen("hash-key");
-	skey_len = strlen("key2");
-	ndata_len = strlen("new-data");
-	ndata = xfiredb_zalloc(ndata_len + 1);
-	key = xfiredb_zalloc(key_len + 1);
-	skey = xfiredb_zalloc(skey_len + 1);
-	memcpy(ndata, "new-data", ndata_len);
-	memcpy(key, "hash-key", key_len);
-	memcpy(skey, "key2", skey_len);
-	bio_queue_add(key, skey, ndata, HM_UPDATE);
+	bio_queue_add("hash-key", "key2", "new-data", HM_UPDATE);
 }
 
 static void dbg_del_hashmap(void)
 {
-	char *key, *skey;
-	int key_len, skey_len;
-
-	key_len = strlen("hash-key");
-	skey_len = strlen("key3");
-	key = xfiredb_zalloc(key_len + 1);
-	skey = xfiredb_zalloc(skey_len + 1);
-	memcpy(key, "hash-key", key_len);
-	memcpy(skey, "key3", skey_len);
-	bio_queue_add(key, skey, NULL, HM_DEL);
+	bio_queue_add("hash-key", "key3", NULL, HM_DEL);
 }
 
 /**
@@ -21,6 +21,8 @@
  * @{
  */
 
+#include <stddef.h>
+
 #include <xfiredb/xfiredb.h>
 #include <xfiredb/error.h>
 #include <xfiredb/types.h>
@@ -30,6 +32,8 @@
 #include <xfiredb/hashmap.h>
 #include <xfiredb/set.h>
 #include <xfiredb/mem.h>
+#include <xfiredb/object.h>
+#include <xfiredb/intern.h>
 
 /**
  * @brief Initialise a new container.
@@ -55,7 +59,38 @@ void container_init(struct container *c, container_type_t type)
 		break;
 	}
 
-	c->type = type;
+	object_init(&c->data.obj);
+	c->data.obj.type = type;
+}
+
+/**
+ * @brief Get the allocation size of a container.
+ * @param type Container type.
+ * @return The number of bytes needed to store a container of type \p type.
+ */
+size_t container_size(container_type_t type)
+{
+	size_t size;
+
+	switch(type) {
+	case CONTAINER_STRING:
+		size = sizeof(struct string);
+		break;
+	case CONTAINER_LIST:
+		size = sizeof(struct list_head);
+		break;
+	case CONTAINER_HASHMAP:
+		size = sizeof(struct hashmap);
+		break;
+	case CONTAINER_SET:
+		size = sizeof(struct set);
+		break;
+	default:
+		size = sizeof(struct container);
+		break;
+	}
+
+	return offsetof(struct container, data) + size;
 }
 
 /**
@@ -67,7 +102,7 @@ struct container *container_alloc(container_type_t type)
 {
 	struct container *c;
 
-	c = xfiredb_zalloc(sizeof(*c));
+	c = xfiredb_zalloc(container_size(type));
 	container_init(c, type);
 
 	return c;
@@ -81,7 +116,7 @@ void *container_get_data(struct container *c)
 {
 	void *data;
 
-	switch(c->type) {
+	switch(container_type(c)) {
 	case CONTAINER_STRING:
 		data = &c->data.string;
 		break;
@@ -102,29 +137,145 @@ void *container_get_data(struct container *c)
 	return data;
 }
 
+/**
+ * @brief Get the base object of a container.
+ * @param c Container to get the object of.
+ * @return The base object of \p c.
+ */
 struct object *container_to_object(struct container *c)
 {
-	struct object *obj;
+	return &c->data.obj;
+}
+
+/**
+ * @brief Get the heap footprint of a string container.
+ * @param s String to get the footprint of.
+ * @return The number of bytes allocated for the data of \p s.
+ */
+static size_t string_mem_usage(struct string *s)
+{
+	if(string_is_shared(s))
+		return intern_size(s->str);
+
+	return string_is_inline(s) ? 0 : xfiredb_mem_size(s->str);
+}
+
+static size_t skiplist_node_mem_usage(struct skiplist_node *node)
+{
+	return intern_size(node->key) +
+		xfiredb_cache_size(node->forward, skiplist_forward_size(node));
+}
+
+static size_t list_mem_usage(struct list_head *lh, size_t samples, size_t *num)
+{
+	struct list *carriage;
+	struct string *s;
+	size_t total = 0;
+
+	*num = 0;
+	list_lock(lh);
+	list_for_each(lh, carriage) {
+		if(samples && *num >= samples)
+			break;
+
+		s = container_of(carriage, struct string, entry);
+		total += xfiredb_cache_size(s, sizeof(*s)) + string_mem_usage(s);
+		*num += 1;
+	}
+	list_unlock(lh);
+
+	return total;
+}
+
+static size_t hashmap_mem_usage(struct hashmap *map, size_t samples, size_t *num)
+{
+	struct hashmap_iterator *it;
+	struct hashmap_node *node;
+	struct string *s;
+	size_t total = 0;
+
+	*num = 0;
+	it = hashmap_new_iterator(map);
+	while((node = hashmap_iterator_next(it)) != NULL) {
+		if(samples && *num >= samples)
+			break;
+
+		s = container_of(node, struct string, node);
+		total += xfiredb_cache_size(s, sizeof(*s)) + string_mem_usage(s);
+		total += intern_size(node->key);
+		total += skiplist_node_mem_usage(&node->node);
+		*num += 1;
+	}
+	hashmap_free_iterator(it);
+
+	return total;
+}
 
-	switch(c->type) {
+static size_t set_mem_usage(struct set *set, size_t samples, size_t *num)
+{
+	struct set_iterator *it;
+	struct set_key *k;
+	size_t total = 0;
+
+	*num = 0;
+	it = set_iterator_new(set);
+	while((k = set_iterator_next(it)) != NULL) {
+		if(samples && *num >= samples)
+			break;
+
+		total += xfiredb_mem_size(k) + intern_size(k->key);
+		total += skiplist_node_mem_usage(&k->node);
+		*num += 1;
+	}
+	set_iterator_free(it);
+
+	return total;
+}
+
+/**
+ * @brief Estimate the memory footprint of a container.
+ * @param c Container to estimate the footprint of.
+ * @param samples Maximum number of elements to inspect. Set to 0 to
+ *   inspect every element.
+ * @return The estimated number of bytes used by the data of \p c.
+ *
+ * The size of \p c itself isn't included, since containers are either
+ * embedded or wrapped by their owner. For lists, hashmaps and sets only the
+ * first \p samples elements are measured and the average element size is
+ * extrapolated over the full length of the container.
+ */
+size_t container_mem_usage(struct container *c, size_t samples)
+{
+	size_t total, num;
+	s64 length;
+
+	switch(container_type(c)) {
 	case CONTAINER_STRING:
-		obj = &c->data.string.obj;
-		break;
+		return string_mem_usage(&c->data.string);
 	case CONTAINER_LIST:
-		obj = &c->data.list.obj;
+		length = list_length(&c->data.list);
+		total = list_mem_usage(&c->data.list, samples, &num);
 		break;
 	case CONTAINER_HASHMAP:
-		obj = &c->data.map.obj;
+		length = hashmap_size(&c->data.map);
+		total = hashmap_mem_usage(&c->data.map, samples, &num);
+		total += skiplist_node_mem_usage(c->data.map.list.header);
+		total += xfiredb_mem_size(c->data.map.list.header);
 		break;
 	case CONTAINER_SET:
-		obj = &c->data.set.obj;
+		length = set_size(&c->data.set);
+		total = set_mem_usage(&c->data.set, samples, &num);
+		total += skiplist_node_mem_usage(c->data.set.list.header);
+		total += xfiredb_mem_size(c->data.set.list.header);
 		break;
 	default:
-		obj = NULL;
-		break;
+		return 0;
 	}
 
-	return obj;
+	if(num && length > (s64)num)
+		total = (total / num) * length;
+
+	return total;
 }
 
 /**
@@ -133,7 +284,7 @@ struct object *container_to_object(struct container *c)
  */
 void container_destroy(struct container *c)
 {
-	switch(c->type) {
+	switch(container_type(c)) {
 	case CONTAINER_STRING:
 		string_destroy(&c->data.string);
 		break;
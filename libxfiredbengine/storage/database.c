@@ -22,6 +22,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include <xfiredb/xfiredb.h>
 #include <xfiredb/types.h>
@@ -29,6 +30,10 @@
 #include <xfiredb/dict.h>
 #include <xfiredb/database.h>
 #include <xfiredb/container.h>
+#include <xfiredb/expire.h>
+#include <xfiredb/os.h>
+#include <xfiredb/time.h>
+#include <xfiredb/object.h>
 
 /**
  * @brief Allocate a new database.
@@ -42,6 +47,8 @@ struct database *db_alloc(const char *name)
 
 	db = xfiredb_zalloc(sizeof(*db));
 	db->container = dict_alloc();
+	db->expires = dict_alloc();
+	expire_heap_init(&db->expire_queue);
 	l = strlen(name) + 1;
 	db->name = xfiredb_zalloc(l);
 
@@ -58,6 +65,9 @@ struct database *db_alloc(const char *name)
  */
 int db_update(struct database *db, const char *key, struct container *c)
 {
+	db_data_t val;
+
+	dict_delete(db->expires, key, &val, false);
 	return dict_update(db->container, key, c, DICT_PTR);
 }
 
@@ -94,9 +104,46 @@ int db_delete(struct database *db, const char *key, db_data_t *data)
 	rv = dict_delete(db->container, key, &val, false);
 	memcpy(data, &val, sizeof(val));
 
+	if(rv == -XFIREDB_OK && object_test_flag(container_to_object(val.ptr),
+				OBJECT_VOLATILE_FLAG)) {
+		object_assign_flag(container_to_object(val.ptr),
+				OBJECT_VOLATILE_FLAG, false);
+		dict_delete(db->expires, key, &val, false);
+	}
+
 	return rv;
 }
 
+static void db_drop_key(struct database *db, const char *key)
+{
+	db_data_t data;
+
+	if(db_delete(db, key, &data) != -XFIREDB_OK)
+		return;
+
+	if(db->expire_hook)
+		db->expire_hook(db, key, &data);
+}
+
+static bool db_expire_if_needed(struct database *db, const char *key,
+				 struct container *c)
+{
+	db_data_t when;
+	size_t tmp;
+
+	if(!object_test_flag(container_to_object(c), OBJECT_VOLATILE_FLAG))
+		return false;
+
+	if(dict_lookup(db->expires, key, &when, &tmp) != -XFIREDB_OK)
+		return false;
+
+	if(!time_after(xfiredb_time_stamp(), when.val_s64))
+		return false;
+
+	db_drop_key(db, key);
+	return true;
+}
+
 /**
  * @brief Lookup a database key.
  * @param db Database to perform the lookup on.
@@ -105,6 +152,7 @@ int db_delete(struct database *db, const char *key, db_data_t *data)
  * @return Error code.
  *
  * Only trust the data in \p data if the return value is \p -DICT_OK.
+ * Keys whose time out has passed are removed before the lookup is done.
  */
 int db_lookup(struct database *db, const char *key, db_data_t *data)
 {
@@ -115,12 +163,299 @@ int db_lookup(struct database *db, const char *key, db_data_t *data)
 	rv = dict_lookup(db->container, key, &val, &tmp);
 	if(rv != -XFIREDB_OK)
 		return rv;
-	else
-		memcpy(data, &val, sizeof(val));
+
+	if(db_expire_if_needed(db, key, val.ptr))
+		return -XFIREDB_ERR;
+
+	memcpy(data, &val, sizeof(val));
+
+	if(db->policy == DB_EVICT_ALLKEYS_LRU || db->policy == DB_EVICT_ALLKEYS_LFU)
+		object_touch(container_to_object(val.ptr));
 
 	return rv;
 }
 
+/*
+ * The expiry queue is compacted once it holds more than
+ * DB_EXPIRE_COMPACT_RATIO entries for every volatile key.
+ */
+#define DB_EXPIRE_COMPACT_RATIO 2
+#define DB_EXPIRE_COMPACT_MIN 1024
+
+static bool db_expire_valid(const char *key, time_t when, void *arg)
+{
+	struct database *db = arg;
+	db_data_t stamp;
+	size_t tmp;
+
+	return dict_lookup(db->expires, key, &stamp, &tmp) == -XFIREDB_OK &&
+		stamp.val_s64 == (s64)when;
+}
+
+/*
+ * Drop the queue entries of time outs that were changed or removed, which
+ * bounds the queue to a multiple of the number of volatile keys.
+ */
+static void db_expire_compact(struct database *db)
+{
+	size_t live;
+
+	live = dict_get_size(db->expires);
+	if(db->expire_queue.size <= DB_EXPIRE_COMPACT_RATIO * live +
+			DB_EXPIRE_COMPACT_MIN)
+		return;
+
+	expire_heap_compact(&db->expire_queue, &db_expire_valid, db);
+}
+
+/**
+ * @brief Set the time out of a database key.
+ * @param db Database containing \p key.
+ * @param key Key to set a time out on.
+ * @param when Time stamp (in milliseconds) at which \p key expires.
+ * @return An error code.
+ *
+ * A time stamp that has already passed removes the key immediately.
+ */
+int db_set_expiry(struct database *db, const char *key, time_t when)
+{
+	db_data_t data;
+	s64 stamp = when;
+
+	if(db_lookup(db, key, &data) != -XFIREDB_OK)
+		return -XFIREDB_ERR;
+
+	if(!time_after(when, xfiredb_time_stamp())) {
+		db_drop_key(db, key);
+		return -XFIREDB_OK;
+	}
+
+	/* Already queued */
+	if(db_expire_valid(key, when, db))
+		return -XFIREDB_OK;
+
+	object_assign_flag(container_to_object(data.ptr), OBJECT_VOLATILE_FLAG, true);
+	dict_update(db->expires, key, &stamp, DICT_S64);
+	expire_heap_push(&db->expire_queue, key, when);
+	db_expire_compact(db);
+	return -XFIREDB_OK;
+}
+
+/**
+ * @brief Remove the time out of a database key.
+ * @param db Database containing \p key.
+ * @param key Key to persist.
+ * @return -XFIREDB_OK if a time out was removed, -XFIREDB_ERR otherwise.
+ */
+int db_persist(struct database *db, const char *key)
+{
+	db_data_t data;
+
+	if(db_lookup(db, key, &data) != -XFIREDB_OK)
+		return -XFIREDB_ERR;
+
+	object_assign_flag(container_to_object(data.ptr), OBJECT_VOLATILE_FLAG, false);
+	return dict_delete(db->expires, key, &data, false);
+}
+
+/**
+ * @brief Get the remaining time to live of a database key.
+ * @param db Database containing \p key.
+ * @param key Key to get the time to live for.
+ * @return The time to live in milliseconds, \p DB_TTL_NONE if \p key
+ *   doesn't expire or \p DB_TTL_MISSING if \p key doesn't exist.
+ */
+s64 db_ttl(struct database *db, const char *key)
+{
+	db_data_t data;
+	size_t tmp;
+	s64 ttl;
+
+	if(db_lookup(db, key, &data) != -XFIREDB_OK)
+		return DB_TTL_MISSING;
+
+	if(dict_lookup(db->expires, key, &data, &tmp) != -XFIREDB_OK)
+		return DB_TTL_NONE;
+
+	ttl = data.val_s64 - xfiredb_time_stamp();
+	return ttl < 0 ? 0 : ttl;
+}
+
+/**
+ * @brief Estimate the bookkeeping overhead of a key.
+ * @param db Database \p key is stored in.
+ * @param key Key to get the overhead of.
+ * @return The estimated number of bytes the database uses to index \p key,
+ *   excluding the stored data itself.
+ */
+size_t db_key_mem_usage(struct database *db, const char *key)
+{
+	db_data_t data;
+	size_t tmp, len, usage;
+
+	len = strlen(key) + 1;
+	usage = sizeof(struct dict_entry) + len;
+
+	if(dict_lookup(db->expires, key, &data, &tmp) == -XFIREDB_OK)
+		usage += sizeof(struct dict_entry) + sizeof(struct expire_entry) + 2 * len;
+
+	return usage;
+}
+
+/**
+ * @brief Remove expired keys from a database.
+ * @param db Database to expire keys from.
+ * @param max Maximum number of expiry queue entries to handle.
+ * @return The number of keys that were removed.
+ *
+ * Keys are handed to the expire hook of \p db after they are removed.
+ * Queue entries of keys whose time out was changed or removed are
+ * skipped, but still count towards \p max.
+ */
+int db_expire_cycle(struct database *db, int max)
+{
+	time_t now, when;
+	char *key;
+	int num = 0;
+
+	now = xfiredb_time_stamp();
+	for(; max > 0; max--) {
+		key = expire_heap_pop(&db->expire_queue, now, &when);
+		if(!key)
+			break;
+
+		if(db_expire_valid(key, when, db)) {
+			db_drop_key(db, key);
+			num++;
+		}
+
+		xfiredb_free(key);
+	}
+
+	return num;
+}
+
+static const char *db_evict_policies[] = {
+	"noeviction",
+	"allkeys-lru",
+	"allkeys-lfu",
+	"volatile-ttl",
+	NULL,
+};
+
+/**
+ * @brief Set the memory budget of a database.
+ * @param db Database to set the budget for.
+ * @param maxmemory Memory budget in bytes. Zero disables the budget.
+ * @param policy Eviction policy name: noeviction, allkeys-lru, allkeys-lfu
+ *   or volatile-ttl.
+ * @return An error code. -XFIREDB_ERR is returned for unknown policies.
+ *
+ * Values stored in \p db must be containers when an eviction policy
+ * other than noeviction is used.
+ */
+int db_set_maxmemory(struct database *db, size_t maxmemory, const char *policy)
+{
+	int idx;
+
+	for(idx = 0; db_evict_policies[idx]; idx++) {
+		if(!strcmp(db_evict_policies[idx], policy))
+			break;
+	}
+
+	if(!db_evict_policies[idx])
+		return -XFIREDB_ERR;
+
+	db->maxmemory = maxmemory;
+	db->policy = idx;
+	return -XFIREDB_OK;
+}
+
+static s64 db_evict_score(struct database *db, db_data_t *data)
+{
+	switch(db->policy) {
+	case DB_EVICT_ALLKEYS_LRU:
+		return object_idle_time(container_to_object(data->ptr));
+	case DB_EVICT_ALLKEYS_LFU:
+		return 255 - object_frequency(container_to_object(data->ptr));
+	case DB_EVICT_VOLATILE_TTL:
+		return -data->val_s64;
+	default:
+		return 0;
+	}
+}
+
+static int db_evict_one(struct database *db)
+{
+	char *keys[DB_EVICT_SAMPLES];
+	db_data_t data[DB_EVICT_SAMPLES];
+	struct dict *src;
+	s64 score, best_score = 0;
+	int num, idx, best = -1;
+
+	src = db->policy == DB_EVICT_VOLATILE_TTL ? db->expires : db->container;
+	num = dict_sample(src, keys, data, DB_EVICT_SAMPLES);
+
+	for(idx = 0; idx < num; idx++) {
+		score = db_evict_score(db, &data[idx]);
+		if(best < 0 || score > best_score) {
+			best = idx;
+			best_score = score;
+		}
+	}
+
+	if(best >= 0)
+		db_drop_key(db, keys[best]);
+
+	for(idx = 0; idx < num; idx++)
+		xfiredb_free(keys[idx]);
+
+	return best >= 0 ? -XFIREDB_OK : -XFIREDB_ERR;
+}
+
+/**
+ * @brief Evict keys until the memory budget is met.
+ * @param db Database to evict keys from.
+ * @return -XFIREDB_OK if the write may continue, -XFIREDB_ERR if the budget
+ *   is exceeded and no keys can be evicted.
+ *
+ * Has to be called before data is written to \p db. Candidates are picked
+ * by sampling \p DB_EVICT_SAMPLES keys and evicting the best match for the
+ * eviction policy. At most \p DB_EVICT_BATCH keys are evicted per call, so
+ * a single write never stalls for long.
+ */
+int db_evict_if_needed(struct database *db)
+{
+	int num;
+
+	if(!db->maxmemory || xfiredb_mem_used() <= db->maxmemory)
+		return -XFIREDB_OK;
+
+	if(db->policy == DB_EVICT_NONE)
+		return -XFIREDB_ERR;
+
+	for(num = 0; num < DB_EVICT_BATCH; num++) {
+		if(db_evict_one(db) != -XFIREDB_OK)
+			return -XFIREDB_ERR;
+
+		if(xfiredb_mem_used() <= db->maxmemory)
+			break;
+	}
+
+	return -XFIREDB_OK;
+}
+
+/**
+ * @brief Set the expired key handler of a database.
+ * @param db Database to set the handler for.
+ * @param hook Handler to set.
+ */
+void db_set_expire_hook(struct database *db,
+		void (*hook)(struct database *db, const char *key, db_data_t *data))
+{
+	db->expire_hook = hook;
+}
+
 /**
  * @brief Free an entire database.
  * @param db Database to free.
@@ -129,6 +464,9 @@ void db_free(struct database *db)
 {
 	dict_clear(db->container);
 	dict_free(db->container);
+	dict_clear(db->expires);
+	dict_free(db->expires);
+	expire_heap_destroy(&db->expire_queue);
 
 	xfiredb_free(db->name);
 	xfiredb_free(db);
@@ -82,16 +82,16 @@ void dict_set_resize_ratio(int r)
 /**
  * @brief Check if the dictionary is rehashing.
  * @param d Dictionary to check.
- * @note struct dict::lock will be locked.
+ * @note struct dict::lock will be read locked.
  * @return TRUE if the dictionary is rehashing, false otherwise.
  */
 static inline int dict_is_rehashing(struct dict *d)
 {
 	int rval;
 
-	xfiredb_mutex_lock(&d->lock);
+	xfiredb_read_lock(&d->lock);
 	rval = d->rehashing != 0;
-	xfiredb_mutex_unlock(&d->lock);
+	xfiredb_read_unlock(&d->lock);
 
 	return rval;
 }
@@ -118,9 +118,9 @@ static inline int dict_has_iterators(struct dict *d)
 {
 	int rval;
 
-	xfiredb_mutex_lock(&d->lock);
+	xfiredb_read_lock(&d->lock);
 	rval = d->iterators != 0;
-	xfiredb_mutex_unlock(&d->lock);
+	xfiredb_read_unlock(&d->lock);
 
 	return rval;
 }
@@ -161,10 +161,10 @@ long dict_get_size(struct dict *d)
 {
 	long rv = 0L;
 
-	xfiredb_mutex_lock(&d->lock);
+	xfiredb_read_lock(&d->lock);
 	rv += d->map[PRIMARY_MAP].length;
 	rv += d->map[REHASH_MAP].length;
-	xfiredb_mutex_unlock(&d->lock);
+	xfiredb_read_unlock(&d->lock);
 
 	return rv;
 }
@@ -176,12 +176,14 @@ long dict_get_size(struct dict *d)
 static void dict_init(struct dict *d)
 {
 	d->status = DICT_STATUS_NONE;
-	d->map[PRIMARY_MAP].array = xfiredb_zalloc(DICT_MINIMAL_SIZE * sizeof(size_t));
+	d->map[PRIMARY_MAP].array = xfiredb_zalloc_stat(DICT_MINIMAL_SIZE * sizeof(size_t),
+			MEM_STAT_DICT);
 	d->map[PRIMARY_MAP].size = DICT_MINIMAL_SIZE;
 	d->map[PRIMARY_MAP].sizemask = DICT_MINIMAL_SIZE - 1;
 	d->map[PRIMARY_MAP].length = 0;
 
-	xfiredb_mutex_init(&d->lock);
+	xfiredb_rwlock_init(&d->lock);
+	xfiredb_fast_mutex_init(&d->rehash_lock);
 	xfiredb_cond_init(&d->rehash_condi);
 	d->worker = xfiredb_create_thread("rehash-worker", &dict_rehash_worker, d);
 
@@ -196,7 +198,7 @@ struct dict *dict_alloc(void)
 {
 	struct dict *d;
 
-	d = xfiredb_zalloc(sizeof(*d));
+	d = xfiredb_zalloc_stat(sizeof(*d), MEM_STAT_DICT);
 
 	if(!d)
 		return NULL;
@@ -217,21 +219,22 @@ void dict_free(struct dict *d)
 		return;
 
 	if(d->map[REHASH_MAP].array)
-		xfiredb_free(d->map[REHASH_MAP].array);
+		xfiredb_free_stat(d->map[REHASH_MAP].array, MEM_STAT_DICT);
 	if(d->map[PRIMARY_MAP].array)
-		xfiredb_free(d->map[PRIMARY_MAP].array);
+		xfiredb_free_stat(d->map[PRIMARY_MAP].array, MEM_STAT_DICT);
 
-	xfiredb_mutex_lock(&d->lock);
+	xfiredb_fast_mutex_lock(&d->rehash_lock);
 	d->status = DICT_STATUS_FREE;
 	xfiredb_cond_signal(&d->rehash_condi);
-	xfiredb_mutex_unlock(&d->lock);
+	xfiredb_fast_mutex_unlock(&d->rehash_lock);
 
 	xfiredb_thread_join(d->worker);
 	xfiredb_thread_destroy(d->worker);
 
 	xfiredb_cond_destroy(&d->rehash_condi);
-	xfiredb_mutex_destroy(&d->lock);
-	xfiredb_free(d);
+	xfiredb_fast_mutex_destroy(&d->rehash_lock);
+	xfiredb_rwlock_destroy(&d->lock);
+	xfiredb_free_stat(d, MEM_STAT_DICT);
 }
 
 /**
@@ -378,7 +381,7 @@ static inline int __dict_is_rehashing(struct dict *d)
  * @param d Dictionary to rehash.
  * @param num Number of rehashing steps.
  * @return 0 if no more rehashing is required, 1 otherwise.
- * @note This function acquires struct dict::lock.
+ * @note This function write locks struct dict::lock.
  * @see dict_rehash_worker dict_rehash_step dict_rehash_ms
  *
  * This function will perform \p num steps of rehashing. If there
@@ -393,9 +396,9 @@ static int dict_rehash(struct dict *d, int num)
 	int visits;
 	struct dict_entry *de, *next;
 
-	xfiredb_mutex_lock(&d->lock);
+	xfiredb_write_lock(&d->lock);
 	if(unlikely(!__dict_is_rehashing(d))) {
-		xfiredb_mutex_unlock(&d->lock);
+		xfiredb_write_unlock(&d->lock);
 		return 0;
 	}
 
@@ -407,7 +410,7 @@ static int dict_rehash(struct dict *d, int num)
 			d->rehashidx++;
 
 			if(--visits == 0) {
-				xfiredb_mutex_unlock(&d->lock);
+				xfiredb_write_unlock(&d->lock);
 				return 1;
 			}
 		}
@@ -431,18 +434,18 @@ static int dict_rehash(struct dict *d, int num)
 		d->rehashidx++;
 
 		if(d->map[PRIMARY_MAP].length == 0L) {
-			xfiredb_free(d->map[PRIMARY_MAP].array);
+			xfiredb_free_stat(d->map[PRIMARY_MAP].array, MEM_STAT_DICT);
 			d->map[PRIMARY_MAP] = d->map[REHASH_MAP];
 			dict_reset(&d->map[REHASH_MAP]);
 
 			d->rehashidx = -1;
 			d->rehashing = false;
-			xfiredb_mutex_unlock(&d->lock);
+			xfiredb_write_unlock(&d->lock);
 			return 0;
 		}
 	}
 
-	xfiredb_mutex_unlock(&d->lock);
+	xfiredb_write_unlock(&d->lock);
 	return 1;
 }
 
@@ -482,13 +485,15 @@ static inline unsigned long dict_real_size(unsigned long size)
  *
  * Resize to atleast \p size elements. \p size will be rounded
  * up to the nearest power of two.
+ *
+ * @note struct dict::lock should be write locked by the caller.
  */
 static int dict_expand(struct dict *d, unsigned long size)
 {
 	struct dict_map map;
 	unsigned long _size = dict_real_size(size);
 
-	if(dict_is_rehashing(d) || d->map[PRIMARY_MAP].length > size)
+	if(__dict_is_rehashing(d) || d->map[PRIMARY_MAP].length > size)
 		return -XFIREDB_ERR;
 
 	if(d->map[PRIMARY_MAP].size == _size)
@@ -497,7 +502,7 @@ static int dict_expand(struct dict *d, unsigned long size)
 	map.size = _size;
 	map.sizemask = _size - 1;
 	map.length = 0;
-	map.array = xfiredb_zalloc(_size * PTR_SIZE);
+	map.array = xfiredb_zalloc_stat(_size * PTR_SIZE, MEM_STAT_DICT);
 
 	if(d->map[PRIMARY_MAP].array == NULL) {
 		d->map[PRIMARY_MAP] = map;
@@ -508,7 +513,9 @@ static int dict_expand(struct dict *d, unsigned long size)
 	d->rehashidx = 0;
 	d->rehashing = true;
 
+	xfiredb_fast_mutex_lock(&d->rehash_lock);
 	xfiredb_cond_signal(&d->rehash_condi);
+	xfiredb_fast_mutex_unlock(&d->rehash_lock);
 	return -XFIREDB_OK;
 }
 
@@ -545,15 +552,17 @@ static void *dict_rehash_worker(void *arg)
 	struct dict *d = arg;
 
 	while(true) {
-		xfiredb_mutex_lock(&d->lock);
+		xfiredb_fast_mutex_lock(&d->rehash_lock);
 		if(!__dict_is_rehashing(d) && d->status != DICT_STATUS_FREE)
-			xfiredb_cond_wait(&d->rehash_condi, &d->lock);
+			xfiredb_cond_wait(&d->rehash_condi, &d->rehash_lock);
 
-		if(d->status == DICT_STATUS_FREE)
+		if(d->status == DICT_STATUS_FREE) {
+			xfiredb_fast_mutex_unlock(&d->rehash_lock);
 			break;
+		}
 
+		xfiredb_fast_mutex_unlock(&d->rehash_lock);
 		dict_rehash_ms(d, 2);
-		xfiredb_mutex_unlock(&d->lock);
 	}
 
 	xfiredb_thread_exit(NULL);
@@ -662,7 +671,7 @@ static inline void dict_set_key(struct dict_entry *e, const char *key)
 	char *_key;
 
 	length = strlen(key);
-	_key = xfiredb_zalloc(length+1);
+	_key = xfiredb_zalloc_stat(length+1, MEM_STAT_DICT);
 
 	memcpy(_key, key, length);
 	e->key = _key;
@@ -676,9 +685,9 @@ static inline void dict_set_key(struct dict_entry *e, const char *key)
 static inline void dict_free_entry(struct dict_entry *e)
 {
 	if(e->key)
-		xfiredb_free(e->key);
+		xfiredb_free_stat(e->key, MEM_STAT_DICT);
 
-	xfiredb_free(e);
+	xfiredb_cache_free(e, sizeof(*e), MEM_STAT_DICT);
 }
 
 /**
@@ -701,21 +710,21 @@ static struct dict_entry *__dict_add(struct dict *d, const char *key,
 	if(dict_is_rehashing(d))
 		dict_rehash_step(d);
 
-	xfiredb_mutex_lock(&d->lock);
+	xfiredb_write_lock(&d->lock);
 	index = dict_calc_index(d, key);
 	if(index == -XFIREDB_ERR) {
-		xfiredb_mutex_unlock(&d->lock);
+		xfiredb_write_unlock(&d->lock);
 		return NULL;
 	}
 
-	map = dict_is_rehashing(d) ? &d->map[REHASH_MAP] : &d->map[PRIMARY_MAP];
-	entry = xfiredb_zalloc(sizeof(*entry));
+	map = __dict_is_rehashing(d) ? &d->map[REHASH_MAP] : &d->map[PRIMARY_MAP];
+	entry = xfiredb_cache_zalloc(sizeof(*entry), MEM_STAT_DICT);
 	entry->next = map->array[index];
 	map->array[index] = entry;
 	map->length++;
 
 	dict_set_key(entry, key);
-	xfiredb_mutex_unlock(&d->lock);
+	xfiredb_write_unlock(&d->lock);
 	return entry;
 }
 
@@ -808,9 +817,9 @@ static struct dict_entry *__dict_delete(struct dict *d, const char *key)
 	if(dict_is_rehashing(d))
 		dict_rehash_step(d);
 
-	xfiredb_mutex_lock(&d->lock);
+	xfiredb_write_lock(&d->lock);
 	if(d->map[PRIMARY_MAP].size == 0L) {
-		xfiredb_mutex_unlock(&d->lock);
+		xfiredb_write_unlock(&d->lock);
 		return NULL;
 	}
 
@@ -830,7 +839,7 @@ static struct dict_entry *__dict_delete(struct dict *d, const char *key)
 					d->map[table].array[idx] = e->next;
 
 				d->map[table].length--;
-				xfiredb_mutex_unlock(&d->lock);
+				xfiredb_write_unlock(&d->lock);
 				return e;
 			}
 
@@ -838,11 +847,11 @@ static struct dict_entry *__dict_delete(struct dict *d, const char *key)
 			e = e->next;
 		}
 
-		if(!dict_is_rehashing(d))
+		if(!__dict_is_rehashing(d))
 			break;
 	}
 
-	xfiredb_mutex_unlock(&d->lock);
+	xfiredb_write_unlock(&d->lock);
 	return NULL;
 }
 
@@ -894,9 +903,9 @@ static struct dict_entry *__dict_lookup(struct dict *d, const char *key)
 	if(dict_is_rehashing(d))
 		dict_rehash_step(d);
 
-	xfiredb_mutex_lock(&d->lock);
+	xfiredb_read_lock(&d->lock);
 	if(d->map[PRIMARY_MAP].size == 0) {
-		xfiredb_mutex_unlock(&d->lock);
+		xfiredb_read_unlock(&d->lock);
 		return NULL;
 	}
 
@@ -907,7 +916,7 @@ static struct dict_entry *__dict_lookup(struct dict *d, const char *key)
 
 		while(e) {
 			if(dict_cmp_keys(key, e->key)) {
-				xfiredb_mutex_unlock(&d->lock);
+				xfiredb_read_unlock(&d->lock);
 				return e;
 			}
 
@@ -918,7 +927,7 @@ static struct dict_entry *__dict_lookup(struct dict *d, const char *key)
 			break;
 	}
 
-	xfiredb_mutex_unlock(&d->lock);
+	xfiredb_read_unlock(&d->lock);
 	return NULL;
 }
 
@@ -993,6 +1002,50 @@ int dict_lookup(struct dict *d, const char *key, union entry_data *data, size_t
 	return -XFIREDB_OK;
 }
 
+/**
+ * @brief Sample random entries from a dictionary.
+ * @param d Dictionary to sample.
+ * @param keys Array to store the sampled keys in.
+ * @param data Array to store the sampled values in.
+ * @param num Number of entries to sample.
+ * @return The number of sampled entries.
+ *
+ * The buckets are walked from a random starting point until \p num
+ * entries are found or \p num * 10 buckets have been visited, so
+ * sampling is cheap even for sparse dictionaries. The sampled keys are
+ * copies, which have to be free'd by the caller.
+ */
+int dict_sample(struct dict *d, char **keys, union entry_data *data, int num)
+{
+	struct dict_map *map;
+	struct dict_entry *e;
+	unsigned long idx;
+	long visits;
+	int table, found = 0;
+
+	xfiredb_read_lock(&d->lock);
+	for(table = 0; table <= 1 && found < num; table++) {
+		map = &d->map[table];
+		if(!map->length || !map->array)
+			continue;
+
+		idx = random() & map->sizemask;
+		for(visits = 0; visits < map->size && visits < num * 10L &&
+				found < num; visits++) {
+			for(e = map->array[idx]; e && found < num; e = e->next) {
+				xfiredb_sprintf(&keys[found], "%s", e->key);
+				data[found] = e->value;
+				found++;
+			}
+
+			idx = (idx + 1) & map->sizemask;
+		}
+	}
+	xfiredb_read_unlock(&d->lock);
+
+	return found;
+}
+
 /**
  * @brief Create an iterator.
  * @param d Dict to create an iterator for.
@@ -1021,9 +1074,9 @@ struct dict_iterator *dict_get_safe_iterator(struct dict *d)
 {
 	struct dict_iterator *it;
 
-	xfiredb_mutex_lock(&d->lock);
+	xfiredb_write_lock(&d->lock);
 	d->iterators++;
-	xfiredb_mutex_unlock(&d->lock);
+	xfiredb_write_unlock(&d->lock);
 
 	it = dict_create_iterator(d);
 	it->safe = true;
@@ -1089,7 +1142,7 @@ struct dict_entry *dict_iterator_prev(struct dict_iterator *it)
 
 	d = dict_iterator_to_dict(it);
 
-	xfiredb_mutex_lock(&d->lock);
+	xfiredb_read_lock(&d->lock);
 	do {
 		map = &d->map[it->table];
 		if(!it->e) {
@@ -1125,12 +1178,12 @@ struct dict_entry *dict_iterator_prev(struct dict_iterator *it)
 		}
 
 		if(it->e) {
-			xfiredb_mutex_unlock(&d->lock);
+			xfiredb_read_unlock(&d->lock);
 			return it->e;
 		}
 	} while(1);
 
-	xfiredb_mutex_unlock(&d->lock);
+	xfiredb_read_unlock(&d->lock);
 	return NULL;
 }
 
@@ -1148,7 +1201,7 @@ struct dict_entry *dict_iterator_next(struct dict_iterator *it)
 
 	d = dict_iterator_to_dict(it);
 
-	xfiredb_mutex_lock(&d->lock);
+	xfiredb_read_lock(&d->lock);
 	do {
 		if(!it->e) {
 			map = &d->map[it->table];
@@ -1171,12 +1224,12 @@ struct dict_entry *dict_iterator_next(struct dict_iterator *it)
 
 		if(it->e) {
 			it->e_next = it->e->next;
-			xfiredb_mutex_unlock(&d->lock);
+			xfiredb_read_unlock(&d->lock);
 			return it->e;
 		}
 	} while(true);
 
-	xfiredb_mutex_unlock(&d->lock);
+	xfiredb_read_unlock(&d->lock);
 	return NULL;
 }
 
@@ -1192,9 +1245,9 @@ void dict_iterator_free(struct dict_iterator *it)
 		return;
 
 	if(it->safe) {
-		xfiredb_mutex_lock(&d->lock);
+		xfiredb_write_lock(&d->lock);
 		d->iterators--;
-		xfiredb_mutex_unlock(&d->lock);
+		xfiredb_write_unlock(&d->lock);
 	}
 
 	xfiredb_free(it);
@@ -1224,7 +1277,7 @@ static void __dict_clear(struct dict_map *map)
 		}
 	}
 
-	xfiredb_free(map->array);
+	xfiredb_free_stat(map->array, MEM_STAT_DICT);
 	dict_reset(map);
 }
 
@@ -1235,13 +1288,13 @@ static void __dict_clear(struct dict_map *map)
  */
 int dict_clear(struct dict *d)
 {
-	xfiredb_mutex_lock(&d->lock);
+	xfiredb_write_lock(&d->lock);
 	__dict_clear(&d->map[PRIMARY_MAP]);
 	__dict_clear(&d->map[REHASH_MAP]);
 
 	d->rehashidx = -1;
 	d->rehashing = false;
-	xfiredb_mutex_unlock(&d->lock);
+	xfiredb_write_unlock(&d->lock);
 
 	return -XFIREDB_OK;
 }
@@ -26,6 +26,7 @@
 #include <time.h>
 #include <sqlite3.h>
 #include <stdio.h>
+#include <stdarg.h>
 
 #include <xfiredb/xfiredb.h>
 #include <xfiredb/types.h>
@@ -38,15 +39,66 @@
 #include <xfiredb/list.h>
 #include <xfiredb/hashmap.h>
 
+#define DISK_SCHEMA_VERSION 2
+/* SQLite's default checkpoint threshold, in WAL pages */
+#define DISK_AUTO_CHECKPOINT 1000
+/*
+ * WAL size, in pages, at which SQLite checkpoints by itself even when the
+ * caller runs the checkpoints. Bounds the WAL if those fall behind.
+ */
+#define DISK_BACKSTOP_CHECKPOINT (DISK_AUTO_CHECKPOINT * 16)
+
+#define DISK_JOURNAL_MODE \
+	"PRAGMA journal_mode = WAL;"
+
 #define DISK_CHECK_TABLE \
 	"SELECT name FROM sqlite_master WHERE type='table' AND name='xfiredb_data';"
 
+#define DISK_CREATE_META \
+	"CREATE TABLE IF NOT EXISTS xfiredb_meta(" \
+	"name TEXT PRIMARY KEY, " \
+	"value INTEGER NOT NULL);"
+
+#define DISK_GET_VERSION \
+	"SELECT value FROM xfiredb_meta WHERE name = 'version';"
+#define DISK_SET_VERSION \
+	"INSERT OR REPLACE INTO xfiredb_meta (name, value) VALUES ('version', %i);"
+
+/*
+ * The secondary key holds list position IDs as well as hashmap and set
+ * keys. It is left without affinity, so list entries keep sorting by
+ * their numeric ID. The number of rows is kept in the meta table by the
+ * triggers, so it never has to be counted.
+ */
 #define DISK_CREATE_TABLE \
+	"INSERT OR REPLACE INTO xfiredb_meta (name, value) VALUES ('rows', 0);" \
 	"CREATE TABLE xfiredb_data(" \
-	"db_key CHAR(64) NOT NULL, " \
+	"db_key TEXT NOT NULL, " \
 	"db_secondary_key, " \
-	"db_type CHAR(64), " \
-	"db_value BLOB);"
+	"db_type TEXT NOT NULL, " \
+	"db_value BLOB);" \
+	"CREATE INDEX xfiredb_data_idx " \
+	"ON xfiredb_data(db_key, db_type, db_secondary_key);" \
+	"CREATE TRIGGER xfiredb_data_insert AFTER INSERT ON xfiredb_data BEGIN " \
+	"UPDATE xfiredb_meta SET value = value + 1 WHERE name = 'rows'; END;" \
+	"CREATE TRIGGER xfiredb_data_delete AFTER DELETE ON xfiredb_data BEGIN " \
+	"UPDATE xfiredb_meta SET value = value - 1 WHERE name = 'rows'; END;"
+
+/*
+ * Version 1 tables have untyped columns, no usable index and no row count.
+ * The rows are copied into a version 2 table in insertion order. List
+ * entries that were stored without a position ID get their ROWID as
+ * position ID.
+ */
+#define DISK_MIGRATE_V1 \
+	"ALTER TABLE xfiredb_data RENAME TO xfiredb_data_v1;" \
+	DISK_CREATE_TABLE \
+	"INSERT INTO xfiredb_data (db_key, db_secondary_key, db_type, db_value) " \
+	"SELECT db_key, " \
+	"CASE WHEN db_type = 'list' AND db_secondary_key = 'null' " \
+	"THEN ROWID ELSE db_secondary_key END, " \
+	"db_type, db_value FROM xfiredb_data_v1 ORDER BY ROWID;" \
+	"DROP TABLE xfiredb_data_v1;"
 
 static int dummy_hook(void *arg, int argc, char **argv, char **colname)
 {
@@ -61,22 +113,57 @@ static int init_hook(void *arg, int argc, char **argv, char **colname)
 	return 0;
 }
 
-static int disk_create_main_table(struct disk *disk)
+static int version_hook(void *arg, int argc, char **argv, char **colname)
 {
-	int rc;
-	char *errmsg;
+	int *version = arg;
+
+	*version = argv[0] ? atoi(argv[0]) : 0;
+	return 0;
+}
+
+/*
+ * Create the tables of a new disk, or bring the tables of an existing
+ * disk up to date. Either happens in a single transaction, so a disk
+ * is never left half migrated.
+ */
+static int disk_create_schema(struct disk *disk)
+{
+	int rc, version = 0;
+	char *errmsg = NULL, *query;
 
 	rc = sqlite3_exec(disk->handle, DISK_CHECK_TABLE, &init_hook, disk, &errmsg);
-	if(rc != SQLITE_OK)
+	if(rc == SQLITE_OK)
+		rc = sqlite3_exec(disk->handle, DISK_CREATE_META, &dummy_hook, NULL, &errmsg);
+	if(rc == SQLITE_OK)
+		rc = sqlite3_exec(disk->handle, DISK_GET_VERSION, &version_hook, &version, &errmsg);
+
+	if(rc != SQLITE_OK) {
 		xfiredb_log_console(LOG_DISK, "Error occured while creating tables: %s\n", errmsg);
+		sqlite3_free(errmsg);
+		return -XFIREDB_ERR;
+	}
 
-	if(!disk->initialised) {
-		/* table's non existent, creating them */
-		rc = sqlite3_exec(disk->handle, DISK_CREATE_TABLE, &init_hook, disk, &errmsg);
-		if(rc != SQLITE_OK)
-			xfiredb_log_console(LOG_DISK, "Error occured while creating tables: %s\n", errmsg);
+	if(version >= DISK_SCHEMA_VERSION)
+		return -XFIREDB_OK;
+
+	if(disk->initialised)
+		xfiredb_log_console(LOG_DISK, "Migrating disk %s to schema version %i\n",
+				disk->dbpath, DISK_SCHEMA_VERSION);
+
+	xfiredb_sprintf(&query, "BEGIN; %s " DISK_SET_VERSION " COMMIT;",
+			disk->initialised ? DISK_MIGRATE_V1 : DISK_CREATE_TABLE,
+			DISK_SCHEMA_VERSION);
+	rc = sqlite3_exec(disk->handle, query, &dummy_hook, NULL, &errmsg);
+	xfiredb_free(query);
+
+	if(rc != SQLITE_OK) {
+		xfiredb_log_console(LOG_DISK, "Error occured while creating tables: %s\n", errmsg);
+		sqlite3_free(errmsg);
+		sqlite3_exec(disk->handle, "ROLLBACK;", &dummy_hook, NULL, NULL);
+		return -XFIREDB_ERR;
 	}
 
+	disk->initialised = true;
 	return -XFIREDB_OK;
 }
 
@@ -109,20 +196,230 @@ struct disk *disk_create(const char *path)
 	disk->records = 0ULL;
 	xfiredb_mutex_init(&disk->lock);
 
-	if(disk_create_main_table(disk) != -XFIREDB_OK)
+	rc = sqlite3_exec(db, DISK_JOURNAL_MODE, &dummy_hook, NULL, NULL);
+	if(rc != SQLITE_OK)
+		xfiredb_log_console(LOG_DISK, "Could not enable WAL on %s: %s\n",
+				path, sqlite3_errmsg(db));
+
+	if(disk_create_schema(disk) != -XFIREDB_OK)
 		fprintf(stderr, "Could not create tables, exiting.\n");
 
 	return disk;
 }
 
-#define DISK_STORE_QUERY \
-	"INSERT INTO xfiredb_data (db_key, db_secondary_key, db_type, db_value) " \
-	"VALUES ('%s', '%s', '%s', '%s');"
-#define DISK_SELECT_QUERY \
-	"SELECT * FROM xfiredb_data WHERE db_key = '%s';"
+#define DISK_PROFILE_QUERY \
+	"PRAGMA synchronous = %s;" \
+	"PRAGMA cache_size = -%u;" \
+	"PRAGMA mmap_size = %lu;" \
+	"PRAGMA wal_autocheckpoint = %i;"
+
+static const char *disk_sync_modes[] = {
+	[DISK_SYNC_OFF] = "OFF",
+	[DISK_SYNC_NORMAL] = "NORMAL",
+	[DISK_SYNC_FULL] = "FULL",
+};
+
+/**
+ * @brief Tune a disk.
+ * @param d Disk to tune.
+ * @param profile Settings to apply.
+ * @return An error code.
+ *
+ * If \p profile has a checkpoint interval, the caller is expected to run
+ * disk_checkpoint at that interval. SQLite then only checkpoints by itself
+ * once the WAL has grown to DISK_BACKSTOP_CHECKPOINT pages.
+ */
+int disk_set_profile(struct disk *d, const struct disk_profile *profile)
+{
+	char *query, *msg = NULL;
+	int rc;
+
+	if(profile->sync > DISK_SYNC_FULL)
+		return -XFIREDB_ERR;
+
+	xfiredb_sprintf(&query, DISK_PROFILE_QUERY, disk_sync_modes[profile->sync],
+			profile->cache_size, profile->mmap_size,
+			profile->checkpoint ? DISK_BACKSTOP_CHECKPOINT :
+			DISK_AUTO_CHECKPOINT);
+
+	xfiredb_mutex_lock(&d->lock);
+	rc = sqlite3_exec(d->handle, query, &dummy_hook, NULL, &msg);
+	xfiredb_mutex_unlock(&d->lock);
+	xfiredb_free(query);
+
+	if(rc != SQLITE_OK) {
+		xfiredb_log_err(LOG_DISK, "Disk profile failed: %s\n", msg);
+		sqlite3_free(msg);
+		return -XFIREDB_ERR;
+	}
+
+	return -XFIREDB_OK;
+}
+
+/**
+ * @brief Checkpoint the write-ahead log of a disk.
+ * @param d Disk to checkpoint.
+ * @return An error code.
+ *
+ * Copies committed transactions from the WAL into the database file,
+ * without waiting for readers or writers. Nothing is done while a
+ * transaction is open on \p d.
+ */
+int disk_checkpoint(struct disk *d)
+{
+	int rc = SQLITE_OK;
+
+	xfiredb_mutex_lock(&d->lock);
+	if(sqlite3_get_autocommit(d->handle))
+		rc = sqlite3_wal_checkpoint_v2(d->handle, NULL,
+				SQLITE_CHECKPOINT_PASSIVE, NULL, NULL);
+	xfiredb_mutex_unlock(&d->lock);
+
+	if(rc != SQLITE_OK && rc != SQLITE_BUSY) {
+		xfiredb_log_err(LOG_DISK, "Disk checkpoint failed: %s\n",
+				sqlite3_errstr(rc));
+		return -XFIREDB_ERR;
+	}
+
+	return -XFIREDB_OK;
+}
+
+/*
+ * Statements in the cache of a disk, indexed by disk_stmt_t. Values are
+ * bound as text, which is how they have always been stored, so rows
+ * written by older versions still match.
+ */
+static const struct disk_query {
+	const char *name;
+	const char *sql;
+} disk_queries[DISK_STMT_NUM] = {
+	[DISK_STMT_BEGIN] = {"transaction", "BEGIN;"},
+	[DISK_STMT_COMMIT] = {"transaction", "COMMIT;"},
+	[DISK_STMT_STORE] = {"store",
+		"INSERT INTO xfiredb_data (db_key, db_secondary_key, db_type, db_value) "
+		"VALUES (?1, ?2, ?3, ?4);"},
+	[DISK_STMT_STORE_LIST] = {"store",
+		"INSERT INTO xfiredb_data (db_key, db_secondary_key, db_type, db_value) "
+		"VALUES (?1, ?2, 'list', ?3);"},
+	[DISK_STMT_UPDATE_HM] = {"update",
+		"UPDATE xfiredb_data SET db_value = ?1 "
+		"WHERE db_key = ?2 AND db_type = 'hashmap' AND db_secondary_key = ?3;"},
+	[DISK_STMT_UPDATE_LIST] = {"update",
+		"UPDATE xfiredb_data SET db_value = ?1 "
+		"WHERE db_key = ?2 AND db_secondary_key = ?3 AND db_type = 'list';"},
+	[DISK_STMT_UPDATE_STRING] = {"update",
+		"UPDATE xfiredb_data SET db_value = ?1 "
+		"WHERE db_key = ?2 AND db_type = 'string';"},
+	[DISK_STMT_APPEND_STRING] = {"update",
+		"UPDATE xfiredb_data SET db_value = db_value || ?1 "
+		"WHERE db_key = ?2 AND db_type = 'string';"},
+	[DISK_STMT_DELETE_STRING] = {"delete",
+		"DELETE FROM xfiredb_data "
+		"WHERE db_type = 'string' AND db_key = ?1;"},
+	[DISK_STMT_DELETE_LIST] = {"delete",
+		"DELETE FROM xfiredb_data "
+		"WHERE db_type = 'list' AND db_key = ?1 AND db_secondary_key = ?2;"},
+	[DISK_STMT_DELETE_HM] = {"delete",
+		"DELETE FROM xfiredb_data "
+		"WHERE db_type = 'hashmap' AND db_key = ?1 AND db_secondary_key = ?2;"},
+	[DISK_STMT_DELETE_SET] = {"delete",
+		"DELETE FROM xfiredb_data "
+		"WHERE db_type = 'set' AND db_key = ?1 AND db_secondary_key = ?2;"},
+	[DISK_STMT_LOAD_KEY] = {"load",
+		"SELECT * FROM xfiredb_data WHERE db_key = ?1 "
+		"ORDER BY db_type, db_secondary_key;"},
+	[DISK_STMT_LOAD_ALL] = {"load",
+		"SELECT * FROM xfiredb_data "
+		"ORDER BY db_key, db_type, db_secondary_key;"},
+	[DISK_STMT_SIZE] = {"size",
+		"SELECT value FROM xfiredb_meta WHERE name = 'rows';"},
+};
+
+/*
+ * Get a statement from the cache of \p d, preparing it on first use.
+ */
+static sqlite3_stmt *disk_stmt(struct disk *d, disk_stmt_t idx)
+{
+	sqlite3_stmt *stmt;
+	int rc;
+
+	if(d->stmts[idx])
+		return d->stmts[idx];
+
+#if SQLITE_VERSION_NUMBER >= 3020000
+	rc = sqlite3_prepare_v3(d->handle, disk_queries[idx].sql, -1,
+			SQLITE_PREPARE_PERSISTENT, &stmt, NULL);
+#else
+	rc = sqlite3_prepare_v2(d->handle, disk_queries[idx].sql, -1, &stmt, NULL);
+#endif
+	if(rc != SQLITE_OK) {
+		fprintf(stderr, "Disk %s failed: %s\n", disk_queries[idx].name,
+				sqlite3_errmsg(d->handle));
+		sqlite3_finalize(stmt);
+		return NULL;
+	}
+
+	d->stmts[idx] = stmt;
+	return stmt;
+}
+
+/*
+ * Run a cached statement. The parameters are described by \p types: 't'
+ * binds a string (NULL binds SQL NULL), 'b' binds a string followed by its
+ * length as a size_t, which may hold NUL bytes, and 'i' binds an s64.
+ */
+static int disk_exec_stmt(struct disk *d, disk_stmt_t idx, const char *types, ...)
+{
+	sqlite3_stmt *stmt;
+	const char *str;
+	size_t len;
+	va_list va;
+	int rc, param;
+
+	xfiredb_mutex_lock(&d->lock);
+	stmt = disk_stmt(d, idx);
+	if(!stmt) {
+		xfiredb_mutex_unlock(&d->lock);
+		return -XFIREDB_ERR;
+	}
+
+	va_start(va, types);
+	for(param = 1; *types; types++, param++) {
+		if(*types == 'i') {
+			sqlite3_bind_int64(stmt, param, va_arg(va, s64));
+			continue;
+		}
+
+		str = va_arg(va, const char*);
+		len = *types == 'b' ? va_arg(va, size_t) : 0;
+		if(!str)
+			sqlite3_bind_null(stmt, param);
+		else if(*types == 'b')
+			sqlite3_bind_text(stmt, param, str, (int)len, SQLITE_STATIC);
+		else
+			sqlite3_bind_text(stmt, param, str, -1, SQLITE_STATIC);
+	}
+	va_end(va);
+
+	rc = sqlite3_step(stmt);
+	if(rc != SQLITE_DONE)
+		fprintf(stderr, "Disk %s failed: %s\n", disk_queries[idx].name,
+				sqlite3_errmsg(d->handle));
+
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+	xfiredb_mutex_unlock(&d->lock);
+
+	return rc == SQLITE_DONE ? -XFIREDB_OK : -XFIREDB_ERR;
+}
+
+static inline size_t disk_strlen(const char *data)
+{
+	return data ? strlen(data) : 0;
+}
 
 #define DISK_CLEAR_QUERY \
-	"DELETE * FROM xfiredb_data;"
+	"DELETE FROM xfiredb_data;"
 
 void disk_clear(struct disk *d)
 {
@@ -139,10 +436,29 @@ void disk_clear(struct disk *d)
 	xfiredb_free(query);
 }
 
-struct hm_store_data {
-	char *key;
-	struct disk *d;
-};
+/**
+ * @brief Start a transaction.
+ * @param d Disk to start the transaction on.
+ * @return An error code.
+ *
+ * Changes made after this call are written to disk as a whole, once
+ * disk_commit is called. This saves a journal sync for each change.
+ */
+int disk_begin(struct disk *d)
+{
+	return disk_exec_stmt(d, DISK_STMT_BEGIN, "");
+}
+
+/**
+ * @brief Commit a transaction.
+ * @param d Disk to commit the transaction of.
+ * @return An error code.
+ * @see disk_begin
+ */
+int disk_commit(struct disk *d)
+{
+	return disk_exec_stmt(d, DISK_STMT_COMMIT, "");
+}
 
 /**
  * @brief Store a hashmap node.
@@ -154,19 +470,23 @@ struct hm_store_data {
  */
 int disk_store_hm_node(struct disk *d, char *key, char *nodekey, char *data)
 {
-	int rc;
-	char *msg, *query;
-
-	xfiredb_sprintf(&query, DISK_STORE_QUERY, key, nodekey, "hashmap", data);
-	rc = sqlite3_exec(d->handle, query, &dummy_hook, NULL, &msg);
-
-	if(rc != SQLITE_OK)
-		fprintf(stderr, "Disk store failed: %s\n", msg);
+	return disk_store_hm_node_len(d, key, nodekey, data, disk_strlen(data));
+}
 
-	sqlite3_free(msg);
-	xfiredb_free(query);
-	
-	return rc == SQLITE_OK ? -XFIREDB_OK : -XFIREDB_ERR;
+/**
+ * @brief Store a hashmap node holding binary data.
+ * @param d Disk to store onto.
+ * @param key Key to store the node under.
+ * @param nodekey Key of \p data within the hashmap.
+ * @param data Data to store.
+ * @param len Length of \p data in bytes.
+ * @return An error code.
+ */
+int disk_store_hm_node_len(struct disk *d, char *key, char *nodekey,
+		const char *data, size_t len)
+{
+	return disk_exec_stmt(d, DISK_STMT_STORE, "tttb",
+			key, nodekey, "hashmap", data, len);
 }
 
 /**
@@ -179,26 +499,20 @@ int disk_store_hm_node(struct disk *d, char *key, char *nodekey, char *data)
 int disk_store_hm(struct disk *d, char *key, struct hashmap *map)
 {
 	struct hashmap_node *node;
-	char *data, *msg, *query;
 	struct string *s;
 	struct hashmap_iterator *it;
-	int rc;
+	const char *data;
+	size_t len;
 
 	it = hashmap_new_iterator(map);
 	for(node = hashmap_iterator_next(it); node;
 			node = hashmap_iterator_next(it)) {
 		s = container_of(node, struct string, node);
-		string_get(s, &data);
-		xfiredb_sprintf(&query, DISK_STORE_QUERY, key, node->key, "hashmap", data);
-		rc = sqlite3_exec(d->handle, query, &dummy_hook, d, &msg);
-
-		if(rc != SQLITE_OK)
-			fprintf(stderr, "Disk store failed: %s\n", msg);
-
-		sqlite3_free(msg);
-		xfiredb_free(query);
-		xfiredb_free(data);
+		data = string_borrow(s, &len);
+		disk_store_hm_node_len(d, key, node->key, data, len);
+		string_unborrow(s);
 	}
+	hashmap_free_iterator(it);
 
 	return -XFIREDB_OK;
 }
@@ -212,43 +526,35 @@ int disk_store_hm(struct disk *d, char *key, struct hashmap *map)
  */
 int disk_store_set_key(struct disk *d, char *key, char *skey)
 {
-	int rc;
-	char *msg, *query;
-
-	xfiredb_sprintf(&query, DISK_STORE_QUERY, key, skey, "set", "null");
-	rc = sqlite3_exec(d->handle, query, &dummy_hook, NULL, &msg);
-
-	if(rc != SQLITE_OK)
-		fprintf(stderr, "Disk store failed: %s\n", msg);
-
-	sqlite3_free(msg);
-	xfiredb_free(query);
-	
-	return rc == SQLITE_OK ? -XFIREDB_OK : -XFIREDB_ERR;
+	return disk_exec_stmt(d, DISK_STMT_STORE, "tttt", key, skey, "set", "null");
 }
 
 /**
  * @brief Store a list entry.
  * @param d Disk to store on.
  * @param key Key to store \p data under.
+ * @param id Position ID of the entry.
  * @param data Data to store.
  * @return An error code.
  */
-int disk_store_list_entry(struct disk *d, char *key, char *data)
+int disk_store_list_entry(struct disk *d, char *key, s64 id, char *data)
 {
-	int rc;
-	char *msg, *query;
-
-	xfiredb_sprintf(&query, DISK_STORE_QUERY, key, "null", "list", data);
-	rc = sqlite3_exec(d->handle, query, &dummy_hook, d, &msg);
-
-	if(rc != SQLITE_OK)
-		fprintf(stderr, "Disk store failed: %s\n", msg);
-
-	xfiredb_free(query);
-	sqlite3_free(msg);
+	return disk_store_list_entry_len(d, key, id, data, disk_strlen(data));
+}
 
-	return (rc == SQLITE_OK) ? -XFIREDB_OK : -XFIREDB_ERR;
+/**
+ * @brief Store a list entry holding binary data.
+ * @param d Disk to store on.
+ * @param key Key to store \p data under.
+ * @param id Position ID of the entry.
+ * @param data Data to store.
+ * @param len Length of \p data in bytes.
+ * @return An error code.
+ */
+int disk_store_list_entry_len(struct disk *d, char *key, s64 id,
+		const char *data, size_t len)
+{
+	return disk_exec_stmt(d, DISK_STMT_STORE_LIST, "tib", key, id, data, len);
 }
 
 /**
@@ -262,17 +568,18 @@ int disk_store_list(struct disk *d, char *key, struct list_head *lh)
 {
 	struct list *c;
 	struct string *s;
-	char *data;
+	const char *data;
+	size_t len;
+	int rc;
 
 	list_for_each(lh, c) {
 		s = container_of(c, struct string, entry);
-		string_get(s, &data);
-		if(disk_store_list_entry(d, key, data)) {
-			xfiredb_free(data);
-			return -XFIREDB_ERR;
-		}
+		data = string_borrow(s, &len);
+		rc = disk_store_list_entry_len(d, key, list_entry_id(c), data, len);
+		string_unborrow(s);
 
-		xfiredb_free(data);
+		if(rc)
+			return -XFIREDB_ERR;
 	}
 
 	return -XFIREDB_OK;
@@ -287,22 +594,21 @@ int disk_store_list(struct disk *d, char *key, struct list_head *lh)
  */
 int disk_store_string(struct disk *d, char *key, char *data)
 {
-	int rc;
-	char *msg, *query;
-
-	xfiredb_sprintf(&query, DISK_STORE_QUERY, key, "null", "string", data);
-	rc = sqlite3_exec(d->handle, query, &dummy_hook, d, &msg);
-
-	if(rc != SQLITE_OK) {
-		fprintf(stderr, "Disk store failed: %s\n", msg);
-		sqlite3_free(msg);
-		xfiredb_free(query);
-		return -XFIREDB_ERR;
-	}
+	return disk_store_string_len(d, key, data, disk_strlen(data));
+}
 
-	sqlite3_free(msg);
-	xfiredb_free(query);
-	return rc;
+/**
+ * @brief Store a key-value pair holding binary data on the disk.
+ * @param d Disk to store on.
+ * @param key Key to store.
+ * @param data Data to store (under \p key).
+ * @param len Length of \p data in bytes.
+ * @return Error code.
+ */
+int disk_store_string_len(struct disk *d, char *key, const char *data, size_t len)
+{
+	return disk_exec_stmt(d, DISK_STMT_STORE, "tttb", key, "null", "string",
+			data, len);
 }
 
 static int dump_hook(void *arg, int argc, char **row, char **colname)
@@ -347,11 +653,6 @@ void disk_dump(struct disk *d, FILE *output)
 	sqlite3_free(msg);
 }
 
-#define DISK_UPDATE_HM_QUERY \
-	"UPDATE xfiredb_data " \
-	"SET db_value = '%s' " \
-	"WHERE db_key = '%s' AND db_secondary_key = '%s';"
-
 /**
  * @brief Update hashmap entry.
  * @param d Disk to update.
@@ -362,53 +663,51 @@ void disk_dump(struct disk *d, FILE *output)
  */
 int disk_update_hm(struct disk *d, char *key, char *nodekey, char *data)
 {
-	int rc;
-	char *msg, *query;
-
-	xfiredb_sprintf(&query, DISK_UPDATE_HM_QUERY, data, key, nodekey);
-	rc = sqlite3_exec(d->handle, query, &dummy_hook, NULL, &msg);
-
-	if(rc != SQLITE_OK)
-		fprintf(stderr, "Disk update failed: %s\n", msg); 
-
-	xfiredb_free(query);
-	sqlite3_free(msg);
-
-	return (rc == SQLITE_OK) ? -XFIREDB_OK : -XFIREDB_ERR;
+	return disk_update_hm_len(d, key, nodekey, data, disk_strlen(data));
 }
 
-#define DISK_UPDATE_LIST_QUERY \
-	"UPDATE xfiredb_data SET db_value = '%s' " \
-	"WHERE ROWID IN (SELECT ROWID FROM xfiredb_data WHERE " \
-	"db_key = '%s' AND db_value = '%s' AND db_type = 'list' LIMIT 1);"
+/**
+ * @brief Update hashmap entry with binary data.
+ * @param d Disk to update.
+ * @param key Key to update.
+ * @param nodekey Node key to update.
+ * @param data Data to set.
+ * @param len Length of \p data in bytes.
+ * @return An error code.
+ */
+int disk_update_hm_len(struct disk *d, char *key, char *nodekey,
+		const char *data, size_t len)
+{
+	return disk_exec_stmt(d, DISK_STMT_UPDATE_HM, "btt", data, len, key, nodekey);
+}
 
 /**
  * @brief Update a list entry.
  * @param d Disk to update.
  * @param key Key to update.
- * @param data Data currently stored under \p key.
+ * @param id Position ID of the entry to update.
  * @param newdata Data to set.
  * @return An error code.
  */
-int disk_update_list(struct disk *d, char *key, char *data, char *newdata)
+int disk_update_list(struct disk *d, char *key, s64 id, char *newdata)
 {
-	int rc;
-	char *msg, *query;
-
-	xfiredb_sprintf(&query, DISK_UPDATE_LIST_QUERY, newdata, key, data);
-	rc = sqlite3_exec(d->handle, query, &dummy_hook, d, &msg);
-
-	if(rc != SQLITE_OK)
-		fprintf(stderr, "Disk update failed: %s\n", msg);
-
-	sqlite3_free(msg);
-	xfiredb_free(query);
-	return rc == SQLITE_OK ? -XFIREDB_OK : -XFIREDB_ERR;
+	return disk_update_list_len(d, key, id, newdata, disk_strlen(newdata));
 }
 
-#define DISK_UPDATE_STRING_QUERY \
-	"UPDATE xfiredb_data SET db_value = '%s' " \
-	"WHERE db_key = '%s' AND db_type = 'string';"
+/**
+ * @brief Update a list entry with binary data.
+ * @param d Disk to update.
+ * @param key Key to update.
+ * @param id Position ID of the entry to update.
+ * @param newdata Data to set.
+ * @param len Length of \p newdata in bytes.
+ * @return An error code.
+ */
+int disk_update_list_len(struct disk *d, char *key, s64 id,
+		const char *newdata, size_t len)
+{
+	return disk_exec_stmt(d, DISK_STMT_UPDATE_LIST, "bti", newdata, len, key, id);
+}
 
 /**
  * @brief Update a key-value pair.
@@ -419,35 +718,47 @@ int disk_update_list(struct disk *d, char *key, char *data, char *newdata)
  */
 int disk_update_string(struct disk *d, char *key, void *data)
 {
-	int rc;
-	char *msg, *query;
-
-	xfiredb_sprintf(&query, DISK_UPDATE_STRING_QUERY, data, key);
-	rc = sqlite3_exec(d->handle, query, &dummy_hook, d, &msg);
-
-	if(rc != SQLITE_OK)
-		fprintf(stderr, "Disk update failed: %s\n", msg);
+	return disk_update_string_len(d, key, data, disk_strlen(data));
+}
 
-	sqlite3_free(msg);
-	xfiredb_free(query);
-	return rc == SQLITE_OK ? -XFIREDB_OK : -XFIREDB_ERR;
+/**
+ * @brief Update a key-value pair with binary data.
+ * @param d Disk to search on.
+ * @param key Key to update.
+ * @param data New data to set under \p key.
+ * @param len Length of \p data in bytes.
+ * @return Error code.
+ */
+int disk_update_string_len(struct disk *d, char *key, const char *data, size_t len)
+{
+	return disk_exec_stmt(d, DISK_STMT_UPDATE_STRING, "bt", data, len, key);
 }
 
-#define DISK_DELETE_STRING_QUERY \
-	"DELETE FROM xfiredb_data " \
-	"WHERE db_type = 'string' AND db_key = '%s';"
-#define DISK_DELETE_LIST_QUERY \
-	"DELETE FROM xfiredb_data WHERE ROWID in (" \
-	"SELECT ROWID FROM xfiredb_data WHERE db_key = '%s' AND " \
-	"db_value = '%s' AND db_type = 'list' LIMIT 1);"
+/**
+ * @brief Append data to a key-value pair.
+ * @param d Disk to search on.
+ * @param key Key to update.
+ * @param data Data to append to the value stored under \p key.
+ * @return Error code.
+ */
+int disk_append_string(struct disk *d, char *key, char *data)
+{
+	return disk_append_string_len(d, key, data, disk_strlen(data));
+}
 
-#define DISK_DELETE_HM_QUERY \
-	"DELETE FROM xfiredb_data " \
-	"WHERE db_type = 'hashmap' AND db_key = '%s' AND db_secondary_key = '%s';"
+/**
+ * @brief Append binary data to a key-value pair.
+ * @param d Disk to search on.
+ * @param key Key to update.
+ * @param data Data to append to the value stored under \p key.
+ * @param len Length of \p data in bytes.
+ * @return Error code.
+ */
+int disk_append_string_len(struct disk *d, char *key, const char *data, size_t len)
+{
+	return disk_exec_stmt(d, DISK_STMT_APPEND_STRING, "bt", data, len, key);
+}
 
-#define DISK_DELETE_SET_QUERY \
-	"DELETE FROM xfiredb_data " \
-	"WHERE db_type = 'set' AND db_key = '%s' AND db_secondary_key = '%s';"
 /**
  * @brief Delete a hashmap node.
  * @param d Disk to delete from.
@@ -456,18 +767,7 @@ int disk_update_string(struct disk *d, char *key, void *data)
  */
 int disk_delete_hashmapnode(struct disk *d, char *key, char *nodekey)
 {
-	int rc;
-	char *msg, *query;
-
-	xfiredb_sprintf(&query, DISK_DELETE_HM_QUERY, key, nodekey);
-	rc = sqlite3_exec(d->handle, query, &dummy_hook, d, &msg);
-
-	if(rc != SQLITE_OK)
-		fprintf(stderr, "Disk delete failed: %s\n", msg);
-
-	sqlite3_free(msg);
-	xfiredb_free(query);
-	return rc == SQLITE_OK ? -XFIREDB_OK : -XFIREDB_ERR;
+	return disk_exec_stmt(d, DISK_STMT_DELETE_HM, "tt", key, nodekey);
 }
 
 /**
@@ -478,40 +778,18 @@ int disk_delete_hashmapnode(struct disk *d, char *key, char *nodekey)
  */
 int disk_delete_set_key(struct disk *d, char *key, char *skey)
 {
-	int rc;
-	char *msg, *query;
-
-	xfiredb_sprintf(&query, DISK_DELETE_SET_QUERY, key, skey);
-	rc = sqlite3_exec(d->handle, query, &dummy_hook, d, &msg);
-
-	if(rc != SQLITE_OK)
-		fprintf(stderr, "Disk delete failed: %s\n", msg);
-
-	sqlite3_free(msg);
-	xfiredb_free(query);
-	return rc == SQLITE_OK ? -XFIREDB_OK : -XFIREDB_ERR;
+	return disk_exec_stmt(d, DISK_STMT_DELETE_SET, "tt", key, skey);
 }
 
 /**
  * @brief Delete a list entry from disk.
  * @param d Disk to delete from.
  * @param key Key to delete.
- * @param data Data currently stored on the disk under this entry.
+ * @param id Position ID of the entry to delete.
  */
-int disk_delete_list(struct disk *d, char *key, char *data)
+int disk_delete_list(struct disk *d, char *key, s64 id)
 {
-	int rc;
-	char *msg, *query;
-
-	xfiredb_sprintf(&query, DISK_DELETE_LIST_QUERY, key, data);
-	rc = sqlite3_exec(d->handle, query, &dummy_hook, d, &msg);
-
-	if(rc != SQLITE_OK)
-		fprintf(stderr, "Disk delete failed: %s\n", msg);
-
-	sqlite3_free(msg);
-	xfiredb_free(query);
-	return rc == SQLITE_OK ? -XFIREDB_OK : -XFIREDB_ERR;
+	return disk_exec_stmt(d, DISK_STMT_DELETE_LIST, "ti", key, id);
 }
 
 /**
@@ -521,107 +799,130 @@ int disk_delete_list(struct disk *d, char *key, char *data)
  */
 int disk_delete_string(struct disk *d, char *key)
 {
-	int rc;
-	char *msg, *query;
-
-	xfiredb_sprintf(&query, DISK_DELETE_STRING_QUERY, key);
-	rc = sqlite3_exec(d->handle, query, &dummy_hook, d, &msg);
-
-	if(rc != SQLITE_OK)
-		fprintf(stderr, "Disk delete failed: %s\n", msg);
-
-	sqlite3_free(msg);
-	xfiredb_free(query);
-	return rc == SQLITE_OK ? -XFIREDB_OK : -XFIREDB_ERR;
-}
-
-static int disk_load_hook(void *arg, int argc, char **rows, char **colname)
-{
-	void (*hook)(int argc, char **rows, char **colnames) = arg;
-
-	hook(argc, rows, colname);
-	return 0;
-}
-
-static int disk_size_hook(void *arg, int argc, char **rows, char **colname)
-{
-	long *size = arg;
-
-	*size = argc;
-	return 0;
+	return disk_exec_stmt(d, DISK_STMT_DELETE_STRING, "t", key);
 }
 
+/**
+ * @brief Get the number of rows stored on a disk.
+ * @param d Disk to get the size of.
+ * @return The number of rows, or -XFIREDB_ERR.
+ */
 long disk_size(struct disk *d)
 {
+	sqlite3_stmt *stmt;
+	long size = -XFIREDB_ERR;
 	int rc;
-	char *msg;
-	long size;
-
-	rc = sqlite3_exec(d->handle, "SELECT * FROM xfiredb_data", &disk_size_hook, &size, &msg);
 
-	switch(rc) {
-	case SQLITE_OK:
-		break;
-
-	default:
-		fprintf(stderr, "Disk load failed: %s\n", msg);
-		sqlite3_free(msg);
+	xfiredb_mutex_lock(&d->lock);
+	stmt = disk_stmt(d, DISK_STMT_SIZE);
+	if(!stmt) {
+		xfiredb_mutex_unlock(&d->lock);
 		return -XFIREDB_ERR;
 	}
 
-	sqlite3_free(msg);
+	rc = sqlite3_step(stmt);
+	if(rc == SQLITE_ROW) {
+		size = (long)sqlite3_column_int64(stmt, 0);
+		d->records = size;
+	} else {
+		fprintf(stderr, "Disk size failed: %s\n", sqlite3_errmsg(d->handle));
+	}
+
+	sqlite3_reset(stmt);
+	xfiredb_mutex_unlock(&d->lock);
+
 	return size;
 }
 
-#define DISK_LOAD_QUERY "SELECT * FROM xfiredb_data WHERE db_key='%s'"
+#define DISK_LOAD_MAX_COLUMNS 8
 
-int disk_load_key(struct disk *d, char *key, void (*hook)(int argc, char **rows, char **colnames))
+/*
+ * Step through the rows of a load statement. Values are passed to \p hook
+ * together with their length in bytes, since they may hold NUL bytes.
+ * The caller holds d->lock.
+ */
+static int disk_load_stmt(struct disk *d, sqlite3_stmt *stmt,
+		void (*hook)(int argc, char **rows, size_t *lens, char **colnames))
 {
-	int rc;
-	char *msg, *query;
+	char *rows[DISK_LOAD_MAX_COLUMNS], *cols[DISK_LOAD_MAX_COLUMNS];
+	size_t lens[DISK_LOAD_MAX_COLUMNS];
+	int rc, argc, idx;
+
+	argc = sqlite3_column_count(stmt);
+	if(argc > DISK_LOAD_MAX_COLUMNS)
+		argc = DISK_LOAD_MAX_COLUMNS;
+
+	while((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		for(idx = 0; idx < argc; idx++) {
+			/* Fetch the text first, so the length is that of the text */
+			rows[idx] = (char*)sqlite3_column_text(stmt, idx);
+			lens[idx] = sqlite3_column_bytes(stmt, idx);
+			cols[idx] = (char*)sqlite3_column_name(stmt, idx);
+		}
 
-	xfiredb_sprintf(&query, DISK_LOAD_QUERY, key);
-	rc = sqlite3_exec(d->handle, query, &disk_load_hook, hook, &msg);
+		hook(argc, rows, lens, cols);
+	}
 
-	switch(rc) {
-	case SQLITE_OK:
-		break;
+	if(rc != SQLITE_DONE)
+		fprintf(stderr, "Disk load failed: %s\n", sqlite3_errmsg(d->handle));
 
-	default:
-		fprintf(stderr, "Disk load failed: %s\n", msg);
-		sqlite3_free(msg);
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+	return rc == SQLITE_DONE ? -XFIREDB_OK : -XFIREDB_ERR;
+}
+
+/**
+ * @brief Load all rows stored under a key.
+ * @param d Disk to load from.
+ * @param key Key to load.
+ * @param hook Load hook, called once for every row with the row values
+ *   and their lengths.
+ * @return Error code.
+ */
+int disk_load_key(struct disk *d, char *key,
+		void (*hook)(int argc, char **rows, size_t *lens, char **colnames))
+{
+	sqlite3_stmt *stmt;
+	int rc;
+
+	xfiredb_mutex_lock(&d->lock);
+	stmt = disk_stmt(d, DISK_STMT_LOAD_KEY);
+	if(!stmt) {
+		xfiredb_mutex_unlock(&d->lock);
 		return -XFIREDB_ERR;
 	}
 
-	sqlite3_free(msg);
-	return -XFIREDB_ERR;
+	sqlite3_bind_text(stmt, 1, key, -1, SQLITE_STATIC);
+	rc = disk_load_stmt(d, stmt, hook);
+	xfiredb_mutex_unlock(&d->lock);
+
+	return rc;
 }
 
 /**
  * @brief Load the disk into memory.
  * @param d Disk to load.
- * @param hook Load hook.
+ * @param hook Load hook, called once for every row with the row values
+ *   and their lengths.
  * @return Error code.
  */
-int disk_load(struct disk *d, void (*hook)(int argc, char **rows, char **colnames))
+int disk_load(struct disk *d,
+		void (*hook)(int argc, char **rows, size_t *lens, char **colnames))
 {
+	sqlite3_stmt *stmt;
 	int rc;
-	char *msg;
-
-	rc = sqlite3_exec(d->handle, "SELECT * FROM xfiredb_data", &disk_load_hook, hook, &msg);
 
-	switch(rc) {
-	case SQLITE_OK:
-		break;
-
-	default:
-		fprintf(stderr, "Disk load failed: %s\n", msg);
-		sqlite3_free(msg);
+	xfiredb_mutex_lock(&d->lock);
+	stmt = disk_stmt(d, DISK_STMT_LOAD_ALL);
+	if(!stmt) {
+		xfiredb_mutex_unlock(&d->lock);
 		return -XFIREDB_ERR;
 	}
 
-	sqlite3_free(msg);
-	return -XFIREDB_ERR;
+	rc = disk_load_stmt(d, stmt, hook);
+	xfiredb_mutex_unlock(&d->lock);
+
+	return rc;
 }
 
 /**
@@ -631,10 +932,14 @@ int disk_load(struct disk *d, void (*hook)(int argc, char **rows, char **colname
 void disk_destroy(struct disk *disk)
 {
 	sqlite3 *db;
+	int idx;
 
 	if(!disk || !disk->handle)
 		return;
 
+	for(idx = 0; idx < DISK_STMT_NUM; idx++)
+		sqlite3_finalize(disk->stmts[idx]);
+
 	db = disk->handle;
 	sqlite3_close(db);
 
@@ -0,0 +1,191 @@
+/*
+ *  Key expiry queue
+ *  Copyright (C) 2015   Michel Megens <dev@michelmegens.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @addtogroup expire
+ * @{
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <xfiredb/xfiredb.h>
+#include <xfiredb/types.h>
+#include <xfiredb/mem.h>
+#include <xfiredb/os.h>
+#include <xfiredb/time.h>
+#include <xfiredb/expire.h>
+
+#define EXPIRE_HEAP_MIN_SIZE 16
+
+/**
+ * @brief Initialise an expiry queue.
+ * @param h Queue to initialise.
+ */
+void expire_heap_init(struct expire_heap *h)
+{
+	h->heap = NULL;
+	h->size = h->capacity = 0;
+	xfiredb_spinlock_init(&h->lock);
+}
+
+/**
+ * @brief Destroy an expiry queue.
+ * @param h Queue to destroy.
+ */
+void expire_heap_destroy(struct expire_heap *h)
+{
+	size_t idx;
+
+	for(idx = 0; idx < h->size; idx++)
+		xfiredb_free(h->heap[idx].key);
+
+	xfiredb_free(h->heap);
+	h->heap = NULL;
+	h->size = h->capacity = 0;
+	xfiredb_spinlock_destroy(&h->lock);
+}
+
+static inline void expire_heap_swap(struct expire_heap *h, size_t a, size_t b)
+{
+	struct expire_entry tmp;
+
+	tmp = h->heap[a];
+	h->heap[a] = h->heap[b];
+	h->heap[b] = tmp;
+}
+
+static void expire_heap_up(struct expire_heap *h, size_t idx)
+{
+	size_t parent;
+
+	while(idx) {
+		parent = (idx - 1) / 2;
+		if(!time_after(h->heap[parent].when, h->heap[idx].when))
+			break;
+
+		expire_heap_swap(h, parent, idx);
+		idx = parent;
+	}
+}
+
+static void expire_heap_down(struct expire_heap *h, size_t idx)
+{
+	size_t child;
+
+	while((child = idx * 2 + 1) < h->size) {
+		if(child + 1 < h->size &&
+				time_after(h->heap[child].when, h->heap[child + 1].when))
+			child++;
+
+		if(!time_after(h->heap[idx].when, h->heap[child].when))
+			break;
+
+		expire_heap_swap(h, idx, child);
+		idx = child;
+	}
+}
+
+/**
+ * @brief Add a key to an expiry queue.
+ * @param h Queue to add to.
+ * @param key Key to add.
+ * @param when Time stamp (in milliseconds) at which \p key expires.
+ */
+void expire_heap_push(struct expire_heap *h, const char *key, time_t when)
+{
+	struct expire_entry *e;
+	char *copy;
+
+	xfiredb_sprintf(&copy, "%s", key);
+	xfiredb_spin_lock(&h->lock);
+	if(h->size == h->capacity) {
+		h->capacity = h->capacity ? h->capacity * 2 : EXPIRE_HEAP_MIN_SIZE;
+		h->heap = xfiredb_realloc(h->heap, h->capacity * sizeof(*h->heap));
+	}
+
+	e = &h->heap[h->size];
+	e->when = when;
+	e->key = copy;
+	expire_heap_up(h, h->size);
+	h->size++;
+	xfiredb_spin_unlock(&h->lock);
+}
+
+/**
+ * @brief Remove the first due entry from an expiry queue.
+ * @param h Queue to pop from.
+ * @param now Current time stamp in milliseconds.
+ * @param when Pointer to store the expiry time of the popped key in.
+ * @return The popped key, or \p NULL if no key is due. The returned key
+ *   has to be free'd by the caller.
+ */
+char *expire_heap_pop(struct expire_heap *h, time_t now, time_t *when)
+{
+	char *key;
+
+	xfiredb_spin_lock(&h->lock);
+	if(!h->size || time_after(h->heap[0].when, now)) {
+		xfiredb_spin_unlock(&h->lock);
+		return NULL;
+	}
+
+	key = h->heap[0].key;
+	*when = h->heap[0].when;
+	h->size--;
+	if(h->size) {
+		h->heap[0] = h->heap[h->size];
+		expire_heap_down(h, 0);
+	}
+	xfiredb_spin_unlock(&h->lock);
+
+	return key;
+}
+
+/**
+ * @brief Remove stale entries from an expiry queue.
+ * @param h Queue to compact.
+ * @param valid Called for every entry. Entries for which it returns false
+ *   are removed.
+ * @param arg Argument passed to \p valid.
+ * @return The number of removed entries.
+ */
+size_t expire_heap_compact(struct expire_heap *h,
+		bool (*valid)(const char *key, time_t when, void *arg), void *arg)
+{
+	size_t idx, size = 0, removed;
+
+	xfiredb_spin_lock(&h->lock);
+	for(idx = 0; idx < h->size; idx++) {
+		if(valid(h->heap[idx].key, h->heap[idx].when, arg))
+			h->heap[size++] = h->heap[idx];
+		else
+			xfiredb_free(h->heap[idx].key);
+	}
+
+	removed = h->size - size;
+	h->size = size;
+	for(idx = size / 2; idx > 0; idx--)
+		expire_heap_down(h, idx - 1);
+	xfiredb_spin_unlock(&h->lock);
+
+	return removed;
+}
+
+/** @} */
+
@@ -28,6 +28,7 @@
 #include <xfiredb/types.h>
 #include <xfiredb/object.h>
 #include <xfiredb/hashmap.h>
+#include <xfiredb/intern.h>
 #include <xfiredb/mem.h>
 #include <xfiredb/error.h>
 
@@ -99,7 +100,8 @@ void hashmap_init(struct hashmap *hm)
  */
 void hashmap_node_destroy(struct hashmap_node *n)
 {
-	xfiredb_free(n->key);
+	intern_put(n->key);
+	n->key = NULL;
 	skiplist_node_destroy(&n->node);
 }
 
@@ -108,13 +110,13 @@ void hashmap_node_destroy(struct hashmap_node *n)
  * @param hm Hashmap to add to.
  * @param key Key to add \p n under.
  * @param n Node to add under \p key.
+ *
+ * Field names are interned, so maps with the same fields share a single
+ * copy of every field name.
  */
 int hashmap_add(struct hashmap *hm, char *key, struct hashmap_node *n)
 {
-	char *_key;
-
-	xfiredb_sprintf(&_key, "%s", key);
-	n->key = _key;
+	n->key = intern_get(key);
 	if(skiplist_insert(&hm->list, key, &n->node) == -XFIREDB_OK) {
 		atomic_inc(hm->num);
 		return -XFIREDB_OK;
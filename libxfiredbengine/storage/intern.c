@@ -0,0 +1,282 @@
+/*
+ *  String interning
+ *  Copyright (C) 2015   Michel Megens <dev@michelmegens.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @addtogroup intern
+ * @{
+ */
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <xfiredb/xfiredb.h>
+#include <xfiredb/types.h>
+#include <xfiredb/os.h>
+#include <xfiredb/mem.h>
+#include <xfiredb/intern.h>
+
+#define INTERN_SHARDS 16
+#define INTERN_MIN_SIZE 64
+
+#define FNV_OFFSET 2166136261U
+#define FNV_PRIME 16777619U
+
+/*
+ * The table is split in shards, each with its own lock, so threads
+ * interning different strings rarely contend.
+ */
+struct intern_shard {
+	xfiredb_spinlock_t lock;
+	struct intern_entry **table;
+	size_t size;
+	size_t num;
+};
+
+static struct intern_shard intern_shards[INTERN_SHARDS];
+static pthread_once_t intern_once = PTHREAD_ONCE_INIT;
+
+static void intern_init(void)
+{
+	int idx;
+
+	for(idx = 0; idx < INTERN_SHARDS; idx++)
+		xfiredb_spinlock_init(&intern_shards[idx].lock);
+}
+
+static inline u32 intern_hash(const void *data, size_t len)
+{
+	const unsigned char *ptr = data;
+	u32 hash = FNV_OFFSET;
+	size_t idx;
+
+	for(idx = 0; idx < len; idx++) {
+		hash ^= ptr[idx];
+		hash *= FNV_PRIME;
+	}
+
+	return hash;
+}
+
+static inline struct intern_shard *intern_shard(u32 hash)
+{
+	return &intern_shards[hash & (INTERN_SHARDS - 1)];
+}
+
+/* The low bits select the shard, so the buckets are indexed by the rest */
+static inline size_t intern_index(struct intern_shard *shard, u32 hash)
+{
+	return (hash >> 4) & (shard->size - 1);
+}
+
+static inline struct intern_entry *intern_to_entry(const char *str)
+{
+	return (struct intern_entry*)(str - offsetof(struct intern_entry, str));
+}
+
+static struct intern_entry *intern_lookup(struct intern_shard *shard,
+		const void *data, size_t len, u32 hash)
+{
+	struct intern_entry *e;
+
+	if(!shard->table)
+		return NULL;
+
+	for(e = shard->table[intern_index(shard, hash)]; e; e = e->next) {
+		if(e->hash == hash && e->len == len && !memcmp(e->str, data, len))
+			return e;
+	}
+
+	return NULL;
+}
+
+static void intern_grow(struct intern_shard *shard)
+{
+	struct intern_entry **old, *e, *next;
+	size_t idx, size;
+
+	old = shard->table;
+	size = shard->size;
+
+	shard->size = size ? size * 2 : INTERN_MIN_SIZE;
+	shard->table = xfiredb_zalloc_stat(shard->size * sizeof(*shard->table),
+			MEM_STAT_INTERN);
+
+	for(idx = 0; idx < size; idx++) {
+		for(e = old[idx]; e; e = next) {
+			next = e->next;
+			e->next = shard->table[intern_index(shard, e->hash)];
+			shard->table[intern_index(shard, e->hash)] = e;
+		}
+	}
+
+	xfiredb_free_stat(old, MEM_STAT_INTERN);
+}
+
+/**
+ * @brief Intern a binary buffer.
+ * @param data Data to intern.
+ * @param len Length of \p data in bytes.
+ * @return A shared, terminated copy of \p data.
+ *
+ * Every call returns the same copy for equal data, and takes a reference
+ * on it. The returned string may not be modified and has to be given back
+ * using intern_put.
+ */
+char *intern_get_len(const void *data, size_t len)
+{
+	struct intern_shard *shard;
+	struct intern_entry *e, *entry;
+	size_t idx;
+	u32 hash;
+
+	pthread_once(&intern_once, &intern_init);
+	hash = intern_hash(data, len);
+	shard = intern_shard(hash);
+
+	xfiredb_spin_lock(&shard->lock);
+	e = intern_lookup(shard, data, len, hash);
+	if(e) {
+		e->refs++;
+		xfiredb_spin_unlock(&shard->lock);
+		return e->str;
+	}
+	xfiredb_spin_unlock(&shard->lock);
+
+	/* Don't allocate with the shard locked, and check again afterwards */
+	entry = xfiredb_alloc_stat(sizeof(*entry) + len + 1, MEM_STAT_INTERN);
+	entry->hash = hash;
+	entry->refs = 1;
+	entry->len = len;
+	memcpy(entry->str, data, len);
+	entry->str[len] = '\0';
+
+	xfiredb_spin_lock(&shard->lock);
+	e = intern_lookup(shard, data, len, hash);
+	if(e) {
+		e->refs++;
+		xfiredb_spin_unlock(&shard->lock);
+		xfiredb_free_stat(entry, MEM_STAT_INTERN);
+		return e->str;
+	}
+
+	if(shard->num >= shard->size)
+		intern_grow(shard);
+
+	idx = intern_index(shard, hash);
+	entry->next = shard->table[idx];
+	shard->table[idx] = entry;
+	shard->num++;
+	xfiredb_spin_unlock(&shard->lock);
+
+	return entry->str;
+}
+
+/**
+ * @brief Intern a C string.
+ * @param str String to intern.
+ * @return A shared copy of \p str.
+ * @see intern_get_len
+ */
+char *intern_get(const char *str)
+{
+	return intern_get_len(str, strlen(str));
+}
+
+/**
+ * @brief Give back an interned string.
+ * @param str String to give back. May be \p NULL.
+ *
+ * The string is free'd when its last reference is dropped.
+ */
+void intern_put(const char *str)
+{
+	struct intern_shard *shard;
+	struct intern_entry *e, **pp;
+
+	if(!str)
+		return;
+
+	e = intern_to_entry(str);
+	shard = intern_shard(e->hash);
+
+	xfiredb_spin_lock(&shard->lock);
+	if(--e->refs) {
+		xfiredb_spin_unlock(&shard->lock);
+		return;
+	}
+
+	for(pp = &shard->table[intern_index(shard, e->hash)]; *pp; pp = &(*pp)->next) {
+		if(*pp == e) {
+			*pp = e->next;
+			break;
+		}
+	}
+
+	shard->num--;
+	xfiredb_spin_unlock(&shard->lock);
+	xfiredb_free_stat(e, MEM_STAT_INTERN);
+}
+
+/**
+ * @brief Get the memory footprint of an interned string.
+ * @param str Interned string.
+ * @return The number of bytes allocated for \p str, divided by the number
+ *   of references to it.
+ */
+size_t intern_size(const char *str)
+{
+	struct intern_shard *shard;
+	struct intern_entry *e;
+	size_t size;
+
+	if(!str)
+		return 0;
+
+	e = intern_to_entry(str);
+	shard = intern_shard(e->hash);
+
+	xfiredb_spin_lock(&shard->lock);
+	size = xfiredb_mem_size(e) / e->refs;
+	xfiredb_spin_unlock(&shard->lock);
+
+	return size;
+}
+
+/**
+ * @brief Get the number of distinct interned strings.
+ * @return The number of strings in the intern table.
+ */
+size_t intern_count(void)
+{
+	struct intern_shard *shard;
+	size_t num = 0;
+	int idx;
+
+	pthread_once(&intern_once, &intern_init);
+	for(idx = 0; idx < INTERN_SHARDS; idx++) {
+		shard = &intern_shards[idx];
+		xfiredb_spin_lock(&shard->lock);
+		num += shard->num;
+		xfiredb_spin_unlock(&shard->lock);
+	}
+
+	return num;
+}
+
+/** @} */
@@ -50,6 +50,33 @@ void list_rpush(struct list_head *head, struct list *node)
 	it = &head->head;
 	it = it->prev;
 
+	node->id = ++head->rid;
+	__list_add(node, it, it->next);
+	atomic_inc(head->num);
+}
+
+/**
+ * @brief Push an element with a known position ID on the right side of \p head.
+ * @param head List head.
+ * @param node Node to add to \p head.
+ * @param id Position ID of \p node.
+ *
+ * Used to restore a list from persistent storage. Entries should be pushed
+ * in ascending order of \p id.
+ */
+void list_rpush_id(struct list_head *head, struct list *node, s64 id)
+{
+	struct list *it;
+
+	it = &head->head;
+	it = it->prev;
+
+	node->id = id;
+	if(id > head->rid)
+		head->rid = id;
+	if(id <= head->lid)
+		head->lid = id - 1;
+
 	__list_add(node, it, it->next);
 	atomic_inc(head->num);
 }
@@ -65,6 +92,7 @@ void list_lpush(struct list_head *head, struct list *node)
 
 	it = &head->head;
 
+	node->id = head->lid--;
 	__list_add(node, it, it->next);
 	atomic_inc(head->num);
 }
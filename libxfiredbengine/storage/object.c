@@ -30,7 +30,6 @@
 #include <xfiredb/object.h>
 #include <xfiredb/time.h>
 #include <xfiredb/mem.h>
-#include <xfiredb/bitops.h>
 
 /**
  * @brief Allocate a new object.
@@ -54,62 +53,86 @@ void object_init(struct object *obj)
 	if(!obj)
 		return;
 
-	obj->crea = xfiredb_time_stamp();
-	xfiredb_spinlock_init(&obj->lock);
-	obj->exp = 0;
-	obj->flags = 0UL;
+	obj->type = 0;
+	obj->encoding = 0;
+	obj->flags = 0;
+	obj->lru = object_lru_clock();
+	obj->freq = OBJECT_LFU_INIT;
 }
 
 /**
- * @brief Check if a given object has expired.
- * @param obj Object to check.
- * @return true if the object expired, false otherwise.
+ * @brief Get the current access clock.
+ * @return The current access clock in seconds, wrapped at \p OBJECT_LRU_MAX.
  */
-bool object_has_expired(struct object *obj)
+u32 object_lru_clock(void)
 {
-	time_t now;
-	bool rv = false;
+	return (u32)(xfiredb_time_stamp() / 1000) & OBJECT_LRU_MAX;
+}
 
-	if(!obj)
-		return false;
+static u32 object_clock_diff(u32 now, u32 then)
+{
+	if(now >= then)
+		return now - then;
 
-	if(__test_bit(OBJECT_EXPIRED_FLAG, &obj->flags))
-		return true;
+	return OBJECT_LRU_MAX - then + now;
+}
 
-	now = xfiredb_time_stamp();
-	object_lock(obj);
-	rv = time_after(now, obj->exp) ? true : false;
+#define OBJECT_LFU_DECAY   60 //!< Seconds per frequency decrement.
+#define OBJECT_LFU_LOG_FACTOR 10 //!< Logarithmic increment factor.
 
-	if(rv)
-		__set_bit(OBJECT_EXPIRED_FLAG, &obj->flags);
-	object_unlock(obj);
+static u32 object_lfu_decay(struct object *obj, u32 now)
+{
+	u32 periods;
 
-	return rv;
+	periods = object_clock_diff(now, obj->lru) / OBJECT_LFU_DECAY;
+	return periods > obj->freq ? 0 : obj->freq - periods;
 }
 
 /**
- * @brief Set the expiry date for an object.
- * @param obj Object to set an expiry for.
- * @param exp Expiry time stamp.
- * @return -XFIREDB_OK on success, -XFIREDB_ERR otherwise.
+ * @brief Mark an object as accessed.
+ * @param obj Object which was accessed.
+ *
+ * Updates the access clock and the access frequency of \p obj. The
+ * frequency is a logarithmic counter: the more often an object has been
+ * accessed, the less likely it is that an access increments the counter.
+ * The counter decays while the object isn't accessed.
  */
-int object_set_expiry(struct object *obj, time_t exp)
+void object_touch(struct object *obj)
 {
-	time_t now;
-
-	if(!obj || !exp)
-		return -XFIREDB_ERR;
-
-	now = xfiredb_time_stamp();
-	if(time_after(now, exp))
-		return -XFIREDB_ERR; /* already expired, pointless */
+	u32 now, freq;
+	double p;
+
+	now = object_lru_clock();
+	freq = object_lfu_decay(obj, now);
+	if(freq < 255) {
+		p = 1.0 / ((freq > OBJECT_LFU_INIT ? freq - OBJECT_LFU_INIT : 0) *
+				OBJECT_LFU_LOG_FACTOR + 1);
+		if((double)random() / RAND_MAX < p)
+			freq++;
+	}
+
+	obj->freq = freq;
+	obj->lru = now;
+}
 
-	object_lock(obj);
-	__clear_bit(OBJECT_EXPIRED_FLAG, &obj->flags);
-	obj->exp = exp;
-	object_unlock(obj);
+/**
+ * @brief Get the idle time of an object.
+ * @param obj Object to get the idle time for.
+ * @return The number of seconds since \p obj was last accessed.
+ */
+u32 object_idle_time(struct object *obj)
+{
+	return object_clock_diff(object_lru_clock(), obj->lru);
+}
 
-	return -XFIREDB_OK;
+/**
+ * @brief Get the access frequency of an object.
+ * @param obj Object to get the frequency for.
+ * @return The decayed access frequency of \p obj.
+ */
+u32 object_frequency(struct object *obj)
+{
+	return object_lfu_decay(obj, object_lru_clock());
 }
 
 /**
@@ -118,7 +141,7 @@ int object_set_expiry(struct object *obj, time_t exp)
  */
 void object_destroy(struct object *obj)
 {
-	xfiredb_spinlock_destroy(&obj->lock);
+	obj->flags = 0;
 }
 
 /**
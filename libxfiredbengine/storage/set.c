@@ -31,6 +31,7 @@
 #include <xfiredb/error.h>
 #include <xfiredb/set.h>
 #include <xfiredb/skiplist.h>
+#include <xfiredb/intern.h>
 
 /**
  * @brief Initialise a new set.
@@ -50,10 +51,7 @@ void set_init(struct set *s)
  */
 void set_key_init(struct set_key *key, const char *k)
 {
-	int len = strlen(k);
-
-	key->key = xfiredb_zalloc(len + 1);
-	memcpy((char*)key->key, k, len);
+	key->key = intern_get(k);
 }
 
 /**
@@ -63,7 +61,7 @@ void set_key_init(struct set_key *key, const char *k)
  */
 struct set_key *set_key_alloc(const char *k)
 {
-	struct set_key *key = xfiredb_zalloc(sizeof(*k));
+	struct set_key *key = xfiredb_zalloc(sizeof(*key));
 
 	set_key_init(key, k);
 	return key;
@@ -85,7 +83,8 @@ void set_destroy(struct set *s)
  */
 void set_key_destroy(struct set_key *k)
 {
-	xfiredb_free(k->key);
+	intern_put(k->key);
+	k->key = NULL;
 	skiplist_node_destroy(&k->node);
 }
 
@@ -135,13 +134,17 @@ struct set_key *set_iterator_next(struct set_iterator *it)
  * @param key Key to add.
  * @param k Set key to add to \p s.
  * @return An error code.
+ *
+ * Set members are interned, so sets sharing members store every member
+ * only once.
  */
 int set_add(struct set *s, char *key, struct set_key *k)
 {
 	if(set_contains(s, key))
 		return -XFIREDB_ERR;
 
-	xfiredb_sprintf(&k->key, "%s", key);
+	intern_put(k->key);
+	k->key = intern_get(key);
 	if(skiplist_insert(&s->list, key, &k->node) == -XFIREDB_OK) {
 		atomic_inc(s->num);
 		return -XFIREDB_OK;
@@ -196,7 +199,7 @@ int set_clear(struct set *set)
 		node = skiplist_iterator_to_node(it);
 		k = container_of(node, struct set_key, node);
 		skiplist_iterator_delete(it);
-		xfiredb_free(k->key);
+		set_key_destroy(k);
 		xfiredb_free(k);
 	}
 	skiplist_iterator_free(it);
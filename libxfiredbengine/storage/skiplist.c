@@ -32,6 +32,7 @@
 #include <xfiredb/mem.h>
 #include <xfiredb/object.h>
 #include <xfiredb/skiplist.h>
+#include <xfiredb/intern.h>
 
 void skiplist_init(struct skiplist *l)
 {
@@ -46,12 +47,14 @@ void raw_skiplist_init(struct skiplist *l, double p)
 	if(!l)
 		return;
 
-	xfiredb_mutex_init(&l->lock);
+	xfiredb_rwlock_init(&l->lock);
 	atomic_init(&l->size);
-	node = xfiredb_zalloc(sizeof(*node));
+	node = xfiredb_zalloc_stat(sizeof(*node), MEM_STAT_SKIPLIST);
 	node->key = NULL;
 	node->hash = SKIPLIST_MAX_SIZE;
-	node->forward = xfiredb_zalloc(sizeof(node) * (SKIPLIST_MAX_LEVELS + 1));
+	node->level = SKIPLIST_MAX_LEVELS;
+	node->forward = xfiredb_cache_zalloc(skiplist_forward_size(node),
+			MEM_STAT_SKIPLIST);
 
 	for(i = 0; i <= SKIPLIST_MAX_LEVELS; i++)
 		node->forward[i] = node;
@@ -85,9 +88,10 @@ void skiplist_destroy(struct skiplist *l)
 		return;
 
 	atomic_destroy(&l->size);
-	xfiredb_mutex_destroy(&l->lock);
-	xfiredb_free(l->header->forward);
-	xfiredb_free(l->header);
+	xfiredb_rwlock_destroy(&l->lock);
+	xfiredb_cache_free(l->header->forward, skiplist_forward_size(l->header),
+			MEM_STAT_SKIPLIST);
+	xfiredb_free_stat(l->header, MEM_STAT_SKIPLIST);
 }
 
 void skiplist_free(struct skiplist *l)
@@ -203,20 +207,17 @@ static u32 skiplist_hash_key(const char *key, u32 seed)
 
 static inline void skiplist_set_key(struct skiplist_node *node, const char *key)
 {
-	int len;
-
-	len = strlen(key);
-	node->key = xfiredb_zalloc(len + 1);
-	memcpy(node->key, key, len);
+	node->key = intern_get(key);
 }
 
 struct skiplist_node *skiplist_search(struct skiplist *l, const char *key)
 {
 	int i;
 	u32 hash;
-	struct skiplist_node *node;
+	struct skiplist_node *node, *rv = NULL;
 
 	hash = skiplist_hash_key(key, SKIPLIST_SEED);
+	skiplist_read_lock(l);
 	node = l->header;
 	for(i = l->level; i >= 1; i--) {
 		while(node->forward[i]->hash < hash)
@@ -230,12 +231,11 @@ struct skiplist_node *skiplist_search(struct skiplist *l, const char *key)
 		}
 
 		if(node->forward[1]->hash == hash)
-			return node->forward[1];
-		else
-			return NULL;
+			rv = node->forward[1];
 	}
 
-	return NULL;
+	skiplist_read_unlock(l);
+	return rv;
 }
 
 int skiplist_insert(struct skiplist *list, const char *key, struct skiplist_node *node)
@@ -273,7 +273,9 @@ int skiplist_insert(struct skiplist *list, const char *key, struct skiplist_node
 
 		node->hash = hash;
 		skiplist_set_key(node, key);
-		node->forward = xfiredb_zalloc(sizeof(node) * (level+1));
+		node->level = level;
+		node->forward = xfiredb_cache_zalloc(skiplist_forward_size(node),
+				MEM_STAT_SKIPLIST);
 
 		for(i = 1; i <= level; i++) {
 			node->forward[i] = update[i]->forward[i];
@@ -292,9 +294,10 @@ void skiplist_node_destroy(struct skiplist_node *node)
 		return;
 
 	if(node->forward)
-		xfiredb_free(node->forward);
+		xfiredb_cache_free(node->forward, skiplist_forward_size(node),
+				MEM_STAT_SKIPLIST);
 	if(node->key)
-		xfiredb_free(node->key);
+		intern_put(node->key);
 
 	node->forward = NULL;
 	node->key = NULL;
@@ -366,14 +369,14 @@ struct skiplist_iterator *skiplist_iterator_new(struct skiplist *l)
 
 struct skiplist_node *skiplist_iterator_next(struct skiplist_iterator *it)
 {
-	skiplist_lock(it->list);
+	skiplist_read_lock(it->list);
 	it->prev = it->current;
 	it->current = it->current->forward[1];
 	
 	if(it->current == it->list->header)
 		it->current = NULL;
 
-	skiplist_unlock(it->list);
+	skiplist_read_unlock(it->list);
 	return it->current;
 }
 
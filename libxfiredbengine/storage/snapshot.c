@@ -0,0 +1,714 @@
+/*
+ *  Binary database snapshots
+ *  Copyright (C) 2015   Michel Megens <dev@michelmegens.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @addtogroup snapshot
+ * @{
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <xfiredb/xfiredb.h>
+#include <xfiredb/types.h>
+#include <xfiredb/snapshot.h>
+#include <xfiredb/database.h>
+#include <xfiredb/container.h>
+#include <xfiredb/string.h>
+#include <xfiredb/list.h>
+#include <xfiredb/hashmap.h>
+#include <xfiredb/set.h>
+#include <xfiredb/disk.h>
+#include <xfiredb/bio.h>
+#include <xfiredb/crc.h>
+#include <xfiredb/error.h>
+#include <xfiredb/log.h>
+#include <xfiredb/mem.h>
+#include <xfiredb/os.h>
+
+#define SNAPSHOT_MAGIC "XFDBSNAP"
+#define SNAPSHOT_MAGIC_SIZE 8
+#define SNAPSHOT_VERSION 1
+/* Magic, followed by the format version */
+#define SNAPSHOT_HEADER_SIZE (SNAPSHOT_MAGIC_SIZE + 1)
+#define SNAPSHOT_CRC_SIZE 4
+#define SNAPSHOT_BUFFER_SIZE (64 * 1024)
+#define SNAPSHOT_VARINT_MAX 10
+
+/* Record types */
+#define SNAPSHOT_STRING  0
+#define SNAPSHOT_LIST    1
+#define SNAPSHOT_HASHMAP 2
+#define SNAPSHOT_SET     3
+#define SNAPSHOT_EXPIRE  0xFE
+#define SNAPSHOT_EOF     0xFF
+
+/* Strings kept by the reader: key, secondary key and data */
+#define SNAPSHOT_FIELDS 3
+
+static struct snapshot_state {
+	xfiredb_mutex_t lock;
+	struct thread *waiter;
+	pid_t child;
+	time_t start;
+	char *path;
+	struct snapshot_info info;
+} snapshot;
+
+static pthread_once_t snapshot_once = PTHREAD_ONCE_INIT;
+
+static void snapshot_init(void)
+{
+	xfiredb_mutex_init(&snapshot.lock);
+}
+
+struct snapshot_writer {
+	FILE *file;
+	u32 crc;
+};
+
+struct snapshot_reader {
+	FILE *file;
+	u64 left; /* Bytes left before the checksum */
+	char *fields[SNAPSHOT_FIELDS];
+	size_t sizes[SNAPSHOT_FIELDS];
+	size_t lens[SNAPSHOT_FIELDS]; /* Length of the last string read */
+};
+
+static inline u64 snapshot_zigzag(s64 value)
+{
+	return ((u64)value << 1) ^ (u64)(value >> 63);
+}
+
+static inline s64 snapshot_unzigzag(u64 value)
+{
+	return (s64)(value >> 1) ^ -(s64)(value & 1);
+}
+
+static inline void snapshot_put32(unsigned char *buf, u32 value)
+{
+	buf[0] = value & 0xFF;
+	buf[1] = (value >> 8) & 0xFF;
+	buf[2] = (value >> 16) & 0xFF;
+	buf[3] = (value >> 24) & 0xFF;
+}
+
+static inline u32 snapshot_get32(const unsigned char *buf)
+{
+	return (u32)buf[0] | (u32)buf[1] << 8 | (u32)buf[2] << 16 |
+		(u32)buf[3] << 24;
+}
+
+/*
+ * Write errors are sticky in the stream, they are checked once the whole
+ * snapshot has been written.
+ */
+static void snapshot_write(struct snapshot_writer *w, const void *buf, size_t len)
+{
+	w->crc = xfiredb_crc32(w->crc, buf, len);
+	fwrite(buf, 1, len, w->file);
+}
+
+static inline void snapshot_write_byte(struct snapshot_writer *w, int byte)
+{
+	unsigned char c = byte;
+
+	snapshot_write(w, &c, 1);
+}
+
+static void snapshot_write_varint(struct snapshot_writer *w, u64 value)
+{
+	unsigned char buf[SNAPSHOT_VARINT_MAX];
+	int len = 0;
+
+	while(value >= 0x80) {
+		buf[len++] = (value & 0x7F) | 0x80;
+		value >>= 7;
+	}
+
+	buf[len++] = value;
+	snapshot_write(w, buf, len);
+}
+
+static inline void snapshot_write_str(struct snapshot_writer *w,
+		const char *str, size_t len)
+{
+	snapshot_write_varint(w, len);
+	snapshot_write(w, str, len);
+}
+
+static void snapshot_write_string(struct snapshot_writer *w, struct string *s)
+{
+	const char *value;
+	size_t len;
+
+	value = string_borrow(s, &len);
+	snapshot_write_str(w, value, len);
+	string_unborrow(s);
+}
+
+static void snapshot_write_entry(struct snapshot_writer *w,
+		struct database *db, struct db_entry *e)
+{
+	struct container *c = e->value.ptr;
+	struct string *s;
+	struct list *l;
+	struct list_head *lh;
+	struct hashmap *map;
+	struct hashmap_node *node;
+	struct hashmap_iterator *it;
+	struct set *set;
+	struct set_key *k;
+	struct set_iterator *set_it;
+	db_data_t when;
+	size_t tmp;
+	int type;
+
+	switch(container_type(c)) {
+	case CONTAINER_STRING:
+		type = SNAPSHOT_STRING;
+		break;
+	case CONTAINER_LIST:
+		type = SNAPSHOT_LIST;
+		break;
+	case CONTAINER_HASHMAP:
+		type = SNAPSHOT_HASHMAP;
+		break;
+	case CONTAINER_SET:
+		type = SNAPSHOT_SET;
+		break;
+	default:
+		return;
+	}
+
+	if(dict_lookup(db->expires, e->key, &when, &tmp) == -XFIREDB_OK) {
+		snapshot_write_byte(w, SNAPSHOT_EXPIRE);
+		snapshot_write_varint(w, snapshot_zigzag(when.val_s64));
+	}
+
+	snapshot_write_byte(w, type);
+	snapshot_write_str(w, e->key, strlen(e->key));
+
+	switch(type) {
+	case SNAPSHOT_STRING:
+		snapshot_write_string(w, container_get_data(c));
+		break;
+
+	case SNAPSHOT_LIST:
+		lh = container_get_data(c);
+		snapshot_write_varint(w, list_length(lh));
+		list_for_each(lh, l) {
+			s = container_of(l, struct string, entry);
+			snapshot_write_varint(w, snapshot_zigzag(list_entry_id(l)));
+			snapshot_write_string(w, s);
+		}
+		break;
+
+	case SNAPSHOT_HASHMAP:
+		map = container_get_data(c);
+		snapshot_write_varint(w, hashmap_size(map));
+		it = hashmap_new_iterator(map);
+		for(node = hashmap_iterator_next(it); node;
+				node = hashmap_iterator_next(it)) {
+			s = container_of(node, struct string, node);
+			snapshot_write_str(w, node->key, strlen(node->key));
+			snapshot_write_string(w, s);
+		}
+		hashmap_free_iterator(it);
+		break;
+
+	case SNAPSHOT_SET:
+		set = container_get_data(c);
+		snapshot_write_varint(w, set_size(set));
+		set_it = set_iterator_new(set);
+		for_each_set(set, k, set_it)
+			snapshot_write_str(w, k->key, strlen(k->key));
+		set_iterator_free(set_it);
+		break;
+	}
+}
+
+/**
+ * @brief Write a snapshot of a database.
+ * @param db Database to write.
+ * @param path File to write the snapshot to.
+ * @return Error code.
+ *
+ * The snapshot is written to a temporary file first, which replaces
+ * \p path once it has been synced. The database may not be modified while
+ * the snapshot is written; use snapshot_bgsave to keep serving writes.
+ */
+int snapshot_save(struct database *db, const char *path)
+{
+	struct snapshot_writer w;
+	struct db_iterator *it;
+	struct db_entry *e;
+	unsigned char crc[SNAPSHOT_CRC_SIZE];
+	char *tmp;
+	int rc = -XFIREDB_OK;
+
+	xfiredb_sprintf(&tmp, "%s.%d.tmp", path, (int)getpid());
+	w.file = fopen(tmp, "wb");
+	if(!w.file) {
+		xfiredb_free(tmp);
+		return -XFIREDB_ERR;
+	}
+
+	setvbuf(w.file, NULL, _IOFBF, SNAPSHOT_BUFFER_SIZE);
+	w.crc = 0;
+	snapshot_write(&w, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE);
+	snapshot_write_byte(&w, SNAPSHOT_VERSION);
+
+	it = db_get_iterator(db);
+	for(e = db_iterator_next(it); e; e = db_iterator_next(it))
+		snapshot_write_entry(&w, db, e);
+	db_iterator_free(it);
+
+	snapshot_write_byte(&w, SNAPSHOT_EOF);
+	snapshot_put32(crc, w.crc);
+	fwrite(crc, 1, sizeof(crc), w.file);
+
+	if(ferror(w.file) || fflush(w.file) || fsync(fileno(w.file)))
+		rc = -XFIREDB_ERR;
+	if(fclose(w.file))
+		rc = -XFIREDB_ERR;
+	if(rc == -XFIREDB_OK && rename(tmp, path))
+		rc = -XFIREDB_ERR;
+	if(rc != -XFIREDB_OK)
+		unlink(tmp);
+
+	xfiredb_free(tmp);
+	return rc;
+}
+
+/*
+ * Reap the child writing a background save, and record the outcome.
+ */
+static void *snapshot_wait_child(void *arg)
+{
+	pid_t pid = (pid_t)(long)arg;
+	struct stat st;
+	time_t now;
+	int status;
+	bool ok;
+
+	while(waitpid(pid, &status, 0) < 0) {
+		if(errno != EINTR) {
+			status = -1;
+			break;
+		}
+	}
+
+	ok = status != -1 && WIFEXITED(status) && !WEXITSTATUS(status);
+	now = xfiredb_time_stamp();
+
+	xfiredb_mutex_lock(&snapshot.lock);
+	snapshot.info.in_progress = false;
+	snapshot.info.last_ok = ok;
+	snapshot.info.last_save = now;
+	snapshot.info.last_duration = now - snapshot.start;
+	if(ok && !stat(snapshot.path, &st))
+		snapshot.info.last_size = st.st_size;
+
+	if(ok)
+		xfiredb_log(LOG_DISK, "Background save to %s finished\n", snapshot.path);
+	else
+		xfiredb_log_err(LOG_DISK, "Background save to %s failed\n", snapshot.path);
+	xfiredb_mutex_unlock(&snapshot.lock);
+
+	return NULL;
+}
+
+/**
+ * @brief Write a snapshot of a database in the background.
+ * @param db Database to write.
+ * @param path File to write the snapshot to.
+ * @return Error code. Fails if a background save is already running.
+ *
+ * The process is forked, and the child writes the snapshot from its copy
+ * on write view of \p db using snapshot_save. The caller only waits for
+ * the fork itself, and may keep modifying \p db right away. The child is
+ * reaped by a separate thread, see snapshot_get_info for the outcome.
+ *
+ * \p db may not be modified by other threads while the process is forked.
+ * The Ruby engine guarantees this by holding the interpreter lock.
+ */
+int snapshot_bgsave(struct database *db, const char *path)
+{
+	struct thread *old;
+	time_t start;
+	pid_t pid;
+
+	pthread_once(&snapshot_once, &snapshot_init);
+	xfiredb_mutex_lock(&snapshot.lock);
+	if(snapshot.info.in_progress) {
+		xfiredb_mutex_unlock(&snapshot.lock);
+		return -XFIREDB_ERR;
+	}
+
+	old = snapshot.waiter;
+	snapshot.waiter = NULL;
+	xfiredb_free(snapshot.path);
+	xfiredb_sprintf(&snapshot.path, "%s", path);
+
+	/* Make sure the key space isn't half way a change in the child */
+	xfiredb_read_lock(&db->container->lock);
+	xfiredb_read_lock(&db->expires->lock);
+	start = xfiredb_clock_us();
+	pid = fork();
+
+	xfiredb_read_unlock(&db->expires->lock);
+	xfiredb_read_unlock(&db->container->lock);
+
+	if(!pid)
+		_exit(snapshot_save(db, path) == -XFIREDB_OK ? 0 : 1);
+
+	if(pid < 0) {
+		xfiredb_mutex_unlock(&snapshot.lock);
+		xfiredb_log_err(LOG_DISK, "Could not fork for a background save\n");
+		goto out;
+	}
+
+	snapshot.info.fork_usec = xfiredb_clock_us() - start;
+	snapshot.info.in_progress = true;
+	snapshot.info.saves++;
+	snapshot.start = xfiredb_time_stamp();
+	snapshot.child = pid;
+	snapshot.waiter = xfiredb_create_thread("snapshot-wait",
+			&snapshot_wait_child, (void*)(long)pid);
+	xfiredb_mutex_unlock(&snapshot.lock);
+
+	/* Without a thread to reap the child, wait for it here */
+	if(!snapshot.waiter)
+		snapshot_wait_child((void*)(long)pid);
+
+out:
+	if(old) {
+		xfiredb_thread_join(old);
+		xfiredb_thread_destroy(old);
+	}
+
+	return pid < 0 ? -XFIREDB_ERR : -XFIREDB_OK;
+}
+
+/**
+ * @brief Wait for a running background save to finish.
+ */
+void snapshot_wait(void)
+{
+	struct thread *waiter;
+
+	pthread_once(&snapshot_once, &snapshot_init);
+	xfiredb_mutex_lock(&snapshot.lock);
+	waiter = snapshot.waiter;
+	snapshot.waiter = NULL;
+	xfiredb_mutex_unlock(&snapshot.lock);
+
+	if(waiter) {
+		xfiredb_thread_join(waiter);
+		xfiredb_thread_destroy(waiter);
+	}
+}
+
+/**
+ * @brief Get the state of the background save.
+ * @param info Structure to store the state in.
+ */
+void snapshot_get_info(struct snapshot_info *info)
+{
+	pthread_once(&snapshot_once, &snapshot_init);
+	xfiredb_mutex_lock(&snapshot.lock);
+	*info = snapshot.info;
+	xfiredb_mutex_unlock(&snapshot.lock);
+}
+
+/*
+ * Check the magic and the checksum of a snapshot, and leave \p file
+ * positioned after the header. Returns the number of bytes between the
+ * header and the checksum, or -1 if the snapshot is damaged.
+ */
+static long snapshot_verify(FILE *file)
+{
+	unsigned char hdr[SNAPSHOT_HEADER_SIZE], crc[SNAPSHOT_CRC_SIZE];
+	unsigned char *buf;
+	long size, left;
+	size_t len;
+	u32 sum;
+
+	if(fseek(file, 0L, SEEK_END))
+		return -1L;
+
+	size = ftell(file);
+	if(size < SNAPSHOT_HEADER_SIZE + 1 + SNAPSHOT_CRC_SIZE)
+		return -1L;
+
+	rewind(file);
+	if(fread(hdr, 1, sizeof(hdr), file) != sizeof(hdr) ||
+			memcmp(hdr, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE) ||
+			hdr[SNAPSHOT_MAGIC_SIZE] != SNAPSHOT_VERSION)
+		return -1L;
+
+	buf = xfiredb_alloc(SNAPSHOT_BUFFER_SIZE);
+	sum = xfiredb_crc32(0, hdr, sizeof(hdr));
+	left = size - SNAPSHOT_HEADER_SIZE - SNAPSHOT_CRC_SIZE;
+	while(left > 0) {
+		len = left < SNAPSHOT_BUFFER_SIZE ? left : SNAPSHOT_BUFFER_SIZE;
+		if(fread(buf, 1, len, file) != len)
+			break;
+
+		sum = xfiredb_crc32(sum, buf, len);
+		left -= len;
+	}
+	xfiredb_free(buf);
+
+	if(left || fread(crc, 1, sizeof(crc), file) != sizeof(crc) ||
+			snapshot_get32(crc) != sum)
+		return -1L;
+
+	if(fseek(file, SNAPSHOT_HEADER_SIZE, SEEK_SET))
+		return -1L;
+
+	return size - SNAPSHOT_HEADER_SIZE - SNAPSHOT_CRC_SIZE;
+}
+
+static int snapshot_read(struct snapshot_reader *r, void *buf, size_t len)
+{
+	if(len > r->left || fread(buf, 1, len, r->file) != len)
+		return -XFIREDB_ERR;
+
+	r->left -= len;
+	return -XFIREDB_OK;
+}
+
+static int snapshot_read_varint(struct snapshot_reader *r, u64 *value)
+{
+	unsigned char c;
+	int shift;
+
+	*value = 0;
+	for(shift = 0; shift < 64; shift += 7) {
+		if(snapshot_read(r, &c, 1))
+			return -XFIREDB_ERR;
+
+		*value |= (u64)(c & 0x7F) << shift;
+		if(!(c & 0x80))
+			return -XFIREDB_OK;
+	}
+
+	return -XFIREDB_ERR;
+}
+
+/*
+ * Read a string into field \p idx of the reader. The string stays valid
+ * until the next string is read into the same field.
+ */
+static char *snapshot_read_str(struct snapshot_reader *r, int idx)
+{
+	u64 len;
+
+	if(snapshot_read_varint(r, &len) || len > r->left)
+		return NULL;
+
+	if(len + 1 > r->sizes[idx]) {
+		r->fields[idx] = xfiredb_realloc(r->fields[idx], len + 1);
+		r->sizes[idx] = len + 1;
+	}
+
+	if(snapshot_read(r, r->fields[idx], len))
+		return NULL;
+
+	r->fields[idx][len] = '\0';
+	r->lens[idx] = len;
+	return r->fields[idx];
+}
+
+#define SNAPSHOT_KEY  0
+#define SNAPSHOT_SCND 1
+#define SNAPSHOT_DATA 2
+
+static char *snapshot_cols[] = {"db_key", "db_secondary_key", "db_type", "db_value"};
+
+/*
+ * Length of \p str, which is either the last string read into field
+ * \p idx, and may hold NUL bytes, or a constant.
+ */
+static inline size_t snapshot_str_len(struct snapshot_reader *r, int idx,
+		const char *str)
+{
+	return str == r->fields[idx] ? r->lens[idx] : strlen(str);
+}
+
+/*
+ * Pass a row about the key in the key field of \p r to \p hook.
+ */
+static inline void snapshot_row(struct snapshot_reader *r,
+		void (*hook)(int argc, char **rows, size_t *lens, char **cols),
+		char *skey, char *type, char *data)
+{
+	char *rows[4];
+	size_t lens[4];
+
+	rows[TABLE_KEY_IDX] = r->fields[SNAPSHOT_KEY];
+	rows[TABLE_SCND_KEY_IDX] = skey;
+	rows[TABLE_TYPE_IDX] = type;
+	rows[TABLE_DATA_IDX] = data;
+	lens[TABLE_KEY_IDX] = r->lens[SNAPSHOT_KEY];
+	lens[TABLE_SCND_KEY_IDX] = snapshot_str_len(r, SNAPSHOT_SCND, skey);
+	lens[TABLE_TYPE_IDX] = strlen(type);
+	lens[TABLE_DATA_IDX] = snapshot_str_len(r, SNAPSHOT_DATA, data);
+
+	hook(4, rows, lens, snapshot_cols);
+}
+
+static int snapshot_read_entry(struct snapshot_reader *r, int type,
+		void (*hook)(int argc, char **rows, size_t *lens, char **cols))
+{
+	char id[BIO_ID_SIZE];
+	char *key, *skey, *data;
+	u64 num, value;
+
+	key = snapshot_read_str(r, SNAPSHOT_KEY);
+	if(!key)
+		return -XFIREDB_ERR;
+
+	if(type == SNAPSHOT_STRING) {
+		data = snapshot_read_str(r, SNAPSHOT_DATA);
+		if(!data)
+			return -XFIREDB_ERR;
+
+		snapshot_row(r, hook, "null", "string", data);
+		return -XFIREDB_OK;
+	}
+
+	if(snapshot_read_varint(r, &num))
+		return -XFIREDB_ERR;
+
+	for(; num; num--) {
+		switch(type) {
+		case SNAPSHOT_LIST:
+			if(snapshot_read_varint(r, &value))
+				return -XFIREDB_ERR;
+
+			data = snapshot_read_str(r, SNAPSHOT_DATA);
+			if(!data)
+				return -XFIREDB_ERR;
+
+			snprintf(id, sizeof(id), "%lld", (long long)snapshot_unzigzag(value));
+			snapshot_row(r, hook, id, "list", data);
+			break;
+
+		case SNAPSHOT_HASHMAP:
+			skey = snapshot_read_str(r, SNAPSHOT_SCND);
+			data = snapshot_read_str(r, SNAPSHOT_DATA);
+			if(!skey || !data)
+				return -XFIREDB_ERR;
+
+			snapshot_row(r, hook, skey, "hashmap", data);
+			break;
+
+		case SNAPSHOT_SET:
+			skey = snapshot_read_str(r, SNAPSHOT_SCND);
+			if(!skey)
+				return -XFIREDB_ERR;
+
+			snapshot_row(r, hook, skey, "set", "null");
+			break;
+
+		default:
+			return -XFIREDB_ERR;
+		}
+	}
+
+	return -XFIREDB_OK;
+}
+
+/**
+ * @brief Load a snapshot.
+ * @param path Snapshot to load.
+ * @param hook Load hook, called with the same rows as disk_load.
+ * @param expire Called for every key with an expiry time, after the rows
+ *   of that key. May be \p NULL.
+ * @return Error code. Fails without calling \p hook if the snapshot is
+ *   damaged.
+ */
+int snapshot_load(const char *path,
+		void (*hook)(int argc, char **rows, size_t *lens, char **cols),
+		snapshot_expire_hook_t expire)
+{
+	struct snapshot_reader r;
+	unsigned char type;
+	u64 when = 0;
+	bool expires = false;
+	long size;
+	int idx, rc = -XFIREDB_ERR;
+
+	r.file = fopen(path, "rb");
+	if(!r.file)
+		return -XFIREDB_ERR;
+
+	setvbuf(r.file, NULL, _IOFBF, SNAPSHOT_BUFFER_SIZE);
+	size = snapshot_verify(r.file);
+	if(size < 0) {
+		xfiredb_log_err(LOG_DISK, "Snapshot %s is damaged\n", path);
+		fclose(r.file);
+		return -XFIREDB_ERR;
+	}
+
+	r.left = size;
+	for(idx = 0; idx < SNAPSHOT_FIELDS; idx++) {
+		r.fields[idx] = NULL;
+		r.sizes[idx] = 0;
+		r.lens[idx] = 0;
+	}
+
+	while(!snapshot_read(&r, &type, 1)) {
+		if(type == SNAPSHOT_EOF) {
+			rc = -XFIREDB_OK;
+			break;
+		}
+
+		if(type == SNAPSHOT_EXPIRE) {
+			if(snapshot_read_varint(&r, &when))
+				break;
+
+			expires = true;
+			continue;
+		}
+
+		if(snapshot_read_entry(&r, type, hook))
+			break;
+
+		if(expires && expire)
+			expire(r.fields[SNAPSHOT_KEY], snapshot_unzigzag(when));
+		expires = false;
+	}
+
+	for(idx = 0; idx < SNAPSHOT_FIELDS; idx++)
+		xfiredb_free(r.fields[idx]);
+	fclose(r.file);
+
+	return rc;
+}
+
+/** @} */
@@ -21,6 +21,15 @@
  * @{
  */
 
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+
 #include <xfiredb/xfiredb.h>
 #include <xfiredb/types.h>
 #include <xfiredb/object.h>
@@ -28,6 +37,13 @@
 #include <xfiredb/string.h>
 #include <xfiredb/list.h>
 #include <xfiredb/mem.h>
+#include <xfiredb/intern.h>
+#include <xfiredb/error.h>
+
+/* Large enough to hold any formatted s64 or double */
+#define STRING_NUM_SIZE 32
+
+static size_t string_share_max;
 
 /**
  * @brief Initialise a new string container.
@@ -35,30 +51,166 @@
  */
 void string_init(struct string *str)
 {
-	str->str = NULL;
+	str->buf[0] = '\0';
+	str->str = str->buf;
 	str->len = 0UL;
-	xfiredb_spinlock_init(&str->lock);
+	str->capacity = STRING_INLINE_SIZE - 1;
+	str->obj.encoding = STRING_ENC_RAW;
+	object_assign_flag(&str->obj, OBJECT_SHARED_FLAG, false);
+	xfiredb_seqlock_init(&str->lock);
 	list_node_init(&str->entry);
 }
 
+/**
+ * @brief Set the maximum length of shared string values.
+ * @param max Maximum length in bytes. Set to 0 to disable sharing.
+ *
+ * Values which are too long to be stored inline, but not longer than
+ * \p max bytes, are interned instead of copied. Equal values then share a
+ * single, immutable buffer, which is copied as soon as one of the strings
+ * is modified in place.
+ */
+void string_set_share_limit(size_t max)
+{
+	string_share_max = max;
+}
+
+/**
+ * @brief Get the maximum length of shared string values.
+ * @return The maximum length of shared values, or 0 if sharing is disabled.
+ */
+size_t string_share_limit(void)
+{
+	return string_share_max;
+}
+
+/*
+ * Drop the reference \p string holds on its shared buffer. If \p keep is
+ * set, the contents are copied into a private buffer first.
+ */
+static void string_unshare(struct string *string, bool keep)
+{
+	char *shared = string->str;
+
+	object_assign_flag(&string->obj, OBJECT_SHARED_FLAG, false);
+	string->str = string->buf;
+	string->capacity = STRING_INLINE_SIZE - 1;
+
+	if(keep) {
+		/* shared buffers are never short enough to be stored inline */
+		string->str = xfiredb_alloc(string->len + 1);
+		string->capacity = string->len;
+		memcpy(string->str, shared, string->len + 1);
+	}
+
+	intern_put(shared);
+}
+
+/*
+ * Make sure \p string can hold \p len bytes plus a terminator. Short strings
+ * are kept in the inline buffer, longer strings get a heap buffer. The
+ * current contents of \p string are not preserved.
+ */
+static void string_resize(struct string *string, size_t len)
+{
+	if(string_is_shared(string))
+		string_unshare(string, false);
+
+	if(len < STRING_INLINE_SIZE) {
+		if(!string_is_inline(string))
+			xfiredb_free(string->str);
+
+		string->str = string->buf;
+		string->capacity = STRING_INLINE_SIZE - 1;
+	} else if(string_is_inline(string)) {
+		string->str = xfiredb_alloc(len + 1);
+		string->capacity = len;
+	} else if(len > string->capacity || len < string->capacity / 2) {
+		/* only reallocate if the buffer is too small or mostly unused */
+		string->str = xfiredb_realloc(string->str, len + 1);
+		string->capacity = len;
+	}
+
+	string->len = len;
+}
+
+/*
+ * Make sure \p string can hold at least \p len bytes plus a terminator,
+ * while preserving its contents. The buffer grows geometrically, so
+ * repeatedly growing a string takes amortized constant time per byte.
+ */
+static void string_grow(struct string *string, size_t len)
+{
+	size_t capacity;
+	char *buf;
+
+	if(string_is_shared(string))
+		string_unshare(string, true);
+
+	if(len <= string->capacity)
+		return;
+
+	capacity = string->capacity * 2;
+	if(capacity < len)
+		capacity = len;
+
+	if(string_is_inline(string)) {
+		buf = xfiredb_alloc(capacity + 1);
+		memcpy(buf, string->str, string->len + 1);
+		string->str = buf;
+	} else {
+		string->str = xfiredb_realloc(string->str, capacity + 1);
+	}
+
+	string->capacity = capacity;
+}
+
+/*
+ * Store \p data in \p string by reference to an interned buffer, if \p len
+ * is within the share limit. Returns false if \p data has to be copied.
+ */
+static bool string_share(struct string *string, const void *data, size_t len)
+{
+	if(len < STRING_INLINE_SIZE || len > string_share_max)
+		return false;
+
+	string_resize(string, 0);
+	string->str = intern_get_len(data, len);
+	string->len = string->capacity = len;
+	object_assign_flag(&string->obj, OBJECT_SHARED_FLAG, true);
+
+	return true;
+}
+
 /**
  * @brief Allocate a string container.
  * @param data String data to allocate a string object 'around'.
  * @return The allocated string container.
  */
 struct string *string_alloc(const char *data)
+{
+	return string_alloc_len(data, strlen(data));
+}
+
+/**
+ * @brief Allocate a string container around a binary buffer.
+ * @param data Data to copy into the new string container.
+ * @param len Length of \p data in bytes.
+ * @return The allocated string container.
+ */
+struct string *string_alloc_len(const void *data, size_t len)
 {
 	struct string *string;
-	int len;
 
-	len = strlen(data);
-	string = xfiredb_zalloc(sizeof(*string));
+	string = xfiredb_cache_zalloc(sizeof(*string), MEM_STAT_GENERAL);
 	string_init(string);
 
-	/* allocate the length of data + 1 (for the terminator) */
-	string->str = xfiredb_zalloc(len + 1);
-	string->len = len;
+	if(string_share(string, data, len))
+		return string;
+
+	string_resize(string, len);
 	memcpy(string->str, data, len);
+	string->str[len] = '\0';
 
 	return string;
 }
@@ -70,15 +222,93 @@ struct string *string_alloc(const char *data)
  */
 void string_set(struct string *string, const char *str)
 {
-	int len;
+	string_set_len(string, str, strlen(str));
+}
 
-	len = strlen(str) + 1;
-	xfiredb_spin_lock(&string->lock);
-	string->str = xfiredb_realloc(string->str, len);
+/**
+ * @brief Copy a binary buffer into a string container.
+ * @param string String container to copy into.
+ * @param data Data to copy.
+ * @param len Length of \p data in bytes.
+ *
+ * \p data may contain NUL bytes. The stored data is always followed by a
+ * terminator, which is not accounted for in the length of \p string.
+ */
+void string_set_len(struct string *string, const void *data, size_t len)
+{
+	xfiredb_write_seqlock(&string->lock);
+	string->obj.encoding = STRING_ENC_RAW;
+	if(!string_share(string, data, len)) {
+		string_resize(string, len);
+		memcpy(string->str, data, len);
+		string->str[len] = '\0';
+	}
+	xfiredb_write_sequnlock(&string->lock);
+}
 
-	memcpy(string->str, str, len);
-	string->len = len;
-	xfiredb_spin_unlock(&string->lock);
+/**
+ * @brief Append data to a string.
+ * @param str String to append to.
+ * @param data Data to append.
+ * @param len Length of \p data in bytes.
+ * @return The length of \p str after appending \p data.
+ */
+size_t string_append(struct string *str, const void *data, size_t len)
+{
+	size_t newlen;
+
+	xfiredb_write_seqlock(&str->lock);
+	string_grow(str, str->len + len);
+	memcpy(str->str + str->len, data, len);
+	str->len += len;
+	str->str[str->len] = '\0';
+	str->obj.encoding = STRING_ENC_RAW;
+	newlen = str->len;
+	xfiredb_write_sequnlock(&str->lock);
+
+	return newlen;
+}
+
+/**
+ * @brief Overwrite part of a string.
+ * @param str String to overwrite.
+ * @param offset Offset to start writing at.
+ * @param data Data to write.
+ * @param len Length of \p data in bytes.
+ * @return The length of \p str after writing \p data.
+ *
+ * If \p offset lies beyond the end of \p str, the string is padded with
+ * zero bytes first. A write that would grow \p str beyond STRING_MAX_SIZE
+ * bytes is refused, and leaves \p str as it is.
+ */
+size_t string_set_range(struct string *str, size_t offset,
+		const void *data, size_t len)
+{
+	size_t newlen;
+
+	if(len > STRING_MAX_SIZE || offset > STRING_MAX_SIZE - len)
+		return string_length(str);
+
+	xfiredb_write_seqlock(&str->lock);
+	if(string_is_shared(str))
+		string_unshare(str, true);
+
+	if(offset + len > str->len) {
+		string_grow(str, offset + len);
+
+		if(offset > str->len)
+			memset(str->str + str->len, 0, offset - str->len);
+
+		str->len = offset + len;
+		str->str[str->len] = '\0';
+	}
+
+	memcpy(str->str + offset, data, len);
+	str->obj.encoding = STRING_ENC_RAW;
+	newlen = str->len;
+	xfiredb_write_sequnlock(&str->lock);
+
+	return newlen;
 }
 
 /**
@@ -91,13 +321,293 @@ void string_set(struct string *string, const char *str)
  */
 int string_get(struct string *str, char **buff)
 {
-	xfiredb_spin_lock(&str->lock);
-	xfiredb_sprintf(buff, "%s", str->str);
-	xfiredb_spin_unlock(&str->lock);
+	char tmp[STRING_INLINE_SIZE];
+	char *buf;
+	size_t len;
+	bool inl;
+	u32 seq;
+
+	/*
+	 * Inline strings live within the container itself, so they can be
+	 * copied without taking the lock. Heap buffers may be free'd by a
+	 * concurrent writer, and are copied with the lock held shared instead.
+	 */
+	do {
+		seq = xfiredb_read_seqbegin(&str->lock);
+		len = str->len;
+		inl = string_is_inline(str) && len < STRING_INLINE_SIZE;
+		if(inl)
+			memcpy(tmp, str->buf, len);
+	} while(xfiredb_read_seqretry(&str->lock, seq));
 
+	if(inl) {
+		buf = xfiredb_alloc(len + 1);
+		memcpy(buf, tmp, len);
+		buf[len] = '\0';
+		*buff = buf;
+		return 0;
+	}
+
+	xfiredb_read_seqlock(&str->lock);
+	buf = xfiredb_alloc(str->len + 1);
+	memcpy(buf, str->str, str->len);
+	buf[str->len] = '\0';
+	xfiredb_read_sequnlock(&str->lock);
+
+	*buff = buf;
 	return 0;
 }
 
+static void string_set_number(struct string *string, const char *fmt, ...)
+{
+	char num[STRING_NUM_SIZE];
+	va_list args;
+	int len;
+
+	va_start(args, fmt);
+	len = vsnprintf(num, sizeof(num), fmt, args);
+	va_end(args);
+
+	string_resize(string, len);
+	memcpy(string->str, num, len + 1);
+}
+
+/*
+ * Format a double using the shortest representation that still
+ * converts back to the same value.
+ */
+static void string_set_float(struct string *string, double value)
+{
+	char num[STRING_NUM_SIZE];
+
+	snprintf(num, sizeof(num), "%.15g", value);
+	if(strtod(num, NULL) != value)
+		string_set_number(string, "%.17g", value);
+	else
+		string_set_number(string, "%s", num);
+}
+
+/*
+ * Floating point values in [STRING_FLOAT_INT_MIN, STRING_FLOAT_INT_MAX)
+ * convert to an s64 without overflowing.
+ */
+#define STRING_FLOAT_INT_MIN -9223372036854775808.0
+#define STRING_FLOAT_INT_MAX 9223372036854775808.0
+
+static int string_to_int(struct string *string, s64 *value)
+{
+	char *end;
+	long long v;
+	double f;
+
+	if(string->obj.encoding == STRING_ENC_INT) {
+		*value = string->num.i;
+		return -XFIREDB_OK;
+	}
+
+	/* A float that holds an exact integer, e.g. after INCRBYFLOAT k 1.0 */
+	if(string->obj.encoding == STRING_ENC_FLOAT) {
+		f = string->num.f;
+		if(f < STRING_FLOAT_INT_MIN || f >= STRING_FLOAT_INT_MAX ||
+				(double)(s64)f != f)
+			return -XFIREDB_ERR;
+
+		*value = (s64)f;
+		return -XFIREDB_OK;
+	}
+
+	if(string->obj.encoding != STRING_ENC_RAW || !string->len ||
+			string->len >= STRING_NUM_SIZE || isspace(string->str[0]))
+		return -XFIREDB_ERR;
+
+	errno = 0;
+	v = strtoll(string->str, &end, 10);
+	if(errno || end != string->str + string->len)
+		return -XFIREDB_ERR;
+
+	*value = v;
+	return -XFIREDB_OK;
+}
+
+static int string_to_float(struct string *string, double *value)
+{
+	char *end;
+	double v;
+
+	switch(string->obj.encoding) {
+	case STRING_ENC_INT:
+		*value = (double)string->num.i;
+		return -XFIREDB_OK;
+
+	case STRING_ENC_FLOAT:
+		*value = string->num.f;
+		return -XFIREDB_OK;
+
+	default:
+		break;
+	}
+
+	if(!string->len || string->len >= STRING_NUM_SIZE || isspace(string->str[0]))
+		return -XFIREDB_ERR;
+
+	errno = 0;
+	v = strtod(string->str, &end);
+	if(errno || end != string->str + string->len || !isfinite(v))
+		return -XFIREDB_ERR;
+
+	*value = v;
+	return -XFIREDB_OK;
+}
+
+/**
+ * @brief Atomically increment an integer string.
+ * @param str String to increment.
+ * @param delta Value to add to \p str.
+ * @param result Pointer to store the new value in. May be \p NULL.
+ * @return An error code. An error is returned if \p str doesn't hold an
+ *         integer or if the increment would overflow.
+ *
+ * On success the string is integer encoded. Its textual representation is
+ * updated as well.
+ */
+int string_incr(struct string *str, s64 delta, s64 *result)
+{
+	s64 value;
+
+	xfiredb_write_seqlock(&str->lock);
+	if(string_to_int(str, &value)) {
+		xfiredb_write_sequnlock(&str->lock);
+		return -XFIREDB_ERR;
+	}
+
+	if((delta > 0 && value > INT64_MAX - delta) ||
+			(delta < 0 && value < INT64_MIN - delta)) {
+		xfiredb_write_sequnlock(&str->lock);
+		return -XFIREDB_ERR;
+	}
+
+	value += delta;
+	string_set_number(str, "%lld", (long long)value);
+	str->obj.encoding = STRING_ENC_INT;
+	str->num.i = value;
+	xfiredb_write_sequnlock(&str->lock);
+
+	if(result)
+		*result = value;
+
+	return -XFIREDB_OK;
+}
+
+/**
+ * @brief Atomically increment a floating point string.
+ * @param str String to increment.
+ * @param delta Value to add to \p str.
+ * @param result Pointer to store the new value in. May be \p NULL.
+ * @return An error code. An error is returned if \p str doesn't hold a
+ *         number or if the result isn't a finite number.
+ *
+ * On success the string is floating point encoded.
+ */
+int string_incr_float(struct string *str, double delta, double *result)
+{
+	double value;
+
+	xfiredb_write_seqlock(&str->lock);
+	if(string_to_float(str, &value)) {
+		xfiredb_write_sequnlock(&str->lock);
+		return -XFIREDB_ERR;
+	}
+
+	value += delta;
+	if(!isfinite(value)) {
+		xfiredb_write_sequnlock(&str->lock);
+		return -XFIREDB_ERR;
+	}
+
+	string_set_float(str, value);
+	str->obj.encoding = STRING_ENC_FLOAT;
+	str->num.f = value;
+	xfiredb_write_sequnlock(&str->lock);
+
+	if(result)
+		*result = value;
+
+	return -XFIREDB_OK;
+}
+
+/**
+ * @brief Borrow the data stored in a string container.
+ * @param str String to borrow from.
+ * @param len Pointer to store the length of the data in. May be \p NULL.
+ * @return The data stored in \p str.
+ * @see string_unborrow
+ *
+ * The string is locked for reading until it is given back using
+ * string_unborrow. This allows a caller to read the stored bytes without
+ * copying them first. Other readers may borrow the string at the same time,
+ * writers wait until every borrow has been given back. The borrow should be
+ * kept as short as possible and the string may not be modified in the mean
+ * time.
+ */
+const char *string_borrow(struct string *str, size_t *len)
+{
+	xfiredb_read_seqlock(&str->lock);
+	if(len)
+		*len = str->len;
+
+	return str->str;
+}
+
+/**
+ * @brief Borrow part of the data stored in a string container.
+ * @param str String to borrow from.
+ * @param start Offset of the first byte.
+ * @param end Offset of the last byte (inclusive).
+ * @param len Pointer to store the length of the range in.
+ * @return A pointer to the start of the range within \p str.
+ * @see string_borrow string_unborrow
+ *
+ * Negative offsets are counted from the end of the string, i.e. -1 is the
+ * last byte of the string. The range is clipped to the string. If the range
+ * is empty, \p len is set to 0. Like string_borrow, the string stays locked
+ * until it is given back.
+ */
+const char *string_borrow_range(struct string *str, s64 start,
+		s64 end, size_t *len)
+{
+	s64 slen;
+
+	xfiredb_read_seqlock(&str->lock);
+	slen = (s64)str->len;
+
+	if(start < 0)
+		start += slen;
+	if(end < 0)
+		end += slen;
+	if(start < 0)
+		start = 0;
+	if(end >= slen)
+		end = slen - 1;
+
+	if(start > end || !slen) {
+		*len = 0;
+		return str->str;
+	}
+
+	*len = (size_t)(end - start + 1);
+	return str->str + start;
+}
+
+/**
+ * @brief Give back a borrowed string.
+ * @param str String to give back.
+ * @see string_borrow
+ */
+void string_unborrow(struct string *str)
+{
+	xfiredb_read_sequnlock(&str->lock);
+}
+
 /**
  * @brief Get the length of a string.
  * @param str String to get the length.
@@ -106,10 +616,12 @@ int string_get(struct string *str, char **buff)
 size_t string_length(struct string *str)
 {
 	size_t len;
+	u32 seq;
 
-	xfiredb_spin_lock(&str->lock);
-	len = str->len;
-	xfiredb_spin_unlock(&str->lock);
+	do {
+		seq = xfiredb_read_seqbegin(&str->lock);
+		len = str->len;
+	} while(xfiredb_read_seqretry(&str->lock, seq));
 
 	return len;
 }
@@ -120,10 +632,10 @@ size_t string_length(struct string *str)
  */
 void string_destroy(struct string *str)
 {
-	if(str->str)
+	if(string_is_shared(str))
+		string_unshare(str, false);
+	else if(str->str && !string_is_inline(str))
 		xfiredb_free(str->str);
-
-	xfiredb_spinlock_destroy(&str->lock);
 }
 
 /**
@@ -133,7 +645,7 @@ void string_destroy(struct string *str)
 void string_free(struct string *string)
 {
 	string_destroy(string);
-	xfiredb_free(string);
+	xfiredb_cache_free(string, sizeof(*string), MEM_STAT_GENERAL);
 }
 
 /** @} */
@@ -18,7 +18,10 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
+#include <assert.h>
+#include <sqlite3.h>
 #include <unittest.h>
 
 #include <xfiredb/xfiredb.h>
@@ -28,6 +31,18 @@
 #include <xfiredb/mem.h>
 #include <xfiredb/error.h>
 #include <xfiredb/disk.h>
+#include <xfiredb/os.h>
+#include <xfiredb/time.h>
+
+#define BIO_THREADS 4
+#define BIO_RECORDS 1500
+#define BIO_BENCH_RECORDS 2000
+#define BIO_HOT_UPDATES 1000
+
+/* Too long to be stored inline in a BIO record */
+static const char bio_long_data[] =
+	"concurrent-data-concurrent-data-concurrent-data-concurrent-data-"
+	"concurrent-data-concurrent-data-concurrent-data-concurrent-data";
 
 static void setup(struct unit_test *test)
 {
@@ -39,6 +54,281 @@ static void teardown(struct unit_test *test)
 	xfiredb_exit();
 }
 
+static void *bio_producer(void *arg)
+{
+	char key[32];
+	long id = (long)arg;
+	int i;
+
+	for(i = 0; i < BIO_RECORDS; i++) {
+		snprintf(key, sizeof(key), "bio-%li-%i", id, i);
+		bio_queue_add(key, NULL, i % 16 ? "concurrent-data" : bio_long_data,
+				STRING_ADD);
+	}
+
+	return NULL;
+}
+
+static void bio_concurrent_test(void)
+{
+	struct thread *threads[BIO_THREADS];
+	long size, i;
+
+	bio_sync();
+	size = disk_size(disk_db);
+	for(i = 0; i < BIO_THREADS; i++)
+		threads[i] = xfiredb_create_thread("bio-producer", &bio_producer, (void*)i);
+
+	for(i = 0; i < BIO_THREADS; i++) {
+		xfiredb_thread_join(threads[i]);
+		xfiredb_thread_destroy(threads[i]);
+	}
+
+	bio_sync();
+	assert(disk_size(disk_db) == size + BIO_THREADS * BIO_RECORDS);
+}
+
+static int bio_rows;
+static char bio_value[32];
+
+static void bio_load_hook(int argc, char **rows, size_t *lens, char **cols)
+{
+	bio_rows++;
+	snprintf(bio_value, sizeof(bio_value), "%s", rows[TABLE_DATA_IDX]);
+}
+
+static void bio_check_key(char *key, int rows, const char *value)
+{
+	bio_rows = 0;
+	bio_value[0] = '\0';
+	disk_load_key(disk_db, key, &bio_load_hook);
+
+	assert(bio_rows == rows);
+	if(value)
+		assert(!strcmp(bio_value, value));
+}
+
+/*
+ * Only the last value of a hot key should reach the disk, and entries
+ * that are added and deleted again shouldn't reach it at all.
+ */
+static void bio_coalesce_test(void)
+{
+	char value[32];
+	int i;
+
+	bio_queue_add("hot-key", NULL, "hot-0", STRING_ADD);
+	bio_queue_add("hot-map", "field", "hot-0", HM_ADD);
+	for(i = 1; i <= BIO_HOT_UPDATES; i++) {
+		snprintf(value, sizeof(value), "hot-%i", i);
+		bio_queue_add("hot-key", NULL, value, STRING_UPDATE);
+		bio_queue_add("hot-map", "field", value, HM_UPDATE);
+	}
+
+	bio_queue_add("gone-key", NULL, "gone", STRING_ADD);
+	bio_queue_add("gone-key", NULL, "gone", STRING_UPDATE);
+	bio_queue_add("gone-key", NULL, NULL, STRING_DEL);
+	bio_queue_add("gone-set", "member", NULL, SET_ADD);
+	bio_queue_add("gone-set", "member", NULL, SET_DEL);
+	bio_queue_add("gone-set", "member", NULL, SET_ADD);
+	bio_sync();
+
+	snprintf(value, sizeof(value), "hot-%i", BIO_HOT_UPDATES);
+	bio_check_key("hot-key", 1, value);
+	bio_check_key("hot-map", 1, value);
+	bio_check_key("gone-key", 0, NULL);
+	bio_check_key("gone-set", 1, NULL);
+}
+
+/*
+ * A record, and every record queued before it, should be on disk once
+ * bio_wait returns, even when it was superseded by a later record.
+ */
+static void bio_durable_test(void)
+{
+	unsigned long first, seq;
+
+	first = bio_queue_add("durable-key", NULL, "durable-0", STRING_ADD);
+	seq = bio_queue_add("durable-key", NULL, "durable-1", STRING_UPDATE);
+	assert(first && seq > first);
+
+	bio_wait(first);
+	assert(bio_durable() >= first);
+	bio_check_key("durable-key", 1, NULL);
+
+	bio_wait(seq);
+	assert(bio_durable() >= seq);
+	bio_check_key("durable-key", 1, "durable-1");
+}
+
+/*
+ * A record should reach the disk within the flush interval, even when too
+ * few records are queued to wake up the worker.
+ */
+static void bio_flush_test(void)
+{
+	struct bio_flush flush;
+	unsigned long seq;
+
+	bio_sync();
+	bio_get_flush(0, &flush);
+	assert(bio_set_flush(0, 1000000, 20) == -XFIREDB_OK);
+	seq = bio_queue_add("flush-key", NULL, "flush-data", STRING_ADD);
+
+	xfiredb_sleep_ms(250);
+	assert(bio_durable() >= seq);
+	bio_check_key("flush-key", 1, "flush-data");
+
+	bio_set_flush(0, flush.ops, flush.interval);
+}
+
+/*
+ * Measure the write throughput of the BIO worker for a number of
+ * transaction sizes.
+ */
+static void bio_batch_bench(void)
+{
+	static const unsigned int sizes[] = {1, 16, 256, 1024};
+	struct bio_batch batch;
+	char key[32];
+	time_t start, duration;
+	long size;
+	int i, j;
+
+	bio_get_batch(0, &batch);
+	for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		assert(bio_set_batch(0, sizes[i], 1000) == -XFIREDB_OK);
+		bio_sync();
+		size = disk_size(disk_db);
+
+		start = xfiredb_time_stamp();
+		for(j = 0; j < BIO_BENCH_RECORDS; j++) {
+			snprintf(key, sizeof(key), "bench-%u-%i", sizes[i], j);
+			bio_queue_add(key, NULL, "bench-data", STRING_ADD);
+		}
+		bio_sync();
+		duration = xfiredb_time_stamp() - start;
+
+		assert(disk_size(disk_db) == size + BIO_BENCH_RECORDS);
+		printf("Batch size %4u: %i records in %li ms (%li records/s)\n",
+				sizes[i], BIO_BENCH_RECORDS, (long)duration,
+				BIO_BENCH_RECORDS * 1000L / (duration ? duration : 1));
+	}
+
+	bio_set_batch(0, batch.size, batch.latency);
+}
+
+/*
+ * Measure the write throughput of the SQLite profile of every persistency
+ * level. Every record is committed on its own, so the cost of syncing
+ * isn't hidden by group commit.
+ */
+static void bio_profile_bench(void)
+{
+	struct disk_profile profile, level0;
+	struct bio_batch batch;
+	char key[32];
+	time_t start, duration;
+	int level, i;
+
+	bio_get_batch(0, &batch);
+	bio_get_profile(0, &level0);
+	assert(bio_set_batch(0, 1, 0) == -XFIREDB_OK);
+
+	for(level = 0; level < BIO_PERSIST_LEVELS; level++) {
+		bio_get_profile(level, &profile);
+		assert(bio_set_profile(0, &profile) == -XFIREDB_OK);
+		bio_sync();
+
+		start = xfiredb_time_stamp();
+		for(i = 0; i < BIO_BENCH_RECORDS; i++) {
+			snprintf(key, sizeof(key), "profile-%i-%i", level, i);
+			bio_queue_add(key, NULL, "bench-data", STRING_ADD);
+		}
+		bio_sync();
+		duration = xfiredb_time_stamp() - start;
+
+		assert(disk_checkpoint(disk_db) == -XFIREDB_OK);
+		printf("Persist level %i: %i records in %li ms (%li records/s)\n",
+				level, BIO_BENCH_RECORDS, (long)duration,
+				BIO_BENCH_RECORDS * 1000L / (duration ? duration : 1));
+	}
+
+	bio_set_profile(0, &level0);
+	bio_set_batch(0, batch.size, batch.latency);
+}
+
+static int bio_count_hook(void *arg, int argc, char **rows, char **cols)
+{
+	*(long*)arg = strtol(rows[0], NULL, 10);
+	return 0;
+}
+
+/*
+ * Count the rows on disk through a connection of its own, which only sees
+ * committed transactions.
+ */
+static long bio_committed_rows(void)
+{
+	sqlite3 *db;
+	long rows = -1L;
+
+	assert(sqlite3_open(SQLITE_DB, &db) == SQLITE_OK);
+	assert(sqlite3_exec(db, "SELECT COUNT(*) FROM xfiredb_data;",
+				&bio_count_hook, &rows, NULL) == SQLITE_OK);
+	sqlite3_close(db);
+
+	return rows;
+}
+
+/*
+ * Records that don't fit in the queue should be dropped and accounted
+ * for, and a snapshot should replace the contents of the disk as a whole.
+ */
+static void bio_limits_test(void)
+{
+	struct bio_stats before, after;
+	unsigned long seq;
+	char key[32];
+	long queued = 0, rows;
+	int i;
+
+	bio_sync();
+	bio_get_stats(&before);
+	bio_set_limits(8, 64, BIO_POLICY_DEGRADE);
+	for(i = 0; i < BIO_BENCH_RECORDS; i++) {
+		snprintf(key, sizeof(key), "limit-%i", i);
+		if(bio_queue_add(key, NULL, "limit-data", STRING_ADD) != BIO_SEQ_DROPPED)
+			queued++;
+	}
+
+	bio_sync();
+	bio_get_stats(&after);
+	assert(after.depth == 0 && after.bytes == 0);
+	assert(after.enqueued - before.enqueued == queued);
+	assert(after.shed - before.shed == BIO_BENCH_RECORDS - queued);
+	assert(after.ops[STRING_ADD].calls > before.ops[STRING_ADD].calls);
+	assert(after.degraded == (queued != BIO_BENCH_RECORDS));
+	bio_wait(BIO_SEQ_DROPPED);
+
+	rows = bio_committed_rows();
+	assert(rows > 1);
+
+	bio_snapshot_begin();
+	seq = bio_queue_add("snapshot-key", NULL, "snapshot-data", STRING_ADD);
+	xfiredb_sleep_ms(250);
+	assert(bio_durable() < seq);
+	assert(bio_committed_rows() == rows);
+
+	bio_snapshot_end();
+	bio_sync();
+	assert(bio_committed_rows() == 1);
+	assert(!bio_degraded());
+	assert(disk_size(disk_db) == 1);
+
+	bio_set_limits(0, 0, BIO_POLICY_BLOCK);
+}
+
 static void test_bio(void)
 {
 	dbg_bio_queue();
@@ -46,6 +336,14 @@ static void test_bio(void)
 	bg_process_signal("bio-worker");
 	sleep(1);
 	disk_dump(disk_db, stdout);
+
+	bio_concurrent_test();
+	bio_coalesce_test();
+	bio_durable_test();
+	bio_flush_test();
+	bio_batch_bench();
+	bio_profile_bench();
+	bio_limits_test();
 }
 
 static test_func_t test_func_array[] = {test_bio, NULL};
@@ -0,0 +1,135 @@
+/*
+ *  Atomic operations unit test
+ *  Copyright (C) 2015   Michel Megens <dev@michelmegens.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <unittest.h>
+
+#include <xfiredb/xfiredb.h>
+#include <xfiredb/types.h>
+#include <xfiredb/os.h>
+
+#define ATOMIC_THREADS 4
+#define ATOMIC_ITERATIONS 1000000
+
+static atomic_t counter;
+static atomic64_t counter64;
+
+static xfiredb_spinlock_t locked_lock;
+static s32 locked_counter;
+
+static void setup(struct unit_test *t)
+{
+	atomic_init(&counter);
+	atomic64_init(&counter64);
+	xfiredb_spinlock_init(&locked_lock);
+	locked_counter = 0;
+}
+
+static void teardown(struct unit_test *t)
+{
+	atomic_destroy(&counter);
+	atomic64_destroy(&counter64);
+	xfiredb_spinlock_destroy(&locked_lock);
+}
+
+static void *atomic_worker(void *arg)
+{
+	int i;
+
+	for(i = 0; i < ATOMIC_ITERATIONS; i++) {
+		atomic_inc(counter);
+		atomic64_inc(counter64);
+	}
+
+	return NULL;
+}
+
+static void *locked_worker(void *arg)
+{
+	int i;
+
+	for(i = 0; i < ATOMIC_ITERATIONS; i++) {
+		xfiredb_spin_lock(&locked_lock);
+		locked_counter++;
+		xfiredb_spin_unlock(&locked_lock);
+		xfiredb_spin_lock(&locked_lock);
+		locked_counter++;
+		xfiredb_spin_unlock(&locked_lock);
+	}
+
+	return NULL;
+}
+
+static time_t atomic_run(const char *name, void *(*fn)(void*))
+{
+	struct thread *threads[ATOMIC_THREADS];
+	time_t start;
+	int i;
+
+	start = xfiredb_time_stamp();
+	for(i = 0; i < ATOMIC_THREADS; i++)
+		threads[i] = xfiredb_create_thread(name, fn, NULL);
+
+	for(i = 0; i < ATOMIC_THREADS; i++) {
+		xfiredb_thread_join(threads[i]);
+		xfiredb_thread_destroy(threads[i]);
+	}
+
+	return xfiredb_time_stamp() - start;
+}
+
+static void atomic_test(void)
+{
+	atomic_add(&counter, 10);
+	atomic_sub(&counter, 4);
+	assert(atomic_get(&counter) == 6);
+	atomic_sub(&counter, 6);
+
+	atomic64_add(&counter64, 1LL << 40);
+	assert(atomic64_get(&counter64) == 1LL << 40);
+	atomic64_sub(&counter64, 1LL << 40);
+	assert(atomic64_get(&counter64) == 0LL);
+}
+
+static void atomic_contention_test(void)
+{
+	time_t atomic_ms, locked_ms;
+
+	atomic_ms = atomic_run("atomic-worker", &atomic_worker);
+	assert(atomic_get(&counter) == ATOMIC_THREADS * ATOMIC_ITERATIONS);
+	assert(atomic64_get(&counter64) == ATOMIC_THREADS * ATOMIC_ITERATIONS);
+
+	locked_ms = atomic_run("locked-worker", &locked_worker);
+	assert(locked_counter == 2 * ATOMIC_THREADS * ATOMIC_ITERATIONS);
+
+	printf("%i threads, %i increments of two counters each\n",
+			ATOMIC_THREADS, ATOMIC_ITERATIONS);
+	printf("atomic_t: %lu ms\n", (unsigned long)atomic_ms);
+	printf("spinlock: %lu ms\n", (unsigned long)locked_ms);
+}
+
+static test_func_t test_func_array[] = {atomic_test, atomic_contention_test, NULL};
+struct unit_test core_atomic_test = {
+	.name = "core:atomic",
+	.setup = setup,
+	.teardown = teardown,
+	.tests = test_func_array,
+};
+
@@ -0,0 +1,181 @@
+/*
+ *  Lock primitives unit test
+ *  Copyright (C) 2015   Michel Megens <dev@michelmegens.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <unittest.h>
+
+#include <xfiredb/xfiredb.h>
+#include <xfiredb/types.h>
+#include <xfiredb/os.h>
+
+#define LOCK_READERS 3
+#define LOCK_ITERATIONS 200000
+
+/*
+ * Writers keep both halves of a pair equal, readers verify that they
+ * never observe a half updated pair.
+ */
+static struct lock_pair {
+	volatile u32 a;
+	volatile u32 b;
+} rw_pair, seq_pair;
+
+static xfiredb_rwlock_t rwlock;
+static xfiredb_seqlock_t seqlock;
+static xfiredb_fast_mutex_t fast_mutex;
+static u32 mutex_counter;
+
+static void setup(struct unit_test *t)
+{
+	xfiredb_rwlock_init(&rwlock);
+	xfiredb_seqlock_init(&seqlock);
+	xfiredb_fast_mutex_init(&fast_mutex);
+	rw_pair.a = rw_pair.b = 0;
+	seq_pair.a = seq_pair.b = 0;
+	mutex_counter = 0;
+}
+
+static void teardown(struct unit_test *t)
+{
+	xfiredb_rwlock_destroy(&rwlock);
+	xfiredb_fast_mutex_destroy(&fast_mutex);
+}
+
+static void *rw_reader(void *arg)
+{
+	int i;
+
+	for(i = 0; i < LOCK_ITERATIONS; i++) {
+		xfiredb_read_lock(&rwlock);
+		assert(rw_pair.a == rw_pair.b);
+		xfiredb_read_unlock(&rwlock);
+	}
+
+	return NULL;
+}
+
+static void *seq_reader(void *arg)
+{
+	u32 a, b, seq;
+	int i;
+
+	for(i = 0; i < LOCK_ITERATIONS; i++) {
+		do {
+			seq = xfiredb_read_seqbegin(&seqlock);
+			a = seq_pair.a;
+			b = seq_pair.b;
+		} while(xfiredb_read_seqretry(&seqlock, seq));
+
+		assert(a == b);
+
+		xfiredb_read_seqlock(&seqlock);
+		assert(seq_pair.a == seq_pair.b);
+		xfiredb_read_sequnlock(&seqlock);
+	}
+
+	return NULL;
+}
+
+static void *mutex_worker(void *arg)
+{
+	int i;
+
+	for(i = 0; i < LOCK_ITERATIONS; i++) {
+		xfiredb_fast_mutex_lock(&fast_mutex);
+		mutex_counter++;
+		xfiredb_fast_mutex_unlock(&fast_mutex);
+	}
+
+	return NULL;
+}
+
+static void lock_start(struct thread **threads, const char *name,
+		void *(*fn)(void*))
+{
+	int i;
+
+	for(i = 0; i < LOCK_READERS; i++)
+		threads[i] = xfiredb_create_thread(name, fn, NULL);
+}
+
+static void lock_join(struct thread **threads)
+{
+	int i;
+
+	for(i = 0; i < LOCK_READERS; i++) {
+		xfiredb_thread_join(threads[i]);
+		xfiredb_thread_destroy(threads[i]);
+	}
+}
+
+static void rwlock_test(void)
+{
+	struct thread *threads[LOCK_READERS];
+	int i;
+
+	lock_start(threads, "rw-reader", &rw_reader);
+	for(i = 0; i < LOCK_ITERATIONS; i++) {
+		xfiredb_write_lock(&rwlock);
+		rw_pair.a++;
+		rw_pair.b++;
+		xfiredb_write_unlock(&rwlock);
+	}
+	lock_join(threads);
+
+	assert(rw_pair.a == LOCK_ITERATIONS);
+}
+
+static void seqlock_test(void)
+{
+	struct thread *threads[LOCK_READERS];
+	int i;
+
+	lock_start(threads, "seq-reader", &seq_reader);
+	for(i = 0; i < LOCK_ITERATIONS; i++) {
+		xfiredb_write_seqlock(&seqlock);
+		seq_pair.a++;
+		seq_pair.b++;
+		xfiredb_write_sequnlock(&seqlock);
+	}
+	lock_join(threads);
+
+	assert(seq_pair.a == LOCK_ITERATIONS);
+	assert(!(seqlock.seq & 1));
+	assert(!seqlock.readers);
+}
+
+static void fast_mutex_test(void)
+{
+	struct thread *threads[LOCK_READERS];
+
+	lock_start(threads, "mutex-worker", &mutex_worker);
+	lock_join(threads);
+
+	assert(mutex_counter == LOCK_READERS * LOCK_ITERATIONS);
+}
+
+static test_func_t test_func_array[] = {rwlock_test, seqlock_test, fast_mutex_test, NULL};
+struct unit_test core_lock_test = {
+	.name = "core:lock",
+	.setup = setup,
+	.teardown = teardown,
+	.tests = test_func_array,
+};
+
@@ -0,0 +1,211 @@
+/*
+ *  Object cache unit test
+ *  Copyright (C) 2015   Michel Megens <dev@michelmegens.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <unittest.h>
+
+#include <xfiredb/xfiredb.h>
+#include <xfiredb/types.h>
+#include <xfiredb/os.h>
+#include <xfiredb/mem.h>
+#include <xfiredb/error.h>
+
+#define MEM_THREADS 4
+#define MEM_BATCH 512
+#define MEM_ROUNDS 2000
+#define MEM_OBJECT_SIZE 48
+
+static void *objects[MEM_BATCH];
+
+static void setup(struct unit_test *t)
+{
+	memset(objects, 0, sizeof(objects));
+}
+
+static void teardown(struct unit_test *t)
+{
+}
+
+static void mem_cache_test(void)
+{
+	size_t before, size;
+	int i;
+
+	before = xfiredb_mem_used_stat(MEM_STAT_GENERAL);
+	for(i = 0; i < MEM_BATCH; i++) {
+		size = (i % 300) + 1;
+		objects[i] = xfiredb_cache_zalloc(size, MEM_STAT_GENERAL);
+		assert(objects[i]);
+		assert(xfiredb_cache_size(objects[i], size) >= size);
+		memset(objects[i], 0xAA, size);
+	}
+
+	assert(xfiredb_mem_used_stat(MEM_STAT_GENERAL) > before);
+	for(i = 0; i < MEM_BATCH; i++)
+		xfiredb_cache_free(objects[i], (i % 300) + 1, MEM_STAT_GENERAL);
+
+	assert(xfiredb_mem_used_stat(MEM_STAT_GENERAL) == before);
+}
+
+static void *mem_remote_free(void *arg)
+{
+	int i;
+
+	for(i = 0; i < MEM_BATCH; i++)
+		xfiredb_cache_free(objects[i], MEM_OBJECT_SIZE, MEM_STAT_GENERAL);
+
+	return NULL;
+}
+
+static void mem_remote_free_test(void)
+{
+	struct thread *tp;
+	size_t before;
+	int i;
+
+	before = xfiredb_mem_used_stat(MEM_STAT_GENERAL);
+	for(i = 0; i < MEM_BATCH; i++)
+		objects[i] = xfiredb_cache_alloc(MEM_OBJECT_SIZE, MEM_STAT_GENERAL);
+
+	tp = xfiredb_create_thread("mem-remote-free", &mem_remote_free, NULL);
+	xfiredb_thread_join(tp);
+	xfiredb_thread_destroy(tp);
+
+	assert(xfiredb_mem_used_stat(MEM_STAT_GENERAL) == before);
+}
+
+static void mem_heapprof_count(unsigned long long *objs, unsigned long long *bytes)
+{
+	FILE *fp;
+	int rc;
+
+	fp = tmpfile();
+	assert(fp);
+	assert(xfiredb_heapprof_dump(fp) == -XFIREDB_OK);
+	rewind(fp);
+	rc = fscanf(fp, "heap profile: %llu: %llu", objs, bytes);
+	assert(rc == 2);
+	fclose(fp);
+}
+
+static void mem_heapprof_test(void)
+{
+	unsigned long long objs, bytes;
+	int i;
+
+	/* sample (nearly) every allocation */
+	assert(xfiredb_heapprof_start(1) == -XFIREDB_OK);
+	assert(xfiredb_heapprof_rate() == 1);
+
+	for(i = 0; i < MEM_BATCH; i++)
+		objects[i] = xfiredb_alloc(MEM_OBJECT_SIZE * 100);
+
+	mem_heapprof_count(&objs, &bytes);
+	assert(objs >= MEM_BATCH);
+	assert(bytes >= MEM_BATCH * MEM_OBJECT_SIZE * 100);
+
+	for(i = 0; i < MEM_BATCH; i++)
+		xfiredb_free(objects[i]);
+
+	mem_heapprof_count(&objs, &bytes);
+	assert(objs < MEM_BATCH);
+
+	xfiredb_heapprof_stop();
+	assert(xfiredb_heapprof_rate() == 0);
+	assert(xfiredb_heapprof_dump(stdout) == -XFIREDB_ERR);
+}
+
+static void *cache_worker(void *arg)
+{
+	void *batch[MEM_BATCH];
+	int i, j;
+
+	for(i = 0; i < MEM_ROUNDS; i++) {
+		for(j = 0; j < MEM_BATCH; j++)
+			batch[j] = xfiredb_cache_alloc(MEM_OBJECT_SIZE, MEM_STAT_GENERAL);
+		for(j = 0; j < MEM_BATCH; j++)
+			xfiredb_cache_free(batch[j], MEM_OBJECT_SIZE, MEM_STAT_GENERAL);
+	}
+
+	return NULL;
+}
+
+static void *heap_worker(void *arg)
+{
+	void *batch[MEM_BATCH];
+	int i, j;
+
+	for(i = 0; i < MEM_ROUNDS; i++) {
+		for(j = 0; j < MEM_BATCH; j++)
+			batch[j] = xfiredb_alloc(MEM_OBJECT_SIZE);
+		for(j = 0; j < MEM_BATCH; j++)
+			xfiredb_free(batch[j]);
+	}
+
+	return NULL;
+}
+
+static time_t mem_run(const char *name, void *(*fn)(void*))
+{
+	struct thread *threads[MEM_THREADS];
+	time_t start;
+	int i;
+
+	start = xfiredb_time_stamp();
+	for(i = 0; i < MEM_THREADS; i++)
+		threads[i] = xfiredb_create_thread(name, fn, NULL);
+
+	for(i = 0; i < MEM_THREADS; i++) {
+		xfiredb_thread_join(threads[i]);
+		xfiredb_thread_destroy(threads[i]);
+	}
+
+	return xfiredb_time_stamp() - start;
+}
+
+static void mem_throughput_test(void)
+{
+	time_t cache_ms, heap_ms;
+
+	cache_ms = mem_run("cache-worker", &cache_worker);
+	heap_ms = mem_run("heap-worker", &heap_worker);
+
+	printf("%i threads, %i allocations of %i bytes each\n", MEM_THREADS,
+			MEM_ROUNDS * MEM_BATCH, MEM_OBJECT_SIZE);
+	printf("object cache: %lu ms\n", (unsigned long)cache_ms);
+	printf("heap: %lu ms\n", (unsigned long)heap_ms);
+
+	xfiredb_heapprof_start(512 * 1024);
+	heap_ms = mem_run("heap-worker", &heap_worker);
+	xfiredb_heapprof_stop();
+	printf("heap, profiled: %lu ms\n", (unsigned long)heap_ms);
+	printf("reserved: %lu bytes\n", (unsigned long)xfiredb_mem_reserved());
+}
+
+static test_func_t test_func_array[] = {mem_cache_test, mem_remote_free_test,
+	mem_heapprof_test, mem_throughput_test, NULL};
+struct unit_test core_mem_test = {
+	.name = "core:mem",
+	.setup = setup,
+	.teardown = teardown,
+	.tests = test_func_array,
+};
+
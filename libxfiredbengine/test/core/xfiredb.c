@@ -50,6 +50,21 @@ static void dbg_string_test(void)
 	assert(xfiredb_key_delete("key3") == 1);
 }
 
+static void dbg_incr_test(void)
+{
+	double f;
+	s64 i;
+
+	assert(xfiredb_string_incr_float("counter", 1.0, &f) == -XFIREDB_OK);
+	assert(xfiredb_string_incr("counter", 1, &i) == -XFIREDB_OK);
+	assert(i == 2);
+
+	/* A float that isn't an integer stays out of reach of INCR */
+	assert(xfiredb_string_incr_float("counter", 0.5, &f) == -XFIREDB_OK);
+	assert(xfiredb_string_incr("counter", 1, &i) == -XFIREDB_ERR);
+	assert(xfiredb_key_delete("counter") == 1);
+}
+
 static void dbg_list_test(void)
 {
 	int idx[] = {0,1,2,3};
@@ -102,6 +117,7 @@ void teardown(struct unit_test *test)
 void test_storage_engine(void)
 {
 	dbg_string_test();
+	dbg_incr_test();
 	dbg_list_test();
 	dbg_hm_test();
 	bio_sync();
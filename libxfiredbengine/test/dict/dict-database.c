@@ -18,6 +18,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unittest.h>
 
 #include <sys/time.h>
@@ -27,6 +28,9 @@
 #include <xfiredb/database.h>
 #include <xfiredb/os.h>
 #include <xfiredb/container.h>
+#include <xfiredb/time.h>
+#include <xfiredb/mem.h>
+#include <xfiredb/string.h>
 
 static const char *dbg_keys[] = {"key1","key2","key3","key4","key5","key6","key7",
 				"key8","key9","key10","key11","key12",
@@ -145,7 +149,147 @@ static void test_database(void)
 	assert(db_delete(strings, dbg_keys[11], &val) == -XFIREDB_OK);
 }
 
-static test_func_t test_func_array[] = {test_database, NULL};
+static int expired;
+
+static void test_expire_hook(struct database *db, const char *key, db_data_t *data)
+{
+	container_destroy(data->ptr);
+	xfiredb_free(data->ptr);
+	expired++;
+}
+
+static struct container *test_string_container(const char *value)
+{
+	struct container *c;
+
+	c = container_alloc(CONTAINER_STRING);
+	string_set(container_get_data(c), value);
+	return c;
+}
+
+static void test_database_expiry(void)
+{
+	db_data_t val;
+	s64 ttl;
+	int i;
+
+	expired = 0;
+	db_set_expire_hook(strings, &test_expire_hook);
+	assert(db_store(strings, dbg_keys[0],
+				test_string_container(dbg_values[0])) == -XFIREDB_OK);
+	assert(db_store(strings, dbg_keys[1],
+				test_string_container(dbg_values[1])) == -XFIREDB_OK);
+	assert(db_set_expiry(strings, dbg_keys[2], xfiredb_time_stamp() + 50) == -XFIREDB_ERR);
+	assert(db_ttl(strings, dbg_keys[0]) == DB_TTL_NONE);
+	assert(db_ttl(strings, dbg_keys[2]) == DB_TTL_MISSING);
+
+	assert(db_set_expiry(strings, dbg_keys[0], xfiredb_time_stamp() + 50) == -XFIREDB_OK);
+	ttl = db_ttl(strings, dbg_keys[0]);
+	assert(ttl > 0 && ttl <= 50);
+	assert(db_persist(strings, dbg_keys[0]) == -XFIREDB_OK);
+	assert(db_persist(strings, dbg_keys[0]) == -XFIREDB_ERR);
+
+	assert(db_set_expiry(strings, dbg_keys[0], xfiredb_time_stamp() + 20) == -XFIREDB_OK);
+	assert(db_set_expiry(strings, dbg_keys[1], xfiredb_time_stamp() + 20) == -XFIREDB_OK);
+	xfiredb_sleep_ms(50);
+
+	/* active expiry */
+	assert(db_expire_cycle(strings, 1) == 1);
+	assert(expired == 1);
+
+	/* lazy expiry */
+	assert(db_lookup(strings, dbg_keys[0], &val) != -XFIREDB_OK);
+	assert(db_lookup(strings, dbg_keys[1], &val) != -XFIREDB_OK);
+	assert(expired == 2);
+	assert(db_expire_cycle(strings, 10) == 0);
+	assert(db_get_size(strings) == 0);
+
+	/* Changing a time out over and over doesn't grow the expiry queue */
+	assert(db_store(strings, dbg_keys[0],
+				test_string_container(dbg_values[0])) == -XFIREDB_OK);
+	for(i = 0; i < 10000; i++)
+		assert(db_set_expiry(strings, dbg_keys[0],
+					xfiredb_time_stamp() + 60000 + i) == -XFIREDB_OK);
+	assert(strings->expire_queue.size < 2048);
+
+	assert(db_delete(strings, dbg_keys[0], &val) == -XFIREDB_OK);
+	container_destroy(val.ptr);
+	xfiredb_free(val.ptr);
+}
+
+static void test_evict_hook(struct database *db, const char *key, db_data_t *data)
+{
+	container_destroy(data->ptr);
+	xfiredb_free(data->ptr);
+	expired++;
+}
+
+static void test_database_eviction(void)
+{
+	struct container *c;
+	struct db_iterator *it;
+	struct db_entry *e;
+	db_data_t val;
+	char *key;
+	size_t used;
+	int i;
+
+	expired = 0;
+	db_set_expire_hook(strings, &test_evict_hook);
+	for(i = 0; i < 100; i++) {
+		xfiredb_sprintf(&key, "evict-%i", i);
+		c = container_alloc(CONTAINER_STRING);
+		string_set(container_get_data(c), "eviction test value which is too long to be inlined");
+		assert(db_store(strings, key, c) == -XFIREDB_OK);
+		xfiredb_free(key);
+	}
+
+	used = xfiredb_mem_used();
+	assert(db_set_maxmemory(strings, used / 2, "allkeys-lfu") == -XFIREDB_OK);
+	assert(db_set_maxmemory(strings, used / 2, "bogus") == -XFIREDB_ERR);
+	assert(db_lookup(strings, "evict-1", &val) == -XFIREDB_OK);
+	assert(db_evict_if_needed(strings) == -XFIREDB_OK);
+	assert(expired > 0 && expired <= DB_EVICT_BATCH);
+
+	assert(db_set_maxmemory(strings, 1, "noeviction") == -XFIREDB_OK);
+	assert(db_evict_if_needed(strings) == -XFIREDB_ERR);
+	assert(db_set_maxmemory(strings, 0, "noeviction") == -XFIREDB_OK);
+	assert(db_evict_if_needed(strings) == -XFIREDB_OK);
+
+	it = db_get_iterator(strings);
+	for(e = db_iterator_next(it); e; e = db_iterator_next(it)) {
+		c = e->value.ptr;
+		container_destroy(c);
+		xfiredb_free(c);
+	}
+	db_iterator_free(it);
+}
+
+static void test_database_memory(void)
+{
+	struct container *c;
+	db_data_t val;
+	size_t dict_mem;
+
+	dict_mem = xfiredb_mem_used_stat(MEM_STAT_DICT);
+	c = container_alloc(CONTAINER_STRING);
+	string_set(container_get_data(c), "short");
+	assert(container_mem_usage(c, 0) == 0);
+	string_set(container_get_data(c), "memory test value which is too long to be inlined");
+	assert(container_mem_usage(c, 0) > strlen("memory test value"));
+
+	assert(db_store(strings, "memory-key", c) == -XFIREDB_OK);
+	assert(xfiredb_mem_used_stat(MEM_STAT_DICT) > dict_mem);
+	assert(db_key_mem_usage(strings, "memory-key") > strlen("memory-key"));
+	assert(xfiredb_mem_used() >= xfiredb_mem_used_stat(MEM_STAT_DICT));
+
+	assert(db_delete(strings, "memory-key", &val) == -XFIREDB_OK);
+	container_destroy(val.ptr);
+	xfiredb_free(val.ptr);
+}
+
+static test_func_t test_func_array[] = {test_database, test_database_expiry,
+	test_database_eviction, test_database_memory, NULL};
 struct unit_test dict_database_test = {
 	.name = "storage:dict:database",
 	.setup = setup,
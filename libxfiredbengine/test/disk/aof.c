@@ -0,0 +1,190 @@
+/*
+ *  Append-only log unit test
+ *  Copyright (C) 2015   Michel Megens <dev@michelmegens.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include <unittest.h>
+
+#include <xfiredb/xfiredb.h>
+#include <xfiredb/log.h>
+#include <xfiredb/types.h>
+#include <xfiredb/aof.h>
+#include <xfiredb/bio.h>
+#include <xfiredb/disk.h>
+#include <xfiredb/database.h>
+#include <xfiredb/container.h>
+#include <xfiredb/string.h>
+#include <xfiredb/time.h>
+
+#define AOF_FILE SQLITE_DB ".aof"
+#define AOF_BENCH_OPS 2000
+#define AOF_REPLAY_OPS 100000
+
+static int aof_rows;
+static char aof_last[64];
+
+static void setup(struct unit_test *t)
+{
+	xfiredb_log_init(NULL, NULL);
+	unlink(AOF_FILE);
+}
+
+static void teardown(struct unit_test *t)
+{
+	unlink(AOF_FILE);
+	xfiredb_log_exit();
+}
+
+static void aof_hook(int argc, char **rows, size_t *lens, char **cols)
+{
+	aof_rows++;
+	snprintf(aof_last, sizeof(aof_last), "%s", rows[TABLE_DATA_IDX]);
+}
+
+static int aof_count(struct aof *aof, char *key)
+{
+	aof_rows = 0;
+	if(key)
+		aof_load_key(aof, key, &aof_hook);
+	else
+		aof_load(aof, &aof_hook);
+
+	return aof_rows;
+}
+
+static void aof_log_test(void)
+{
+	struct database *db;
+	struct container *c;
+	struct aof *aof;
+	FILE *file;
+
+	aof = aof_create(AOF_FILE);
+	assert(!aof_append(aof, STRING_ADD, "aof-string", NULL, "it's", 4));
+	assert(!aof_append(aof, STRING_APPEND, "aof-string", NULL, " logged", 7));
+	assert(!aof_append(aof, LIST_ADD, "aof-list", "1", "entry-1", 7));
+	assert(!aof_append(aof, LIST_ADD, "aof-list", "2", "entry-2", 7));
+	assert(!aof_append(aof, LIST_DEL, "aof-list", "1", NULL, 0));
+	assert(!aof_append(aof, HM_ADD, "aof-map", "field", "data", 4));
+	assert(!aof_append(aof, HM_UPDATE, "aof-map", "field", "new-data", 8));
+	assert(!aof_commit(aof));
+	aof_destroy(aof);
+
+	/* A record cut off by a crash */
+	file = fopen(AOF_FILE, "ab");
+	fwrite("\x00\x10\x00", 1, 3, file);
+	fclose(file);
+
+	aof = aof_create(AOF_FILE);
+	assert(aof_size(aof) == 7);
+	assert(aof_count(aof, NULL) == 3);
+	assert(aof_count(aof, "aof-string") == 1);
+	assert(!strcmp(aof_last, "it's logged"));
+	assert(aof_count(aof, "aof-map") == 1);
+	assert(!strcmp(aof_last, "new-data"));
+	assert(aof_count(aof, "aof-list") == 1);
+	assert(!strcmp(aof_last, "entry-2"));
+	assert(aof_count(aof, "aof-missing") == 0);
+
+	/* A rewrite keeps the database, plus what was logged while it ran */
+	db = db_alloc("aof-db");
+	c = container_alloc(CONTAINER_STRING);
+	string_set(container_get_data(c), "it's logged");
+	assert(db_store(db, "aof-string", c) == -XFIREDB_OK);
+
+	assert(!aof_bgrewrite(aof, db));
+	assert(aof_bgrewrite(aof, db) == -XFIREDB_ERR);
+	assert(!aof_append(aof, STRING_ADD, "aof-new", NULL, "new", 3));
+	assert(!aof_commit(aof));
+	aof_rewrite_wait(aof);
+	assert(aof_size(aof) == 2);
+	assert(aof_count(aof, NULL) == 2);
+	assert(aof_count(aof, "aof-string") == 1);
+	assert(!strcmp(aof_last, "it's logged"));
+	assert(access(AOF_FILE ".rewrite", F_OK) && access(AOF_FILE ".rewrite.incr", F_OK));
+	aof_destroy(aof);
+	db_free(db);
+
+	aof = aof_create(AOF_FILE);
+	assert(aof_size(aof) == 2);
+	aof_destroy(aof);
+}
+
+/*
+ * Measure the append throughput of every sync policy, committing every
+ * record on its own, and the replay speed of a large log.
+ */
+static void aof_bench(void)
+{
+	static const char *names[] = {"always", "everysec", "no"};
+	struct aof *aof;
+	char key[32];
+	time_t start, duration;
+	int policy, i;
+
+	for(policy = AOF_FSYNC_ALWAYS; policy <= AOF_FSYNC_NO; policy++) {
+		unlink(AOF_FILE);
+		aof = aof_create(AOF_FILE);
+		aof_set_fsync(aof, policy);
+
+		start = xfiredb_time_stamp();
+		for(i = 0; i < AOF_BENCH_OPS; i++) {
+			snprintf(key, sizeof(key), "bench-%i", i);
+			aof_append(aof, STRING_ADD, key, NULL, "bench-data", 10);
+			aof_commit(aof);
+		}
+		duration = xfiredb_time_stamp() - start;
+
+		printf("AOF fsync %-8s: %i records in %li ms (%li records/s)\n",
+				names[policy], AOF_BENCH_OPS, (long)duration,
+				AOF_BENCH_OPS * 1000L / (duration ? duration : 1));
+		aof_destroy(aof);
+	}
+
+	unlink(AOF_FILE);
+	aof = aof_create(AOF_FILE);
+	aof_set_fsync(aof, AOF_FSYNC_NO);
+	for(i = 0; i < AOF_REPLAY_OPS; i++) {
+		snprintf(key, sizeof(key), "replay-%i", i);
+		aof_append(aof, STRING_ADD, key, NULL, "replay-data", 11);
+	}
+	aof_commit(aof);
+
+	start = xfiredb_time_stamp();
+	assert(aof_count(aof, NULL) == AOF_REPLAY_OPS);
+	duration = xfiredb_time_stamp() - start;
+	printf("AOF replay: %i records in %li ms\n", AOF_REPLAY_OPS, (long)duration);
+
+	start = xfiredb_time_stamp();
+	assert(aof_count(aof, "replay-42") == 1);
+	duration = xfiredb_time_stamp() - start;
+	printf("AOF single key load: %i records scanned in %li ms\n",
+			AOF_REPLAY_OPS, (long)duration);
+	aof_destroy(aof);
+}
+
+static test_func_t test_func_array[] = {aof_log_test, aof_bench, NULL};
+struct unit_test aof_test = {
+	.name = "storage:aof",
+	.setup = setup,
+	.teardown = teardown,
+	.tests = test_func_array,
+};
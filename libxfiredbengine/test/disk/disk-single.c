@@ -18,9 +18,13 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unittest.h>
 
 #include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#include <sqlite3.h>
 
 #include <xfiredb/xfiredb.h>
 #include <xfiredb/log.h>
@@ -104,8 +108,8 @@ static void dbg_list_store(struct disk *d)
 	list_rpush(&lh, &s4->entry);
 
 	disk_store_list(d, "list-key", &lh);
-	disk_delete_list(d, "list-key", "entry-3");
-	disk_update_list(d, "list-key", "entry-3", "entry-4");
+	disk_delete_list(d, "list-key", list_entry_id(&s3->entry));
+	disk_update_list(d, "list-key", list_entry_id(&s4->entry), "entry-4");
 
 	list_del(&lh, &s1->entry);
 	list_del(&lh, &s2->entry);
@@ -123,6 +127,51 @@ static void dbg_list_store(struct disk *d)
 	xfiredb_free(s4);
 }
 
+#define DISK_BENCH_OPS 5000
+
+static void disk_bench_print(const char *name, clock_t start)
+{
+	double usec;
+
+	usec = (double)(clock() - start) * 1000000.0 / CLOCKS_PER_SEC;
+	printf("%-8s %d ops, %.2f us CPU per op\n", name, DISK_BENCH_OPS,
+			usec / DISK_BENCH_OPS);
+}
+
+/*
+ * Measure the CPU time spent per disk operation. The operations run in a
+ * single transaction, so the journal sync doesn't dominate.
+ */
+static void disk_bench(struct disk *d)
+{
+	char key[32];
+	clock_t start;
+	int i;
+
+	disk_begin(d);
+	start = clock();
+	for(i = 0; i < DISK_BENCH_OPS; i++) {
+		snprintf(key, sizeof(key), "bench-%i", i);
+		disk_store_string(d, key, "bench-value");
+	}
+	disk_bench_print("store", start);
+
+	start = clock();
+	for(i = 0; i < DISK_BENCH_OPS; i++) {
+		snprintf(key, sizeof(key), "bench-%i", i);
+		disk_update_string(d, key, "bench-update");
+	}
+	disk_bench_print("update", start);
+
+	start = clock();
+	for(i = 0; i < DISK_BENCH_OPS; i++) {
+		snprintf(key, sizeof(key), "bench-%i", i);
+		disk_delete_string(d, key);
+	}
+	disk_bench_print("delete", start);
+	disk_commit(d);
+}
+
 static void setup(struct unit_test *t)
 {
 	xfiredb_log_init(NULL, NULL);
@@ -133,6 +182,40 @@ static void teardown(struct unit_test *t)
 	xfiredb_log_exit();
 }
 
+static int disk_length_hook(void *arg, int argc, char **rows, char **cols)
+{
+	*(long*)arg = strtol(rows[0], NULL, 10);
+	return 0;
+}
+
+/*
+ * Values are stored with their length, so they may hold NUL bytes.
+ */
+static void disk_binary_check(void)
+{
+	sqlite3 *db;
+	long len = 0L;
+
+	assert(sqlite3_open(SQLITE_DB, &db) == SQLITE_OK);
+	assert(sqlite3_exec(db, "SELECT length(CAST(db_value AS BLOB)) FROM " \
+				"xfiredb_data WHERE db_key = 'binary-key';",
+				&disk_length_hook, &len, NULL) == SQLITE_OK);
+	sqlite3_close(db);
+	assert(len == 8L);
+}
+
+static int binary_rows;
+
+static void disk_binary_hook(int argc, char **rows, size_t *lens, char **cols)
+{
+	if(strcmp(rows[TABLE_KEY_IDX], "binary-key"))
+		return;
+
+	binary_rows++;
+	assert(lens[TABLE_DATA_IDX] == 8);
+	assert(!memcmp(rows[TABLE_DATA_IDX], "bin\0ary\0", 8));
+}
+
 static void disk_test(void)
 {
 	struct disk *d;
@@ -143,6 +226,13 @@ static void disk_test(void)
 	assert(!disk_store_string(d, "test-key", s->str));
 
 	disk_update_string(d, "test-key", "String update success!");
+	assert(!disk_store_string(d, "quote-key", "it's"));
+	assert(!disk_append_string(d, "quote-key", " quoted"));
+	assert(!disk_store_string_len(d, "binary-key", "bin\0ary", 7));
+	assert(!disk_append_string_len(d, "binary-key", "\0", 1));
+	assert(!disk_load_key(d, "binary-key", &disk_binary_hook));
+	assert(!disk_load(d, &disk_binary_hook));
+	assert(binary_rows == 2);
 
 	string_destroy(s);
 	xfiredb_free(s);
@@ -150,10 +240,60 @@ static void disk_test(void)
 	dbg_list_store(d);
 	dbg_hm_store(d);
 	disk_dump(d, stdout);
+	disk_bench(d);
+	disk_destroy(d);
+	disk_binary_check();
+}
+
+#define DISK_V1_DB SQLITE_DB ".v1"
+#define DISK_V1_SCHEMA \
+	"CREATE TABLE xfiredb_data(" \
+	"db_key CHAR(64) NOT NULL, " \
+	"db_secondary_key, " \
+	"db_type CHAR(64), " \
+	"db_value BLOB);" \
+	"INSERT INTO xfiredb_data VALUES ('v1-string', 'null', 'string', 'value');" \
+	"INSERT INTO xfiredb_data VALUES ('v1-list', 'null', 'list', 'first');" \
+	"INSERT INTO xfiredb_data VALUES ('v1-list', 'null', 'list', 'second');" \
+	"INSERT INTO xfiredb_data VALUES ('v1-map', 'field', 'hashmap', 'data');"
+
+static int v1_rows;
+
+static void disk_v1_hook(int argc, char **rows, size_t *lens, char **cols)
+{
+	v1_rows++;
+	assert(rows[TABLE_SCND_KEY_IDX][0] != 'n');
+}
+
+static void disk_migrate_test(void)
+{
+	struct disk *d;
+	sqlite3 *db;
+
+	unlink(DISK_V1_DB);
+	assert(sqlite3_open(DISK_V1_DB, &db) == SQLITE_OK);
+	assert(sqlite3_exec(db, DISK_V1_SCHEMA, NULL, NULL, NULL) == SQLITE_OK);
+	sqlite3_close(db);
+
+	d = disk_create(DISK_V1_DB);
+	assert(disk_size(d) == 4);
+	disk_load_key(d, "v1-list", &disk_v1_hook);
+	assert(v1_rows == 2);
+
+	assert(!disk_update_hm(d, "v1-map", "field", "new-data"));
+	assert(!disk_delete_list(d, "v1-list", 2));
+	assert(!disk_store_string(d, "v2-string", "value"));
+	assert(disk_size(d) == 4);
+	disk_destroy(d);
+
+	/* Opening it again shouldn't migrate a second time */
+	d = disk_create(DISK_V1_DB);
+	assert(disk_size(d) == 4);
 	disk_destroy(d);
+	unlink(DISK_V1_DB);
 }
 
-static test_func_t test_func_array[] = {disk_test, NULL};
+static test_func_t test_func_array[] = {disk_test, disk_migrate_test, NULL};
 struct unit_test disk_single_test = {
 	.name = "storage:disk",
 	.setup = setup,
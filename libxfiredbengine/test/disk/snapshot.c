@@ -0,0 +1,278 @@
+/*
+ *  Snapshot unit test
+ *  Copyright (C) 2015   Michel Megens <dev@michelmegens.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include <unittest.h>
+
+#include <xfiredb/xfiredb.h>
+#include <xfiredb/log.h>
+#include <xfiredb/types.h>
+#include <xfiredb/database.h>
+#include <xfiredb/container.h>
+#include <xfiredb/string.h>
+#include <xfiredb/list.h>
+#include <xfiredb/hashmap.h>
+#include <xfiredb/set.h>
+#include <xfiredb/disk.h>
+#include <xfiredb/mem.h>
+#include <xfiredb/time.h>
+#include <xfiredb/snapshot.h>
+
+#define SNAPSHOT_FILE SQLITE_DB ".snap"
+#define SNAPSHOT_KEYS 100
+#define SNAPSHOT_BENCH_KEYS 200000
+
+static struct database *db;
+static int snapshot_rows[4];
+static int snapshot_expiries;
+static char snapshot_value[64];
+
+static void setup(struct unit_test *t)
+{
+	xfiredb_log_init(NULL, NULL);
+	unlink(SNAPSHOT_FILE);
+	db = db_alloc("snapshot-db");
+}
+
+static void teardown(struct unit_test *t)
+{
+	db_free(db);
+	unlink(SNAPSHOT_FILE);
+	xfiredb_log_exit();
+}
+
+static void snapshot_store_string(const char *key, const char *value)
+{
+	struct container *c;
+
+	c = container_alloc(CONTAINER_STRING);
+	string_set(container_get_data(c), value);
+	assert(db_store(db, key, c) == -XFIREDB_OK);
+}
+
+/*
+ * Fill the database with strings. Every tenth key is a list, hashmap or
+ * set instead, and every seventh key expires.
+ */
+static void snapshot_fill(int num)
+{
+	struct container *c;
+	struct string *s;
+	struct set_key *k;
+	char key[32], value[32];
+	int i;
+
+	for(i = 0; i < num; i++) {
+		snprintf(key, sizeof(key), "key-%i", i);
+		snprintf(value, sizeof(value), "value-%i", i);
+
+		switch(i % 10) {
+		case 1:
+			c = container_alloc(CONTAINER_LIST);
+			s = string_alloc("entry-1");
+			list_rpush(container_get_data(c), &s->entry);
+			s = string_alloc("entry-2");
+			list_rpush(container_get_data(c), &s->entry);
+			db_store(db, key, c);
+			break;
+
+		case 2:
+			c = container_alloc(CONTAINER_HASHMAP);
+			s = string_alloc(value);
+			hashmap_add(container_get_data(c), "field", &s->node);
+			db_store(db, key, c);
+			break;
+
+		case 3:
+			c = container_alloc(CONTAINER_SET);
+			k = xfiredb_zalloc(sizeof(*k));
+			set_add(container_get_data(c), "member-1", k);
+			k = xfiredb_zalloc(sizeof(*k));
+			set_add(container_get_data(c), "member-2", k);
+			k = xfiredb_zalloc(sizeof(*k));
+			set_add(container_get_data(c), "member-3", k);
+			db_store(db, key, c);
+			break;
+
+		default:
+			snapshot_store_string(key, value);
+			break;
+		}
+
+		if(!(i % 7))
+			db_set_expiry(db, key, xfiredb_time_stamp() + 60000);
+	}
+}
+
+static void snapshot_hook(int argc, char **rows, size_t *lens, char **cols)
+{
+	const char *type = rows[TABLE_TYPE_IDX];
+
+	if(!strcmp(type, "string"))
+		snapshot_rows[CONTAINER_STRING]++;
+	else if(!strcmp(type, "list"))
+		snapshot_rows[CONTAINER_LIST]++;
+	else if(!strcmp(type, "hashmap"))
+		snapshot_rows[CONTAINER_HASHMAP]++;
+	else if(!strcmp(type, "set"))
+		snapshot_rows[CONTAINER_SET]++;
+
+	if(!strcmp(rows[TABLE_KEY_IDX], "key-12"))
+		snprintf(snapshot_value, sizeof(snapshot_value), "%s", rows[TABLE_DATA_IDX]);
+}
+
+static void snapshot_expire(const char *key, s64 when)
+{
+	assert(when > xfiredb_time_stamp());
+	snapshot_expiries++;
+}
+
+static int snapshot_count(void)
+{
+	memset(snapshot_rows, 0, sizeof(snapshot_rows));
+	snapshot_expiries = 0;
+	return snapshot_load(SNAPSHOT_FILE, &snapshot_hook, &snapshot_expire);
+}
+
+static void snapshot_check(int num)
+{
+	assert(snapshot_count() == -XFIREDB_OK);
+	assert(snapshot_rows[CONTAINER_STRING] == num - 3 * num / 10);
+	assert(snapshot_rows[CONTAINER_LIST] == 2 * num / 10);
+	assert(snapshot_rows[CONTAINER_HASHMAP] == num / 10);
+	assert(snapshot_rows[CONTAINER_SET] == 3 * num / 10);
+	assert(snapshot_expiries == (num + 6) / 7);
+	assert(!strcmp(snapshot_value, "value-12"));
+}
+
+static void snapshot_save_test(void)
+{
+	struct snapshot_info info;
+	db_data_t data;
+	FILE *file;
+	char key[32];
+	int i;
+
+	snapshot_fill(SNAPSHOT_KEYS);
+	assert(snapshot_save(db, SNAPSHOT_FILE) == -XFIREDB_OK);
+	snapshot_check(SNAPSHOT_KEYS);
+
+	/* A damaged snapshot is refused as a whole */
+	file = fopen(SNAPSHOT_FILE, "r+b");
+	fseek(file, 32L, SEEK_SET);
+	fputc(fgetc(file) ^ 0x20, file);
+	fclose(file);
+	assert(snapshot_count() == -XFIREDB_ERR);
+	assert(!snapshot_rows[CONTAINER_STRING]);
+
+	/* Changes made during a background save are not in the snapshot */
+	assert(snapshot_bgsave(db, SNAPSHOT_FILE) == -XFIREDB_OK);
+	for(i = 0; i < SNAPSHOT_KEYS; i += 10) {
+		snprintf(key, sizeof(key), "key-%i", i);
+		assert(db_delete(db, key, &data) == -XFIREDB_OK);
+		container_destroy(data.ptr);
+		xfiredb_free(data.ptr);
+	}
+	snapshot_store_string("key-new", "new");
+
+	snapshot_wait();
+	snapshot_get_info(&info);
+	assert(!info.in_progress);
+	assert(info.last_ok);
+	assert(info.saves == 1);
+	assert(info.last_size > 0);
+	snapshot_check(SNAPSHOT_KEYS);
+}
+
+/*
+ * Measure how long writing and loading a large snapshot takes, and how
+ * long a background save blocks the caller.
+ */
+static void snapshot_bench(void)
+{
+	struct snapshot_info info;
+	time_t start, save, load;
+
+	snapshot_fill(SNAPSHOT_BENCH_KEYS);
+
+	start = xfiredb_time_stamp();
+	assert(snapshot_save(db, SNAPSHOT_FILE) == -XFIREDB_OK);
+	save = xfiredb_time_stamp() - start;
+
+	start = xfiredb_time_stamp();
+	snapshot_check(SNAPSHOT_BENCH_KEYS);
+	load = xfiredb_time_stamp() - start;
+
+	start = xfiredb_time_stamp();
+	assert(snapshot_bgsave(db, SNAPSHOT_FILE) == -XFIREDB_OK);
+	snapshot_get_info(&info);
+	printf("Snapshot bgsave: returned after %li ms, fork took %li us\n",
+			(long)(xfiredb_time_stamp() - start), (long)info.fork_usec);
+
+	snapshot_wait();
+	snapshot_get_info(&info);
+	assert(info.last_ok);
+	printf("Snapshot of %i keys: %llu bytes, saved in %li ms " \
+			"(background: %li ms), loaded in %li ms\n",
+			SNAPSHOT_BENCH_KEYS, (unsigned long long)info.last_size,
+			(long)save, (long)info.last_duration, (long)load);
+}
+
+static int snapshot_binary_rows;
+
+static void snapshot_binary_hook(int argc, char **rows, size_t *lens, char **cols)
+{
+	if(strcmp(rows[TABLE_KEY_IDX], "binary-key"))
+		return;
+
+	snapshot_binary_rows++;
+	assert(lens[TABLE_DATA_IDX] == 8);
+	assert(!memcmp(rows[TABLE_DATA_IDX], "bin\0ary\0", 8));
+}
+
+/*
+ * Values may hold NUL bytes.
+ */
+static void snapshot_binary_test(void)
+{
+	struct container *c;
+
+	c = container_alloc(CONTAINER_STRING);
+	string_set_len(container_get_data(c), "bin\0ary\0", 8);
+	assert(db_store(db, "binary-key", c) == -XFIREDB_OK);
+
+	assert(snapshot_save(db, SNAPSHOT_FILE) == -XFIREDB_OK);
+	assert(snapshot_load(SNAPSHOT_FILE, &snapshot_binary_hook, NULL) ==
+			-XFIREDB_OK);
+	assert(snapshot_binary_rows == 1);
+}
+
+static test_func_t test_func_array[] = {
+	snapshot_save_test, snapshot_bench, snapshot_binary_test, NULL
+};
+struct unit_test snapshot_test = {
+	.name = "storage:snapshot",
+	.setup = setup,
+	.teardown = teardown,
+	.tests = test_func_array,
+};
+
@@ -27,6 +27,7 @@
 #include <xfiredb/string.h>
 #include <xfiredb/hashmap.h>
 #include <xfiredb/mem.h>
+#include <xfiredb/intern.h>
 
 static struct string s1, s2, s3, s4;
 
@@ -98,7 +99,48 @@ static void test_hashmap(void)
 	assert(iterate_count == 4);
 }
 
-static test_func_t test_func_array[] = {test_hashmap, NULL};
+#define SHARED_VALUE "a value too long to be stored inline"
+
+static void test_hashmap_intern(void)
+{
+	struct hashmap other;
+	struct hashmap_node *node, *onode;
+	struct string *a, *b;
+	size_t num;
+
+	hashmap_init(&other);
+	a = string_alloc("other-val");
+	assert(hashmap_add(&other, "key4", &a->node) == -XFIREDB_OK);
+
+	node = hashmap_find(&map, "key4");
+	onode = hashmap_find(&other, "key4");
+	assert(node->key == onode->key);
+	assert(node->node.key == onode->node.key);
+
+	num = intern_count();
+	string_set_share_limit(64);
+	a = string_alloc(SHARED_VALUE);
+	b = string_alloc(SHARED_VALUE);
+	assert(string_is_shared(a) && a->str == b->str);
+	assert(intern_count() == num + 1);
+
+	string_append(b, "!", 1);
+	assert(!string_is_shared(b) && a->str != b->str);
+	assert(!strcmp(a->str, SHARED_VALUE));
+	assert(!strcmp(b->str, SHARED_VALUE "!"));
+	string_free(a);
+	string_free(b);
+	string_set_share_limit(0);
+	assert(intern_count() == num);
+
+	onode = hashmap_remove(&other, "key4");
+	a = container_of(onode, struct string, node);
+	hashmap_node_destroy(onode);
+	string_free(a);
+	hashmap_destroy(&other);
+}
+
+static test_func_t test_func_array[] = {test_hashmap, test_hashmap_intern, NULL};
 struct unit_test skiplist_hashmap_test = {
 	.name = "storage:skiplist:hashmap",
 	.setup = setup,
@@ -36,11 +36,16 @@ extern struct unit_test core_bitops_test;
 extern struct unit_test core_xfiredb_test;
 extern struct unit_test core_quotearg_test;
 extern struct unit_test core_sleep_test;
+extern struct unit_test core_atomic_test;
+extern struct unit_test core_lock_test;
+extern struct unit_test core_mem_test;
 
 extern struct unit_test skiplist_set_test;
 extern struct unit_test skiplist_hashmap_test;
 
 extern struct unit_test disk_single_test;
+extern struct unit_test aof_test;
+extern struct unit_test snapshot_test;
 
 extern struct unit_test bg_test;
 extern struct unit_test bio_test;
@@ -60,8 +65,13 @@ static struct unit_test *tests[] = {
 	&core_xfiredb_test,
 	&core_quotearg_test,
 	&core_sleep_test,
+	&core_atomic_test,
+	&core_lock_test,
+	&core_mem_test,
 
 	&disk_single_test,
+	&aof_test,
+	&snapshot_test,
 
 	&bio_test,
 	&bg_test,
@@ -22,6 +22,7 @@
  */
 
 #include <stdlib.h>
+#include <stdio.h>
 
 #include <xfiredb/xfiredb.h>
 #include <xfiredb/types.h>
@@ -33,16 +34,34 @@
 #include <xfiredb/os.h>
 #include <xfiredb/error.h>
 #include <xfiredb/disk.h>
+#include <xfiredb/aof.h>
+#include <xfiredb/snapshot.h>
 
 /**
  * @brief XFireDB debugging databse.
  */
 static struct database *xfiredb;
 
+/**
+ * @brief XFireDB API lock.
+ *
+ * Serialises the API calls below and the active expiry job, which frees
+ * the containers of expired keys.
+ */
+static xfiredb_mutex_t xfiredb_lock;
+
+#define XFIREDB_EXPIRE_JOB "expire-worker" //!< Active expiry job name.
+#define XFIREDB_EXPIRE_INTERVAL 100 //!< Active expiry interval in ms.
+#define XFIREDB_EXPIRE_BATCH 64 //!< Maximum number of keys per expiry run.
+
 static struct config config;
 static bool load_state = false;
 
 struct disk *disk_db;
+struct aof *aof_db;
+
+static int xfiredb_container_delete(const char *key, struct container *c);
+static int __xfiredb_list_push(char *key, char *data, bool left);
 
 /**
  * @brief Global configuration getter.
@@ -59,7 +78,10 @@ struct config *xfiredb_get_config(void)
  */
 void xfiredb_disk_clear(void)
 {
-	disk_clear(disk_db);
+	if(aof_db)
+		aof_clear(aof_db);
+	else
+		disk_clear(disk_db);
 }
 
 /**
@@ -110,10 +132,14 @@ void xfiredb_se_init(struct config *conf)
 
 /**
  * @brief Number of entry's (rows) on the disk.
- * @return Number of entry's on the disk.
+ * @return Number of entry's on the disk. The append-only log returns the
+ *   number of records in the log.
  */
 long xfiredb_disk_size(void)
 {
+	if(aof_db)
+		return aof_size(aof_db);
+
 	return disk_size(disk_db);
 }
 
@@ -121,10 +147,14 @@ long xfiredb_disk_size(void)
  * @brief Load data from the hard disk using a hook.
  * @param hook Called for each disk entry.
  */
-void xfiredb_raw_load(void (*hook)(int argc, char **rows, char **cols))
+void xfiredb_raw_load(
+		void (*hook)(int argc, char **rows, size_t *lens, char **cols))
 {
 	xfiredb_log_console(LOG_INIT, "Loading data from disk\n");
-	disk_load(disk_db, hook);
+	if(aof_db)
+		aof_load(aof_db, hook);
+	else
+		disk_load(disk_db, hook);
 }
 
 /**
@@ -132,9 +162,13 @@ void xfiredb_raw_load(void (*hook)(int argc, char **rows, char **cols))
  * @param key Key to load.
  * @param hook Load hook.
  */
-void xfiredb_load_key(char *key, void (*hook)(int argc, char **rows, char **cols))
+void xfiredb_load_key(char *key,
+		void (*hook)(int argc, char **rows, size_t *lens, char **cols))
 {
-	disk_load_key(disk_db, key, hook);
+	if(aof_db)
+		aof_load_key(aof_db, key, hook);
+	else
+		disk_load_key(disk_db, key, hook);
 }
 
 /**
@@ -145,6 +179,7 @@ void xfiredb_load_key(char *key, void (*hook)(int argc, char **rows, char **cols
  */
 void xfiredb_se_exit(void)
 {
+	snapshot_wait();
 	bio_sync();
 	bio_exit();
 	bg_processes_exit();
@@ -166,31 +201,60 @@ void xfiredb_se_save(void)
 	bio_sync();
 }
 
+/**
+ * @brief Rewrite the disk from the in-memory database.
+ * @param db Database to write.
+ * @see bio_snapshot_begin
+ *
+ * Used to bring the disk up to date after the BIO queue dropped writes, and
+ * to compact the append-only log. The entries are queued, not written, when
+ * this function returns. The append-only log is written by a forked child
+ * instead, see bio_bgrewrite; \p db may not be modified by other threads
+ * while the process is forked.
+ */
+void xfiredb_se_snapshot(struct database *db)
+{
+	struct db_iterator *it;
+	struct db_entry *e;
+
+	if(xfiredb_get_config()->persist_engine == BIO_ENGINE_AOF) {
+		bio_bgrewrite(db);
+		return;
+	}
+
+	bio_snapshot_begin();
+	it = db_get_iterator(db);
+	for(e = db_iterator_next(it); e; e = db_iterator_next(it))
+		xfiredb_store_container(e->key, e->value.ptr);
+	db_iterator_free(it);
+	bio_snapshot_end();
+}
+
 /**
  * @brief Notify the disk handler of a data change.
  * @param _key Key that changed.
  * @param _arg Extra info about the entry that changed.
- * @param _data New data.
+ * @param _data New data, may hold NUL bytes.
+ * @param _len Length of \p _data in bytes.
  * @param _op Type of change.
  */
-void xfiredb_notice_disk(char *_key, char *_arg, char *_data, int _op)
+void xfiredb_notice_disk(char *_key, char *_arg, const void *_data,
+		size_t _len, int _op)
 {
-	char *key, *arg, *data;
-	bio_operation_t op = _op;
-
 	if(!load_state)
 		return;
 
-	key = arg = data = NULL;
-
-	if(_key)
-		xfiredb_sprintf(&key, "%s", _key);
-	if(_arg)
-		xfiredb_sprintf(&arg, "%s", _arg);
-	if(_data)
-		xfiredb_sprintf(&data, "%s", _data);
+	bio_queue_add_len(_key, _arg, _data, _len, _op);
+}
 
-	bio_queue_add(key, arg, data, op);
+/*
+ * Format the ID of a list entry into \p buf, which has to be able to hold
+ * BIO_ID_SIZE bytes.
+ */
+static inline char *xfiredb_list_arg(struct list *entry, char *buf)
+{
+	snprintf(buf, BIO_ID_SIZE, "%lld", (long long)list_entry_id(entry));
+	return buf;
 }
 
 /**
@@ -200,7 +264,9 @@ void xfiredb_notice_disk(char *_key, char *_arg, char *_data, int _op)
  */
 void xfiredb_store_container(char *_key, struct container *c)
 {
-	char *key, *arg, *value;
+	char id[BIO_ID_SIZE];
+	const char *value;
+	size_t len;
 	struct string *s;
 	struct list *l;
 	struct list_head *lh;
@@ -214,21 +280,21 @@ void xfiredb_store_container(char *_key, struct container *c)
 	if(!load_state)
 		return;
 
-	switch(c->type) {
+	switch(container_type(c)) {
 	case CONTAINER_STRING:
-		xfiredb_sprintf(&key, "%s", _key);
 		s = container_get_data(c);
-		string_get(s, &value);
-		bio_queue_add(key, NULL, value, STRING_ADD);
+		value = string_borrow(s, &len);
+		bio_queue_add_len(_key, NULL, value, len, STRING_ADD);
+		string_unborrow(s);
 		break;
 
 	case CONTAINER_LIST:
 		lh = container_get_data(c);
 		list_for_each(lh, l) {
-			xfiredb_sprintf(&key, "%s", _key);
 			s = container_of(l, struct string, entry);
-			string_get(s, &value);
-			bio_queue_add(key, NULL, value, LIST_ADD);
+			value = string_borrow(s, &len);
+			bio_queue_add_len(_key, xfiredb_list_arg(l, id), value, len, LIST_ADD);
+			string_unborrow(s);
 		}
 		break;
 
@@ -237,22 +303,19 @@ void xfiredb_store_container(char *_key, struct container *c)
 		it = hashmap_new_iterator(map);
 		for(node = hashmap_iterator_next(it); node;
 				node = hashmap_iterator_next(it)) {
-			xfiredb_sprintf(&key, "%s", _key);
 			s = container_of(node, struct string, node);
-			string_get(s, &value);
-			xfiredb_sprintf(&arg, "%s", node->key);
-			bio_queue_add(key, arg, value, HM_ADD);
+			value = string_borrow(s, &len);
+			bio_queue_add_len(_key, node->key, value, len, HM_ADD);
+			string_unborrow(s);
 		}
+		hashmap_free_iterator(it);
 		break;
 
 	case CONTAINER_SET:
 		set = container_get_data(c);
 		set_it = set_iterator_new(set);
-		for_each_set(set, k, set_it) {
-			xfiredb_sprintf(&key, "%s", _key);
-			xfiredb_sprintf(&arg, "%s", k->key);
-			bio_queue_add(key, arg, NULL, SET_ADD);
-		}
+		for_each_set(set, k, set_it)
+			bio_queue_add(_key, k->key, NULL, SET_ADD);
 
 		set_iterator_free(set_it);
 		break;
@@ -277,10 +340,11 @@ static container_type_t xfiredb_get_row_type(char *cell)
 }
 
 static void xfiredb_load(struct database *db,
-		int argc, char **rows, char **cols)
+		int argc, char **rows, size_t *lens, char **cols)
 {
 	container_type_t type;
 	char *key, *skey, *data;
+	size_t len;
 	int i;
 	bool available;
 	db_data_t dbdata;
@@ -296,6 +360,7 @@ static void xfiredb_load(struct database *db,
 		key = rows[i + TABLE_KEY_IDX];
 		skey = rows[i + TABLE_SCND_KEY_IDX];
 		data = rows[i + TABLE_DATA_IDX];
+		len = lens[i + TABLE_DATA_IDX];
 		available = db_lookup(db, key, &dbdata) == -XFIREDB_OK ? true : false;
 
 		switch(type) {
@@ -305,7 +370,7 @@ static void xfiredb_load(struct database *db,
 
 			c = container_alloc(CONTAINER_STRING);
 			s = container_get_data(c);
-			string_set(s, data);
+			string_set_len(s, data, len);
 			db_store(db, key, c);
 			break;
 
@@ -316,8 +381,8 @@ static void xfiredb_load(struct database *db,
 				c = container_alloc(CONTAINER_LIST);
 
 			h = container_get_data(c);
-			s = string_alloc(data);
-			list_rpush(h, &s->entry);
+			s = string_alloc_len(data, len);
+			list_rpush_id(h, &s->entry, strtoll(skey, NULL, 10));
 
 			if(!available)
 				db_store(db, key, c);
@@ -330,7 +395,7 @@ static void xfiredb_load(struct database *db,
 				c = container_alloc(CONTAINER_HASHMAP);
 
 			map = container_get_data(c);
-			s = string_alloc(data);
+			s = string_alloc_len(data, len);
 			hashmap_add(map, skey, &s->node);
 
 			if(!available)
@@ -354,9 +419,21 @@ static void xfiredb_load(struct database *db,
 	}
 }
 
-static void xfiredb_load_hook(int argc, char **rows, char **cols)
+static void xfiredb_load_hook(int argc, char **rows, size_t *lens, char **cols)
+{
+	xfiredb_load(xfiredb, argc, rows, lens, cols);
+}
+
+static void xfiredb_expire_hook(struct database *db, const char *key, db_data_t *data)
+{
+	xfiredb_container_delete(key, data->ptr);
+}
+
+static void xfiredb_expire_worker(void *arg)
 {
-	xfiredb_load(xfiredb, argc, rows, cols);
+	xfiredb_mutex_lock(&xfiredb_lock);
+	db_expire_cycle(arg, XFIREDB_EXPIRE_BATCH);
+	xfiredb_mutex_unlock(&xfiredb_lock);
 }
 
 /**
@@ -369,12 +446,18 @@ void xfiredb_init(void)
 	conf.err_log_file = NULL;
 	conf.db_file = SQLITE_DB;
 	conf.persist_level = 0;
+	conf.persist_engine = BIO_ENGINE_DISK;
 
 	xfiredb_se_init(&conf);
+	xfiredb_mutex_init(&xfiredb_lock);
 #ifdef HAVE_DEBUG
 	xfiredb = db_alloc("xfiredb");
 #endif
-	disk_load(disk_db, &xfiredb_load_hook);
+	xfiredb_raw_load(&xfiredb_load_hook);
+
+	db_set_expire_hook(xfiredb, &xfiredb_expire_hook);
+	bg_process_create_periodic(XFIREDB_EXPIRE_JOB, &xfiredb_expire_worker,
+			xfiredb, XFIREDB_EXPIRE_INTERVAL);
 }
 
 /**
@@ -382,19 +465,16 @@ void xfiredb_init(void)
  */
 void xfiredb_exit(void)
 {
+	bg_process_stop(XFIREDB_EXPIRE_JOB);
 	bio_sync();
 	bio_exit();
 	bg_processes_exit();
 	db_free(xfiredb);
+	xfiredb_mutex_destroy(&xfiredb_lock);
 	xfiredb_log_exit();
 }
 
-/**
- * @brief Get a string.
- * @param key Key to search.
- * @param data Data pointer.
- */
-int xfiredb_string_get(char *key, char **data)
+static int __xfiredb_string_get(char *key, char **data)
 {
 	struct string *s;
 	struct container *c;
@@ -415,32 +495,40 @@ int xfiredb_string_get(char *key, char **data)
 }
 
 /**
- * @brief Set the data of a string.
- * @param key Key to store under.
- * @param str Data to set.
- * @return An error code.
+ * @brief Get a string.
+ * @param key Key to search.
+ * @param data Data pointer.
  */
-int xfiredb_string_set(char *key, char *str)
+int xfiredb_string_get(char *key, char **data)
+{
+	int rv;
+
+	xfiredb_mutex_lock(&xfiredb_lock);
+	rv = __xfiredb_string_get(key, data);
+	xfiredb_mutex_unlock(&xfiredb_lock);
+
+	return rv;
+}
+
+static int __xfiredb_string_set(char *key, char *str)
 {
 	struct string *s;
 	struct container *c;
 	db_data_t data;
-	char *bio_key, *bio_str;
 	int rv = -XFIREDB_OK;
 	bio_operation_t op;
 
-	xfiredb_sprintf(&bio_key, "%s", key);
-	xfiredb_sprintf(&bio_str, "%s", str);
+	if(db_evict_if_needed(xfiredb))
+		return -XFIREDB_ERR;
+
 	if(!db_lookup(xfiredb, key, &data)) {
 		c = data.ptr;
-		if(!container_check_type(c, CONTAINER_STRING)) {
-			xfiredb_free(bio_key);
-			xfiredb_free(bio_str);
+		if(!container_check_type(c, CONTAINER_STRING))
 			return -XFIREDB_ERR;
-		}
 
 		s = container_get_data(c);
 		string_set(s, str);
+		db_persist(xfiredb, key);
 		op = STRING_UPDATE;
 	} else {
 		op = STRING_ADD;
@@ -454,16 +542,172 @@ int xfiredb_string_set(char *key, char *str)
 		}
 	}
 
-	bio_queue_add(bio_key, NULL, bio_str, op);
+	bio_queue_add(key, NULL, str, op);
 	return rv;
 }
 
 /**
- * @brief Get the length of a list.
- * @param key List key.
- * @return Length of the list under \p key.
+ * @brief Set the data of a string.
+ * @param key Key to store under.
+ * @param str Data to set.
+ * @return An error code.
  */
-int xfiredb_list_length(char *key)
+int xfiredb_string_set(char *key, char *str)
+{
+	int rv;
+
+	xfiredb_mutex_lock(&xfiredb_lock);
+	rv = __xfiredb_string_set(key, str);
+	xfiredb_mutex_unlock(&xfiredb_lock);
+
+	return rv;
+}
+
+static int xfiredb_string_lookup(char *key, struct string **str)
+{
+	struct container *c;
+	db_data_t data;
+
+	if(db_evict_if_needed(xfiredb))
+		return -XFIREDB_ERR;
+
+	if(!db_lookup(xfiredb, key, &data)) {
+		c = data.ptr;
+		if(!container_check_type(c, CONTAINER_STRING))
+			return -XFIREDB_ERR;
+
+		*str = container_get_data(c);
+		return -XFIREDB_OK;
+	}
+
+	c = container_alloc(CONTAINER_STRING);
+	if(db_store(xfiredb, key, c)) {
+		container_destroy(c);
+		xfiredb_free(c);
+		return -XFIREDB_ERR;
+	}
+
+	*str = container_get_data(c);
+	return 1;
+}
+
+static int __xfiredb_string_incr(char *key, s64 delta, s64 *result)
+{
+	struct string *s;
+	int rv;
+
+	rv = xfiredb_string_lookup(key, &s);
+	if(rv < 0)
+		return rv;
+
+	if(rv > 0)
+		string_set(s, "0");
+
+	if(string_incr(s, delta, result))
+		return -XFIREDB_ERR;
+
+	bio_queue_add(key, NULL, string_borrow(s, NULL),
+			rv > 0 ? STRING_ADD : STRING_UPDATE);
+	string_unborrow(s);
+	return -XFIREDB_OK;
+}
+
+/**
+ * @brief Atomically increment an integer string.
+ * @param key Key of the string.
+ * @param delta Value to add.
+ * @param result Pointer to store the new value in. May be \p NULL.
+ * @return An error code.
+ * @note If \p key doesn't exist, it is created with an initial value of 0.
+ */
+int xfiredb_string_incr(char *key, s64 delta, s64 *result)
+{
+	int rv;
+
+	xfiredb_mutex_lock(&xfiredb_lock);
+	rv = __xfiredb_string_incr(key, delta, result);
+	xfiredb_mutex_unlock(&xfiredb_lock);
+
+	return rv;
+}
+
+static int __xfiredb_string_incr_float(char *key, double delta, double *result)
+{
+	struct string *s;
+	int rv;
+
+	rv = xfiredb_string_lookup(key, &s);
+	if(rv < 0)
+		return rv;
+
+	if(rv > 0)
+		string_set(s, "0");
+
+	if(string_incr_float(s, delta, result))
+		return -XFIREDB_ERR;
+
+	bio_queue_add(key, NULL, string_borrow(s, NULL),
+			rv > 0 ? STRING_ADD : STRING_UPDATE);
+	string_unborrow(s);
+	return -XFIREDB_OK;
+}
+
+/**
+ * @brief Atomically increment a floating point string.
+ * @param key Key of the string.
+ * @param delta Value to add.
+ * @param result Pointer to store the new value in. May be \p NULL.
+ * @return An error code.
+ * @note If \p key doesn't exist, it is created with an initial value of 0.
+ */
+int xfiredb_string_incr_float(char *key, double delta, double *result)
+{
+	int rv;
+
+	xfiredb_mutex_lock(&xfiredb_lock);
+	rv = __xfiredb_string_incr_float(key, delta, result);
+	xfiredb_mutex_unlock(&xfiredb_lock);
+
+	return rv;
+}
+
+static int __xfiredb_string_append(char *key, char *data)
+{
+	struct string *s;
+	size_t len;
+	int rv;
+
+	rv = xfiredb_string_lookup(key, &s);
+	if(rv < 0)
+		return rv;
+
+	len = string_append(s, data, strlen(data));
+	bio_queue_add(key, NULL, data, rv > 0 ? STRING_ADD : STRING_APPEND);
+	return (int)len;
+}
+
+/**
+ * @brief Append data to a string.
+ * @param key Key of the string.
+ * @param data Data to append.
+ * @return The length of the string after appending \p data, or an error
+ *         code.
+ * @note If \p key doesn't exist, it is created.
+ *
+ * Only the appended data is sent to the disk.
+ */
+int xfiredb_string_append(char *key, char *data)
+{
+	int rv;
+
+	xfiredb_mutex_lock(&xfiredb_lock);
+	rv = __xfiredb_string_append(key, data);
+	xfiredb_mutex_unlock(&xfiredb_lock);
+
+	return rv;
+}
+
+static int __xfiredb_list_length(char *key)
 {
 	struct container *c;
 	struct list_head *h;
@@ -481,19 +725,28 @@ int xfiredb_list_length(char *key)
 }
 
 /**
- * @brief Pop a list entry.
+ * @brief Get the length of a list.
  * @param key List key.
- * @param idx Index array.
- * @param num Number of indexes in \p idx.
- * @return An error code.
+ * @return Length of the list under \p key.
  */
-int xfiredb_list_pop(char *key, int *idx, int num)
+int xfiredb_list_length(char *key)
+{
+	int rv;
+
+	xfiredb_mutex_lock(&xfiredb_lock);
+	rv = __xfiredb_list_length(key);
+	xfiredb_mutex_unlock(&xfiredb_lock);
+
+	return rv;
+}
+
+static int __xfiredb_list_pop(char *key, int *idx, int num)
 {
 	struct string *s;
 	struct container *container;
 	struct list_head *lh;
 	struct list *c, *tmp;
-	char *bio_key, *bio_data;
+	char id[BIO_ID_SIZE];
 	db_data_t dbdata;
 	int i = 0, counter = 0;
 
@@ -512,11 +765,8 @@ int xfiredb_list_pop(char *key, int *idx, int num)
 		if(idx[counter] == i) {
 			list_del(lh, c);
 			s = container_of(c, struct string, entry);
-			xfiredb_sprintf(&bio_key, "%s", key);
-			string_get(s, &bio_data);
-			bio_queue_add(bio_key, bio_data, NULL, LIST_DEL);
-			string_destroy(s);
-			xfiredb_free(s);
+			bio_queue_add(key, xfiredb_list_arg(c, id), NULL, LIST_DEL);
+			string_free(s);
 			counter++;
 		}
 
@@ -537,15 +787,24 @@ int xfiredb_list_pop(char *key, int *idx, int num)
 }
 
 /**
- * @brief Get a number of list elements.
+ * @brief Pop a list entry.
  * @param key List key.
- * @param data Data storage pointer.
- * @param idx Indexes to lookup.
- * @param num Number of indexes to lookup.
- * @note Both the \p data and \p idx array have to be able to hold
- * \p num entry's.
+ * @param idx Index array.
+ * @param num Number of indexes in \p idx.
+ * @return An error code.
  */
-int xfiredb_list_get(char *key, char **data, int *idx, int num)
+int xfiredb_list_pop(char *key, int *idx, int num)
+{
+	int rv;
+
+	xfiredb_mutex_lock(&xfiredb_lock);
+	rv = __xfiredb_list_pop(key, idx, num);
+	xfiredb_mutex_unlock(&xfiredb_lock);
+
+	return rv;
+}
+
+static int __xfiredb_list_get(char *key, char **data, int *idx, int num)
 {
 	struct string *s;
 	struct container *container;
@@ -583,25 +842,40 @@ int xfiredb_list_get(char *key, char **data, int *idx, int num)
 }
 
 /**
- * @brief Set a list entry's data.
+ * @brief Get a number of list elements.
  * @param key List key.
- * @param idx List index to set.
- * @param data Data to set.
- * @note If the index \p idx doesn't exist the data
- * will be appended to the list as a new entry.
+ * @param data Data storage pointer.
+ * @param idx Indexes to lookup.
+ * @param num Number of indexes to lookup.
+ * @note Both the \p data and \p idx array have to be able to hold
+ * \p num entry's.
  */
-int xfiredb_list_set(char *key, int idx, char *data)
+int xfiredb_list_get(char *key, char **data, int *idx, int num)
+{
+	int rv;
+
+	xfiredb_mutex_lock(&xfiredb_lock);
+	rv = __xfiredb_list_get(key, data, idx, num);
+	xfiredb_mutex_unlock(&xfiredb_lock);
+
+	return rv;
+}
+
+static int __xfiredb_list_set(char *key, int idx, char *data)
 {
 	struct string *s;
 	struct container *container;
 	struct list_head *h;
 	struct list *c;
-	char *bio_key, *bio_data, *bio_newdata;
+	char id[BIO_ID_SIZE];
 	db_data_t dbdata;
 	int i, rv = -XFIREDB_ERR;
 
+	if(db_evict_if_needed(xfiredb))
+		return -XFIREDB_ERR;
+
 	if(db_lookup(xfiredb, key, &dbdata) != -XFIREDB_OK) {
-		return xfiredb_list_push(key, data, false);
+		return __xfiredb_list_push(key, data, false);
 	}
 
 	container = dbdata.ptr;
@@ -611,20 +885,17 @@ int xfiredb_list_set(char *key, int idx, char *data)
 	h = container_get_data(container);
 	i = 0;
 
-	xfiredb_sprintf(&bio_key, "%s", key);
-	xfiredb_sprintf(&bio_newdata, "%s", data);
 	if(list_length(h) == 0) {
 		s = string_alloc(data);
 		list_rpush(h, &s->entry);
-		bio_queue_add(bio_key, NULL, bio_newdata, LIST_ADD);
+		bio_queue_add(key, xfiredb_list_arg(&s->entry, id), data, LIST_ADD);
 		return -XFIREDB_OK;
 	}
 
 	list_for_each(h, c) {
 		if(i == idx) {
 			s = container_of(c, struct string, entry);
-			string_get(s, &bio_data);
-			bio_queue_add(bio_key, bio_data, bio_newdata, LIST_UPDATE);
+			bio_queue_add(key, xfiredb_list_arg(c, id), data, LIST_UPDATE);
 			string_set(s, data);
 			rv = -XFIREDB_OK;
 			break;
@@ -634,6 +905,7 @@ int xfiredb_list_set(char *key, int idx, char *data)
 		if(i >= list_length(h)) {
 			s = string_alloc(data);
 			list_rpush(h, &s->entry);
+			bio_queue_add(key, xfiredb_list_arg(&s->entry, id), data, LIST_ADD);
 			rv = -XFIREDB_OK;
 			break;
 		}
@@ -643,22 +915,36 @@ int xfiredb_list_set(char *key, int idx, char *data)
 }
 
 /**
- * @brief Push a new list entry.
+ * @brief Set a list entry's data.
  * @param key List key.
- * @param data Data to push.
- * @param left Set to true if \p data should be pushed at
- * the start, false for the end.
- * @return An error code.
+ * @param idx List index to set.
+ * @param data Data to set.
+ * @note If the index \p idx doesn't exist the data
+ * will be appended to the list as a new entry.
  */
-int xfiredb_list_push(char *key, char *data, bool left)
+int xfiredb_list_set(char *key, int idx, char *data)
+{
+	int rv;
+
+	xfiredb_mutex_lock(&xfiredb_lock);
+	rv = __xfiredb_list_set(key, idx, data);
+	xfiredb_mutex_unlock(&xfiredb_lock);
+
+	return rv;
+}
+
+static int __xfiredb_list_push(char *key, char *data, bool left)
 {
 	struct string *s;
 	struct container *c;
 	struct list_head *h;
-	char *bio_key, *bio_data;
+	char id[BIO_ID_SIZE];
 	db_data_t dbdata;
 	bool new = false;
 
+	if(db_evict_if_needed(xfiredb))
+		return -XFIREDB_ERR;
+
 	if(db_lookup(xfiredb, key, &dbdata) != -XFIREDB_OK) {
 		c = container_alloc(CONTAINER_LIST);
 		new = true;
@@ -670,15 +956,14 @@ int xfiredb_list_push(char *key, char *data, bool left)
 
 	h = container_get_data(c);
 	s = string_alloc(data);
-	xfiredb_sprintf(&bio_data, "%s", data);
-	xfiredb_sprintf(&bio_key, "%s", key);
-	bio_queue_add(bio_key, NULL, bio_data, LIST_ADD);
 
 	if(left)
 		list_lpush(h, &s->entry);
 	else
 		list_rpush(h, &s->entry);
 
+	bio_queue_add(key, xfiredb_list_arg(&s->entry, id), data, LIST_ADD);
+
 	if(new)
 		db_store(xfiredb, key, c);
 
@@ -686,13 +971,25 @@ int xfiredb_list_push(char *key, char *data, bool left)
 }
 
 /**
- * @brief Get a hashmap entry.
- * @param key Hashmap key
- * @param skey Array of hashmap keys.
- * @param data Data storage array.
- * @param num Number of entry's is \p skey and \p data.
+ * @brief Push a new list entry.
+ * @param key List key.
+ * @param data Data to push.
+ * @param left Set to true if \p data should be pushed at
+ * the start, false for the end.
+ * @return An error code.
  */
-int xfiredb_hashmap_get(char *key, char **skey, char **data, int num)
+int xfiredb_list_push(char *key, char *data, bool left)
+{
+	int rv;
+
+	xfiredb_mutex_lock(&xfiredb_lock);
+	rv = __xfiredb_list_push(key, data, left);
+	xfiredb_mutex_unlock(&xfiredb_lock);
+
+	return rv;
+}
+
+static int __xfiredb_hashmap_get(char *key, char **skey, char **data, int num)
 {
 	struct string *s;
 	struct container *c;
@@ -725,19 +1022,29 @@ int xfiredb_hashmap_get(char *key, char **skey, char **data, int num)
 }
 
 /**
- * @brief Remove a hashmap node.
- * @param key Hashmap key.
- * @param skeys Array of hashmap key's.
- * @param num Length of the \p skey array.
- * @return An error code.
+ * @brief Get a hashmap entry.
+ * @param key Hashmap key
+ * @param skey Array of hashmap keys.
+ * @param data Data storage array.
+ * @param num Number of entry's is \p skey and \p data.
  */
-int xfiredb_hashmap_remove(char *key, char **skeys, int num)
+int xfiredb_hashmap_get(char *key, char **skey, char **data, int num)
+{
+	int rv;
+
+	xfiredb_mutex_lock(&xfiredb_lock);
+	rv = __xfiredb_hashmap_get(key, skey, data, num);
+	xfiredb_mutex_unlock(&xfiredb_lock);
+
+	return rv;
+}
+
+static int __xfiredb_hashmap_remove(char *key, char **skeys, int num)
 {
 	struct string *s;
 	struct container *c;
 	struct hashmap *hm;
 	struct hashmap_node *node;
-	char *bio_key, *bio_skey;
 	db_data_t dbdata;
 	int i = 0, rmnum = 0;
 
@@ -755,13 +1062,10 @@ int xfiredb_hashmap_remove(char *key, char **skeys, int num)
 		if(!node)
 			continue;
 		rmnum++;
-		xfiredb_sprintf(&bio_key, "%s", key);
-		xfiredb_sprintf(&bio_skey, "%s", skeys[i]);
-		bio_queue_add(bio_key, bio_skey, NULL, HM_DEL);
+		bio_queue_add(key, skeys[i], NULL, HM_DEL);
 		s = container_of(node, struct string, node);
 		hashmap_node_destroy(node);
-		string_destroy(s);
-		xfiredb_free(s);
+		string_free(s);
 	}
 
 	if(!hashmap_size(hm)) {
@@ -775,6 +1079,64 @@ int xfiredb_hashmap_remove(char *key, char **skeys, int num)
 	return rmnum;
 }
 
+/**
+ * @brief Remove a hashmap node.
+ * @param key Hashmap key.
+ * @param skeys Array of hashmap key's.
+ * @param num Length of the \p skey array.
+ * @return An error code.
+ */
+int xfiredb_hashmap_remove(char *key, char **skeys, int num)
+{
+	int rv;
+
+	xfiredb_mutex_lock(&xfiredb_lock);
+	rv = __xfiredb_hashmap_remove(key, skeys, num);
+	xfiredb_mutex_unlock(&xfiredb_lock);
+
+	return rv;
+}
+
+static int __xfiredb_hashmap_set(char *key, char *skey, char *data)
+{
+	struct string *s;
+	struct container *c;
+	struct hashmap *hm;
+	struct hashmap_node *node;
+	bool new = false;
+	db_data_t dbdata;
+
+	if(db_evict_if_needed(xfiredb))
+		return -XFIREDB_ERR;
+
+	if(db_lookup(xfiredb, key, &dbdata) != -XFIREDB_OK) {
+		c = container_alloc(CONTAINER_HASHMAP);
+		new = true;
+	} else {
+		c = dbdata.ptr;
+		if(!container_check_type(c, CONTAINER_HASHMAP))
+			return -XFIREDB_ERR;
+	}
+
+	hm = container_get_data(c);
+	node = hashmap_find(hm, skey);
+
+	if(!node) {
+		s = string_alloc(data);
+		hashmap_add(hm, skey, &s->node);
+		bio_queue_add(key, skey, data, HM_ADD);
+	} else {
+		s = container_of(node, struct string, node);
+		string_set(s, data);
+		bio_queue_add(key, skey, data, HM_UPDATE);
+	}
+
+	if(new)
+		db_store(xfiredb, key, c);
+
+	return -XFIREDB_OK;
+}
+
 /**
  * @brief Set the value of a hashmap node.
  * @param key Hashmap key.
@@ -784,15 +1146,28 @@ int xfiredb_hashmap_remove(char *key, char **skeys, int num)
  * added to the hashmap.
  */
 int xfiredb_hashmap_set(char *key, char *skey, char *data)
+{
+	int rv;
+
+	xfiredb_mutex_lock(&xfiredb_lock);
+	rv = __xfiredb_hashmap_set(key, skey, data);
+	xfiredb_mutex_unlock(&xfiredb_lock);
+
+	return rv;
+}
+
+static int __xfiredb_hashmap_incr(char *key, char *skey, s64 delta, s64 *result)
 {
 	struct string *s;
 	struct container *c;
 	struct hashmap *hm;
 	struct hashmap_node *node;
-	char *bio_key, *bio_skey, *bio_data;
 	bool new = false;
 	db_data_t dbdata;
 
+	if(db_evict_if_needed(xfiredb))
+		return -XFIREDB_ERR;
+
 	if(db_lookup(xfiredb, key, &dbdata) != -XFIREDB_OK) {
 		c = container_alloc(CONTAINER_HASHMAP);
 		new = true;
@@ -804,20 +1179,20 @@ int xfiredb_hashmap_set(char *key, char *skey, char *data)
 
 	hm = container_get_data(c);
 	node = hashmap_find(hm, skey);
-	xfiredb_sprintf(&bio_key, "%s", key);
-	xfiredb_sprintf(&bio_skey, "%s", skey);
-	xfiredb_sprintf(&bio_data, "%s", data);
 
-	if(!node) {
-		s = string_alloc(data);
-		hashmap_add(hm, skey, &s->node);
-		bio_queue_add(bio_key, bio_skey, bio_data, HM_ADD);
-	} else {
+	if(node) {
 		s = container_of(node, struct string, node);
-		string_set(s, data);
-		bio_queue_add(bio_key, bio_skey, bio_data, HM_UPDATE);
+		if(string_incr(s, delta, result))
+			return -XFIREDB_ERR;
+	} else {
+		s = string_alloc("0");
+		string_incr(s, delta, result);
+		hashmap_add(hm, skey, &s->node);
 	}
 
+	bio_queue_add(key, skey, string_borrow(s, NULL), node ? HM_UPDATE : HM_ADD);
+	string_unborrow(s);
+
 	if(new)
 		db_store(xfiredb, key, c);
 
@@ -825,46 +1200,52 @@ int xfiredb_hashmap_set(char *key, char *skey, char *data)
 }
 
 /**
- * @brief Delete a key from the database.
- * @param key Key to delete.
+ * @brief Atomically increment an integer hashmap field.
+ * @param key Hashmap key.
+ * @param skey Field within the hashmap.
+ * @param delta Value to add.
+ * @param result Pointer to store the new value in. May be \p NULL.
  * @return An error code.
+ * @note Non existing hashmaps and fields are created with an initial value
+ * of 0.
  */
-int xfiredb_key_delete(char *key)
+int xfiredb_hashmap_incr(char *key, char *skey, s64 delta, s64 *result)
+{
+	int rv;
+
+	xfiredb_mutex_lock(&xfiredb_lock);
+	rv = __xfiredb_hashmap_incr(key, skey, delta, result);
+	xfiredb_mutex_unlock(&xfiredb_lock);
+
+	return rv;
+}
+
+static int xfiredb_container_delete(const char *key, struct container *c)
 {
 	struct list *carriage, *tmp;
 	struct list_head *lh;
 	struct string *s;
-	struct container *c;
 	struct hashmap *hm;
 	struct hashmap_node *hnode;
 	struct hashmap_iterator *hit;
-	char *bio_key, *bio_data, *bio_skey;
-	db_data_t data;
+	char id[BIO_ID_SIZE];
 	int rv = 0;
 
-	if(db_delete(xfiredb, key, &data) != -XFIREDB_OK)
-		return rv;
-
-	c = data.ptr;
-	switch(c->type) {
+	switch(container_type(c)) {
 	case CONTAINER_STRING:
-		xfiredb_sprintf(&bio_key, "%s", key);
-		bio_queue_add(bio_key, NULL, NULL, STRING_DEL);
+		bio_queue_add(key, NULL, NULL, STRING_DEL);
 		container_destroy(c);
 		xfiredb_free(c);
 		rv++;
 		break;
 
 	case CONTAINER_LIST:
-		xfiredb_sprintf(&bio_key, "%s", key);
 		lh = container_get_data(c);
 		list_for_each_safe(lh, carriage, tmp) {
 			s = container_of(carriage, struct string, entry);
-			string_get(s, &bio_data);
-			bio_queue_add(bio_key, bio_data, NULL, LIST_DEL);
+			bio_queue_add(key, xfiredb_list_arg(carriage, id), NULL, LIST_DEL);
 			list_del(lh, carriage);
-			string_destroy(s);
-			xfiredb_free(s);
+			string_free(s);
 			rv++;
 		}
 
@@ -878,13 +1259,10 @@ int xfiredb_key_delete(char *key)
 		hit = hashmap_new_iterator(hm);
 		while((hnode = hashmap_iterator_next(hit)) != NULL) { 
 			s = container_of(hnode, struct string, node);
-			xfiredb_sprintf(&bio_key, "%s", key);
-			xfiredb_sprintf(&bio_skey, "%s", hnode->key);
-			bio_queue_add(bio_key, bio_skey, NULL, HM_DEL);
+			bio_queue_add(key, hnode->key, NULL, HM_DEL);
 			hashmap_iterator_delete(hit);
 			hashmap_node_destroy(hnode);
-			string_destroy(s);
-			xfiredb_free(s);
+			string_free(s);
 		}
 		hashmap_free_iterator(hit);
 		container_destroy(c);
@@ -899,22 +1277,108 @@ int xfiredb_key_delete(char *key)
 	return rv;
 }
 
+static int __xfiredb_key_delete(char *key)
+{
+	db_data_t data;
+
+	if(db_delete(xfiredb, key, &data) != -XFIREDB_OK)
+		return 0;
+
+	return xfiredb_container_delete(key, data.ptr);
+}
+
 /**
- * @brief Clear a list.
- * @param key List to clear.
- * @param hook Hook to call on each list entry.
- *
- * Clear a list (i.e. delete each entry). \p hook is called for each
- * entry in the list.
+ * @brief Delete a key from the database.
+ * @param key Key to delete.
+ * @return An error code.
  */
-int xfiredb_list_clear(char *key, void (*hook)(char *key, char *data))
+int xfiredb_key_delete(char *key)
+{
+	int rv;
+
+	xfiredb_mutex_lock(&xfiredb_lock);
+	rv = __xfiredb_key_delete(key);
+	xfiredb_mutex_unlock(&xfiredb_lock);
+
+	return rv;
+}
+
+/**
+ * @brief Set the memory budget of the database.
+ * @param maxmemory Memory budget in bytes. Zero disables the budget.
+ * @param policy Eviction policy name.
+ * @return An error code.
+ * @see db_set_maxmemory
+ */
+int xfiredb_set_maxmemory(size_t maxmemory, const char *policy)
+{
+	int rv;
+
+	xfiredb_mutex_lock(&xfiredb_lock);
+	rv = db_set_maxmemory(xfiredb, maxmemory, policy);
+	xfiredb_mutex_unlock(&xfiredb_lock);
+
+	return rv;
+}
+
+/**
+ * @brief Set a time out on a key.
+ * @param key Key to set the time out on.
+ * @param ms Time to live in milliseconds.
+ * @return An error code.
+ */
+int xfiredb_key_expire(char *key, s64 ms)
+{
+	int rv;
+
+	xfiredb_mutex_lock(&xfiredb_lock);
+	rv = db_set_expiry(xfiredb, key, xfiredb_time_stamp() + ms);
+	xfiredb_mutex_unlock(&xfiredb_lock);
+
+	return rv;
+}
+
+/**
+ * @brief Remove the time out of a key.
+ * @param key Key to persist.
+ * @return -XFIREDB_OK if a time out was removed, -XFIREDB_ERR otherwise.
+ */
+int xfiredb_key_persist(char *key)
+{
+	int rv;
+
+	xfiredb_mutex_lock(&xfiredb_lock);
+	rv = db_persist(xfiredb, key);
+	xfiredb_mutex_unlock(&xfiredb_lock);
+
+	return rv;
+}
+
+/**
+ * @brief Get the time to live of a key.
+ * @param key Key to get the time to live of.
+ * @return The time to live in milliseconds.
+ * @see db_ttl
+ */
+s64 xfiredb_key_ttl(char *key)
+{
+	s64 rv;
+
+	xfiredb_mutex_lock(&xfiredb_lock);
+	rv = db_ttl(xfiredb, key);
+	xfiredb_mutex_unlock(&xfiredb_lock);
+
+	return rv;
+}
+
+static int __xfiredb_list_clear(char *key, void (*hook)(char *key, char *data))
 {
 	struct container *c;
 	struct list_head *lh;
 	struct list *carriage, *tmp;
 	struct string *s;
 	char *data;
-	char *bio_key, *bio_data;
+	char id[BIO_ID_SIZE];
 	db_data_t d;
 
 	if(db_lookup(xfiredb, key, &d) != XFIREDB_OK)
@@ -928,13 +1392,10 @@ int xfiredb_list_clear(char *key, void (*hook)(char *key, char *data))
 	list_for_each_safe(lh, carriage, tmp) {
 		list_del(lh, carriage);
 		s = container_of(carriage, struct string, entry);
-		xfiredb_sprintf(&bio_key, "%s", key);
-		string_get(s, &bio_data);
-		bio_queue_add(bio_key, bio_data, NULL, LIST_DEL);
+		bio_queue_add(key, xfiredb_list_arg(carriage, id), NULL, LIST_DEL);
 		string_get(s, &data);
 		hook(key, data);
-		string_destroy(s);
-		xfiredb_free(s);
+		string_free(s);
 	}
 
 	container_destroy(c);
@@ -944,21 +1405,32 @@ int xfiredb_list_clear(char *key, void (*hook)(char *key, char *data))
 }
 
 /**
- * @brief Clear a hashmap.
- * @param key Hashmap to clear.
- * @param hook Hook to call on each node.
+ * @brief Clear a list.
+ * @param key List to clear.
+ * @param hook Hook to call on each list entry.
  *
- * Clear a hashmap (i.e. delete each entry). \p hook is called for each
- * node in the map.
+ * Clear a list (i.e. delete each entry). \p hook is called for each
+ * entry in the list.
  */
-int xfiredb_hashmap_clear(char *key, void (*hook)(char *key, char *data))
+int xfiredb_list_clear(char *key, void (*hook)(char *key, char *data))
+{
+	int rv;
+
+	xfiredb_mutex_lock(&xfiredb_lock);
+	rv = __xfiredb_list_clear(key, hook);
+	xfiredb_mutex_unlock(&xfiredb_lock);
+
+	return rv;
+}
+
+static int __xfiredb_hashmap_clear(char *key, void (*hook)(char *key, char *data))
 {
 	struct container *c;
 	struct hashmap_node *n;
 	struct hashmap *hm;
 	struct string *s;
 	struct hashmap_iterator *hit;
-	char *data, *bio_key, *bio_skey;
+	char *data;
 	db_data_t d;
 
 	if(db_lookup(xfiredb, key, &d) != XFIREDB_OK)
@@ -976,14 +1448,11 @@ int xfiredb_hashmap_clear(char *key, void (*hook)(char *key, char *data))
 		hook(n->key, data);
 		xfiredb_free(data);
 
-		xfiredb_sprintf(&bio_key, "%s", key);
-		xfiredb_sprintf(&bio_skey, "%s", n->key);
-		bio_queue_add(bio_key, bio_skey, NULL, HM_DEL);
+		bio_queue_add(key, n->key, NULL, HM_DEL);
 
 		hashmap_iterator_delete(hit);
 		hashmap_node_destroy(n);
-		string_destroy(s);
-		xfiredb_free(s);
+		string_free(s);
 	}
 	hashmap_free_iterator(hit);
 
@@ -991,6 +1460,25 @@ int xfiredb_hashmap_clear(char *key, void (*hook)(char *key, char *data))
 	xfiredb_free(c);
 	return -XFIREDB_OK;
 }
+
+/**
+ * @brief Clear a hashmap.
+ * @param key Hashmap to clear.
+ * @param hook Hook to call on each node.
+ *
+ * Clear a hashmap (i.e. delete each entry). \p hook is called for each
+ * node in the map.
+ */
+int xfiredb_hashmap_clear(char *key, void (*hook)(char *key, char *data))
+{
+	int rv;
+
+	xfiredb_mutex_lock(&xfiredb_lock);
+	rv = __xfiredb_hashmap_clear(key, hook);
+	xfiredb_mutex_unlock(&xfiredb_lock);
+
+	return rv;
+}
 #endif
 
 /** @} */
@@ -22,6 +22,29 @@ if(NOT ${XFIREDB_PTHREAD_LIB} EQUAL NOTFOUND)
 	set(XFIREDB_PTHREAD true)
 endif()
 
+INCLUDE (CheckCSourceCompiles)
+set(CMAKE_REQUIRED_FLAGS "-std=gnu89")
+CHECK_C_SOURCE_COMPILES("
+int main(void)
+{
+	long long v = 0;
+
+	__atomic_fetch_add(&v, 1, __ATOMIC_ACQ_REL);
+	return (int)__atomic_load_n(&v, __ATOMIC_ACQUIRE) - 1;
+}" ATOMIC_BUILTINS)
+unset(CMAKE_REQUIRED_FLAGS)
+
+set(HAVE_ATOMIC_BUILTINS "")
+if(ATOMIC_BUILTINS)
+	set(HAVE_ATOMIC_BUILTINS "#define HAVE_ATOMIC_BUILTINS")
+endif()
+
+CHECK_INCLUDE_FILES(execinfo.h EXECINFO_HEADER)
+set(HAVE_EXECINFO "")
+if(EXECINFO_HEADER)
+	set(HAVE_EXECINFO "#define HAVE_EXECINFO")
+endif()
+
 CHECK_INCLUDE_FILES(stdlib.h STDLIB_HEADER)
 CHECK_INCLUDE_FILES(stdint.h STDINT_HEADER)
 CHECK_INCLUDE_FILES(stdio.h STDIO_HEADER)
@@ -14,6 +14,10 @@ option (XFIREDB_DEBUG
 	"Set to true if debugging options should be enabled"
 	[false])
 
+option (XFIREDB_SLAB
+	"Set to true if engine objects should be allocated from slab caches"
+	true)
+
 
 set (RUBY_RBCONF "" CACHE STRING
 	"Ruby config file.")
@@ -28,6 +32,11 @@ if(XFIREDB_DEBUG)
 	set(HAVE_DBG "#define HAVE_DBG")
 endif(XFIREDB_DEBUG)
 
+set(HAVE_SLAB "")
+if(XFIREDB_SLAB AND XFIREDB_PTHREAD)
+	set(HAVE_SLAB "#define HAVE_SLAB")
+endif(XFIREDB_SLAB AND XFIREDB_PTHREAD)
+
 set(HAVE_X64 "")
 if(X64)
 	set(HAVE_X64 "#define HAVE_X64")